@@ -0,0 +1,968 @@
+#include <arpa/inet.h>
+#include <net/client/client.h>
+#include <net/components.h>
+#include <net/proto/messages.h>
+#include <net/server/impl/client_server_connection_handler_factory.h>
+#include <net/server/server.h>
+#include <net/socket.h>
+#include <netinet/in.h>
+#include <program/options.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <util/bytes.h>
+#include <util/console.h>
+#include <util/filesystem.h>
+#include <util/metrics.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs a cluster of clients and servers in one process over loopback, to
+// measure the distributed mutex under contention and check that it is safe.
+//
+// Every client is a real client with its own components, peer network, and
+// DistributedMutualExclusionService, listening on a port picked by the
+// system. Every server is a real server over its own root directory in a new
+// temporary directory. Each client makes a number of requests for mutual
+// exclusion, one at a time, and in each critical section appends a line to
+// the file on every server, like a client's write does.
+//
+// Scenarios:
+//   hot      every request is for the same file
+//   uniform  every request is for a file picked uniformly at random
+//   bursty   every request is for the same file, and clients make them in
+//            bursts at the same times, idle in between
+//
+// Every critical section is recorded in an event log with the times it was
+// entered and left. The run fails if two critical sections for the same file
+// overlap, if a request is never granted, or if a server's file does not
+// hold the lines in the order the log says they were written.
+//
+// Reports critical sections per second, messages sent between clients per
+// critical section, and the time to acquire the mutex.
+//
+// Usage: cluster_bench [--clients n] [--servers n] [--scenario name]
+//                      [--algorithm name] [--requests n] [--files n]
+//                      [--think-ms ms] [--burst n] [--burst-ms ms]
+//                      [--threads n] [--props file] [--log]
+//
+// Every client opens a connection to every other client, so large clusters
+// need many file descriptors and threads. The limit of open files is raised
+// as far as allowed.
+//
+// Build with the "g++ build cluster benchmark" task, or with the "g++ build
+// cluster benchmark (thread sanitizer)" task to check the mutex service for
+// data races.
+
+namespace {
+
+using clock_t = std::chrono::steady_clock;
+using net::mutex::DistributedMutualExclusionService;
+using net::proto::Message;
+using net::proto::Opcode;
+
+constexpr int kTimeoutMs = 10000;
+constexpr int kRetryTimeoutMs = 1000;
+constexpr std::chrono::seconds kAwaitTimeout{30};
+constexpr net::proto::node_id_t kFirstId = 1;
+constexpr char kHotFile[] = "hot.txt";
+constexpr double kPercentiles[] = {50, 90, 99};
+
+// Opcodes as they are named in the metrics of the mutex service.
+constexpr const char* kMutexOpcodes[] = {
+    "request",    "reply",  "release",       "inquire",
+    "relinquish", "failed", "token_request", "token",
+};
+
+enum class Scenario {
+    kHot,
+    kUniform,
+    kBursty,
+};
+
+/**
+ * @brief Settings of a run, read from the command line.
+ *
+ */
+struct Config {
+    std::size_t clients = 8;
+    std::size_t servers = 1;
+    Scenario scenario = Scenario::kHot;
+    std::string scenario_name = "hot";
+    std::string algorithm = "ricart_agrawala";
+
+    // Critical sections each client enters.
+    std::size_t requests = 20;
+
+    // Files to pick from in the uniform scenario.
+    std::size_t files = 16;
+
+    // Mean of the exponentially distributed time a client waits between
+    // requests, outside of bursts.
+    std::size_t think_ms = 0;
+
+    // Requests each client makes back to back in every burst, and the time
+    // between bursts.
+    std::size_t burst = 4;
+    std::size_t burst_ms = 200;
+
+    // Threads in the pool of every node. Each connection to a peer holds a
+    // thread while it waits for a message, so by default there is one for
+    // every client and two more.
+    std::size_t threads = 0;
+    std::string props_file;
+    bool log = false;
+};
+
+/**
+ * @brief A critical section a client entered.
+ *
+ */
+struct Event {
+    std::size_t client;
+    std::string file;
+    std::string line;
+    clock_t::time_point entered;
+    clock_t::time_point left;
+};
+
+/**
+ * @brief Critical sections entered by every client, to check once the run is
+ * over.
+ *
+ */
+class EventLog {
+   public:
+    void Record(Event&& event) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back(std::move(event));
+    }
+
+    /**
+     * @brief Checks that no two critical sections for the same file overlap.
+     *
+     * @return std::map<std::string, std::vector<std::string>> Lines written to
+     * each file, in the order their critical sections were entered
+     */
+    util::result<std::map<std::string, std::vector<std::string>>, net::Error>
+    Verify() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::sort(events_.begin(), events_.end(),
+                  [](const Event& a, const Event& b) {
+                      return a.entered < b.entered;
+                  });
+        std::map<std::string, const Event*> last;
+        std::map<std::string, std::vector<std::string>> lines;
+        for (const auto& event : events_) {
+            const Event*& previous = last[event.file];
+            if (previous != nullptr && previous->left > event.entered) {
+                return net::Error::Create(util::string::stream(
+                    "Clients ", previous->client, " and ", event.client,
+                    " were in the critical section for ", event.file,
+                    " at the same time"));
+            }
+            previous = &event;
+            lines[event.file].push_back(event.line);
+        }
+        return lines;
+    }
+
+    std::size_t Size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return events_.size();
+    }
+
+   private:
+    std::mutex mutex_;
+    std::vector<Event> events_;
+};
+
+/**
+ * @brief What every client shares, and what they measure together.
+ *
+ */
+struct Cluster {
+    explicit Cluster(const Config& config) : config(config) {}
+
+    const Config& config;
+    std::vector<std::uint16_t> server_ports;
+    EventLog events;
+    util::metrics::hdr_histogram acquire_us;
+
+    // Time every client is ready to start, so bursts are aligned.
+    clock_t::time_point start;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t ready = 0;
+    bool started = false;
+    bool aborted = false;
+    std::size_t done = 0;
+    std::vector<std::string> errors;
+};
+
+/**
+ * @brief Opens a connection to a server over loopback.
+ *
+ * @param port
+ * @return util::result<int, net::Error> The connected socket
+ */
+util::result<int, net::Error> Connect(std::uint16_t port) {
+    int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return net::Error::CreateFromErrNo("Failed to open socket");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+    addr.sin_port = ::htons(port);
+    if (::connect(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+        0) {
+        ::close(sockfd);
+        return net::Error::CreateFromErrNo("Failed to connect to a server");
+    }
+    return sockfd;
+}
+
+/**
+ * @brief Picks distinct free ports on loopback for the clients to listen on.
+ *
+ * Every port stays bound until all are picked, so none is handed out twice.
+ * They are released before the clients bind them, so another process could
+ * take one in between, which is unlikely on a test machine.
+ *
+ * @param count
+ * @return util::result<std::vector<std::uint16_t>, net::Error>
+ */
+util::result<std::vector<std::uint16_t>, net::Error> FreePorts(
+    std::size_t count) {
+    util::result<std::vector<std::uint16_t>, net::Error> result =
+        std::vector<std::uint16_t>();
+    std::vector<int> sockfds;
+    while (sockfds.size() < count) {
+        int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (sockfd < 0) {
+            result = net::Error::CreateFromErrNo("Failed to open socket");
+            break;
+        }
+        sockfds.push_back(sockfd);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (::bind(sockfd, reinterpret_cast<sockaddr*>(&addr), len) < 0 ||
+            ::getsockname(sockfd, reinterpret_cast<sockaddr*>(&addr), &len) <
+                0) {
+            result = net::Error::CreateFromErrNo("Failed to pick a free port");
+            break;
+        }
+        result.ok().push_back(::ntohs(addr.sin_port));
+    }
+    for (int sockfd : sockfds) {
+        ::close(sockfd);
+    }
+    return result;
+}
+
+/**
+ * @brief Sends a whole message, waiting for the socket as needed.
+ *
+ * @param socket
+ * @param msg
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> SendMessage(net::Socket& socket,
+                                           Message&& msg) {
+    util::buffer& output = socket.Output();
+    output.put(&msg.opcode, net::proto::kOpcodeLength, true);
+    util::bytes::insert<net::proto::kBodySizeLength>(
+        output, static_cast<std::uint32_t>(msg.body.size()));
+    output.move_buffer(msg.body, true);
+    while (output.size() > 0) {
+        RETURN_IF_ERROR(socket.Send());
+        if (output.size() > 0) {
+            RETURN_IF_ERROR(socket.Poll(net::PollOption::kWrite));
+        }
+    }
+    return util::ok;
+}
+
+/**
+ * @brief Receives a whole message, waiting for the socket as needed.
+ *
+ * @param socket
+ * @return util::result<Opcode, net::Error> Opcode of the message
+ */
+util::result<Opcode, net::Error> ReceiveMessage(net::Socket& socket) {
+    constexpr std::size_t kHeaderLength =
+        net::proto::kOpcodeLength + net::proto::kBodySizeLength;
+    util::buffer& input = socket.Input();
+    bool have_header = false;
+    Opcode opcode = Opcode::kOk;
+    std::size_t body_size = 0;
+    while (true) {
+        if (!have_header && input.size() >= kHeaderLength) {
+            opcode = static_cast<Opcode>(input.get());
+            body_size =
+                util::bytes::extract<net::proto::kBodySizeLength>(input);
+            have_header = true;
+        }
+        if (have_header && input.size() >= body_size) {
+            input.consume(body_size);
+            return opcode;
+        }
+
+        ASSIGN_OR_RETURN(auto status, socket.Poll(net::PollOption::kRead));
+        if (status != net::PollStatus::Success) {
+            return net::Error::Create("Timed out waiting for a server");
+        }
+        ASSIGN_OR_RETURN(auto received, socket.Receive());
+        if (received == 0) {
+            return net::Error::Create("Server closed the connection");
+        }
+    }
+}
+
+/**
+ * @brief Converts a result with a general error into one with a network
+ * error.
+ *
+ * @tparam T
+ * @param result
+ * @return util::result<T, net::Error>
+ */
+template <typename T>
+util::result<T, net::Error> ToNetResult(util::result<T, util::error>&& result) {
+    return std::move(result).map_err(
+        [](util::error&& error) { return net::Error::Create(error.what()); });
+}
+
+/**
+ * @brief Makes an asynchronous call and waits for its result.
+ *
+ * A call that never finishes is how a lost or deadlocked request shows, so
+ * the wait gives up after a while, leaving the call to finish into nothing.
+ *
+ * @tparam T
+ * @param call Makes the call with the callback to give the result to
+ * @param what Name of the call, for the error
+ * @return util::result<T, net::Error>
+ */
+template <typename T>
+util::result<T, net::Error> Await(
+    const std::function<
+        void(const std::function<void(util::result<T, net::Error>)>&)>& call,
+    const std::string& what) {
+    auto promise =
+        std::make_shared<std::promise<util::result<T, net::Error>>>();
+    auto future = promise->get_future();
+    call([promise](util::result<T, net::Error> result) {
+        promise->set_value(std::move(result));
+    });
+    if (future.wait_for(kAwaitTimeout) != std::future_status::ready) {
+        return net::Error::Create(what + " did not finish in time");
+    }
+    return future.get();
+}
+
+/**
+ * @brief A client of the cluster, which makes its requests once every client
+ * has joined the peer network.
+ *
+ */
+class SimulatedClient : public net::client::Client {
+   public:
+    SimulatedClient(Cluster& cluster, net::Components& components,
+                    std::size_t index)
+        : net::client::Client(false, components),
+          cluster_(cluster),
+          index_(index),
+          rng_(index) {}
+
+    ~SimulatedClient() {
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+    }
+
+    /**
+     * @brief Counts the messages this client sent to its peers for the given
+     * files.
+     *
+     * @param files
+     * @return std::uint64_t
+     */
+    std::uint64_t MessagesSent(const std::vector<std::string>& files) {
+        std::uint64_t sent = 0;
+        for (const auto& file : files) {
+            for (const char* opcode : kMutexOpcodes) {
+                sent += components_.common.metrics
+                            .get_counter("mutex." + file + ".sent." + opcode)
+                            .value();
+            }
+        }
+        return sent;
+    }
+
+   protected:
+    void Run() override {
+        worker_ = std::thread([this]() {
+            auto result = Work();
+            std::lock_guard<std::mutex> lock(cluster_.mutex);
+            if (result.is_err()) {
+                cluster_.errors.push_back(util::string::stream(
+                    "Client ", index_, ": ", result.err()));
+            }
+            ++cluster_.done;
+            cluster_.changed.notify_all();
+        });
+    }
+
+   private:
+    /**
+     * @brief Connects to every server, waits for every other client, and
+     * makes every request.
+     *
+     * @return util::result<void, net::Error>
+     */
+    util::result<void, net::Error> Work() {
+        for (auto port : cluster_.server_ports) {
+            ASSIGN_OR_RETURN(int sockfd, Connect(port));
+            servers_.emplace_back(new net::Socket(
+                sockfd, net::SocketState::kConnected, kTimeoutMs));
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(cluster_.mutex);
+            ++cluster_.ready;
+            cluster_.changed.notify_all();
+            cluster_.changed.wait(lock, [this]() { return cluster_.started; });
+            if (cluster_.aborted) {
+                return util::ok;
+            }
+        }
+
+        const Config& config = cluster_.config;
+        std::exponential_distribution<double> think(
+            config.think_ms > 0 ? 1.0 / config.think_ms : 1);
+        std::uniform_int_distribution<std::size_t> pick(0, config.files - 1);
+        for (std::size_t i = 0; i < config.requests; ++i) {
+            std::string file = kHotFile;
+            switch (config.scenario) {
+                case Scenario::kHot:
+                    break;
+                case Scenario::kUniform:
+                    file = "file" + std::to_string(pick(rng_)) + ".txt";
+                    break;
+                case Scenario::kBursty:
+                    std::this_thread::sleep_until(
+                        cluster_.start + std::chrono::milliseconds(
+                                             config.burst_ms *
+                                             (i / config.burst)));
+                    break;
+            }
+            if (config.scenario != Scenario::kBursty && config.think_ms > 0) {
+                std::this_thread::sleep_for(
+                    std::chrono::duration<double, std::milli>(think(rng_)));
+            }
+            RETURN_IF_ERROR(CriticalSection(file, i));
+        }
+        return util::ok;
+    }
+
+    /**
+     * @brief Gains mutual exclusion for a file, appends a line to it on every
+     * server, and releases it.
+     *
+     * @param file
+     * @param sequence Number of the request
+     * @return util::result<void, net::Error>
+     */
+    util::result<void, net::Error> CriticalSection(const std::string& file,
+                                                   std::size_t sequence) {
+        using done_t =
+            DistributedMutualExclusionService::mutex_operation_done_t;
+        using granted_t = std::function<void(util::result<done_t, net::Error>)>;
+        auto requested_at = clock_t::now();
+        ASSIGN_OR_RETURN(
+            done_t done,
+            Await<done_t>(
+                [this, &file](const granted_t& granted) {
+                    components_.distributed_mutex_service
+                        .RunWithMutualExclusion(file, granted);
+                },
+                util::string::stream("Request ", sequence, " for ", file)));
+
+        Event event;
+        event.client = index_;
+        event.file = file;
+        event.line = util::string::stream("(", index_, ", ", sequence, ")");
+        event.entered = clock_t::now();
+        cluster_.acquire_us.observe(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                event.entered - requested_at)
+                .count());
+
+        util::result<void, net::Error> result = util::ok;
+        for (auto& server : servers_) {
+            result = SendMessage(
+                *server,
+                net::proto::WriteMessage{file, event.line}.ToMessage());
+            if (result.is_err()) {
+                break;
+            }
+        }
+        for (std::size_t i = 0; i < servers_.size() && result.is_ok(); ++i) {
+            auto opcode = ReceiveMessage(*servers_[i]);
+            if (opcode.is_err()) {
+                result = std::move(opcode).err();
+            } else if (opcode.ok() != Opcode::kOk) {
+                result = net::Error::Create("A server failed to write");
+            }
+        }
+        event.left = clock_t::now();
+        cluster_.events.Record(std::move(event));
+
+        RETURN_IF_ERROR(Await<void>(
+            done, util::string::stream("Release ", sequence, " for ", file)));
+        return result;
+    }
+
+    Cluster& cluster_;
+    const std::size_t index_;
+    std::mt19937 rng_;
+    std::vector<std::unique_ptr<net::Socket>> servers_;
+    std::thread worker_;
+};
+
+/**
+ * @brief Components of every node, and where each one keeps its files.
+ *
+ */
+struct Node {
+    std::unique_ptr<net::Components> components;
+    std::string root_dir;
+};
+
+/**
+ * @brief Creates the components of a node, with its properties written to a
+ * file and parsed.
+ *
+ * @param config
+ * @param server Whether the node is a server
+ * @param dir Directory of the node, which is created
+ * @param port
+ * @param id
+ * @param props Properties of the node
+ * @return util::result<std::unique_ptr<net::Components>, net::Error>
+ */
+util::result<std::unique_ptr<net::Components>, net::Error> CreateComponents(
+    const Config& config, bool server, const std::string& dir,
+    std::uint16_t port, int id, const std::string& props) {
+    RETURN_IF_ERROR(ToNetResult(util::fs::create_directory(dir)));
+    std::string props_path = dir + "/node.properties";
+    std::ofstream props_file(props_path);
+    if (!config.props_file.empty()) {
+        std::ifstream extra(config.props_file);
+        if (!extra) {
+            return net::Error::Create("Failed to read " + config.props_file);
+        }
+        props_file << extra.rdbuf() << '\n';
+    }
+    props_file << props;
+    props_file.close();
+    if (!props_file) {
+        return net::Error::Create("Failed to write " + props_path);
+    }
+
+    program::Options options{};
+    options.server = server;
+    options.id = id;
+    options.port = port;
+    options.threads = config.threads;
+    options.timeout = kTimeoutMs;
+    options.retry_timeout = kRetryTimeoutMs;
+    options.temp_directory = dir + "/temp";
+    options.props_file = props_path;
+    std::unique_ptr<net::Components> components(new net::Components(options));
+    RETURN_IF_ERROR(ToNetResult(components->props.ParseFile(props_path)));
+    components->thread_pool.Start();
+    components->timer_service.Start();
+    components->reactor.Start();
+    return components;
+}
+
+/**
+ * @brief Files the clients write to in the scenario.
+ *
+ * @param config
+ * @return std::vector<std::string>
+ */
+std::vector<std::string> Files(const Config& config) {
+    if (config.scenario != Scenario::kUniform) {
+        return {kHotFile};
+    }
+    std::vector<std::string> files;
+    for (std::size_t i = 0; i < config.files; ++i) {
+        files.push_back("file" + std::to_string(i) + ".txt");
+    }
+    return files;
+}
+
+/**
+ * @brief Checks that every server's copy of every file holds the lines
+ * written in the order the event log says.
+ *
+ * @param servers
+ * @param lines
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> VerifyFiles(
+    const std::vector<Node>& servers,
+    const std::map<std::string, std::vector<std::string>>& lines) {
+    for (const auto& server : servers) {
+        for (const auto& file : lines) {
+            std::ifstream stream(server.root_dir + "/" + file.first);
+            std::vector<std::string> written;
+            std::string line;
+            while (std::getline(stream, line)) {
+                written.push_back(line);
+            }
+            if (written != file.second) {
+                return net::Error::Create(
+                    "A server wrote " + file.first +
+                    " in a different order than the critical sections");
+            }
+        }
+    }
+    return util::ok;
+}
+
+/**
+ * @brief Logs a line of the report.
+ *
+ * @param name
+ * @param value
+ */
+void Report(const std::string& name, double value) {
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << value;
+    util::nolog::console::log(name + ":", line.str());
+}
+
+/**
+ * @brief Starts every server and client, runs the scenario, and checks the
+ * event log.
+ *
+ * @param config
+ * @param temp_dir
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> Run(const Config& config,
+                                   const std::string& temp_dir) {
+    Cluster cluster(config);
+    std::vector<std::string> files = Files(config);
+
+    std::streambuf* console = std::cout.rdbuf();
+    if (!config.log) {
+        // The nodes log every step, so their output is discarded until they
+        // are stopped. Writes to a stream without a buffer fail silently.
+        std::cout.rdbuf(nullptr);
+    }
+
+    std::vector<Node> server_nodes;
+    std::vector<std::unique_ptr<net::server::Server>> servers;
+    util::result<void, net::Error> result = util::ok;
+    for (std::size_t i = 0; i < config.servers && result.is_ok(); ++i) {
+        std::string dir = temp_dir + "/server" + std::to_string(i);
+        std::string root_dir = dir + "/root";
+        auto components = CreateComponents(config, true, dir, 0, i + 1,
+                                           "root_dir=" + root_dir + "\n");
+        if (components.is_err()) {
+            result = std::move(components).err();
+            break;
+        }
+        server_nodes.push_back(Node{std::move(components).ok(), root_dir});
+        result = ToNetResult(util::fs::create_directory(root_dir));
+        for (std::size_t f = 0; f < files.size() && result.is_ok(); ++f) {
+            result =
+                ToNetResult(util::fs::create_file(root_dir + "/" + files[f]));
+        }
+        if (result.is_err()) {
+            break;
+        }
+        servers.emplace_back(new net::server::Server(
+            false, *server_nodes.back().components,
+            net::server::impl::ClientServerConnectionHandlerFactory::
+                CreateFactory()));
+        result = servers.back()->Start();
+        cluster.server_ports.push_back(servers.back()->Port());
+    }
+
+    std::vector<std::uint16_t> ports;
+    std::string peers;
+    if (result.is_ok()) {
+        auto free_ports = FreePorts(config.clients);
+        if (free_ports.is_err()) {
+            result = std::move(free_ports).err();
+        } else {
+            ports = std::move(free_ports).ok();
+        }
+    }
+    for (std::size_t i = 0; i < ports.size(); ++i) {
+        peers += util::string::stream(i == 0 ? "" : ",", "localhost:",
+                                      ports[i]);
+    }
+    std::string client_props = util::string::stream(
+        "clients=", peers, "\npassword=cluster\nmutex_algorithm=",
+        config.algorithm, "\n");
+
+    std::vector<Node> client_nodes;
+    std::vector<std::unique_ptr<SimulatedClient>> clients;
+    for (std::size_t i = 0; i < config.clients && result.is_ok(); ++i) {
+        std::string dir = temp_dir + "/client" + std::to_string(i);
+        auto components = CreateComponents(config, false, dir, ports[i],
+                                           kFirstId + i, client_props);
+        if (components.is_err()) {
+            result = std::move(components).err();
+            break;
+        }
+        client_nodes.push_back(Node{std::move(components).ok(), dir});
+        clients.emplace_back(
+            new SimulatedClient(cluster, *client_nodes.back().components, i));
+    }
+
+    // Clients are started together, since starting one can take a while and
+    // every client waits for all of the others before joining the network.
+    auto set_up_start = clock_t::now();
+    if (result.is_ok()) {
+        std::vector<util::result<void, net::Error>> results(clients.size(),
+                                                            util::ok);
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < clients.size(); ++i) {
+            threads.emplace_back(
+                [&, i]() { results[i] = clients[i]->Start(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto failed =
+            std::find_if(results.begin(), results.end(),
+                         [](const util::result<void, net::Error>& result) {
+                             return result.is_err();
+                         });
+        if (failed != results.end()) {
+            result = *failed;
+        }
+    }
+
+    // Every client joins the peer network before any request is made.
+    clock_t::time_point run_start;
+    if (result.is_ok()) {
+        std::unique_lock<std::mutex> lock(cluster.mutex);
+        bool all_ready = cluster.changed.wait_for(
+            lock, std::chrono::milliseconds(kTimeoutMs) * 3, [&]() {
+                return cluster.ready + cluster.done == config.clients;
+            });
+        if (!all_ready) {
+            result = net::Error::Create("Timed out forming the peer network");
+            cluster.aborted = true;
+        }
+        run_start = clock_t::now();
+        cluster.start = run_start;
+        cluster.started = true;
+        cluster.changed.notify_all();
+        if (all_ready) {
+            cluster.changed.wait(
+                lock, [&]() { return cluster.done == config.clients; });
+        }
+    }
+    auto run_end = clock_t::now();
+
+    std::uint64_t messages = 0;
+    for (auto& client : clients) {
+        messages += client->MessagesSent(files);
+        client->Stop();
+    }
+    for (auto& server : servers) {
+        server->Stop();
+    }
+    clients.clear();
+    std::cout.rdbuf(console);
+
+    RETURN_IF_ERROR(result);
+    if (!cluster.errors.empty()) {
+        return net::Error::Create(cluster.errors.front());
+    }
+
+    std::size_t entries = cluster.events.Size();
+    if (entries != config.clients * config.requests) {
+        return net::Error::Create("A request was never granted");
+    }
+    ASSIGN_OR_RETURN(auto lines, cluster.events.Verify());
+    RETURN_IF_ERROR(VerifyFiles(server_nodes, lines));
+
+    double run_s = std::chrono::duration<double>(run_end - run_start).count();
+    Report("set up ms", std::chrono::duration<double, std::milli>(
+                            run_start - set_up_start)
+                            .count());
+    Report("run ms", run_s * 1000);
+    util::nolog::console::log("critical sections:", entries);
+    Report("critical sections per second", entries / run_s);
+    Report("messages per critical section",
+           static_cast<double>(messages) / entries);
+    auto acquire = cluster.acquire_us.take_snapshot();
+    for (double p : kPercentiles) {
+        Report(util::string::stream("acquire us p", p), acquire.percentile(p));
+    }
+    Report("acquire us max", acquire.max());
+    util::nolog::console::log("mutual exclusion: safe");
+    return util::ok;
+}
+
+/**
+ * @brief Reads the settings from the command line.
+ *
+ * @param argc
+ * @param argv
+ * @param config
+ * @return util::result<void, util::error>
+ */
+util::result<void, util::error> ParseArgs(int argc, char* argv[],
+                                          Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--log") {
+            config.log = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return util::error("Missing value for " + arg);
+        }
+        std::string value = argv[++i];
+        if (arg == "--props") {
+            config.props_file = value;
+            continue;
+        }
+        if (arg == "--algorithm") {
+            config.algorithm = value;
+            continue;
+        }
+        if (arg == "--scenario") {
+            const std::pair<const char*, Scenario> scenarios[] = {
+                {"hot", Scenario::kHot},
+                {"uniform", Scenario::kUniform},
+                {"bursty", Scenario::kBursty},
+            };
+            auto it = std::find_if(
+                std::begin(scenarios), std::end(scenarios),
+                [&value](const std::pair<const char*, Scenario>& pair) {
+                    return value == pair.first;
+                });
+            if (it == std::end(scenarios)) {
+                return util::error(
+                    "Scenario must be \"hot\", \"uniform\", or \"bursty\"");
+            }
+            config.scenario = it->second;
+            config.scenario_name = value;
+            continue;
+        }
+
+        auto result = util::num::string_to_num<std::size_t>(value);
+        if (result.is_err()) {
+            return util::error("Invalid " + arg);
+        }
+        std::size_t number = result.ok();
+        const std::pair<const char*, std::size_t*> positive[] = {
+            {"--clients", &config.clients}, {"--requests", &config.requests},
+            {"--files", &config.files},     {"--burst", &config.burst},
+            {"--burst-ms", &config.burst_ms}, {"--threads", &config.threads},
+        };
+        auto it = std::find_if(
+            std::begin(positive), std::end(positive),
+            [&arg](const std::pair<const char*, std::size_t*>& pair) {
+                return arg == pair.first;
+            });
+        if (it != std::end(positive) && number > 0) {
+            *it->second = number;
+        } else if (arg == "--servers") {
+            config.servers = number;
+        } else if (arg == "--think-ms") {
+            config.think_ms = number;
+        } else {
+            return util::error("Invalid option " + arg);
+        }
+    }
+    if (config.clients < 2) {
+        return util::error("At least 2 clients are needed");
+    }
+    if (config.threads == 0) {
+        config.threads = config.clients + 2;
+    }
+    return util::ok;
+}
+
+/**
+ * @brief Raises the limit of open file descriptors as far as allowed.
+ *
+ */
+void RaiseFileLimit() {
+    rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    auto args = ParseArgs(argc, argv, config);
+    if (args.is_err()) {
+        util::nolog::error_log::log(args.err().what());
+        return 1;
+    }
+    RaiseFileLimit();
+
+    char dir_template[] = "/tmp/cluster_bench.XXXXXX";
+    if (::mkdtemp(dir_template) == nullptr) {
+        util::nolog::error_log::log("Failed to create temp directory");
+        return 1;
+    }
+    std::string temp_dir = dir_template;
+
+    util::nolog::console::log("scenario:", config.scenario_name);
+    util::nolog::console::log("algorithm:", config.algorithm);
+    util::nolog::console::log("clients:", config.clients,
+                              "servers:", config.servers);
+    util::nolog::console::log("requests per client:", config.requests);
+
+    auto result = Run(config, temp_dir);
+    util::fs::delete_directory(temp_dir);
+    if (result.is_err()) {
+        util::nolog::error_log::log(result.err());
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,666 @@
+#include <net/proto/messages.h>
+#include <util/buffer.h>
+#include <util/bytes.h>
+#include <util/console.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Measures the buffer and codec primitives every message goes through:
+// util::buffer, util::bytes, and the encoding and decoding of every message
+// type, framed the way the message services put them on and take them off a
+// socket.
+//
+// Buffer cases are run both with their data contiguous and with it wrapped
+// around the end of the buffer. Every case reports the time per operation,
+// the bytes moved per second where it moves bytes, and the heap allocations
+// per operation, counted by replacing the global operator new.
+//
+// A baseline of the time and allocations per operation is checked in as
+// src/bench/codec_bench.baseline. Comparing against it reports every case
+// that got slower by more than the tolerance (25% by default) or allocates
+// more, and exits with 2 if any did. Times are only comparable on the
+// machine the baseline was saved on, so regenerate it there before comparing
+// a change.
+//
+// Usage: codec_bench [--filter text] [--min-ms ms] [--save file]
+//                    [--baseline file] [--tolerance percent]
+//
+// Build with the "g++ build codec benchmark" task.
+
+namespace {
+
+std::atomic<std::uint64_t> allocations(0);
+
+}  // namespace
+
+// Not inlined, so the compiler does not pair the malloc and free inside them
+// with the allocations they replace.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+using clock_t = std::chrono::steady_clock;
+using net::proto::Message;
+using net::proto::Opcode;
+
+constexpr std::size_t kDefaultMinMs = 200;
+constexpr double kDefaultTolerance = 25;
+constexpr std::size_t kRepetitions = 5;
+constexpr char kFileName[] = "file1.txt";
+constexpr char kLine[] = "<1, 1700000000000000>";
+
+// Capacity of the buffers in the wrap cases, and how far into them the data
+// starts. Every operation moves a whole capacity, so the positions come back
+// to where they started and every operation wraps (or never does).
+constexpr std::size_t kBlockSize = 64;
+constexpr std::size_t kWrapOffset = kBlockSize / 2;
+
+// Lines split by get_until, including the delimiter.
+constexpr std::size_t kLineSize = 256;
+
+// Bytes written at once into a small buffer, which must grow to fit them.
+constexpr std::size_t kGrowSize = 4096;
+
+/**
+ * @brief Keeps the compiler from optimizing away the computation of a value.
+ *
+ * @tparam T
+ * @param value
+ */
+template <typename T>
+void KeepAlive(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * @brief A single operation to measure.
+ *
+ */
+struct Case {
+    std::string name;
+
+    // Bytes moved by every operation, or 0 to not report a throughput.
+    std::size_t bytes;
+
+    // Runs the operation the given number of times.
+    std::function<void(std::size_t)> run;
+};
+
+/**
+ * @brief Time and allocations of a single operation.
+ *
+ */
+struct Sample {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+/**
+ * @brief A codec to measure, under a name to report it by.
+ *
+ */
+struct Codec {
+    const char* name;
+    std::function<Message()> encode;
+    std::function<bool(Message&&)> decode;
+};
+
+/**
+ * @brief Creates a buffer of the given capacity with its positions moved the
+ * given number of bytes in.
+ *
+ * @param capacity
+ * @param offset
+ * @return util::buffer
+ */
+util::buffer OffsetBuffer(std::size_t capacity, std::size_t offset) {
+    util::buffer buffer(capacity);
+    if (offset > 0) {
+        buffer.commit(offset);
+        buffer.consume(offset);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Frames a message onto a buffer, the same way the message services
+ * queue it on a socket.
+ *
+ * @param msg
+ * @param wire
+ */
+void Frame(Message&& msg, util::buffer& wire) {
+    wire.put(&msg.opcode, net::proto::kOpcodeLength, true);
+    util::bytes::insert<net::proto::kBodySizeLength>(
+        wire, static_cast<std::uint32_t>(msg.body.size()));
+    wire.move_buffer(msg.body, true);
+}
+
+/**
+ * @brief Takes a framed message off a buffer, the same way the message
+ * services read it from a socket.
+ *
+ * @param wire
+ * @return Message
+ */
+Message Unframe(util::buffer& wire) {
+    auto opcode = static_cast<Opcode>(wire.get());
+    std::size_t size =
+        util::bytes::extract<net::proto::kBodySizeLength>(wire);
+    util::buffer body;
+    if (size != 0) {
+        body.reserve(size);
+        auto bytes = wire.get_many(size);
+        body.put_iter(bytes.begin(), bytes.end());
+    }
+    return Message{opcode, std::move(body)};
+}
+
+/**
+ * @brief Creates the cases for util::buffer.
+ *
+ * @return std::vector<Case>
+ */
+std::vector<Case> BufferCases() {
+    std::vector<Case> cases;
+    cases.push_back({"buffer.put_get/byte", 1, [](std::size_t n) {
+                         util::buffer buffer;
+                         for (std::size_t i = 0; i < n; ++i) {
+                             buffer.put(static_cast<std::uint8_t>(i));
+                             KeepAlive(buffer.get());
+                         }
+                     }});
+
+    for (std::size_t offset : {std::size_t(0), kWrapOffset}) {
+        std::string layout = offset == 0 ? "/contiguous" : "/wrapped";
+        cases.push_back(
+            {"buffer.put_get_many" + layout, kBlockSize,
+             [offset](std::size_t n) {
+                 std::vector<std::uint8_t> block(kBlockSize, 'a');
+                 auto buffer = OffsetBuffer(kBlockSize, offset);
+                 for (std::size_t i = 0; i < n; ++i) {
+                     buffer.put(block.data(), block.size());
+                     KeepAlive(buffer.get_many(kBlockSize));
+                 }
+             }});
+        cases.push_back(
+            {"buffer.view" + layout, 0, [offset](std::size_t n) {
+                 auto buffer = OffsetBuffer(kBlockSize, offset);
+                 buffer.commit(kBlockSize);
+                 for (std::size_t i = 0; i < n; ++i) {
+                     KeepAlive(buffer.view());
+                 }
+             }});
+        cases.push_back(
+            {"buffer.get_until" + layout, kLineSize, [offset](std::size_t n) {
+                 std::string line(kLineSize - 2, 'a');
+                 line += net::proto::kStringDelimiter;
+                 const std::string delim = net::proto::kStringDelimiter;
+                 auto buffer = OffsetBuffer(kLineSize, offset);
+                 for (std::size_t i = 0; i < n; ++i) {
+                     buffer.put(line.data(), line.size());
+                     KeepAlive(buffer.get_until(delim));
+                 }
+             }});
+        // Grows a small buffer holding some data to fit a large write.
+        cases.push_back(
+            {"buffer.resize" + layout, kGrowSize, [offset](std::size_t n) {
+                 std::vector<std::uint8_t> block(kGrowSize, 'a');
+                 for (std::size_t i = 0; i < n; ++i) {
+                     auto buffer = OffsetBuffer(kBlockSize, offset);
+                     buffer.commit(kWrapOffset + kBlockSize / 4);
+                     buffer.put(block.data(), block.size(), true);
+                     KeepAlive(buffer);
+                 }
+             }});
+    }
+
+    cases.push_back({"buffer.reserve_commit/contiguous", kGrowSize,
+                     [](std::size_t n) {
+                         util::buffer buffer(kGrowSize);
+                         for (std::size_t i = 0; i < n; ++i) {
+                             KeepAlive(buffer.reserve(kGrowSize));
+                             buffer.commit(kGrowSize);
+                             buffer.consume(kGrowSize);
+                         }
+                     }});
+    // The free space wraps, so every reservation shifts the data held
+    // (three eighths of the buffer) to the beginning.
+    cases.push_back({"buffer.reserve_commit/shifted", kGrowSize / 2,
+                     [](std::size_t n) {
+                         auto buffer = OffsetBuffer(kGrowSize, kGrowSize / 2);
+                         buffer.commit(kGrowSize * 3 / 8);
+                         for (std::size_t i = 0; i < n; ++i) {
+                             KeepAlive(buffer.reserve(kGrowSize / 2));
+                             buffer.commit(kGrowSize / 2);
+                             buffer.consume(kGrowSize / 2);
+                         }
+                     }});
+    // The data wraps, so every shift takes the slow path.
+    cases.push_back({"buffer.put_shift/wrapped", kBlockSize * 3 / 4,
+                     [](std::size_t n) {
+                         std::vector<std::uint8_t> block(kBlockSize * 3 / 4,
+                                                         'a');
+                         auto buffer =
+                             OffsetBuffer(kBlockSize, kBlockSize * 3 / 4);
+                         for (std::size_t i = 0; i < n; ++i) {
+                             buffer.put(block.data(), block.size());
+                             buffer.shift();
+                             buffer.consume(block.size());
+                         }
+                     }});
+    return cases;
+}
+
+/**
+ * @brief Creates the cases for util::bytes.
+ *
+ * @return std::vector<Case>
+ */
+std::vector<Case> BytesCases() {
+    std::vector<Case> cases;
+    cases.push_back({"bytes.insert/vector/4", 4, [](std::size_t n) {
+                         util::bytes::byte_vector bytes;
+                         bytes.reserve(8);
+                         for (std::size_t i = 0; i < n; ++i) {
+                             bytes.clear();
+                             util::bytes::insert<4>(
+                                 bytes, static_cast<std::uint32_t>(i));
+                             KeepAlive(bytes);
+                         }
+                     }});
+    cases.push_back({"bytes.insert/vector/8", 8, [](std::size_t n) {
+                         util::bytes::byte_vector bytes;
+                         bytes.reserve(8);
+                         for (std::size_t i = 0; i < n; ++i) {
+                             bytes.clear();
+                             util::bytes::insert<8>(
+                                 bytes, static_cast<std::uint64_t>(i));
+                             KeepAlive(bytes);
+                         }
+                     }});
+    cases.push_back({"bytes.insert_extract/buffer/4", 4, [](std::size_t n) {
+                         util::buffer buffer;
+                         for (std::size_t i = 0; i < n; ++i) {
+                             util::bytes::insert<4>(
+                                 buffer, static_cast<std::uint32_t>(i));
+                             KeepAlive(util::bytes::extract<4>(buffer));
+                         }
+                     }});
+    cases.push_back({"bytes.insert_extract/buffer/8", 8, [](std::size_t n) {
+                         util::buffer buffer;
+                         for (std::size_t i = 0; i < n; ++i) {
+                             util::bytes::insert<8>(
+                                 buffer, static_cast<std::uint64_t>(i));
+                             KeepAlive(util::bytes::extract<8>(buffer));
+                         }
+                     }});
+    return cases;
+}
+
+/**
+ * @brief Creates a codec for every message type, with a typical body.
+ *
+ * @return std::vector<Codec>
+ */
+std::vector<Codec> Codecs() {
+    using namespace net::proto;
+    std::vector<std::uint8_t> data(kGrowSize, 'a');
+    std::vector<std::string> file_names;
+    std::vector<node_id_t> ids;
+    std::unordered_map<node_id_t, std::size_t> last_granted;
+    std::deque<node_id_t> queue;
+    for (node_id_t id = 0; id < 16; ++id) {
+        file_names.push_back("file" + std::to_string(id) + ".txt");
+        ids.push_back(id);
+        last_granted[id] = id * 10;
+        if (id % 2 == 0) {
+            queue.push_back(id);
+        }
+    }
+
+    return {
+        {"ok", []() { return OkMessage{}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToOk().is_ok(); }},
+        {"error", []() { return ErrorMessage{kBusyError}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToError().is_ok(); }},
+        {"establish_connection",
+         []() { return EstablishConnectionMessage{1, "server"}.ToMessage(); },
+         [](Message&& msg) {
+             return std::move(msg).ToEstablishConnection().is_ok();
+         }},
+        {"response", []() { return ResponseMessage{kLine}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToResponse().is_ok(); }},
+        {"file_transfer",
+         []() { return FileTransferMessage{kFileName}.ToMessage(); },
+         [](Message&& msg) {
+             return std::move(msg).ToFileTransfer().is_ok();
+         }},
+        {"transmit_data",
+         [data]() { return compound::TransmitDataMessage{data}.ToMessage(); },
+         [](Message&& msg) {
+             return std::move(msg).ToTransmitData().is_ok();
+         }},
+        {"finished",
+         []() { return compound::FinishedMessage{}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToFinished().is_ok(); }},
+        {"enquiry",
+         []() { return EnquiryMessage{std::uint64_t(1)}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToEnquiry().is_ok(); }},
+        {"listing",
+         [file_names]() { return ListingMessage{1, file_names}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToListing().is_ok(); }},
+        {"not_modified", []() { return NotModifiedMessage{}.ToMessage(); },
+         [](Message&& msg) {
+             return std::move(msg).ToNotModified().is_ok();
+         }},
+        {"read", []() { return ReadMessage{kFileName}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToRead().is_ok(); }},
+        {"write", []() { return WriteMessage{kFileName, kLine}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToWrite().is_ok(); }},
+        {"heartbeat", []() { return HeartbeatMessage{}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToHeartbeat().is_ok(); }},
+        {"members", [ids]() { return MembersMessage{ids}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToMembers().is_ok(); }},
+        {"leave", []() { return LeaveMessage{}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToLeave().is_ok(); }},
+        {"request",
+         []() { return mutex::RequestMessage{1, kFileName}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToRequest().is_ok(); }},
+        {"reply",
+         []() { return mutex::ReplyMessage{1, 1, kFileName}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToReply().is_ok(); }},
+        {"release",
+         []() { return mutex::ReleaseMessage{1, kFileName}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToRelease().is_ok(); }},
+        {"inquire",
+         []() { return mutex::InquireMessage{1, kFileName}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToInquire().is_ok(); }},
+        {"relinquish",
+         []() { return mutex::RelinquishMessage{1, kFileName}.ToMessage(); },
+         [](Message&& msg) {
+             return std::move(msg).ToRelinquish().is_ok();
+         }},
+        {"failed",
+         []() { return mutex::FailedMessage{1, kFileName}.ToMessage(); },
+         [](Message&& msg) { return std::move(msg).ToFailed().is_ok(); }},
+        {"token_request",
+         []() {
+             return mutex::TokenRequestMessage{1, 1, kFileName}.ToMessage();
+         },
+         [](Message&& msg) {
+             return std::move(msg).ToTokenRequest().is_ok();
+         }},
+        {"token",
+         [last_granted, queue]() {
+             return mutex::TokenMessage{1, 1, 1, last_granted, queue,
+                                        kFileName}
+                 .ToMessage();
+         },
+         [](Message&& msg) { return std::move(msg).ToToken().is_ok(); }},
+    };
+}
+
+/**
+ * @brief Creates an encode and a decode case for every message type.
+ *
+ * Encoding builds the message, as its sender would, and frames it onto an
+ * output buffer. Decoding copies the frame into an input buffer, as a receive
+ * would, then unframes and parses it.
+ *
+ * @return std::vector<Case>
+ */
+std::vector<Case> MessageCases() {
+    std::vector<Case> cases;
+    for (const auto& codec : Codecs()) {
+        util::buffer wire;
+        Frame(codec.encode(), wire);
+        auto frame = wire.get_many(wire.size());
+        auto encode = codec.encode;
+        auto decode = codec.decode;
+        cases.push_back({std::string("proto.encode/") + codec.name,
+                         frame.size(), [encode](std::size_t n) {
+                             util::buffer wire;
+                             for (std::size_t i = 0; i < n; ++i) {
+                                 Frame(encode(), wire);
+                                 wire.consume(wire.size());
+                             }
+                         }});
+        cases.push_back({std::string("proto.decode/") + codec.name,
+                         frame.size(), [decode, frame](std::size_t n) {
+                             util::buffer wire;
+                             for (std::size_t i = 0; i < n; ++i) {
+                                 wire.put(frame.data(), frame.size(), true);
+                                 if (!decode(Unframe(wire))) {
+                                     throw std::runtime_error(
+                                         "Failed to decode");
+                                 }
+                             }
+                         }});
+    }
+    return cases;
+}
+
+/**
+ * @brief Runs a case for the given number of operations.
+ *
+ * @param test
+ * @param n
+ * @return Sample
+ */
+Sample Run(const Case& test, std::size_t n) {
+    std::uint64_t allocations_before = allocations.load();
+    auto start = clock_t::now();
+    test.run(n);
+    auto elapsed = clock_t::now() - start;
+    std::uint64_t allocated = allocations.load() - allocations_before;
+    return {std::chrono::duration<double, std::nano>(elapsed).count() / n,
+            static_cast<double>(allocated) / n};
+}
+
+/**
+ * @brief Measures a case, running it long enough for the clock to be
+ * accurate, and keeping the fastest of a few repetitions.
+ *
+ * @param test
+ * @param min_ms Time every repetition runs for
+ * @return Sample
+ */
+Sample Measure(const Case& test, std::size_t min_ms) {
+    double min_ns = min_ms * 1e6;
+    std::size_t n = 1;
+    Sample sample = Run(test, n);
+    while (sample.ns_per_op * n < min_ns / 10) {
+        n *= 10;
+        sample = Run(test, n);
+    }
+    n = std::max<std::size_t>(n, min_ns / sample.ns_per_op);
+
+    Sample best = Run(test, n);
+    for (std::size_t i = 1; i < kRepetitions; ++i) {
+        Sample next = Run(test, n);
+        if (next.ns_per_op < best.ns_per_op) {
+            best = next;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Formats a measured case as a single line.
+ *
+ * @param test
+ * @param sample
+ * @return std::string
+ */
+std::string Format(const Case& test, const Sample& sample) {
+    std::ostringstream line;
+    line << std::left << std::setw(36) << test.name << std::right << std::fixed
+         << std::setprecision(1) << std::setw(10) << sample.ns_per_op
+         << " ns/op";
+    if (test.bytes > 0) {
+        line << std::setw(10) << test.bytes * 1e3 / sample.ns_per_op
+             << " MB/s";
+    } else {
+        line << std::setw(15) << "";
+    }
+    line << std::setprecision(2) << std::setw(8) << sample.allocs_per_op
+         << " allocs/op";
+    return line.str();
+}
+
+/**
+ * @brief Reads a baseline saved with --save.
+ *
+ * @param path
+ * @param baseline
+ * @return true
+ * @return false Failed to read the file
+ */
+bool ReadBaseline(const std::string& path,
+                  std::map<std::string, Sample>& baseline) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        Sample sample;
+        if (fields >> name >> sample.ns_per_op >> sample.allocs_per_op) {
+            baseline[name] = sample;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::size_t min_ms = kDefaultMinMs;
+    std::string save_path;
+    std::string baseline_path;
+    double tolerance = kDefaultTolerance;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            util::nolog::error_log::log("Missing value for", arg);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--filter") {
+            filter = value;
+        } else if (arg == "--min-ms") {
+            auto result = util::num::string_to_num<std::size_t>(value);
+            if (result.is_err() || result.ok() == 0) {
+                util::nolog::error_log::log("Invalid minimum time");
+                return 1;
+            }
+            min_ms = result.ok();
+        } else if (arg == "--save") {
+            save_path = value;
+        } else if (arg == "--baseline") {
+            baseline_path = value;
+        } else if (arg == "--tolerance") {
+            auto result = util::num::string_to_num<double>(value);
+            if (result.is_err() || result.ok() < 0) {
+                util::nolog::error_log::log("Invalid tolerance");
+                return 1;
+            }
+            tolerance = result.ok();
+        } else {
+            util::nolog::error_log::log("Unknown option", arg);
+            return 1;
+        }
+    }
+
+    std::map<std::string, Sample> baseline;
+    if (!baseline_path.empty() && !ReadBaseline(baseline_path, baseline)) {
+        util::nolog::error_log::log("Failed to read baseline", baseline_path);
+        return 1;
+    }
+
+    std::vector<Case> cases = BufferCases();
+    for (auto&& group : {BytesCases(), MessageCases()}) {
+        cases.insert(cases.end(), group.begin(), group.end());
+    }
+
+    std::ostringstream saved;
+    saved << "# name ns/op allocs/op\n";
+    std::size_t regressions = 0;
+    for (const auto& test : cases) {
+        if (test.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        Sample sample = Measure(test, min_ms);
+        saved << test.name << ' ' << std::fixed << std::setprecision(1)
+              << sample.ns_per_op << ' ' << std::setprecision(2)
+              << sample.allocs_per_op << '\n';
+
+        std::string line = Format(test, sample);
+        auto it = baseline.find(test.name);
+        if (it != baseline.end()) {
+            const Sample& before = it->second;
+            std::ostringstream change;
+            change << std::fixed << std::setprecision(1) << std::showpos
+                   << (sample.ns_per_op / before.ns_per_op - 1) * 100 << '%';
+            line += "  " + change.str();
+            if (sample.ns_per_op > before.ns_per_op * (1 + tolerance / 100)) {
+                line += " SLOWER";
+                ++regressions;
+            }
+            // Allocations are exact, so any increase is reported.
+            if (sample.allocs_per_op > before.allocs_per_op + 0.005) {
+                line += " MORE ALLOCATIONS";
+                ++regressions;
+            }
+        }
+        util::nolog::console::log(line);
+    }
+
+    if (!save_path.empty()) {
+        std::ofstream file(save_path);
+        file << saved.str();
+        if (!file) {
+            util::nolog::error_log::log("Failed to save baseline", save_path);
+            return 1;
+        }
+    }
+    if (regressions > 0) {
+        util::nolog::error_log::log(regressions, "regressions against",
+                                    baseline_path);
+        return 2;
+    }
+    return 0;
+}
\ No newline at end of file
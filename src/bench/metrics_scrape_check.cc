@@ -0,0 +1,464 @@
+#include <arpa/inet.h>
+#include <net/components.h>
+#include <net/shared/metrics_endpoint.h>
+#include <netinet/in.h>
+#include <program/options.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <util/console.h>
+#include <util/filesystem.h>
+#include <util/metrics.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Checks the metrics endpoint end to end, the way Prometheus scrapes it.
+//
+// Starts a net::shared::MetricsEndpoint on a port the system picks, serving a
+// registry with every kind of metric and per-file mutual exclusion metrics
+// named like the mutual exclusion service names them, and sends it
+// GET /metrics over loopback. The run fails unless:
+//   - the response is 200 with the content type of the text exposition
+//     format, and its body is as long as Content-Length says
+//   - every line is a TYPE comment or a sample with a valid name, well-formed
+//     labels, and a number, and no sample is listed twice
+//   - every name has one TYPE line, and all of its samples follow it
+//   - per-file metrics share one name with the file as a label, including
+//     files whose names would collide once made valid metric names
+//
+// Usage: metrics_scrape_check
+//
+// Build with the "g++ build metrics scrape check" task.
+
+namespace {
+
+constexpr int kTimeoutMs = 5000;
+
+// Files of the per-file metrics. The first two become the same metric name if
+// the file is part of it, and the last needs escaping as a label value.
+const char* const kFiles[] = {"a.b", "a_b", "quote\"file"};
+
+/**
+ * @brief A sample parsed from the exposition format.
+ *
+ */
+struct Sample {
+    std::string name;
+    std::map<std::string, std::string> labels;
+    double value;
+};
+
+/**
+ * @brief Counts failed checks.
+ *
+ */
+std::size_t failures = 0;
+
+void Check(bool ok, const std::string& what) {
+    if (!ok) {
+        ++failures;
+        util::nolog::error_log::log("Check failed:", what);
+    }
+}
+
+/**
+ * @brief Records one of every kind of metric, and per-file metrics.
+ *
+ * @param metrics
+ */
+void Populate(util::metrics::registry& metrics) {
+    metrics.get_counter("server.connections.accepted").increment(3);
+    metrics.get_gauge("thread_pool.queue_depth").set(2);
+    metrics.get_histogram("server.request_us.read").observe(40);
+    metrics.get_hdr_histogram("client.read.acquire_us").observe(250);
+    for (const char* file : kFiles) {
+        std::string prefix = std::string("mutex.") + file + ".";
+        metrics.label(prefix, "mutex.", "file", file);
+        metrics.get_counter(prefix + "requests").increment();
+        metrics.get_counter(prefix + "sent.request").increment(2);
+        metrics.get_histogram(prefix + "wait_us").observe(100);
+    }
+}
+
+/**
+ * @brief Sends a GET request for the given target, and reads the response
+ * until the endpoint closes the connection.
+ *
+ * @param port
+ * @param target
+ * @return util::result<std::string, net::Error> The whole response
+ */
+util::result<std::string, net::Error> Get(std::uint16_t port,
+                                          const std::string& target) {
+    int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return net::Error::CreateFromErrNo("Failed to open socket");
+    }
+    timeval timeout{kTimeoutMs / 1000, 0};
+    ::setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+    addr.sin_port = ::htons(port);
+    if (::connect(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+        0) {
+        ::close(sockfd);
+        return net::Error::CreateFromErrNo("Failed to connect to endpoint");
+    }
+
+    std::string request =
+        "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (::send(sockfd, request.data(), request.size(), MSG_NOSIGNAL) !=
+        static_cast<ssize_t>(request.size())) {
+        ::close(sockfd);
+        return net::Error::CreateFromErrNo("Failed to send request");
+    }
+
+    std::string response;
+    char buffer[4096];
+    while (true) {
+        ssize_t received = ::recv(sockfd, buffer, sizeof(buffer), 0);
+        if (received < 0) {
+            ::close(sockfd);
+            return net::Error::CreateFromErrNo("Failed to read response");
+        }
+        if (received == 0) {
+            break;
+        }
+        response.append(buffer, received);
+    }
+    ::close(sockfd);
+    return response;
+}
+
+/**
+ * @brief Splits a response into its status line, headers, and body, checking
+ * the body length against Content-Length.
+ *
+ * @param response
+ * @param status
+ * @param content_type
+ * @param body
+ */
+void SplitResponse(const std::string& response, std::string& status,
+                   std::string& content_type, std::string& body) {
+    std::size_t headers_end = response.find("\r\n\r\n");
+    Check(headers_end != std::string::npos, "response has headers");
+    if (headers_end == std::string::npos) {
+        return;
+    }
+    body = response.substr(headers_end + 4);
+
+    std::istringstream headers(response.substr(0, headers_end));
+    std::string line;
+    std::getline(headers, line);
+    status = line.substr(0, line.find('\r'));
+    bool has_length = false;
+    while (std::getline(headers, line)) {
+        line = line.substr(0, line.find('\r'));
+        std::size_t colon = line.find(": ");
+        std::string name = line.substr(0, colon);
+        std::string value =
+            colon == std::string::npos ? "" : line.substr(colon + 2);
+        if (name == "Content-Type") {
+            content_type = value;
+        } else if (name == "Content-Length") {
+            has_length = true;
+            Check(std::strtoull(value.c_str(), nullptr, 10) == body.size(),
+                  "body is as long as Content-Length says");
+        }
+    }
+    Check(has_length, "response has Content-Length");
+}
+
+bool ValidName(const std::string& name) {
+    if (name.empty()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < name.size(); ++i) {
+        char c = name[i];
+        bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     c == '_' || c == ':' || (i > 0 && c >= '0' && c <= '9');
+        if (!valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Parses the labels of a sample, starting just after the opening
+ * brace.
+ *
+ * @param line
+ * @param pos Set to just after the closing brace
+ * @param labels
+ * @return true
+ * @return false The labels are malformed
+ */
+bool ParseLabels(const std::string& line, std::size_t& pos,
+                 std::map<std::string, std::string>& labels) {
+    while (true) {
+        std::size_t equals = line.find('=', pos);
+        if (equals == std::string::npos || equals + 1 >= line.size() ||
+            line[equals + 1] != '"') {
+            return false;
+        }
+        std::string name = line.substr(pos, equals - pos);
+        std::string value;
+        pos = equals + 2;
+        while (pos < line.size() && line[pos] != '"') {
+            if (line[pos] == '\\') {
+                if (++pos >= line.size()) {
+                    return false;
+                }
+                char escaped = line[pos];
+                if (escaped == 'n') {
+                    value += '\n';
+                } else if (escaped == '\\' || escaped == '"') {
+                    value += escaped;
+                } else {
+                    return false;
+                }
+            } else {
+                value += line[pos];
+            }
+            ++pos;
+        }
+        if (pos >= line.size() || !ValidName(name) || labels.count(name)) {
+            return false;
+        }
+        labels[name] = value;
+        if (++pos >= line.size()) {
+            return false;
+        }
+        if (line[pos++] == '}') {
+            return true;
+        }
+        if (line[pos - 1] != ',') {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Checks a body is in the exposition format, and parses its samples.
+ *
+ * @param body
+ * @return std::vector<Sample>
+ */
+std::vector<Sample> ParseBody(const std::string& body) {
+    std::vector<Sample> samples;
+    Check(!body.empty() && body.back() == '\n', "body ends with a newline");
+
+    std::set<std::string> typed;
+    std::set<std::string> series;
+    std::string family;
+    std::string type;
+    std::istringstream lines(body);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 7, "# TYPE ") == 0) {
+            std::istringstream words(line.substr(7));
+            std::string extra;
+            words >> family >> type;
+            Check(ValidName(family), "valid name in \"" + line + '"');
+            Check(type == "counter" || type == "gauge" ||
+                      type == "histogram" || type == "summary",
+                  "known type in \"" + line + '"');
+            Check(!(words >> extra), "nothing after the type in \"" + line +
+                                         '"');
+            Check(typed.insert(family).second,
+                  "one TYPE line for " + family);
+            continue;
+        }
+        Check(line.empty() || line[0] != '#', "only TYPE comments");
+
+        Sample sample;
+        std::size_t pos = line.find_first_of("{ ");
+        sample.name = line.substr(0, pos);
+        Check(ValidName(sample.name), "valid name in \"" + line + '"');
+        if (pos != std::string::npos && line[pos] == '{') {
+            ++pos;
+            Check(ParseLabels(line, pos, sample.labels),
+                  "well-formed labels in \"" + line + '"');
+        }
+        Check(pos < line.size() && line[pos] == ' ',
+              "value follows the labels in \"" + line + '"');
+        std::string value = line.substr(std::min(pos + 1, line.size()));
+        char* end = nullptr;
+        sample.value = std::strtod(value.c_str(), &end);
+        Check(!value.empty() && *end == '\0',
+              "value is a number in \"" + line + '"');
+
+        // Histograms and summaries add suffixes to their samples.
+        std::string suffix =
+            sample.name.compare(0, family.size(), family) == 0
+                ? sample.name.substr(family.size())
+                : "?";
+        bool in_family =
+            suffix.empty() ||
+            ((type == "histogram" || type == "summary") &&
+             (suffix == "_sum" || suffix == "_count")) ||
+            (type == "histogram" && suffix == "_bucket");
+        Check(!family.empty() && in_family,
+              "\"" + line + "\" follows the TYPE line of its metric");
+
+        std::ostringstream key;
+        key << sample.name;
+        for (const auto& label : sample.labels) {
+            key << ',' << label.first << '=' << label.second;
+        }
+        Check(series.insert(key.str()).second,
+              "one sample for \"" + line + '"');
+        samples.push_back(std::move(sample));
+    }
+    return samples;
+}
+
+/**
+ * @brief Finds the value of a sample, if the body has it.
+ *
+ * @param samples
+ * @param name
+ * @param labels
+ * @param value
+ * @return true
+ * @return false
+ */
+bool Find(const std::vector<Sample>& samples, const std::string& name,
+          const std::map<std::string, std::string>& labels, double& value) {
+    for (const auto& sample : samples) {
+        if (sample.name == name && sample.labels == labels) {
+            value = sample.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CheckSample(const std::vector<Sample>& samples, const std::string& name,
+                 const std::map<std::string, std::string>& labels,
+                 double expected) {
+    double value = 0;
+    std::ostringstream what;
+    what << name << " is " << expected;
+    for (const auto& label : labels) {
+        what << " for " << label.first << ' ' << label.second;
+    }
+    Check(Find(samples, name, labels, value) && value == expected,
+          what.str());
+}
+
+/**
+ * @brief Checks the samples have the metrics recorded by `Populate`.
+ *
+ * @param samples
+ */
+void CheckMetrics(const std::vector<Sample>& samples) {
+    CheckSample(samples, "server_connections_accepted", {}, 3);
+    CheckSample(samples, "thread_pool_queue_depth", {}, 2);
+    CheckSample(samples, "server_request_us_read_count", {}, 1);
+    CheckSample(samples, "server_request_us_read_bucket", {{"le", "+Inf"}},
+                1);
+    CheckSample(samples, "client_read_acquire_us_count", {}, 1);
+    double p50 = 0;
+    Check(Find(samples, "client_read_acquire_us", {{"quantile", "0.5"}}, p50),
+          "summary has a median");
+
+    for (const char* file : kFiles) {
+        CheckSample(samples, "mutex_requests", {{"file", file}}, 1);
+        CheckSample(samples, "mutex_sent_request", {{"file", file}}, 2);
+        CheckSample(samples, "mutex_wait_us_count", {{"file", file}}, 1);
+        CheckSample(samples, "mutex_wait_us_bucket",
+                    {{"file", file}, {"le", "+Inf"}}, 1);
+    }
+    for (const auto& sample : samples) {
+        Check(sample.name.compare(0, 8, "mutex_a_") != 0 &&
+                  sample.name.compare(0, 11, "mutex_quote") != 0,
+              "no file in the name " + sample.name);
+    }
+}
+
+/**
+ * @brief Runs the endpoint and scrapes it.
+ *
+ * @param temp_dir
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> Run(const std::string& temp_dir) {
+    program::Options options{};
+    options.threads = 2;
+    options.timeout = kTimeoutMs;
+    options.retry_timeout = kTimeoutMs;
+    options.temp_directory = temp_dir;
+
+    net::Components components(options);
+    Populate(components.metrics);
+    components.thread_pool.Start();
+
+    net::shared::MetricsEndpoint endpoint(components, [&components]() {
+        return components.metrics.dump_prometheus();
+    });
+    auto result = endpoint.Start(0);
+    if (result.is_ok()) {
+        Check(endpoint.Port() != 0, "endpoint picked a port");
+        auto scrape = Get(endpoint.Port(), "/metrics");
+        auto missing = Get(endpoint.Port(), "/other");
+        if (scrape.is_err()) {
+            result = std::move(scrape).err();
+        } else if (missing.is_err()) {
+            result = std::move(missing).err();
+        } else {
+            std::string status, content_type, body;
+            SplitResponse(scrape.ok(), status, content_type, body);
+            Check(status == "HTTP/1.0 200 OK", "status is 200");
+            Check(content_type == "text/plain; version=0.0.4",
+                  "content type is the text exposition format");
+            CheckMetrics(ParseBody(body));
+
+            SplitResponse(missing.ok(), status, content_type, body);
+            Check(status == "HTTP/1.0 404 Not Found", "other paths are 404");
+        }
+    }
+    endpoint.Stop();
+    components.thread_pool.Stop();
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        util::nolog::error_log::log("Usage:", argv[0]);
+        return 1;
+    }
+
+    char dir_template[] = "/tmp/metrics_scrape_check.XXXXXX";
+    if (::mkdtemp(dir_template) == nullptr) {
+        util::nolog::error_log::log("Failed to create temp directory");
+        return 1;
+    }
+    std::string temp_dir = dir_template;
+    auto result = Run(temp_dir + "/temp");
+    util::fs::delete_directory(temp_dir);
+    if (result.is_err()) {
+        util::nolog::error_log::log(result.err());
+        return 1;
+    }
+
+    if (failures > 0) {
+        util::nolog::error_log::log(failures, "checks failed");
+        return 1;
+    }
+    util::nolog::console::log("metrics scrape: ok");
+    return 0;
+}
\ No newline at end of file
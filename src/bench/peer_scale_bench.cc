@@ -0,0 +1,347 @@
+#include <net/mutex/mutual_exclusion_algorithm.h>
+#include <net/proto/messages.h>
+#include <program/properties.h>
+#include <util/console.h>
+#include <util/metrics.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Simulates a peer network of many nodes in one process, to measure how the
+// mutual exclusion algorithms scale with the number of peers.
+//
+// Every node runs the algorithm against a simulated context, and messages are
+// delivered in order through a single in-memory queue instead of sockets.
+// Every requesting node asks for the same resource at once, and each node
+// releases the resource as soon as it enters the critical section.
+//
+// Usage: peer_scale_bench [nodes] [algorithm] [requesters]
+//
+// Build with the "g++ build peer scale benchmark" task.
+
+namespace {
+
+using net::mutex::MutualExclusionAlgorithm;
+using net::proto::node_id_t;
+
+constexpr std::size_t kDefaultNodes = 1000;
+constexpr char kDefaultAlgorithm[] = "ricart_agrawala";
+constexpr char kFileName[] = "bench.txt";
+
+// IDs start past the old one-byte limit, so the widened IDs are exercised.
+constexpr node_id_t kFirstId = 1000;
+
+class SimulatedNetwork;
+
+/**
+ * @brief A node of the simulated network, which drives one algorithm.
+ *
+ */
+class SimulatedNode : public MutualExclusionAlgorithm::Context {
+   public:
+    SimulatedNode(SimulatedNetwork& network, node_id_t id,
+                  const std::vector<node_id_t>& founding_ids);
+
+    util::result<void, net::Error> SetUp(const std::string& algorithm_name);
+
+    MutualExclusionAlgorithm& Algorithm() { return *algorithm_; }
+
+    node_id_t MyId() const override { return id_; }
+    const std::vector<node_id_t>& PeerIds() const override {
+        return peer_ids_;
+    }
+    const std::vector<node_id_t>& FoundingIds() const override {
+        return founding_ids_;
+    }
+    std::size_t Timestamp() const override { return timestamp_; }
+    void ObserveTimestamp(std::size_t timestamp) override;
+    void SendToPeer(node_id_t id, const std::string& file_name,
+                    net::proto::Message&& msg) override;
+    void EnterCriticalSection(const std::string& file_name) override;
+    void RunAfter(const std::string& file_name,
+                  std::chrono::milliseconds delay,
+                  const std::function<void()>& job) override;
+    const program::Properties& Props() const override { return props_; }
+    void RecordDelayedRequests(const std::string&, std::size_t) override {}
+    util::metrics::registry& Metrics() override { return metrics_; }
+
+   private:
+    SimulatedNetwork& network_;
+    node_id_t id_;
+    std::vector<node_id_t> peer_ids_;
+    const std::vector<node_id_t>& founding_ids_;
+    std::size_t timestamp_;
+    program::Properties props_;
+    util::metrics::registry metrics_;
+    std::unique_ptr<MutualExclusionAlgorithm> algorithm_;
+};
+
+/**
+ * @brief Every node of the simulation and the messages between them.
+ *
+ * IDs are handed out in order, so a node is found by indexing with its ID.
+ *
+ */
+class SimulatedNetwork {
+   public:
+    struct Stats {
+        std::size_t messages = 0;
+        std::size_t bytes = 0;
+        std::size_t entries = 0;
+        bool violated = false;
+    };
+
+    SimulatedNetwork(std::size_t num_nodes);
+
+    util::result<void, net::Error> SetUp(const std::string& algorithm_name);
+
+    /**
+     * @brief Has the given number of nodes request the resource, and runs
+     * until every one of them has entered and left the critical section.
+     *
+     * @param requesters
+     * @return Stats
+     */
+    Stats Run(std::size_t requesters);
+
+    SimulatedNode& Node(node_id_t id) { return *nodes_[id - kFirstId]; }
+
+    void Send(node_id_t from, node_id_t to, net::proto::Message&& msg);
+    void Entered(node_id_t id);
+    void Schedule(const std::function<void()>& job);
+
+   private:
+    struct Envelope {
+        node_id_t from;
+        node_id_t to;
+        net::proto::Message msg;
+    };
+
+    void Deliver(Envelope& envelope);
+
+    std::vector<node_id_t> ids_;
+    std::vector<std::unique_ptr<SimulatedNode>> nodes_;
+    std::deque<Envelope> in_flight_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<node_id_t> in_critical_section_;
+    Stats stats_;
+};
+
+SimulatedNode::SimulatedNode(SimulatedNetwork& network, node_id_t id,
+                             const std::vector<node_id_t>& founding_ids)
+    : network_(network),
+      id_(id),
+      founding_ids_(founding_ids),
+      timestamp_(0) {
+    peer_ids_.reserve(founding_ids.size() - 1);
+    for (auto peer : founding_ids) {
+        if (peer != id) {
+            peer_ids_.push_back(peer);
+        }
+    }
+}
+
+util::result<void, net::Error> SimulatedNode::SetUp(
+    const std::string& algorithm_name) {
+    auto algorithm = MutualExclusionAlgorithm::Create(algorithm_name, *this);
+    if (algorithm.is_err()) {
+        return algorithm.err();
+    }
+    algorithm_ = std::move(algorithm).ok();
+    return util::ok;
+}
+
+void SimulatedNode::ObserveTimestamp(std::size_t timestamp) {
+    timestamp_ = std::max(timestamp + 1, timestamp_ + 1);
+}
+
+void SimulatedNode::SendToPeer(node_id_t id, const std::string&,
+                               net::proto::Message&& msg) {
+    network_.Send(id_, id, std::move(msg));
+}
+
+void SimulatedNode::EnterCriticalSection(const std::string&) {
+    network_.Entered(id_);
+}
+
+void SimulatedNode::RunAfter(const std::string&, std::chrono::milliseconds,
+                             const std::function<void()>& job) {
+    // Simulated time does not pass, so delayed jobs run once the network is
+    // otherwise idle.
+    network_.Schedule(job);
+}
+
+SimulatedNetwork::SimulatedNetwork(std::size_t num_nodes) {
+    ids_.reserve(num_nodes);
+    for (std::size_t i = 0; i < num_nodes; ++i) {
+        ids_.push_back(kFirstId + i);
+    }
+    nodes_.reserve(num_nodes);
+    for (auto id : ids_) {
+        nodes_.emplace_back(new SimulatedNode(*this, id, ids_));
+    }
+}
+
+util::result<void, net::Error> SimulatedNetwork::SetUp(
+    const std::string& algorithm_name) {
+    for (auto& node : nodes_) {
+        RETURN_IF_ERROR(node->SetUp(algorithm_name));
+    }
+    for (auto& node : nodes_) {
+        node->Algorithm().OnNetworkConnected();
+    }
+    return util::ok;
+}
+
+SimulatedNetwork::Stats SimulatedNetwork::Run(std::size_t requesters) {
+    stats_ = Stats();
+    for (std::size_t i = 0; i < requesters; ++i) {
+        auto& node = *nodes_[i];
+        node.Algorithm().Request(kFileName, node.Timestamp());
+    }
+
+    while (!in_flight_.empty() || !jobs_.empty() ||
+           !in_critical_section_.empty()) {
+        // A node leaves the critical section before anything else happens,
+        // as if its work took no time.
+        if (!in_critical_section_.empty()) {
+            node_id_t id = in_critical_section_.back();
+            in_critical_section_.pop_back();
+            Node(id).Algorithm().Release(kFileName);
+        } else if (!in_flight_.empty()) {
+            Envelope envelope = std::move(in_flight_.front());
+            in_flight_.pop_front();
+            Deliver(envelope);
+        } else {
+            auto job = std::move(jobs_.front());
+            jobs_.pop_front();
+            job();
+        }
+    }
+    return stats_;
+}
+
+void SimulatedNetwork::Send(node_id_t from, node_id_t to,
+                            net::proto::Message&& msg) {
+    ++stats_.messages;
+    stats_.bytes += net::proto::kOpcodeLength + net::proto::kBodySizeLength +
+                    msg.body.size();
+    in_flight_.push_back(Envelope{from, to, std::move(msg)});
+}
+
+void SimulatedNetwork::Entered(node_id_t id) {
+    ++stats_.entries;
+    if (!in_critical_section_.empty()) {
+        stats_.violated = true;
+    }
+    in_critical_section_.push_back(id);
+}
+
+void SimulatedNetwork::Schedule(const std::function<void()>& job) {
+    jobs_.push_back(job);
+}
+
+void SimulatedNetwork::Deliver(Envelope& envelope) {
+    auto& algorithm = Node(envelope.to).Algorithm();
+    node_id_t from = envelope.from;
+    net::proto::Message& msg = envelope.msg;
+    switch (msg.opcode) {
+        case net::proto::Opcode::kRequest: {
+            algorithm.OnRequest(from, std::move(msg).ToRequest().ok());
+        } break;
+        case net::proto::Opcode::kReply: {
+            algorithm.OnReply(from, std::move(msg).ToReply().ok());
+        } break;
+        case net::proto::Opcode::kRelease: {
+            algorithm.OnRelease(from, std::move(msg).ToRelease().ok());
+        } break;
+        case net::proto::Opcode::kInquire: {
+            algorithm.OnInquire(from, std::move(msg).ToInquire().ok());
+        } break;
+        case net::proto::Opcode::kRelinquish: {
+            algorithm.OnRelinquish(from, std::move(msg).ToRelinquish().ok());
+        } break;
+        case net::proto::Opcode::kFailed: {
+            algorithm.OnFailed(from, std::move(msg).ToFailed().ok());
+        } break;
+        case net::proto::Opcode::kTokenRequest: {
+            algorithm.OnTokenRequest(from,
+                                     std::move(msg).ToTokenRequest().ok());
+        } break;
+        case net::proto::Opcode::kToken: {
+            algorithm.OnToken(from, std::move(msg).ToToken().ok());
+        } break;
+        default: {
+            // Algorithms send nothing else.
+        } break;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t num_nodes = kDefaultNodes;
+    if (argc > 1) {
+        auto result = util::num::string_to_num<std::size_t>(argv[1]);
+        if (result.is_err() || result.ok() < 2) {
+            util::nolog::error_log::log("Invalid number of nodes");
+            return 1;
+        }
+        num_nodes = result.ok();
+    }
+    std::string algorithm_name = argc > 2 ? argv[2] : kDefaultAlgorithm;
+    std::size_t requesters = num_nodes;
+    if (argc > 3) {
+        auto result = util::num::string_to_num<std::size_t>(argv[3]);
+        if (result.is_err() || result.ok() > num_nodes) {
+            util::nolog::error_log::log("Invalid number of requesters");
+            return 1;
+        }
+        requesters = result.ok();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    SimulatedNetwork network(num_nodes);
+    auto res = network.SetUp(algorithm_name);
+    if (res.is_err()) {
+        util::nolog::error_log::log(res.err());
+        return 1;
+    }
+    auto set_up = std::chrono::steady_clock::now();
+
+    auto stats = network.Run(requesters);
+    auto end = std::chrono::steady_clock::now();
+
+    double set_up_ms =
+        std::chrono::duration<double, std::milli>(set_up - start).count();
+    double run_ms =
+        std::chrono::duration<double, std::milli>(end - set_up).count();
+    util::nolog::console::log("algorithm:", algorithm_name);
+    util::nolog::console::log("nodes:", num_nodes);
+    util::nolog::console::log("requesters:", requesters);
+    util::nolog::console::log("set up ms:", set_up_ms);
+    util::nolog::console::log("run ms:", run_ms);
+    util::nolog::console::log("critical sections:", stats.entries);
+    util::nolog::console::log("messages:", stats.messages);
+    util::nolog::console::log("bytes:", stats.bytes);
+    util::nolog::console::log(
+        "messages per critical section:",
+        stats.entries == 0 ? 0 : stats.messages / stats.entries);
+    util::nolog::console::log(
+        "us per message:",
+        stats.messages == 0 ? 0 : run_ms * 1000 / stats.messages);
+
+    if (stats.entries != requesters || stats.violated) {
+        util::nolog::error_log::log(
+            "Mutual exclusion was violated or a request was never granted");
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include <thread/serial_executor.h>
+#include <thread/thread_pool.h>
+#include <util/console.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stresses thread::SerialExecutor the way the mutual exclusion shards use it,
+// to be run under ThreadSanitizer.
+//
+// Cases:
+//   producers  threads schedule numbered jobs onto every executor at once,
+//              like peer messages arriving for the shards
+//   reentrant  jobs schedule more jobs onto their own executor and onto
+//              others, like an algorithm answering a message by sending one
+//
+// State guarded by an executor is plain data, so a job that runs without
+// seeing every earlier job's writes is a data race the sanitizer reports.
+// The run also fails if two jobs of one executor overlap, or if the jobs of
+// one producer run out of order.
+//
+// Usage: serial_executor_stress [--threads n] [--executors n]
+//                               [--producers n] [--jobs n] [--rounds n]
+//
+// Build with the "g++ build serial executor stress (thread sanitizer)" task.
+
+namespace {
+
+/**
+ * @brief Options for a run of the stress test.
+ *
+ */
+struct Config {
+    std::size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    std::size_t executors = 8;
+    std::size_t producers = 8;
+    std::size_t jobs = 20000;
+    std::size_t rounds = 3;
+};
+
+/**
+ * @brief Counts down to zero, waking a waiter when it gets there.
+ *
+ */
+class Latch {
+   public:
+    Latch(std::size_t count) : count_(count) {}
+
+    void CountDown() {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+            return count_.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+   private:
+    std::atomic<std::size_t> count_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+/**
+ * @brief An executor and the state only its jobs may touch.
+ *
+ */
+struct Shard {
+    Shard(thread::ThreadPool& pool, std::size_t producers)
+        : executor(pool), running(false), last_seen(producers, 0) {}
+
+    thread::SerialExecutor executor;
+
+    // Set while a job runs, to catch jobs that overlap.
+    std::atomic<bool> running;
+
+    // Plain data, only ordered by the executor.
+    std::vector<std::size_t> last_seen;
+    std::size_t jobs_run = 0;
+    std::size_t checksum = 0;
+};
+
+/**
+ * @brief Counts failed checks from any thread.
+ *
+ */
+std::atomic<std::size_t> failures(0);
+
+void Check(bool ok, const char* what) {
+    if (!ok && failures.fetch_add(1, std::memory_order_relaxed) == 0) {
+        util::nolog::error_log::log("Check failed:", what);
+    }
+}
+
+/**
+ * @brief Runs one job in a shard, checking it runs alone and in order.
+ *
+ * @param shard
+ * @param producer
+ * @param sequence Numbers the producer's jobs for the shard, from 1
+ */
+void RunJob(Shard& shard, std::size_t producer, std::size_t sequence) {
+    // Relaxed, so the flag does not order the jobs in the executor's place.
+    Check(!shard.running.exchange(true, std::memory_order_relaxed),
+          "jobs of one executor overlapped");
+    Check(shard.last_seen[producer] + 1 == sequence,
+          "jobs of one producer ran out of order");
+    shard.last_seen[producer] = sequence;
+    ++shard.jobs_run;
+    shard.checksum += sequence;
+    shard.running.store(false, std::memory_order_relaxed);
+}
+
+/**
+ * @brief The state of a run, which outlives every job in it.
+ *
+ */
+struct Run {
+    Run(const Config& config, std::size_t producers)
+        : pool(config.threads) {
+        pool.Start();
+        for (std::size_t i = 0; i < config.executors; ++i) {
+            shards.emplace_back(new Shard(pool, producers));
+        }
+    }
+
+    ~Run() {
+        // Executors may only go once no drain of theirs can still run.
+        pool.Stop();
+        shards.clear();
+    }
+
+    /**
+     * @brief Checks every shard ran the given number of jobs from each
+     * producer.
+     *
+     * @param per_producer
+     */
+    void Verify(std::size_t per_producer) {
+        std::size_t producers = shards.front()->last_seen.size();
+        for (auto& shard : shards) {
+            // Scheduled last, so it sees every job before it.
+            Latch seen(1);
+            shard->executor.Schedule([&shard, &seen, producers,
+                                      per_producer]() {
+                Check(shard->jobs_run == producers * per_producer,
+                      "an executor lost jobs");
+                Check(shard->checksum ==
+                          producers * per_producer * (per_producer + 1) / 2,
+                      "an executor ran the wrong jobs");
+                seen.CountDown();
+            });
+            seen.Wait();
+        }
+    }
+
+    thread::ThreadPool pool;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+/**
+ * @brief Has producer threads schedule numbered jobs onto every executor.
+ *
+ * @param config
+ */
+void RunProducers(const Config& config) {
+    Run run(config, config.producers);
+    std::size_t total = config.producers * config.jobs * run.shards.size();
+    Latch done(total);
+
+    std::vector<std::thread> threads;
+    for (std::size_t producer = 0; producer < config.producers; ++producer) {
+        threads.emplace_back([&run, &done, &config, producer]() {
+            for (std::size_t sequence = 1; sequence <= config.jobs;
+                 ++sequence) {
+                for (auto& shard : run.shards) {
+                    Shard* raw = shard.get();
+                    raw->executor.Schedule([raw, &done, producer,
+                                            sequence]() {
+                        RunJob(*raw, producer, sequence);
+                        done.CountDown();
+                    });
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done.Wait();
+    run.Verify(config.jobs);
+}
+
+/**
+ * @brief A chain of jobs that each schedule the next, on the chain's own
+ * shard, and a numbered job on the next shard along.
+ *
+ */
+struct Relay {
+    Run& run;
+    Latch& done;
+    std::size_t index;
+    std::size_t hops;
+
+    void Hop(std::size_t sequence) {
+        Shard& own = *run.shards[index];
+        RunJob(own, index, sequence);
+        done.CountDown();
+
+        // Other relays number their jobs on this shard separately.
+        Shard* next = run.shards[(index + 1) % run.shards.size()].get();
+        next->executor.Schedule([this, next, sequence]() {
+            RunJob(*next, run.shards.size() + index, sequence);
+            done.CountDown();
+        });
+
+        if (sequence == hops) {
+            return;
+        }
+        own.executor.Schedule([this, sequence]() { Hop(sequence + 1); });
+    }
+};
+
+/**
+ * @brief Runs one relay per executor, all at once.
+ *
+ * @param config
+ */
+void RunReentrant(const Config& config) {
+    // Each shard hears from its own relay and from the one before it.
+    std::size_t executors = config.executors;
+    Run run(config, 2 * executors);
+    Latch done(2 * executors * config.jobs);
+
+    std::vector<std::unique_ptr<Relay>> relays;
+    for (std::size_t i = 0; i < executors; ++i) {
+        relays.emplace_back(new Relay{run, done, i, config.jobs});
+    }
+    for (auto& relay : relays) {
+        Relay* raw = relay.get();
+        run.shards[raw->index]->executor.Schedule([raw]() { raw->Hop(1); });
+    }
+    done.Wait();
+
+    // Only the two producers that feed each shard have run jobs on it.
+    for (std::size_t i = 0; i < executors; ++i) {
+        Shard& shard = *run.shards[i];
+        Latch seen(1);
+        shard.executor.Schedule([&shard, &seen, &config, executors, i]() {
+            std::size_t previous = (i + executors - 1) % executors;
+            Check(shard.last_seen[i] == config.jobs &&
+                      shard.last_seen[executors + previous] == config.jobs,
+                  "a relay lost jobs");
+            seen.CountDown();
+        });
+        seen.Wait();
+    }
+}
+
+util::result<void, util::error> ParseArgs(int argc, char* argv[],
+                                          Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return util::error("Missing value for " + arg);
+        }
+        auto result = util::num::string_to_num<std::size_t>(argv[++i]);
+        if (result.is_err() || result.ok() == 0) {
+            return util::error("Invalid " + arg);
+        }
+        const std::pair<const char*, std::size_t*> positive[] = {
+            {"--threads", &config.threads},
+            {"--executors", &config.executors},
+            {"--producers", &config.producers},
+            {"--jobs", &config.jobs},
+            {"--rounds", &config.rounds},
+        };
+        auto it = std::find_if(
+            std::begin(positive), std::end(positive),
+            [&arg](const std::pair<const char*, std::size_t*>& pair) {
+                return arg == pair.first;
+            });
+        if (it == std::end(positive)) {
+            return util::error("Invalid " + arg);
+        }
+        *it->second = result.ok();
+    }
+    return util::ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    auto args = ParseArgs(argc, argv, config);
+    if (args.is_err()) {
+        util::nolog::error_log::log(args.err().what());
+        return 1;
+    }
+
+    util::nolog::console::log("threads:", config.threads,
+                              "executors:", config.executors);
+    for (std::size_t round = 1; round <= config.rounds; ++round) {
+        RunProducers(config);
+        RunReentrant(config);
+        util::nolog::console::log("round", round, "done");
+    }
+
+    std::size_t failed = failures.load();
+    if (failed > 0) {
+        util::nolog::error_log::log(failed, "checks failed");
+        return 1;
+    }
+    util::nolog::console::log("serial executor: ok");
+    return 0;
+}
\ No newline at end of file
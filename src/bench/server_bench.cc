@@ -0,0 +1,524 @@
+#include <arpa/inet.h>
+#include <net/components.h>
+#include <net/proto/messages.h>
+#include <net/server/impl/client_server_connection_handler_factory.h>
+#include <net/server/server.h>
+#include <net/socket.h>
+#include <netinet/in.h>
+#include <program/options.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <util/bytes.h>
+#include <util/console.h>
+#include <util/filesystem.h>
+#include <util/metrics.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures the throughput and latency of a server end to end, over loopback
+// on a single machine.
+//
+// Starts a server in this process with the client connection handlers, over
+// a root directory of files in a new temporary directory, and opens a number
+// of connections to it. Every connection sends Enquiry, Read, and Write at
+// fixed rates, each evenly spaced, and waits for every response before
+// sending the next request, like a client does. Connections start spread
+// over the first gap, so they do not send in lockstep.
+//
+// Latency is measured from the time a request was due, not from when it was
+// sent, so a server that falls behind cannot hide it by slowing the
+// connections down. After the warmup, the throughput and latency
+// percentiles of every opcode are reported.
+//
+// The server logs every request, so its console output is discarded while
+// it runs unless --log is given. Extra server properties (for example,
+// server_acceptors) can be read from a file with --props.
+//
+// Usage: server_bench [--connections n] [--enquiry-rate ops/s]
+//                     [--read-rate ops/s] [--write-rate ops/s]
+//                     [--duration-ms ms] [--warmup-ms ms] [--files n]
+//                     [--threads n] [--props file] [--log]
+//
+// Rates are per connection.
+//
+// Build with the "g++ build server benchmark" task.
+
+namespace {
+
+using clock_t = std::chrono::steady_clock;
+using net::proto::Message;
+using net::proto::Opcode;
+
+constexpr int kTimeoutMs = 5000;
+constexpr double kPercentiles[] = {50, 90, 99, 99.9};
+
+/**
+ * @brief Settings of a run, read from the command line.
+ *
+ */
+struct Config {
+    std::size_t connections = 16;
+
+    // Requests sent per second by every connection, by operation.
+    double rates[3] = {5, 100, 50};
+
+    std::chrono::milliseconds duration = std::chrono::milliseconds(5000);
+    std::chrono::milliseconds warmup = std::chrono::milliseconds(1000);
+    std::size_t files = 16;
+    std::size_t threads = 8;
+    std::string props_file;
+    bool log = false;
+};
+
+/**
+ * @brief An operation a connection performs, and what it measured.
+ *
+ */
+struct Operation {
+    const char* name;
+    const char* option;
+
+    // Opcode of a successful response.
+    Opcode expected;
+
+    util::metrics::hdr_histogram latency_us;
+    std::atomic<std::uint64_t> completed;
+    std::atomic<std::uint64_t> errors;
+};
+
+Operation operations[] = {
+    {"enquiry", "--enquiry-rate", Opcode::kListing, {}, {0}, {0}},
+    {"read", "--read-rate", Opcode::kResponse, {}, {0}, {0}},
+    {"write", "--write-rate", Opcode::kOk, {}, {0}, {0}},
+};
+
+constexpr std::size_t kNumOperations =
+    sizeof(operations) / sizeof(operations[0]);
+
+std::string FileName(std::size_t index) {
+    return "file" + std::to_string(index) + ".txt";
+}
+
+/**
+ * @brief Creates the message to send for an operation.
+ *
+ * @param op Index of the operation
+ * @param file Name of the file to operate on
+ * @param line Line to write
+ * @return Message
+ */
+Message CreateRequest(std::size_t op, const std::string& file,
+                      const std::string& line) {
+    switch (op) {
+        case 0:
+            // Every Enquiry asks for the whole listing.
+            return net::proto::EnquiryMessage{std::uint64_t(0)}.ToMessage();
+        case 1:
+            return net::proto::ReadMessage{file}.ToMessage();
+        default:
+            return net::proto::WriteMessage{file, line}.ToMessage();
+    }
+}
+
+/**
+ * @brief Opens a connection to the server over loopback.
+ *
+ * @param port
+ * @return util::result<int, net::Error> The connected socket
+ */
+util::result<int, net::Error> Connect(std::uint16_t port) {
+    int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return net::Error::CreateFromErrNo("Failed to open socket");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+    addr.sin_port = ::htons(port);
+    if (::connect(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+        0) {
+        ::close(sockfd);
+        return net::Error::CreateFromErrNo("Failed to connect to the server");
+    }
+    return sockfd;
+}
+
+/**
+ * @brief Sends a whole message, waiting for the socket as needed.
+ *
+ * @param socket
+ * @param msg
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> SendMessage(net::Socket& socket,
+                                           Message&& msg) {
+    util::buffer& output = socket.Output();
+    output.put(&msg.opcode, net::proto::kOpcodeLength, true);
+    util::bytes::insert<net::proto::kBodySizeLength>(
+        output, static_cast<std::uint32_t>(msg.body.size()));
+    output.move_buffer(msg.body, true);
+    while (output.size() > 0) {
+        RETURN_IF_ERROR(socket.Send());
+        if (output.size() > 0) {
+            RETURN_IF_ERROR(socket.Poll(net::PollOption::kWrite));
+        }
+    }
+    return util::ok;
+}
+
+/**
+ * @brief Receives a whole message, waiting for the socket as needed.
+ *
+ * @param socket
+ * @return util::result<Opcode, net::Error> Opcode of the message
+ */
+util::result<Opcode, net::Error> ReceiveMessage(net::Socket& socket) {
+    constexpr std::size_t kHeaderLength =
+        net::proto::kOpcodeLength + net::proto::kBodySizeLength;
+    util::buffer& input = socket.Input();
+    bool have_header = false;
+    Opcode opcode = Opcode::kOk;
+    std::size_t body_size = 0;
+    while (true) {
+        if (!have_header && input.size() >= kHeaderLength) {
+            opcode = static_cast<Opcode>(input.get());
+            body_size =
+                util::bytes::extract<net::proto::kBodySizeLength>(input);
+            have_header = true;
+        }
+        if (have_header && input.size() >= body_size) {
+            input.consume(body_size);
+            return opcode;
+        }
+
+        ASSIGN_OR_RETURN(auto status, socket.Poll(net::PollOption::kRead));
+        if (status != net::PollStatus::Success) {
+            return net::Error::Create("Timed out waiting for a response");
+        }
+        ASSIGN_OR_RETURN(auto received, socket.Receive());
+        if (received == 0) {
+            return net::Error::Create("Server closed the connection");
+        }
+    }
+}
+
+/**
+ * @brief Sends every operation at its rate from a single connection until the
+ * run ends.
+ *
+ * @param port
+ * @param config
+ * @param index Index of the connection
+ * @param start Time the first requests are due, before being spread out
+ * @param measure_from End of the warmup
+ * @param end End of the run
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> RunConnection(std::uint16_t port,
+                                             const Config& config,
+                                             std::size_t index,
+                                             clock_t::time_point start,
+                                             clock_t::time_point measure_from,
+                                             clock_t::time_point end) {
+    ASSIGN_OR_RETURN(int sockfd, Connect(port));
+    net::Socket socket(sockfd, net::SocketState::kConnected, kTimeoutMs);
+
+    clock_t::duration gaps[kNumOperations];
+    clock_t::time_point next_due[kNumOperations];
+    for (std::size_t op = 0; op < kNumOperations; ++op) {
+        next_due[op] = clock_t::time_point::max();
+        if (config.rates[op] > 0) {
+            std::chrono::duration<double> gap(1 / config.rates[op]);
+            gaps[op] = std::chrono::duration_cast<clock_t::duration>(gap);
+            next_due[op] =
+                start + std::chrono::duration_cast<clock_t::duration>(
+                            gap * index / config.connections);
+        }
+    }
+
+    for (std::size_t sent = 0;; ++sent) {
+        std::size_t op = std::min_element(std::begin(next_due),
+                                          std::end(next_due)) -
+                         std::begin(next_due);
+        clock_t::time_point due = next_due[op];
+        if (due >= end) {
+            return util::ok;
+        }
+        next_due[op] += gaps[op];
+        std::this_thread::sleep_until(due);
+
+        std::string file = FileName((index + sent) % config.files);
+        std::string line = util::string::stream("<", index, ", ", sent, ">");
+        RETURN_IF_ERROR(SendMessage(socket, CreateRequest(op, file, line)));
+        ASSIGN_OR_RETURN(auto opcode, ReceiveMessage(socket));
+        if (due < measure_from) {
+            continue;
+        }
+        Operation& operation = operations[op];
+        if (opcode != operation.expected) {
+            ++operation.errors;
+            continue;
+        }
+        ++operation.completed;
+        operation.latency_us.observe(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                clock_t::now() - due)
+                .count());
+    }
+}
+
+/**
+ * @brief Creates the root directory and its files, and the properties file
+ * of the server, in a new temporary directory.
+ *
+ * @param config
+ * @param temp_dir Set to the new temporary directory
+ * @return util::result<std::string, net::Error> Path of the properties file
+ */
+util::result<std::string, net::Error> CreateFixture(const Config& config,
+                                                    std::string& temp_dir) {
+    char dir_template[] = "/tmp/server_bench.XXXXXX";
+    if (::mkdtemp(dir_template) == nullptr) {
+        return net::Error::CreateFromErrNo("Failed to create temp directory");
+    }
+    temp_dir = dir_template;
+    std::string root_dir = temp_dir + "/root";
+    RETURN_IF_ERROR(util::fs::create_directory(root_dir).map_err(
+        [](util::error&& error) { return net::Error::Create(error.what()); }));
+    for (std::size_t i = 0; i < config.files; ++i) {
+        std::ofstream file(root_dir + "/" + FileName(i));
+        file << "<start>\n";
+        if (!file) {
+            return net::Error::Create("Failed to create " + FileName(i));
+        }
+    }
+
+    std::string props_path = temp_dir + "/server.properties";
+    std::ofstream props(props_path);
+    if (!config.props_file.empty()) {
+        std::ifstream extra(config.props_file);
+        if (!extra) {
+            return net::Error::Create("Failed to read " + config.props_file);
+        }
+        props << extra.rdbuf() << '\n';
+    }
+    props << "root_dir=" << root_dir << '\n';
+    if (!props) {
+        return net::Error::Create("Failed to write " + props_path);
+    }
+    return props_path;
+}
+
+/**
+ * @brief Runs the server and every connection.
+ *
+ * @param config
+ * @param temp_dir
+ * @param props_path
+ * @param seconds Set to the time from the end of the warmup until the last
+ * response, which is later than the end of the run if the server fell behind
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> Run(const Config& config,
+                                   const std::string& temp_dir,
+                                   const std::string& props_path,
+                                   double& seconds) {
+    program::Options options{};
+    options.server = true;
+    options.port = 0;
+    options.threads = config.threads;
+    options.timeout = kTimeoutMs;
+    options.retry_timeout = kTimeoutMs;
+    options.temp_directory = temp_dir + "/temp";
+    options.props_file = props_path;
+
+    net::Components components(options);
+    RETURN_IF_ERROR(components.props.ParseFile(props_path).map_err(
+        [](util::error&& error) { return net::Error::Create(error.what()); }));
+    components.thread_pool.Start();
+    components.timer_service.Start();
+    components.reactor.Start();
+
+    std::streambuf* console = std::cout.rdbuf();
+    if (!config.log) {
+        // Writes to a stream without a buffer fail silently.
+        std::cout.rdbuf(nullptr);
+    }
+
+    net::server::Server server(
+        false, components,
+        net::server::impl::ClientServerConnectionHandlerFactory::
+            CreateFactory());
+    auto result = server.Start();
+    if (result.is_ok()) {
+        auto start = clock_t::now();
+        auto measure_from = start + config.warmup;
+        auto end = measure_from + config.duration;
+        std::vector<util::result<void, net::Error>> results(config.connections,
+                                                            util::ok);
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < config.connections; ++i) {
+            threads.emplace_back([&, i]() {
+                results[i] = RunConnection(server.Port(), config, i, start,
+                                           measure_from, end);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        seconds = std::chrono::duration<double>(
+                      std::max(end, clock_t::now()) - measure_from)
+                      .count();
+        auto failed =
+            std::find_if(results.begin(), results.end(),
+                         [](const util::result<void, net::Error>& result) {
+                             return result.is_err();
+                         });
+        if (failed != results.end()) {
+            result = *failed;
+        }
+    }
+    server.Stop();
+
+    std::cout.rdbuf(console);
+    return result;
+}
+
+/**
+ * @brief Reports the throughput and latency of every operation.
+ *
+ * @param config
+ * @param seconds Time the measured responses took
+ */
+void Report(const Config& config, double seconds) {
+    std::uint64_t total = 0;
+    for (std::size_t op = 0; op < kNumOperations; ++op) {
+        Operation& operation = operations[op];
+        if (config.rates[op] == 0) {
+            continue;
+        }
+        std::uint64_t completed = operation.completed;
+        total += completed;
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1) << operation.name << ": "
+             << completed / seconds << " ops/s (offered "
+             << config.rates[op] * config.connections << "), errors "
+             << operation.errors << ", latency us:";
+        auto snapshot = operation.latency_us.take_snapshot();
+        if (snapshot.count() > 0) {
+            for (double p : kPercentiles) {
+                line << " p" << util::string::stream(p) << " "
+                     << snapshot.percentile(p);
+            }
+            line << " max " << snapshot.max();
+        }
+        util::nolog::console::log(line.str());
+    }
+    util::nolog::console::log("total:", total / seconds, "ops/s");
+}
+
+/**
+ * @brief Reads the settings from the command line.
+ *
+ * @param argc
+ * @param argv
+ * @param config
+ * @return util::result<void, util::error>
+ */
+util::result<void, util::error> ParseArgs(int argc, char* argv[],
+                                          Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--log") {
+            config.log = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return util::error("Missing value for " + arg);
+        }
+        std::string value = argv[++i];
+        if (arg == "--props") {
+            config.props_file = value;
+            continue;
+        }
+
+        auto rate = std::find_if(
+            std::begin(operations), std::end(operations),
+            [&arg](const Operation& op) { return arg == op.option; });
+        if (rate != std::end(operations)) {
+            auto result = util::num::string_to_num<double>(value);
+            if (result.is_err() || result.ok() < 0) {
+                return util::error("Invalid " + arg);
+            }
+            config.rates[rate - std::begin(operations)] = result.ok();
+            continue;
+        }
+
+        auto result = util::num::string_to_num<std::size_t>(value);
+        if (result.is_err()) {
+            return util::error("Invalid " + arg);
+        }
+        std::size_t number = result.ok();
+        if (arg == "--connections" && number > 0) {
+            config.connections = number;
+        } else if (arg == "--duration-ms" && number > 0) {
+            config.duration = std::chrono::milliseconds(number);
+        } else if (arg == "--warmup-ms") {
+            config.warmup = std::chrono::milliseconds(number);
+        } else if (arg == "--files" && number > 0) {
+            config.files = number;
+        } else if (arg == "--threads" && number > 0) {
+            config.threads = number;
+        } else {
+            return util::error("Invalid option " + arg);
+        }
+    }
+    return util::ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    auto args = ParseArgs(argc, argv, config);
+    if (args.is_err()) {
+        util::nolog::error_log::log(args.err().what());
+        return 1;
+    }
+
+    std::string temp_dir;
+    double seconds = 0;
+    auto props_path = CreateFixture(config, temp_dir);
+    util::result<void, net::Error> result = util::ok;
+    if (props_path.is_err()) {
+        result = std::move(props_path).err();
+    } else {
+        util::nolog::console::log("connections:", config.connections,
+                                  "duration ms:", config.duration.count(),
+                                  "warmup ms:", config.warmup.count());
+        result = Run(config, temp_dir, props_path.ok(), seconds);
+    }
+    if (!temp_dir.empty()) {
+        util::fs::delete_directory(temp_dir);
+    }
+    if (result.is_err()) {
+        util::nolog::error_log::log(result.err());
+        return 1;
+    }
+
+    Report(config, seconds);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include <arpa/inet.h>
+#include <net/proto/messages.h>
+#include <net/socket.h>
+#include <net/socket_options.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <util/bytes.h>
+#include <util/console.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures how socket options change the time to acquire a lock from a peer
+// over loopback TCP.
+//
+// Each round follows Ricart-Agrawala between two nodes. The requester sends a
+// Release for its last critical section and a Request for the next one back
+// to back, and the peer answers the Request with a Reply. The time from
+// sending the Request to receiving the Reply is the acquisition time. With
+// Nagle's algorithm, the Request waits for the Release to be acknowledged,
+// which the peer delays.
+//
+// Usage: socket_latency_bench [rounds]
+//
+// Build with the "g++ build socket latency benchmark" task.
+
+namespace {
+
+using net::proto::mutex::ReleaseMessage;
+using net::proto::mutex::ReplyMessage;
+using net::proto::mutex::RequestMessage;
+using clock_t = std::chrono::steady_clock;
+
+constexpr std::size_t kDefaultRounds = 100;
+constexpr int kTimeoutMs = 5000;
+constexpr char kFileName[] = "bench.txt";
+
+/**
+ * @brief Socket options to measure, under a name to report them by.
+ *
+ */
+struct Profile {
+    const char* name;
+    bool no_delay;
+    bool quick_ack;
+};
+
+constexpr Profile kProfiles[] = {
+    {"nagle", false, false},
+    {"nagle+quickack", false, true},
+    {"nodelay", true, false},
+    {"nodelay+quickack", true, true},
+};
+
+/**
+ * @brief Connects two sockets to each other over loopback.
+ *
+ * @param requester
+ * @param peer
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> ConnectPair(int& requester, int& peer) {
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return net::Error::CreateFromErrNo("Failed to open listener");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), len) < 0 ||
+        ::listen(listener, 1) < 0 ||
+        ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) <
+            0) {
+        ::close(listener);
+        return net::Error::CreateFromErrNo("Failed to listen on loopback");
+    }
+
+    requester = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (requester < 0 ||
+        ::connect(requester, reinterpret_cast<sockaddr*>(&addr), len) < 0) {
+        ::close(listener);
+        return net::Error::CreateFromErrNo("Failed to connect over loopback");
+    }
+    peer = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+    if (peer < 0) {
+        return net::Error::CreateFromErrNo("Failed to accept over loopback");
+    }
+    return util::ok;
+}
+
+/**
+ * @brief Sends a whole message, waiting for the socket as needed.
+ *
+ * @param socket
+ * @param msg
+ * @return util::result<void, net::Error>
+ */
+util::result<void, net::Error> SendMessage(net::Socket& socket,
+                                           net::proto::Message&& msg) {
+    util::buffer& output = socket.Output();
+    output.put(&msg.opcode, net::proto::kOpcodeLength, true);
+    util::bytes::insert<net::proto::kBodySizeLength>(
+        output, static_cast<std::uint32_t>(msg.body.size()));
+    output.move_buffer(msg.body, true);
+    while (output.size() > 0) {
+        RETURN_IF_ERROR(socket.Send());
+        if (output.size() > 0) {
+            RETURN_IF_ERROR(socket.Poll(net::PollOption::kWrite));
+        }
+    }
+    return util::ok;
+}
+
+/**
+ * @brief Receives a whole message, waiting for the socket as needed.
+ *
+ * @param socket
+ * @return util::result<net::proto::Opcode, net::Error> Opcode of the message
+ */
+util::result<net::proto::Opcode, net::Error> ReceiveMessage(
+    net::Socket& socket) {
+    constexpr std::size_t kHeaderLength =
+        net::proto::kOpcodeLength + net::proto::kBodySizeLength;
+    util::buffer& input = socket.Input();
+    bool have_header = false;
+    net::proto::Opcode opcode = net::proto::Opcode::kOk;
+    std::size_t body_size = 0;
+    while (true) {
+        if (!have_header && input.size() >= kHeaderLength) {
+            auto header = input.get_many(kHeaderLength);
+            opcode = static_cast<net::proto::Opcode>(header[0]);
+            // The body size is little-endian.
+            for (std::size_t i = 0; i < net::proto::kBodySizeLength; ++i) {
+                body_size |= static_cast<std::size_t>(header[1 + i])
+                             << (8 * i);
+            }
+            have_header = true;
+        }
+        if (have_header && input.size() >= body_size) {
+            input.consume(body_size);
+            return opcode;
+        }
+
+        ASSIGN_OR_RETURN(auto status, socket.Poll(net::PollOption::kRead));
+        if (status != net::PollStatus::Success) {
+            return net::Error::Create("Timed out waiting for a message");
+        }
+        RETURN_IF_ERROR(socket.Receive());
+    }
+}
+
+/**
+ * @brief Answers every Request with a Reply until the given number of rounds
+ * is done.
+ *
+ * @param socket
+ * @param rounds
+ */
+void RunPeer(net::Socket& socket, std::size_t rounds) {
+    std::size_t replies = 0;
+    while (replies < rounds) {
+        auto opcode = ReceiveMessage(socket);
+        if (opcode.is_err()) {
+            util::nolog::error_log::log(opcode.err());
+            return;
+        }
+        if (opcode.ok() != net::proto::Opcode::kRequest) {
+            continue;
+        }
+        auto result = SendMessage(
+            socket, ReplyMessage{replies, 0, kFileName}.ToMessage());
+        if (result.is_err()) {
+            util::nolog::error_log::log(result.err());
+            return;
+        }
+        ++replies;
+    }
+}
+
+/**
+ * @brief Runs every round over a new pair of sockets with the profile's
+ * options.
+ *
+ * @param profile
+ * @param rounds
+ * @return util::result<std::vector<double>, net::Error> Acquisition time of
+ * every round, in microseconds
+ */
+util::result<std::vector<double>, net::Error> Measure(const Profile& profile,
+                                                      std::size_t rounds) {
+    int requester_fd = -1;
+    int peer_fd = -1;
+    RETURN_IF_ERROR(ConnectPair(requester_fd, peer_fd));
+    net::Socket requester(requester_fd, net::SocketState::kConnected,
+                          kTimeoutMs);
+    net::Socket peer(peer_fd, net::SocketState::kConnected, kTimeoutMs);
+
+    net::SocketOptions options;
+    options.no_delay = profile.no_delay;
+    options.quick_ack = profile.quick_ack;
+    RETURN_IF_ERROR(requester.SetOptions(options));
+    RETURN_IF_ERROR(peer.SetOptions(options));
+
+    std::thread peer_thread([&peer, rounds]() { RunPeer(peer, rounds); });
+
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+    util::result<void, net::Error> result = util::ok;
+    for (std::size_t i = 0; i < rounds && result.is_ok(); ++i) {
+        result =
+            SendMessage(requester, ReleaseMessage{i, kFileName}.ToMessage());
+        if (result.is_err()) {
+            break;
+        }
+        auto start = clock_t::now();
+        result = SendMessage(requester,
+                             RequestMessage{i + 1, kFileName}.ToMessage());
+        if (result.is_err()) {
+            break;
+        }
+        auto reply = ReceiveMessage(requester);
+        if (reply.is_err()) {
+            result = reply.err();
+            break;
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+                                clock_t::now() - start)
+                                .count());
+    }
+
+    if (result.is_err()) {
+        // Unblocks the peer, which only waits as long as the timeout.
+        requester.Close();
+    }
+    peer_thread.join();
+    RETURN_IF_ERROR(result);
+    return latencies;
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+    std::size_t index = static_cast<std::size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t rounds = kDefaultRounds;
+    if (argc > 1) {
+        auto result = util::num::string_to_num<std::size_t>(argv[1]);
+        if (result.is_err() || result.ok() == 0) {
+            util::nolog::error_log::log("Invalid number of rounds");
+            return 1;
+        }
+        rounds = result.ok();
+    }
+
+    util::nolog::console::log("rounds:", rounds);
+    for (const auto& profile : kProfiles) {
+        auto latencies = Measure(profile, rounds);
+        if (latencies.is_err()) {
+            util::nolog::error_log::log(profile.name, latencies.err());
+            return 1;
+        }
+        auto sorted = std::move(latencies).ok();
+        std::sort(sorted.begin(), sorted.end());
+        util::nolog::console::log(
+            profile.name, "acquisition us: p50", Percentile(sorted, 0.5),
+            "p99", Percentile(sorted, 0.99), "max", sorted.back());
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include <thread/thread_pool.h>
+#include <util/console.h>
+#include <util/metrics.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures thread::ThreadPool under the ways the rest of the program uses it.
+//
+// Cases:
+//   schedule   producers schedule empty jobs as fast as they can, for 1 up to
+//              the maximum number of producers, doubling each time
+//   ping-pong  each of a number of chains runs one job at a time, and every
+//              job schedules the next, like AsyncMessageService::ReceiveBytes
+//              scheduling PollForRead
+//   fan-out    one job schedules a number of jobs, and the last of them to
+//              finish schedules the next round, like a message sent to every
+//              peer
+//
+// Reports jobs per second for every case, and the latency from scheduling a
+// job to it running for ping-pong, and of a whole round for fan-out.
+//
+// With --sample, the pool is instrumented and times one in every that many
+// jobs, and the metrics it recorded are logged at the end. Comparing runs
+// with and without it shows the cost of the instrumentation.
+//
+// Usage: thread_pool_bench [--threads n] [--jobs n] [--producers n]
+//                          [--chains n] [--hops n] [--fan-out n]
+//                          [--rounds n] [--sample n]
+//
+// Build with the "g++ build thread pool benchmark" task.
+
+namespace {
+
+using clock_t = std::chrono::steady_clock;
+
+constexpr double kPercentiles[] = {50, 90, 99};
+
+/**
+ * @brief Options for a run of the benchmark.
+ *
+ */
+struct Config {
+    std::size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    std::size_t jobs = 1000000;
+    std::size_t producers = 64;
+    std::size_t chains = 1;
+    std::size_t hops = 200000;
+    std::size_t fan_out = 64;
+    std::size_t rounds = 5000;
+    std::size_t sample = 0;
+};
+
+/**
+ * @brief Counts down to zero, waking a waiter when it gets there.
+ *
+ */
+class Latch {
+   public:
+    Latch(std::size_t count) : count_(count) {}
+
+    void CountDown() {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+            return count_.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+   private:
+    std::atomic<std::size_t> count_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+/**
+ * @brief A pool started for one case, and instrumented if configured.
+ *
+ */
+struct Pool {
+    Pool(const Config& config, util::metrics::registry& metrics)
+        : pool(config.threads) {
+        if (config.sample > 0) {
+            pool.Instrument(metrics, config.sample);
+        }
+        pool.Start();
+    }
+    ~Pool() { pool.Stop(); }
+
+    thread::ThreadPool pool;
+};
+
+double Seconds(clock_t::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+std::uint64_t Nanoseconds(clock_t::duration duration) {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+            .count());
+}
+
+std::string Rate(double count, clock_t::duration duration) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(0) << count / Seconds(duration);
+    return out.str();
+}
+
+/**
+ * @brief Logs the percentiles and maximum of a latency histogram.
+ *
+ * @param name
+ * @param unit
+ * @param histogram
+ */
+void ReportLatency(const std::string& name, const std::string& unit,
+                   const util::metrics::hdr_histogram& histogram) {
+    auto snapshot = histogram.take_snapshot();
+    std::ostringstream out;
+    for (double p : kPercentiles) {
+        out << " p" << p << " " << snapshot.percentile(p);
+    }
+    out << " max " << snapshot.max();
+    util::nolog::console::log(name, unit + ":" + out.str());
+}
+
+/**
+ * @brief Has producers schedule empty jobs as fast as they can.
+ *
+ * @param config
+ * @param metrics
+ * @param producers
+ */
+void RunSchedule(const Config& config, util::metrics::registry& metrics,
+                 std::size_t producers) {
+    Pool pool(config, metrics);
+    std::size_t per_producer = config.jobs / producers;
+    Latch done(per_producer * producers);
+    Latch started(producers);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < producers; ++i) {
+        threads.emplace_back([&]() {
+            started.CountDown();
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (std::size_t j = 0; j < per_producer; ++j) {
+                pool.pool.Schedule([&done]() { done.CountDown(); });
+            }
+        });
+    }
+
+    started.Wait();
+    auto start = clock_t::now();
+    go.store(true, std::memory_order_release);
+    done.Wait();
+    auto elapsed = clock_t::now() - start;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    util::nolog::console::log("schedule producers", producers,
+                              "jobs/s:", Rate(per_producer * producers,
+                                              elapsed));
+}
+
+/**
+ * @brief A chain of jobs where each schedules the next.
+ *
+ */
+struct Chain {
+    thread::ThreadPool& pool;
+    util::metrics::hdr_histogram& latency;
+    Latch& done;
+    std::size_t hops_left;
+
+    void Hop(clock_t::time_point scheduled_at) {
+        latency.observe(Nanoseconds(clock_t::now() - scheduled_at));
+        if (--hops_left == 0) {
+            done.CountDown();
+            return;
+        }
+        Schedule();
+    }
+
+    void Schedule() {
+        auto scheduled_at = clock_t::now();
+        pool.Schedule([this, scheduled_at]() { Hop(scheduled_at); });
+    }
+};
+
+/**
+ * @brief Runs chains of jobs where each schedules the next.
+ *
+ * @param config
+ * @param metrics
+ */
+void RunPingPong(const Config& config, util::metrics::registry& metrics) {
+    Pool pool(config, metrics);
+    util::metrics::hdr_histogram latency;
+    Latch done(config.chains);
+    std::vector<std::unique_ptr<Chain>> chains;
+    for (std::size_t i = 0; i < config.chains; ++i) {
+        chains.emplace_back(
+            new Chain{pool.pool, latency, done, config.hops});
+    }
+
+    auto start = clock_t::now();
+    for (auto& chain : chains) {
+        chain->Schedule();
+    }
+    done.Wait();
+    auto elapsed = clock_t::now() - start;
+
+    util::nolog::console::log("ping-pong chains", config.chains, "jobs/s:",
+                              Rate(config.chains * config.hops, elapsed));
+    ReportLatency("ping-pong chains " + std::to_string(config.chains),
+                  "schedule to run ns", latency);
+}
+
+/**
+ * @brief Rounds of one job scheduling many, where the last of them to finish
+ * starts the next round.
+ *
+ */
+struct FanOut {
+    FanOut(thread::ThreadPool& pool, util::metrics::hdr_histogram& latency,
+           Latch& done, std::size_t fan_out, std::size_t rounds)
+        : pool(pool),
+          latency(latency),
+          done(done),
+          fan_out(fan_out),
+          rounds_left(rounds),
+          pending(0) {}
+
+    thread::ThreadPool& pool;
+    util::metrics::hdr_histogram& latency;
+    Latch& done;
+    std::size_t fan_out;
+    std::size_t rounds_left;
+    std::atomic<std::size_t> pending;
+    clock_t::time_point round_start;
+
+    void Round() {
+        round_start = clock_t::now();
+        pending.store(fan_out, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < fan_out; ++i) {
+            pool.Schedule([this]() { Finish(); });
+        }
+    }
+
+    void Finish() {
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        latency.observe(Nanoseconds(clock_t::now() - round_start) / 1000);
+        if (--rounds_left == 0) {
+            done.CountDown();
+            return;
+        }
+        pool.Schedule([this]() { Round(); });
+    }
+};
+
+/**
+ * @brief Runs rounds of one job scheduling many.
+ *
+ * @param config
+ * @param metrics
+ */
+void RunFanOut(const Config& config, util::metrics::registry& metrics) {
+    Pool pool(config, metrics);
+    util::metrics::hdr_histogram latency;
+    Latch done(1);
+    FanOut fan_out(pool.pool, latency, done, config.fan_out, config.rounds);
+
+    auto start = clock_t::now();
+    pool.pool.Schedule([&fan_out]() { fan_out.Round(); });
+    done.Wait();
+    auto elapsed = clock_t::now() - start;
+
+    std::string name = "fan-out " + std::to_string(config.fan_out);
+    util::nolog::console::log(
+        name, "jobs/s:", Rate((config.fan_out + 1) * config.rounds, elapsed));
+    ReportLatency(name, "round us", latency);
+}
+
+util::result<void, util::error> ParseArgs(int argc, char* argv[],
+                                          Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return util::error("Missing value for " + arg);
+        }
+        auto result = util::num::string_to_num<std::size_t>(argv[++i]);
+        if (result.is_err()) {
+            return util::error("Invalid " + arg);
+        }
+        std::size_t number = result.ok();
+        const std::pair<const char*, std::size_t*> positive[] = {
+            {"--threads", &config.threads}, {"--jobs", &config.jobs},
+            {"--producers", &config.producers}, {"--chains", &config.chains},
+            {"--hops", &config.hops},       {"--fan-out", &config.fan_out},
+            {"--rounds", &config.rounds},
+        };
+        auto it = std::find_if(
+            std::begin(positive), std::end(positive),
+            [&arg](const std::pair<const char*, std::size_t*>& pair) {
+                return arg == pair.first;
+            });
+        if (it != std::end(positive) && number > 0) {
+            *it->second = number;
+        } else if (arg == "--sample") {
+            config.sample = number;
+        } else {
+            return util::error("Invalid " + arg);
+        }
+    }
+    return util::ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    auto args = ParseArgs(argc, argv, config);
+    if (args.is_err()) {
+        util::nolog::error_log::log(args.err().what());
+        return 1;
+    }
+
+    util::nolog::console::log("threads:", config.threads);
+    if (config.sample > 0) {
+        util::nolog::console::log("instrumented, timing one in",
+                                  config.sample, "jobs");
+    }
+
+    util::metrics::registry metrics;
+    for (std::size_t producers = 1; producers <= config.producers;
+         producers *= 2) {
+        RunSchedule(config, metrics, producers);
+    }
+    RunPingPong(config, metrics);
+    RunFanOut(config, metrics);
+
+    if (config.sample > 0) {
+        util::nolog::console::log("metrics:");
+        util::nolog::console::log(metrics.dump());
+    }
+    return 0;
+}
\ No newline at end of file
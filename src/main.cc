@@ -5,6 +5,7 @@
 #include <program/properties.h>
 #include <util/buffer.h>
 #include <util/console.h>
+#include <util/number.h>
 
 #include <iostream>
 #include <string>
@@ -69,11 +70,29 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // Instrumenting the thread pool is off by default, because it takes the
+    // time of some jobs.
+    auto sample_every = components.props.Get("thread_pool_sample_every");
+    if (sample_every.has_value()) {
+        auto sample =
+            util::num::string_to_num<std::size_t>(sample_every.value());
+        if (sample.is_err() || sample.ok() == 0) {
+            util::nolog::error_log::log(
+                "Invalid \"thread_pool_sample_every\" property");
+            return 1;
+        }
+        components.thread_pool.Instrument(components.metrics, sample.ok());
+    }
+
     components.thread_pool.Start();
+    components.timer_service.Start();
+    components.reactor.Start();
 
     int exit_code = RunProgram(components);
 
+    components.reactor.Stop();
+    components.timer_service.Stop();
     components.thread_pool.Stop();
 
     return exit_code;
-}
+}
\ No newline at end of file
@@ -20,9 +20,16 @@ Client::Client(bool use_signals, Components& components,
           [this](Error error) { OnPeerNetworkError(std::move(error)); }),
       on_stop_(on_stop) {}
 
-util::result<void, Error> Client::SetUp() { return util::ok; }
+util::result<void, Error> Client::SetUp() {
+    ASSIGN_OR_RETURN(
+        auto socket_options,
+        SocketOptions::FromProperties(components_.common.props, "client"));
+    components_.connection_service.SetSocketOptions(socket_options);
+    return util::ok;
+}
 
 util::result<void, Error> Client::OnStart() {
+    RETURN_IF_ERROR(components_.metrics_service.Start());
     util::safe_console::log("Starting distributed mutual exclusion service");
     return components_.distributed_mutex_service.Start();
 }
@@ -36,6 +43,9 @@ util::result<void, Error> Client::CleanUp() {
     }
     components_.connection_service.CancelPendingConnections();
     components_.distributed_mutex_service.Stop();
+    components_.metrics_service.Stop();
+    components_.common.reactor.Stop();
+    components_.common.timer_service.Stop();
     components_.common.thread_pool.Stop();
     return util::ok;
 }
@@ -11,7 +11,8 @@ ClientComponents::ClientComponents(
         error_callback)
     : common(common),
       connection_service(common),
-      distributed_mutex_service(*this, ready_callback, error_callback) {}
+      distributed_mutex_service(*this, ready_callback, error_callback),
+      metrics_service(common) {}
 
 }  // namespace client
 }  // namespace net
\ No newline at end of file
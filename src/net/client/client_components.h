@@ -4,6 +4,7 @@
 #include <net/client/service/connection_service.h>
 #include <net/components.h>
 #include <net/mutex/distributed_mutual_exclusion_service.h>
+#include <net/shared/metrics_service.h>
 
 namespace net {
 namespace client {
@@ -26,6 +27,7 @@ class ClientComponents {
     Components& common;
     service::ConnectionService connection_service;
     mutex::DistributedMutualExclusionService distributed_mutex_service;
+    shared::MetricsService metrics_service;
 };
 
 }  // namespace client
@@ -6,25 +6,512 @@
 #include <util/number.h>
 #include <util/strings.h>
 
+#include <algorithm>
 #include <random>
 
 namespace net {
 namespace client {
 namespace impl {
 
-Project2Client::Server::Server(Connection&& moved_connection,
-                               Components& components)
+namespace {
+
+// Number of times a write is sent again to a server that failed to perform it.
+constexpr std::size_t kMaxWriteRepairs = 3;
+
+}  // namespace
+
+Project2Lane::Server::Server(Connection&& moved_connection,
+                             const std::string& name, Components& components,
+                             service::ServerSelector::ServerStats& stats)
     : connection(std::make_shared<Connection>(std::move(moved_connection))),
       message_service(connection->socket, components),
       operation_sent(false),
-      performed_write(false) {}
+      awaiting_response(false),
+      repair_attempts(0),
+      read_response_us(components.metrics.get_hdr_histogram(
+          "client.read.response_us." + name)),
+      write_response_us(components.metrics.get_hdr_histogram(
+          "client.write.response_us." + name)),
+      stats(stats) {
+    // Servers are told apart by a label when exported, like files are.
+    components.metrics.label("client.read.response_us." + name,
+                             "client.read.response_us", "server", name);
+    components.metrics.label("client.write.response_us." + name,
+                             "client.write.response_us", "server", name);
+}
+
+Project2Lane::PhaseMetrics::PhaseMetrics(util::metrics::registry& registry,
+                                         const std::string& kind)
+    : acquire_us(registry.get_hdr_histogram("client." + kind + ".acquire_us")),
+      send_us(registry.get_hdr_histogram("client." + kind + ".send_us")),
+      release_us(
+          registry.get_hdr_histogram("client." + kind + ".release_us")) {}
+
+Project2Lane::Project2Lane(Project2Client& client,
+                           ClientComponents& components)
+    : util::state_machine<Project2Lane>(*this, states::Wait::instance()),
+      client_(client),
+      components_(components),
+      current_server_(nullptr),
+      rng_(std::random_device()()),
+      read_metrics_(components.common.metrics, "read"),
+      write_metrics_(components.common.metrics, "write"),
+      write_stragglers_(
+          components.common.metrics.get_counter("client.write.stragglers")),
+      write_repairs_(
+          components.common.metrics.get_counter("client.write.repairs")),
+      hedged_reads_(
+          components.common.metrics.get_counter("client.read.hedged")),
+      hedge_wins_(
+          components.common.metrics.get_counter("client.read.hedge_wins")),
+      writing_(false),
+      write_measured_(false),
+      write_acks_(0),
+      write_pending_(0),
+      write_settled_(false),
+      write_released_(true),
+      idle_all_(false),
+      read_measured_(false),
+      read_id_(0),
+      read_settled_(false) {}
+
+void Project2Lane::AddServer(Connection&& connection,
+                             const std::string& name) {
+    auto& stats = client_.selector_->StatsFor(name);
+    CRITICAL_SECTION(mutex_, servers_.emplace_back(std::move(connection), name,
+                                                   components_.common, stats));
+}
+
+util::result<proto::AsyncMessageService*, Error> Project2Lane::RandomServer() {
+    RETURN_IF_ERROR(ChangeServer());
+    return &current_server_->message_service;
+}
+
+void Project2Lane::Run(const done_callback_t& callback) {
+    util::state_machine<Project2Lane>::start(callback);
+}
+
+void Project2Lane::Stop() { util::state_machine<Project2Lane>::stop(); }
+
+util::result<void, Error> Project2Lane::BeginOperation(bool write,
+                                                       std::string file_name) {
+    // Select a random server to send the next request to, under the lock,
+    // because stragglers of the last write check it.
+    CRITICAL_SECTION(mutex_, {
+        writing_ = write;
+        RETURN_IF_ERROR(ChangeServer());
+    });
+
+    current_file_name_ = std::move(file_name);
+    set_next_state(states::AwaitServers::instance());
+    return util::ok;
+}
+
+void Project2Lane::CompleteOperation() {
+    if (operation_.has_value()) {
+        client_.generator_->Complete(operation_.value());
+        operation_ = util::none;
+    }
+}
+
+bool Project2Lane::LogsOperations() const { return !client_.generator_; }
+
+void Project2Lane::RecordPhase(util::metrics::hdr_histogram& histogram,
+                               clock_t::time_point start) {
+    RecordPhase(histogram, start,
+                !operation_.has_value() || operation_.value().measured);
+}
+
+void Project2Lane::RecordPhase(util::metrics::hdr_histogram& histogram,
+                               clock_t::time_point start, bool measured) {
+    if (!measured) {
+        return;
+    }
+    histogram.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+                          clock_t::now() - start)
+                          .count());
+}
+
+void Project2Lane::AwaitRelease(bool any_file,
+                                const std::function<void()>& callback) {
+    bool released = false;
+    CRITICAL_SECTION(mutex_, {
+        released = write_released_ ||
+                   (!any_file && last_write_.file_name != current_file_name_);
+        if (!released) {
+            released_callback_ = callback;
+        }
+    });
+    if (released) {
+        callback();
+    }
+}
+
+void Project2Lane::AwaitIdleServers(bool all,
+                                    const std::function<void()>& callback) {
+    bool idle = false;
+    CRITICAL_SECTION(mutex_, {
+        idle_all_ = all;
+        idle = ServersIdle();
+        if (!idle) {
+            idle_callback_ = callback;
+        }
+    });
+    if (idle) {
+        callback();
+    }
+}
+
+bool Project2Lane::ServersIdle() const {
+    if (!idle_all_) {
+        return !current_server_->awaiting_response;
+    }
+    return std::none_of(
+        servers_.begin(), servers_.end(),
+        [](const Server& server) { return server.awaiting_response; });
+}
+
+util::optional<std::function<void()>> Project2Lane::TakeIdleCallback() {
+    util::optional<std::function<void()>> callback;
+    if (idle_callback_.has_value() && ServersIdle()) {
+        callback = std::move(idle_callback_);
+        idle_callback_ = util::none;
+    }
+    return callback;
+}
+
+void Project2Lane::AwaitWriteResponse(Server& server,
+                                      const util::sm_callback_t& callback) {
+    server.message_service.ReadMessage(
+        [this, &server, callback](util::result<proto::Message, Error> result) {
+            if (result.is_err()) {
+                // No way to verify if the server performed our operation.
+                EndWrite(std::move(result).err(), callback);
+                return;
+            }
+
+            client_.selector_->End(server.stats,
+                                   clock_t::now() - server.sent_at, false);
+            auto msg = std::move(result).ok();
+            switch (msg.opcode) {
+                case proto::Opcode::kOk: {
+                    RecordPhase(server.write_response_us, server.sent_at,
+                                write_measured_);
+                    AcknowledgeWrite(server, callback);
+                } break;
+                case proto::Opcode::kError: {
+                    auto err = std::move(msg).ToError().ok();
+                    util::safe_error_log::log("Error from server on write:",
+                                              err.message);
+                    RepairWrite(server, callback);
+                } break;
+                default: {
+                    EndWrite(util::error(util::string::stream(
+                                 "Received message type ",
+                                 static_cast<int>(msg.opcode),
+                                 " from server in write response state, "
+                                 "expected ",
+                                 static_cast<int>(proto::Opcode::kOk))),
+                             callback);
+                } break;
+            }
+        });
+}
+
+void Project2Lane::AcknowledgeWrite(Server& server,
+                                    const util::sm_callback_t& callback) {
+    bool proceed = false;
+    std::size_t stragglers = 0;
+    util::optional<typename mutex::DistributedMutualExclusionService::
+                       mutex_operation_done_t>
+        release;
+    util::optional<std::function<void()>> idle_callback;
+    CRITICAL_SECTION(mutex_, {
+        server.awaiting_response = false;
+        if (!write_settled_ && ++write_acks_ >= client_.write_quorum_) {
+            write_settled_ = true;
+            proceed = true;
+            stragglers = servers_.size() - write_acks_;
+        }
+        if (--write_pending_ == 0) {
+            release = std::move(write_release_);
+            write_release_ = util::none;
+        }
+        idle_callback = TakeIdleCallback();
+    });
+
+    if (proceed) {
+        write_stragglers_.increment(stragglers);
+    }
+    if (release.has_value()) {
+        ReleaseWrite(release.value(),
+                     proceed ? util::optional<util::sm_callback_t>(callback)
+                             : util::none);
+    } else if (proceed) {
+        // Mutual exclusion is kept until the stragglers catch up.
+        callback(util::ok);
+    }
+    if (idle_callback.has_value()) {
+        idle_callback.value()();
+    }
+}
+
+void Project2Lane::ReleaseWrite(
+    const typename mutex::DistributedMutualExclusionService::
+        mutex_operation_done_t& release,
+    util::optional<util::sm_callback_t> callback) {
+    clock_t::time_point started = clock_t::now();
+    bool measured = write_measured_;
+    release([this, callback, started,
+             measured](util::result<void, Error> result) {
+        RecordPhase(write_metrics_.release_us, started, measured);
+        util::optional<std::function<void()>> released_callback;
+        CRITICAL_SECTION(mutex_, {
+            write_released_ = true;
+            released_callback = std::move(released_callback_);
+            released_callback_ = util::none;
+        });
+
+        if (callback.has_value()) {
+            // Then, go to the next state.
+            callback.value()(std::move(result).map_err(
+                [](Error&& error) -> util::error { return error; }));
+        } else if (result.is_err()) {
+            // The lane moved on before the release.
+            stop_with_result(std::move(result).err());
+        }
+        if (released_callback.has_value()) {
+            released_callback.value()();
+        }
+    });
+}
+
+void Project2Lane::RepairWrite(Server& server,
+                               const util::sm_callback_t& callback) {
+    bool repair = false;
+    CRITICAL_SECTION(mutex_, {
+        repair = client_.write_quorum_ < servers_.size() &&
+                 server.repair_attempts < kMaxWriteRepairs;
+        if (repair) {
+            ++server.repair_attempts;
+        }
+    });
+    if (!repair) {
+        EndWrite(util::ok, callback);
+        return;
+    }
+
+    write_repairs_.increment();
+    server.message_service.WriteMessage(
+        proto::WriteMessage(last_write_).ToMessage(),
+        [this, &server, callback](util::result<void, Error> result) {
+            if (result.is_err()) {
+                EndWrite(std::move(result).err(), callback);
+                return;
+            }
+            server.sent_at = clock_t::now();
+            client_.selector_->Begin(server.stats);
+            AwaitWriteResponse(server, callback);
+        });
+}
+
+void Project2Lane::EndWrite(util::result<void, util::error> result,
+                            const util::sm_callback_t& callback) {
+    bool settled = false;
+    CRITICAL_SECTION(mutex_, {
+        settled = write_settled_;
+        write_settled_ = true;
+    });
+
+    if (settled) {
+        // The lane moved on without this server, which has now fallen behind
+        // for good, so mutual exclusion is never released.
+        if (result.is_ok()) {
+            result = util::error("Server failed to perform a write that a "
+                                 "quorum acknowledged");
+        }
+        stop_with_result(result);
+        return;
+    }
+
+    // Mutual exclusion is not released, because working with this file will
+    // now be inconsistent.
+    if (result.is_ok()) {
+        set_next_state(states::Finish::instance());
+    }
+    callback(std::move(result));
+}
+
+void Project2Lane::AwaitReadResponse(Server& server,
+                                     const util::sm_callback_t& callback) {
+    server.message_service.ReadMessage(
+        [this, &server, callback](util::result<proto::Message, Error> result) {
+            if (result.is_err()) {
+                FailRead(std::move(result).err(), callback);
+                return;
+            }
+
+            client_.selector_->End(server.stats,
+                                   clock_t::now() - server.sent_at, true);
+            auto msg = std::move(result).ok();
+            switch (msg.opcode) {
+                case proto::Opcode::kResponse: {
+                    if (!SettleRead(server)) {
+                        // The other server of a hedged read answered first.
+                        return;
+                    }
+                    if (&server != current_server_) {
+                        hedge_wins_.increment();
+                    }
+
+                    auto resp = std::move(msg).ToResponse().ok();
+                    RecordPhase(server.read_response_us, server.sent_at,
+                                read_measured_);
+                    if (LogsOperations()) {
+                        util::safe_console::stream(
+                            "Last line of ", current_file_name_, " is \"",
+                            resp.message, "\"", util::manip::endl);
+                    }
+                    // Release mutual exclusion.
+                    phase_started_ = clock_t::now();
+                    finished_critical_section_callback_.value()(
+                        [this, callback](util::result<void, Error> result) {
+                            RecordPhase(read_metrics_.release_us,
+                                        phase_started_);
+                            // Then, go to the next state.
+                            callback(std::move(result).map_err(
+                                [](Error&& error) -> util::error {
+                                    return error;
+                                }));
+                        });
+                } break;
+                case proto::Opcode::kError: {
+                    auto err = std::move(msg).ToError().ok();
+                    util::safe_error_log::log("Error from server on read:",
+                                              err.message);
+                    if (SettleRead(server)) {
+                        set_next_state(states::Finish::instance());
+                        callback(util::ok);
+                    }
+                } break;
+                default: {
+                    FailRead(util::error(util::string::stream(
+                                 "Received message type ",
+                                 static_cast<int>(msg.opcode),
+                                 " from server in read response state, "
+                                 "expected ",
+                                 static_cast<int>(proto::Opcode::kResponse))),
+                             callback);
+                } break;
+            }
+        });
+}
+
+void Project2Lane::HedgeRead(std::uint64_t read_id,
+                             const util::sm_callback_t& callback) {
+    Server* hedge = nullptr;
+    CRITICAL_SECTION(mutex_, {
+        if (read_id != read_id_ || read_settled_) {
+            return;
+        }
+        hedge_timer_ = util::none;
+
+        std::vector<Server*> free;
+        std::vector<const service::ServerSelector::ServerStats*> stats;
+        for (auto& server : servers_) {
+            if (!server.awaiting_response) {
+                free.push_back(&server);
+                stats.push_back(&server.stats);
+            }
+        }
+        if (free.empty()) {
+            return;
+        }
+        hedge = free[client_.selector_->Pick(stats, rng_)];
+        hedge->awaiting_response = true;
+    });
+
+    hedged_reads_.increment();
+    hedge->message_service.WriteMessage(
+        proto::ReadMessage{current_file_name_}.ToMessage(),
+        [this, hedge, callback](util::result<void, Error> result) {
+            if (result.is_err()) {
+                FailRead(std::move(result).err(), callback);
+                return;
+            }
+            hedge->sent_at = clock_t::now();
+            client_.selector_->Begin(hedge->stats);
+            AwaitReadResponse(*hedge, callback);
+        });
+}
+
+bool Project2Lane::SettleRead(Server& server) {
+    bool first = false;
+    util::optional<thread::TimerService::timer_id_t> timer;
+    util::optional<std::function<void()>> idle_callback;
+    CRITICAL_SECTION(mutex_, {
+        server.awaiting_response = false;
+        first = !read_settled_;
+        read_settled_ = true;
+        timer = std::move(hedge_timer_);
+        hedge_timer_ = util::none;
+        idle_callback = TakeIdleCallback();
+    });
+
+    if (timer.has_value()) {
+        components_.common.timer_service.Cancel(timer.value());
+    }
+    if (idle_callback.has_value()) {
+        idle_callback.value()();
+    }
+    return first;
+}
+
+void Project2Lane::FailRead(util::error error,
+                            const util::sm_callback_t& callback) {
+    bool settled = false;
+    CRITICAL_SECTION(mutex_, {
+        settled = read_settled_;
+        read_settled_ = true;
+    });
+
+    if (settled) {
+        stop_with_result(std::move(error));
+        return;
+    }
+    callback(std::move(error));
+}
+
+util::result<void, Error> Project2Lane::ChangeServer() {
+    if (servers_.empty()) {
+        return Error::Create("Failed to select server from empty list");
+    }
+
+    std::vector<const service::ServerSelector::ServerStats*> stats;
+    stats.reserve(servers_.size());
+    for (const auto& server : servers_) {
+        stats.push_back(&server.stats);
+    }
+    current_server_ = &servers_[client_.selector_->Pick(stats, rng_)];
+    return util::ok;
+}
 
 Project2Client::Project2Client(Components& components)
     : Client(true, components, [this]() { StopStateMachine(); }),
       util::state_machine<Project2Client>(*this,
                                           states::ConnectToServers::instance()),
-      current_server_(nullptr),
-      current_file_name_(nullptr) {}
+      num_connections_(0),
+      connected_(0),
+      running_lanes_(0),
+      write_quorum_(0),
+      enquiry_server_(nullptr),
+      listing_version_(0),
+      refresh_interval_(0),
+      refreshing_(false),
+      listings_not_modified_(
+          components.metrics.get_counter("client.enquiry.not_modified")),
+      listings_changed_(
+          components.metrics.get_counter("client.enquiry.changed")) {}
 
 void Project2Client::Run() {
     // Start state machine.
@@ -38,33 +525,182 @@ void Project2Client::Run() {
 }
 
 void Project2Client::StopStateMachine() {
+    // Lanes report stopping under the lock, so they are stopped without it.
+    std::vector<Project2Lane*> lanes;
+    service::LoadGenerator* generator = nullptr;
+    util::optional<thread::TimerService::timer_id_t> refresh_timer;
+    CRITICAL_SECTION(mutex_, {
+        for (auto& lane : lanes_) {
+            lanes.push_back(lane.get());
+        }
+        generator = generator_.get();
+        refreshing_ = false;
+        refresh_timer = std::move(refresh_timer_);
+        refresh_timer_ = util::none;
+    });
+
+    if (refresh_timer.has_value()) {
+        components_.common.timer_service.Cancel(refresh_timer.value());
+    }
+    if (generator) {
+        generator->Stop();
+    }
+    for (auto lane : lanes) {
+        lane->Stop();
+    }
     util::state_machine<Project2Client>::stop();
 }
 
-util::result<void, Error> Project2Client::ChangeServer() {
-    auto it = util::iterator::random(servers_.begin(), servers_.end());
-    if (it == servers_.end()) {
-        return Error::Create("Failed to select random server from list");
+void Project2Client::OnLaneDone(util::result<void, util::error> result) {
+    if (result.is_err()) {
+        util::safe_error_log::log(result.err().what());
     }
 
-    current_server_ = &*it;
-    return util::ok;
+    // A lane only stops once there is nothing left to do or it failed, so the
+    // other lanes finish what they started and stop too.
+    service::LoadGenerator* generator = nullptr;
+    util::optional<util::sm_callback_t> done;
+    CRITICAL_SECTION(mutex_, {
+        generator = generator_.get();
+        if (--running_lanes_ == 0) {
+            done = lanes_done_callback_;
+        }
+    });
+
+    if (generator) {
+        generator->Stop();
+    }
+    if (done.has_value()) {
+        done.value()(util::ok);
+    }
 }
 
-util::result<void, Error> Project2Client::ChangeFile() {
-    auto it = util::iterator::random(file_names_.begin(), file_names_.end());
-    if (it == file_names_.end()) {
-        return Error::Create("Failed to select random file from list");
+bool Project2Client::OnConnected() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ++connected_ == num_connections_;
+}
+
+std::string Project2Client::FileName(std::size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return file_names_[index % file_names_.size()];
+}
+
+std::string Project2Client::RandomFileName(std::mt19937& rng) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return *util::iterator::random(file_names_.begin(), file_names_.end(), rng);
+}
+
+util::result<void, util::error> Project2Client::UpdateFileNames(
+    proto::Message&& msg) {
+    std::vector<std::string> file_names;
+    std::uint64_t version = 0;
+    switch (msg.opcode) {
+        case proto::Opcode::kNotModified: {
+            listings_not_modified_.increment();
+            return util::ok;
+        }
+        case proto::Opcode::kListing: {
+            auto listing = std::move(msg).ToListing();
+            if (listing.is_err()) {
+                return std::move(listing).err();
+            }
+            version = listing.ok().version;
+            file_names = std::move(listing).ok().file_names;
+        } break;
+        case proto::Opcode::kResponse: {
+            // Servers that do not version listings answer with a response.
+            auto resp = std::move(msg).ToResponse().ok();
+            file_names = util::strings::split_trim(resp.message, ',');
+        } break;
+        case proto::Opcode::kError: {
+            auto err = std::move(msg).ToError().ok();
+            return util::error("Error from server on enquiry: " +
+                               err.message);
+        }
+        default: {
+            return util::error(util::string::stream(
+                "Received message type ", static_cast<int>(msg.opcode),
+                " from server in enquiry response, expected ",
+                static_cast<int>(proto::Opcode::kListing)));
+        }
     }
 
-    current_file_name_ = &*it;
+    if (file_names.empty()) {
+        return util::error("Server responded to enquiry with 0 file names");
+    }
+    util::safe_debug::log("Received", file_names.size(), "file names");
+    CRITICAL_SECTION(mutex_, {
+        if (!file_names_.empty() && file_names != file_names_) {
+            listings_changed_.increment();
+        }
+        file_names_ = std::move(file_names);
+        listing_version_ = version;
+    });
     return util::ok;
 }
 
+void Project2Client::ScheduleRefresh() {
+    CRITICAL_SECTION(mutex_, {
+        if (!refreshing_) {
+            return;
+        }
+        refresh_timer_ = components_.common.timer_service.ScheduleAfter(
+            refresh_interval_, [this]() { RefreshFileNames(); });
+    });
+}
+
+void Project2Client::RefreshFileNames() {
+    std::uint64_t version = 0;
+    CRITICAL_SECTION(mutex_, {
+        if (!refreshing_) {
+            return;
+        }
+        refresh_timer_ = util::none;
+        version = listing_version_;
+    });
+
+    enquiry_server_->WriteMessage(
+        proto::EnquiryMessage{version}.ToMessage(),
+        [this](util::result<void, Error> result) {
+            if (result.is_err()) {
+                // The connection is gone, so the list of files stays as is.
+                util::safe_error_log::log("Failed to refresh file names:",
+                                          result.err().what());
+                return;
+            }
+
+            enquiry_server_->ReadMessage(
+                [this](util::result<proto::Message, Error> result) {
+                    if (result.is_err()) {
+                        util::safe_error_log::log(
+                            "Failed to refresh file names:",
+                            result.err().what());
+                        return;
+                    }
+
+                    auto updated = UpdateFileNames(std::move(result).ok());
+                    if (updated.is_err()) {
+                        util::safe_error_log::log(
+                            "Failed to refresh file names:",
+                            updated.err().what());
+                    }
+                    ScheduleRefresh();
+                });
+        });
+}
+
 namespace states {
 
 IMPL_STATE_HANDLER(Project2Client, ConnectToServers) {
     util::safe_debug::log("Connecting to servers");
+    auto workload =
+        service::Workload::FromProperties(instance.components_.common.props);
+    if (workload.is_err()) {
+        callback(std::move(workload).err());
+        return;
+    }
+    instance.workload_ = std::move(workload).ok();
+
     auto servers_string = instance.components_.common.props.Get("servers");
     if (!servers_string.has_value()) {
         callback(
@@ -78,7 +714,60 @@ IMPL_STATE_HANDLER(Project2Client, ConnectToServers) {
     }
 
     auto servers = util::strings::split(servers_string.value(), ',');
-    instance.num_servers_ = servers.size();
+
+    // Writes are acknowledged by every server by default.
+    instance.write_quorum_ = servers.size();
+    auto quorum = instance.components_.common.props.Get("client_write_quorum");
+    if (quorum.has_value()) {
+        auto quorum_result =
+            util::num::string_to_num<std::size_t>(quorum.value());
+        if (quorum_result.is_err() || quorum_result.ok() == 0 ||
+            quorum_result.ok() > servers.size()) {
+            callback(util::error(
+                "Invalid \"client_write_quorum\" property, must be between 1 "
+                "and the number of servers"));
+            return;
+        }
+        instance.write_quorum_ = quorum_result.ok();
+    }
+
+    auto selector = service::ServerSelector::FromProperties(
+        instance.components_.common.props, servers,
+        instance.components_.common.metrics);
+    if (selector.is_err()) {
+        callback(std::move(selector).err());
+        return;
+    }
+    instance.selector_ = std::move(selector).ok();
+
+    auto refresh = instance.components_.common.props.Get(
+        "client_enquiry_refresh_ms");
+    if (refresh.has_value()) {
+        auto refresh_result =
+            util::num::string_to_num<std::size_t>(refresh.value());
+        if (refresh_result.is_err()) {
+            callback(util::error(
+                "Invalid \"client_enquiry_refresh_ms\" property"));
+            return;
+        }
+        instance.refresh_interval_ =
+            std::chrono::milliseconds(refresh_result.ok());
+    }
+    bool refreshes = instance.refresh_interval_.count() > 0;
+
+    // A user performs one operation at a time.
+    std::size_t num_lanes =
+        instance.workload_.rate > 0 ? instance.workload_.concurrency : 1;
+    CRITICAL_SECTION(instance.mutex_, {
+        for (std::size_t i = 0; i < num_lanes; ++i) {
+            instance.lanes_.emplace_back(
+                new Project2Lane(instance, instance.components_));
+        }
+        // Refreshes get a connection of their own, so they never wait for
+        // an operation.
+        instance.num_connections_ =
+            num_lanes * servers.size() + (refreshes ? 1 : 0);
+    });
 
     for (const auto& server : servers) {
         util::safe_console::log("Connecting to", server);
@@ -95,45 +784,70 @@ IMPL_STATE_HANDLER(Project2Client, ConnectToServers) {
             return;
         }
         port_t port = std::move(port_result).ok();
-        instance.components_.connection_service.NewConnection(
-            full_hostname, port,
-            [&instance, server,
-             callback](util::result<Connection, Error> result) {
-                if (result.is_err()) {
-                    callback(std::move(result).err());
-                } else {
-                    auto connection = std::move(result).ok();
-                    util::safe_console::log("Connected to server", server);
-                    bool done = false;
+        if (refreshes && &server == &servers.front()) {
+            instance.components_.connection_service.NewConnection(
+                full_hostname, port,
+                [&instance, callback](util::result<Connection, Error> result) {
+                    if (result.is_err()) {
+                        callback(std::move(result).err());
+                        return;
+                    }
                     CRITICAL_SECTION(instance.mutex_, {
-                        instance.servers_.emplace_back(
-                            std::move(connection), instance.components_.common);
-                        if (instance.servers_.size() == instance.num_servers_) {
-                            done = true;
-                        }
+                        instance.enquiry_connection_ =
+                            std::make_shared<Connection>(
+                                std::move(result).ok());
+                        instance.enquiry_service_.reset(
+                            new proto::AsyncMessageService(
+                                instance.enquiry_connection_->socket,
+                                instance.components_.common));
                     });
-
-                    if (done) {
+                    if (instance.OnConnected()) {
+                        util::safe_console::log("Connected to servers");
                         callback(util::ok);
                     }
-                }
-            });
+                });
+        }
+        for (auto& lane : instance.lanes_) {
+            Project2Lane& lane_ref = *lane;
+            instance.components_.connection_service.NewConnection(
+                full_hostname, port,
+                [&instance, &lane_ref, server,
+                 callback](util::result<Connection, Error> result) {
+                    if (result.is_err()) {
+                        callback(std::move(result).err());
+                    } else {
+                        lane_ref.AddServer(std::move(result).ok(), server);
+                        util::safe_debug::log("Connected to server", server);
+                        if (instance.OnConnected()) {
+                            util::safe_console::log("Connected to servers");
+                            callback(util::ok);
+                        }
+                    }
+                });
+        }
     }
 }
 
 IMPL_NEXT_STATE(Project2Client, ConnectToServers, SendEnquiry);
 
 IMPL_STATE_HANDLER(Project2Client, SendEnquiry) {
-    auto res = instance.ChangeServer();
-    if (res.is_err()) {
-        callback(std::move(res).err());
-        return;
+    if (instance.enquiry_service_) {
+        instance.enquiry_server_ = instance.enquiry_service_.get();
+    } else {
+        auto server = instance.lanes_.front()->RandomServer();
+        if (server.is_err()) {
+            callback(std::move(server).err());
+            return;
+        }
+        instance.enquiry_server_ = server.ok();
     }
 
     util::safe_console::log("Fetching file names");
 
-    instance.current_server_->message_service.WriteMessage(
-        proto::EnquiryMessage{}.ToMessage(),
+    // No listing is known yet, but sending a version asks for a versioned
+    // one.
+    instance.enquiry_server_->WriteMessage(
+        proto::EnquiryMessage{std::uint64_t(0)}.ToMessage(),
         [callback](util::result<void, Error> result) {
             callback(std::move(result).map_err(
                 [](Error&& error) -> util::error { return error; }));
@@ -143,7 +857,7 @@ IMPL_STATE_HANDLER(Project2Client, SendEnquiry) {
 IMPL_NEXT_STATE(Project2Client, SendEnquiry, ReceiveEnquiryResponse);
 
 IMPL_STATE_HANDLER(Project2Client, ReceiveEnquiryResponse) {
-    instance.current_server_->message_service.ReadMessage(
+    instance.enquiry_server_->ReadMessage(
         [&instance, callback](util::result<proto::Message, Error> result) {
             if (result.is_err()) {
                 callback(std::move(result).err());
@@ -151,86 +865,132 @@ IMPL_STATE_HANDLER(Project2Client, ReceiveEnquiryResponse) {
             }
 
             auto msg = std::move(result).ok();
-            switch (msg.opcode) {
-                case proto::Opcode::kResponse: {
-                    auto resp = std::move(msg).ToResponse().ok();
-                    instance.file_names_ =
-                        util::strings::split_trim(resp.message, ',');
-                    if (instance.file_names_.empty()) {
-                        callback(util::error(
-                            "Server responded to enquiry with 0 file names"));
-                    } else {
-                        util::safe_debug::log("Received",
-                                              instance.file_names_.size(),
-                                              "file names");
-                        callback(util::ok);
-                    }
-                } break;
-                case proto::Opcode::kError: {
-                    auto err = std::move(msg).ToError().ok();
-                    util::safe_error_log::log("Error from server:",
-                                              err.message);
-                    instance.set_next_state(Stop::instance());
-                    callback(util::ok);
-                } break;
-                default: {
-                    callback(util::error(util::string::stream(
-                        "Received message type ", static_cast<int>(msg.opcode),
-                        " from server in enquiry response state, expected ",
-                        static_cast<int>(proto::Opcode::kResponse))));
-                } break;
+            if (msg.opcode == proto::Opcode::kError) {
+                auto err = std::move(msg).ToError().ok();
+                util::safe_error_log::log("Error from server:", err.message);
+                instance.set_next_state(Stop::instance());
+                callback(util::ok);
+                return;
             }
+            callback(instance.UpdateFileNames(std::move(msg)));
         });
 }
 
-IMPL_NEXT_STATE(Project2Client, ReceiveEnquiryResponse, Wait);
+IMPL_NEXT_STATE(Project2Client, ReceiveEnquiryResponse, RunLanes);
 
-IMPL_STATE_HANDLER(Project2Client, Wait) {
-    // Get a random number of milliseconds to wait.
-    static std::random_device device;
-    static std::mt19937 rng(device());
-    std::uniform_int_distribution<std::size_t> ms_dis(500, 5000);
-    std::size_t ms_to_sleep = ms_dis(rng);
-    std::this_thread::sleep_for(std::chrono::milliseconds(ms_to_sleep));
+IMPL_STATE_HANDLER(Project2Client, RunLanes) {
+    CRITICAL_SECTION(instance.mutex_, {
+        if (instance.workload_.rate > 0) {
+            instance.generator_.reset(new service::LoadGenerator(
+                instance.components_.common, instance.workload_,
+                instance.file_names_.size()));
+        }
+        instance.running_lanes_ = instance.lanes_.size();
+        instance.lanes_done_callback_ = callback;
+        instance.refreshing_ = instance.refresh_interval_.count() > 0;
+    });
 
-    // Randomly branch to the read or write state.
-    std::uniform_int_distribution<> bool_dis(0, 1);
-    bool should_write = bool_dis(rng);
-    if (should_write) {
-        instance.set_next_state(SendWrite::instance());
-    } else {
-        instance.set_next_state(SendRead::instance());
+    for (auto& lane : instance.lanes_) {
+        lane->Run([&instance](util::result<void, util::error> result) {
+            instance.OnLaneDone(std::move(result));
+        });
     }
 
-    // Select a random server to send the next request to.
-    auto res = instance.ChangeServer();
-    if (res.is_err()) {
-        callback(std::move(res).err());
-        return;
+    if (instance.generator_) {
+        instance.generator_->Start();
     }
 
-    // Select a random file to work with.
-    res = instance.ChangeFile();
-    if (res.is_err()) {
-        callback(std::move(res).err());
+    instance.ScheduleRefresh();
+}
+
+IMPL_NEXT_STATE(Project2Client, RunLanes, Stop);
+
+IMPL_STATE_HANDLER(Project2Client, Stop) {}
+IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Client, Stop);
+IMPL_STOP_STATE_SHOULD_STOP(Stop);
+
+IMPL_STATE_HANDLER(Project2Lane, Wait) {
+    // Operations are performed one at a time, so the last one is done.
+    instance.CompleteOperation();
+
+    if (instance.client_.generator_) {
+        instance.client_.generator_->Next(
+            [&instance, callback](
+                util::optional<service::LoadGenerator::Operation> operation) {
+                if (!operation.has_value()) {
+                    // Let stragglers of the last write catch up first.
+                    instance.AwaitRelease(true, [&instance, callback]() {
+                        instance.AwaitIdleServers(
+                            true, [&instance, callback]() {
+                                instance.set_next_state(Finish::instance());
+                                callback(util::ok);
+                            });
+                    });
+                    return;
+                }
+
+                instance.operation_ = operation;
+                callback(instance
+                             .BeginOperation(
+                                 operation.value().write,
+                                 instance.client_.FileName(
+                                     operation.value().file))
+                             .map_err([](Error&& error) -> util::error {
+                                 return error;
+                             }));
+            });
         return;
     }
 
-    callback(util::ok);
+    // Wait a random number of milliseconds, like a user would.
+    std::uniform_int_distribution<std::size_t> ms_dis(500, 5000);
+    std::chrono::milliseconds wait(ms_dis(instance.rng_));
+    instance.components_.common.timer_service.ScheduleAfter(
+        wait, [&instance, callback]() {
+            // Randomly branch to the read or write state, with a random file.
+            std::uniform_int_distribution<> bool_dis(0, 1);
+            bool should_write = bool_dis(instance.rng_);
+            callback(instance
+                         .BeginOperation(should_write,
+                                         instance.client_.RandomFileName(
+                                             instance.rng_))
+                         .map_err([](Error&& error) -> util::error {
+                             return error;
+                         }));
+        });
+}
+
+IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Lane, Wait);
+
+IMPL_STATE_HANDLER(Project2Lane, AwaitServers) {
+    // A server still performing the last write has a response pending on its
+    // connection, so it cannot be sent another operation yet. The file of the
+    // last write also stays locked by this lane until every server performs
+    // it.
+    if (instance.writing_) {
+        instance.set_next_state(SendWrite::instance());
+    } else {
+        instance.set_next_state(SendRead::instance());
+    }
+    instance.AwaitRelease(false, [&instance, callback]() {
+        instance.AwaitIdleServers(instance.writing_,
+                                  [callback]() { callback(util::ok); });
+    });
 }
 
-IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Client, Wait);
+IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Lane, AwaitServers);
 
-IMPL_STATE_HANDLER(Project2Client, SendRead) {
+IMPL_STATE_HANDLER(Project2Lane, SendRead) {
     util::safe_debug::log("Beginning mutually exclusive read on",
-                          *instance.current_file_name_);
+                          instance.current_file_name_);
 
     for (auto& server : instance.servers_) {
         server.operation_sent = false;
     }
 
+    instance.phase_started_ = Project2Lane::clock_t::now();
     instance.components_.distributed_mutex_service.RunWithMutualExclusion(
-        *instance.current_file_name_,
+        instance.current_file_name_,
         [&instance, callback](
             util::result<typename mutex::DistributedMutualExclusionService::
                              mutex_operation_done_t,
@@ -243,72 +1003,80 @@ IMPL_STATE_HANDLER(Project2Client, SendRead) {
 
             instance.finished_critical_section_callback_ =
                 std::move(result).ok();
+            instance.RecordPhase(instance.read_metrics_.acquire_us,
+                                 instance.phase_started_);
+            instance.phase_started_ = Project2Lane::clock_t::now();
+
+            instance.read_measured_ = !instance.operation_.has_value() ||
+                                      instance.operation_.value().measured;
+            CRITICAL_SECTION(instance.mutex_, {
+                ++instance.read_id_;
+                instance.read_settled_ = false;
+                instance.current_server_->awaiting_response = true;
+            });
 
             instance.current_server_->message_service.WriteMessage(
-                proto::ReadMessage{*instance.current_file_name_}.ToMessage(),
+                proto::ReadMessage{instance.current_file_name_}.ToMessage(),
                 [&instance, callback](util::result<void, Error> result) {
+                    if (result.is_ok()) {
+                        instance.RecordPhase(instance.read_metrics_.send_us,
+                                             instance.phase_started_);
+                        instance.current_server_->sent_at =
+                            Project2Lane::clock_t::now();
+                        instance.client_.selector_->Begin(
+                            instance.current_server_->stats);
+                    }
                     callback(std::move(result).map_err(
                         [](Error&& error) -> util::error { return error; }));
                 });
         });
 }
 
-IMPL_NEXT_STATE(Project2Client, SendRead, ReceiveReadResponse);
+IMPL_NEXT_STATE(Project2Lane, SendRead, ReceiveReadResponse);
 
-IMPL_STATE_HANDLER(Project2Client, ReceiveReadResponse) {
-    instance.current_server_->message_service.ReadMessage(
-        [&instance, callback](util::result<proto::Message, Error> result) {
-            if (result.is_err()) {
-                callback(std::move(result).err());
-                return;
-            }
+IMPL_STATE_HANDLER(Project2Lane, ReceiveReadResponse) {
+    instance.AwaitReadResponse(*instance.current_server_, callback);
 
-            auto msg = std::move(result).ok();
-            switch (msg.opcode) {
-                case proto::Opcode::kResponse: {
-                    auto resp = std::move(msg).ToResponse().ok();
-                    util::safe_console::stream(
-                        "Last line of ", *instance.current_file_name_, " is \"",
-                        resp.message, "\"", util::manip::endl);
-                    // Release mutual exclusion.
-                    instance.finished_critical_section_callback_.value()(
-                        [callback](util::result<void, Error> result) {
-                            // Then, go to the next state.
-                            callback(std::move(result).map_err(
-                                [](Error&& error) -> util::error {
-                                    return error;
-                                }));
-                        });
-                } break;
-                case proto::Opcode::kError: {
-                    auto err = std::move(msg).ToError().ok();
-                    util::safe_error_log::log("Error from server on read:",
-                                              err.message);
-                    instance.set_next_state(Stop::instance());
-                    callback(util::ok);
-                } break;
-                default: {
-                    callback(util::error(util::string::stream(
-                        "Received message type ", static_cast<int>(msg.opcode),
-                        " from server in read response state, expected ",
-                        static_cast<int>(proto::Opcode::kOk))));
-                } break;
-            }
-        });
+    auto& selector = *instance.client_.selector_;
+    auto delay = selector.HedgeDelay();
+    if (!selector.Hedges() || !delay.has_value() ||
+        instance.servers_.size() < 2) {
+        return;
+    }
+
+    // The timer service counts milliseconds, so round up.
+    auto remaining = instance.current_server_->sent_at + delay.value() -
+                     Project2Lane::clock_t::now();
+    auto remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        remaining + std::chrono::milliseconds(1) -
+        Project2Lane::clock_t::duration(1));
+    remaining_ms = std::max(remaining_ms, std::chrono::milliseconds(0));
+    CRITICAL_SECTION(instance.mutex_, {
+        if (instance.read_settled_) {
+            return;
+        }
+        std::uint64_t read_id = instance.read_id_;
+        instance.hedge_timer_ =
+            instance.components_.common.timer_service.ScheduleAfter(
+                remaining_ms, [&instance, read_id, callback]() {
+                    instance.HedgeRead(read_id, callback);
+                });
+    });
 }
 
-IMPL_NEXT_STATE(Project2Client, ReceiveReadResponse, Wait);
+IMPL_NEXT_STATE(Project2Lane, ReceiveReadResponse, Wait);
 
-IMPL_STATE_HANDLER(Project2Client, SendWrite) {
+IMPL_STATE_HANDLER(Project2Lane, SendWrite) {
     util::safe_debug::log("Beginning mutually exclusive write on",
-                          *instance.current_file_name_);
+                          instance.current_file_name_);
 
     for (auto& server : instance.servers_) {
         server.operation_sent = false;
     }
 
+    instance.phase_started_ = Project2Lane::clock_t::now();
     instance.components_.distributed_mutex_service.RunWithMutualExclusion(
-        *instance.current_file_name_,
+        instance.current_file_name_,
         [&instance, callback](
             util::result<typename mutex::DistributedMutualExclusionService::
                              mutex_operation_done_t,
@@ -321,21 +1089,32 @@ IMPL_STATE_HANDLER(Project2Client, SendWrite) {
 
             instance.finished_critical_section_callback_ =
                 std::move(result).ok();
+            instance.RecordPhase(instance.write_metrics_.acquire_us,
+                                 instance.phase_started_);
+            instance.phase_started_ = Project2Lane::clock_t::now();
 
             std::string append = util::string::stream(
                 '(', instance.components_.common.options.id, ", ",
                 instance.components_.distributed_mutex_service.Timestamp(),
                 ')');
 
-            util::safe_console::stream("Appending \"", append, "\" to ",
-                                       *instance.current_file_name_,
-                                       util::manip::endl);
+            if (instance.LogsOperations()) {
+                util::safe_console::stream("Appending \"", append, "\" to ",
+                                           instance.current_file_name_,
+                                           util::manip::endl);
+            }
+
+            // Keep the write to send again to servers that fail to perform it.
+            instance.last_write_ =
+                proto::WriteMessage{instance.current_file_name_, append};
+            instance.write_measured_ =
+                !instance.operation_.has_value() ||
+                instance.operation_.value().measured;
 
             // Send appended line to every server.
             for (auto& server : instance.servers_) {
                 server.message_service.WriteMessage(
-                    proto::WriteMessage{*instance.current_file_name_, append}
-                        .ToMessage(),
+                    proto::WriteMessage(instance.last_write_).ToMessage(),
                     [&instance, &server,
                      callback](util::result<void, Error> result) {
                         if (result.is_err()) {
@@ -352,7 +1131,9 @@ IMPL_STATE_HANDLER(Project2Client, SendWrite) {
                             return;
                         }
 
+                        server.sent_at = Project2Lane::clock_t::now();
                         server.operation_sent = true;
+                        instance.client_.selector_->Begin(server.stats);
 
                         // Only move on when every server has received my
                         // operation.
@@ -361,11 +1142,14 @@ IMPL_STATE_HANDLER(Project2Client, SendWrite) {
                             done =
                                 std::all_of(instance.servers_.begin(),
                                             instance.servers_.end(),
-                                            [](Project2Client::Server& server) {
+                                            [](Project2Lane::Server& server) {
                                                 return server.operation_sent;
                                             });
                         });
                         if (done) {
+                            instance.RecordPhase(
+                                instance.write_metrics_.send_us,
+                                instance.phase_started_);
                             callback(util::ok);
                         }
                     });
@@ -373,76 +1157,35 @@ IMPL_STATE_HANDLER(Project2Client, SendWrite) {
         });
 }
 
-IMPL_NEXT_STATE(Project2Client, SendWrite, ReceiveWriteResponse);
+IMPL_NEXT_STATE(Project2Lane, SendWrite, ReceiveWriteResponse);
 
-IMPL_STATE_HANDLER(Project2Client, ReceiveWriteResponse) {
-    for (auto& server : instance.servers_) {
-        server.performed_write = false;
-    }
+IMPL_STATE_HANDLER(Project2Lane, ReceiveWriteResponse) {
+    CRITICAL_SECTION(instance.mutex_, {
+        instance.write_acks_ = 0;
+        instance.write_pending_ = instance.servers_.size();
+        instance.write_settled_ = false;
+        instance.write_released_ = false;
+        instance.write_release_ =
+            std::move(instance.finished_critical_section_callback_);
+        instance.finished_critical_section_callback_ = util::none;
+        for (auto& server : instance.servers_) {
+            server.awaiting_response = true;
+            server.repair_attempts = 0;
+        }
+    });
 
+    // Move on once a quorum of servers has performed my operation, and release
+    // mutual exclusion once the rest have.
     for (auto& server : instance.servers_) {
-        server.message_service.ReadMessage(
-            [&instance, &server,
-             callback](util::result<proto::Message, Error> result) {
-                if (result.is_err()) {
-                    // No way to verify if the server performed our operation.
-                    callback(std::move(result).err());
-                    return;
-                }
-
-                auto msg = std::move(result).ok();
-                switch (msg.opcode) {
-                    case proto::Opcode::kOk: {
-                        server.performed_write = true;
-
-                        // Only move on when every server has performed my
-                        // operation.
-                        bool done = false;
-                        CRITICAL_SECTION(instance.mutex_, {
-                            done =
-                                std::all_of(instance.servers_.begin(),
-                                            instance.servers_.end(),
-                                            [](Project2Client::Server& server) {
-                                                return server.performed_write;
-                                            });
-                        });
-                        if (done) {
-                            // First, release mutual exclusion.
-                            instance.finished_critical_section_callback_
-                                .value()([callback](
-                                             util::result<void, Error> result) {
-                                    // Then, go to the next state.
-                                    callback(std::move(result).map_err(
-                                        [](Error&& error) -> util::error {
-                                            return error;
-                                        }));
-                                });
-                        }
-                    } break;
-                    case proto::Opcode::kError: {
-                        auto err = std::move(msg).ToError().ok();
-                        util::safe_error_log::log("Error from server on write:",
-                                                  err.message);
-                        instance.set_next_state(Stop::instance());
-                        callback(util::ok);
-                    } break;
-                    default: {
-                        callback(util::error(util::string::stream(
-                            "Received message type ",
-                            static_cast<int>(msg.opcode),
-                            " from server in write response state, expected ",
-                            static_cast<int>(proto::Opcode::kOk))));
-                    } break;
-                }
-            });
+        instance.AwaitWriteResponse(server, callback);
     }
 }
 
-IMPL_NEXT_STATE(Project2Client, ReceiveWriteResponse, Wait);
+IMPL_NEXT_STATE(Project2Lane, ReceiveWriteResponse, Wait);
 
-IMPL_STATE_HANDLER(Project2Client, Stop) {}
-IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Client, Stop);
-IMPL_STOP_STATE_SHOULD_STOP(Stop);
+IMPL_STATE_HANDLER(Project2Lane, Finish) {}
+IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Lane, Finish);
+IMPL_STOP_STATE_SHOULD_STOP(Finish);
 
 }  // namespace states
 
@@ -2,12 +2,20 @@
 #define NET_CLIENT_IMPL_PROJECT2_CLIENT_
 
 #include <net/client/client.h>
+#include <net/client/service/load_generator.h>
+#include <net/client/service/server_selector.h>
 #include <net/proto/async_message_service.h>
+#include <thread/timer_service.h>
+#include <util/metrics.h>
 #include <util/state_machine.h>
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <random>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 namespace net {
@@ -15,70 +23,480 @@ namespace client {
 namespace impl {
 
 class Project2Client;
+class Project2Lane;
 
 namespace states {
 
 DEFINE_ASYNC_STATE(Project2Client, ConnectToServers);
 DEFINE_ASYNC_STATE(Project2Client, SendEnquiry);
 DEFINE_ASYNC_STATE(Project2Client, ReceiveEnquiryResponse);
-DEFINE_STATE(Project2Client, Wait);
-DEFINE_ASYNC_STATE(Project2Client, SendRead);
-DEFINE_ASYNC_STATE(Project2Client, ReceiveReadResponse);
-DEFINE_ASYNC_STATE(Project2Client, SendWrite);
-DEFINE_ASYNC_STATE(Project2Client, ReceiveWriteResponse);
+DEFINE_ASYNC_STATE(Project2Client, RunLanes);
 DEFINE_STOP_STATE(Project2Client, Stop);
 
+DEFINE_ASYNC_STATE(Project2Lane, Wait);
+DEFINE_ASYNC_STATE(Project2Lane, AwaitServers);
+DEFINE_ASYNC_STATE(Project2Lane, SendRead);
+DEFINE_ASYNC_STATE(Project2Lane, ReceiveReadResponse);
+DEFINE_ASYNC_STATE(Project2Lane, SendWrite);
+DEFINE_ASYNC_STATE(Project2Lane, ReceiveWriteResponse);
+DEFINE_STOP_STATE(Project2Lane, Finish);
+
 }  // namespace states
 
 /**
- * @brief Implementation for a client according to the specifications of
- * Project 2.
+ * @brief A sequence of operations performed one at a time, over its own
+ * connection to every server.
+ *
+ * Without a load generator, the lane waits a random time between operations
+ * like a user would. With one, it performs the operations it is handed.
+ *
+ * The latency of each phase of an operation is recorded in microseconds, as
+ * "client.<read|write>.acquire_us" for gaining mutual exclusion,
+ * "client.<read|write>.send_us" for sending the request,
+ * "client.<read|write>.response_us.<server>" for each server to respond, and
+ * "client.<read|write>.release_us" for releasing mutual exclusion. Operations
+ * generated during a warmup are not recorded.
+ *
+ * A write lets the lane move on once a quorum of servers acknowledge it, and
+ * the lane keeps waiting for the rest in the background. Mutual exclusion is
+ * only released once every server has performed the write, so the quorum does
+ * not shorten how long the lock is held. A straggler that answers with an
+ * error is sent the write again. A server must answer before it is sent
+ * another operation, so responses on each connection stay in order.
+ *
+ * Reads go to the server picked by the client's `service::ServerSelector`.
+ * A hedged read is also sent to a second server that is free, and the first
+ * response is used while the other is read in the background. Hedged reads are
+ * counted as "client.read.hedged", and those the second server answered first
+ * as "client.read.hedge_wins".
  *
  */
-class Project2Client : public Client,
-                       protected util::state_machine<Project2Client> {
+class Project2Lane : protected util::state_machine<Project2Lane> {
    public:
-    Project2Client(Components& components);
+    using clock_t = std::chrono::steady_clock;
+    using done_callback_t = util::sm_callback_t;
+
+    Project2Lane(Project2Client& client, ClientComponents& components);
+
+    /**
+     * @brief Adds a connection to a server.
+     *
+     * @param connection
+     * @param name Location of the server, to name its metrics by
+     */
+    void AddServer(Connection&& connection, const std::string& name);
+
+    /**
+     * @brief Gets the message service of a server picked like for a read.
+     *
+     * @return util::result<proto::AsyncMessageService*, Error>
+     */
+    util::result<proto::AsyncMessageService*, Error> RandomServer();
+
+    /**
+     * @brief Starts performing operations.
+     *
+     * @param callback Called once the lane stops
+     */
+    void Run(const done_callback_t& callback);
+
+    void Stop();
 
    private:
     /**
-     * @brief A single server the client is connected to and can send operations
+     * @brief A single server the lane is connected to and can send operations
      * to.
      *
      */
     struct Server {
-        Server(Connection&& moved_connection, Components& components);
+        Server(Connection&& moved_connection, const std::string& name,
+               Components& components,
+               service::ServerSelector::ServerStats& stats);
 
         std::shared_ptr<Connection> connection;
         proto::AsyncMessageService message_service;
         bool operation_sent;
-        bool performed_write;
+
+        // The server has not answered the last operation sent to it yet.
+        bool awaiting_response;
+        std::size_t repair_attempts;
+        clock_t::time_point sent_at;
+        util::metrics::hdr_histogram& read_response_us;
+        util::metrics::hdr_histogram& write_response_us;
+
+        // Shared by every lane connected to the server.
+        service::ServerSelector::ServerStats& stats;
     };
 
-    void Run() override;
+    /**
+     * @brief Latencies of the phases of one kind of operation.
+     *
+     */
+    struct PhaseMetrics {
+        PhaseMetrics(util::metrics::registry& registry,
+                     const std::string& kind);
 
-    void StopStateMachine();
+        util::metrics::hdr_histogram& acquire_us;
+        util::metrics::hdr_histogram& send_us;
+        util::metrics::hdr_histogram& release_us;
+    };
 
-    util::result<void, Error> ChangeServer();
+    /**
+     * @brief Sets up the lane for the next operation.
+     *
+     * @param write
+     * @param file_name
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> BeginOperation(bool write,
+                                             std::string file_name);
 
-    util::result<void, Error> ChangeFile();
+    /**
+     * @brief Reports the last operation handed out by the load generator as
+     * done.
+     *
+     */
+    void CompleteOperation();
 
+    /**
+     * @brief Checks if operations should be logged, which is only done when
+     * waiting between them like a user.
+     *
+     * @return true
+     * @return false
+     */
+    bool LogsOperations() const;
+
+    /**
+     * @brief Records the time since the given start of a phase of the current
+     * operation, unless it is part of a warmup.
+     *
+     * @param histogram
+     * @param start
+     */
+    void RecordPhase(util::metrics::hdr_histogram& histogram,
+                     clock_t::time_point start);
+
+    /**
+     * @brief Records the time since the given start of a phase, if it is
+     * measured.
+     *
+     * @param histogram
+     * @param start
+     * @param measured
+     */
+    void RecordPhase(util::metrics::hdr_histogram& histogram,
+                     clock_t::time_point start, bool measured);
+
+    /**
+     * @brief Calls the given callback once mutual exclusion of the last write
+     * is released, if the next operation needs it.
+     *
+     * @param any_file Waits for a write to any file, instead of only the
+     * current one
+     * @param callback
+     */
+    void AwaitRelease(bool any_file, const std::function<void()>& callback);
+
+    /**
+     * @brief Calls the given callback once the servers the next operation uses
+     * have answered the last write.
+     *
+     * @param all Waits for every server, instead of only the current one
+     * @param callback
+     */
+    void AwaitIdleServers(bool all, const std::function<void()>& callback);
+
+    /**
+     * @brief Checks if the servers being waited for have answered the last
+     * write.
+     *
+     * Must be called with the lock held.
+     *
+     * @return true
+     * @return false
+     */
+    bool ServersIdle() const;
+
+    /**
+     * @brief Takes the callback waiting for servers to be idle, if they are.
+     *
+     * Must be called with the lock held.
+     *
+     * @return util::optional<std::function<void()>>
+     */
+    util::optional<std::function<void()>> TakeIdleCallback();
+
+    /**
+     * @brief Waits for a server to answer the last write.
+     *
+     * @param server
+     * @param callback Callback of the write response state
+     */
+    void AwaitWriteResponse(Server& server,
+                            const util::sm_callback_t& callback);
+
+    /**
+     * @brief Counts a server's acknowledgment of the last write.
+     *
+     * The lane moves on once a quorum has acknowledged it, but mutual
+     * exclusion is only released once every server has, so no other writer
+     * can slip in before a straggler.
+     *
+     * @param server
+     * @param callback Callback of the write response state
+     */
+    void AcknowledgeWrite(Server& server, const util::sm_callback_t& callback);
+
+    /**
+     * @brief Releases mutual exclusion of the last write, which every server
+     * has performed.
+     *
+     * @param release
+     * @param callback Callback of the write response state, if the lane has
+     * not moved on yet
+     */
+    void ReleaseWrite(const typename mutex::DistributedMutualExclusionService::
+                          mutex_operation_done_t& release,
+                      util::optional<util::sm_callback_t> callback);
+
+    /**
+     * @brief Sends the last write again to a server that failed to perform it,
+     * if the quorum allows it to fall behind.
+     *
+     * @param server
+     * @param callback Callback of the write response state
+     */
+    void RepairWrite(Server& server, const util::sm_callback_t& callback);
+
+    /**
+     * @brief Stops the lane during a write, with an error or successfully.
+     *
+     * If mutual exclusion is still held, it is not released, because the file
+     * is now inconsistent across servers.
+     *
+     * @param result
+     * @param callback Callback of the write response state
+     */
+    void EndWrite(util::result<void, util::error> result,
+                  const util::sm_callback_t& callback);
+
+    /**
+     * @brief Waits for a server to answer the current read.
+     *
+     * @param server
+     * @param callback Callback of the read response state
+     */
+    void AwaitReadResponse(Server& server, const util::sm_callback_t& callback);
+
+    /**
+     * @brief Sends the current read to a second server, if it is still not
+     * answered and another server is free.
+     *
+     * @param read_id Read to hedge, which may have been answered since
+     * @param callback Callback of the read response state
+     */
+    void HedgeRead(std::uint64_t read_id, const util::sm_callback_t& callback);
+
+    /**
+     * @brief Records that a server answered the current read.
+     *
+     * @param server
+     * @return true The server answered first
+     * @return false
+     */
+    bool SettleRead(Server& server);
+
+    /**
+     * @brief Stops the lane during a read with an error.
+     *
+     * @param error
+     * @param callback Callback of the read response state
+     */
+    void FailRead(util::error error, const util::sm_callback_t& callback);
+
+    /**
+     * @brief Picks the server to send the next read to.
+     *
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> ChangeServer();
+
+    Project2Client& client_;
+    ClientComponents& components_;
     std::mutex mutex_;
-    std::size_t num_servers_;
     std::vector<Server> servers_;
-    std::vector<std::string> file_names_;
-    std::unordered_set<net::Connection::id_t> servers_that_finished_my_write_;
     Server* current_server_;
-    const std::string* current_file_name_;
+    std::string current_file_name_;
+    util::optional<service::LoadGenerator::Operation> operation_;
+    std::mt19937 rng_;
+    PhaseMetrics read_metrics_;
+    PhaseMetrics write_metrics_;
+    util::metrics::counter& write_stragglers_;
+    util::metrics::counter& write_repairs_;
+    util::metrics::counter& hedged_reads_;
+    util::metrics::counter& hedge_wins_;
+    clock_t::time_point phase_started_;
+    bool writing_;
+    proto::WriteMessage last_write_;
+    bool write_measured_;
+    std::size_t write_acks_;
+
+    // Servers yet to perform the last write, which keeps mutual exclusion
+    // until they have.
+    std::size_t write_pending_;
+
+    // The write response state moved on, because a quorum acknowledged the
+    // last write or it failed.
+    bool write_settled_;
+    bool write_released_;
+    util::optional<typename mutex::DistributedMutualExclusionService::
+                       mutex_operation_done_t>
+        write_release_;
+    util::optional<std::function<void()>> released_callback_;
+    bool idle_all_;
+    util::optional<std::function<void()>> idle_callback_;
+    bool read_measured_;
+
+    // Counts reads, so a late hedging timer knows its read is over.
+    std::uint64_t read_id_;
+    bool read_settled_;
+    util::optional<thread::TimerService::timer_id_t> hedge_timer_;
     util::optional<typename mutex::DistributedMutualExclusionService::
                        mutex_operation_done_t>
         finished_critical_section_callback_;
 
    public:
+    friend struct states::Wait;
+    friend struct states::AwaitServers;
+    friend struct states::SendRead;
+    friend struct states::ReceiveReadResponse;
+    friend struct states::SendWrite;
+    friend struct states::ReceiveWriteResponse;
+};
+
+/**
+ * @brief Implementation for a client according to the specifications of
+ * Project 2.
+ *
+ * With "client_load_rate" set, the client generates load instead of acting
+ * like a single user, performing operations over "client_load_concurrency"
+ * lanes (see `service::Workload`). Every lane keeps a connection open to every
+ * server, and servers handle each connection on its own thread, so the thread
+ * pools of both must be sized for it.
+ *
+ * Writes go to every server, and the lane moves on once "client_write_quorum"
+ * of them acknowledge it, every server by default. Mutual exclusion is only
+ * released once every server has performed the write, so servers append
+ * writes to a file in the same order and no read misses one. The quorum
+ * therefore does not shorten lock hold time; until the release, the lane may
+ * work on other files, and an operation on the same file waits.
+ *
+ * Reads are spread over servers by a `service::ServerSelector`, configured
+ * with "client_read_selection" and "client_read_hedging".
+ *
+ * With "client_enquiry_refresh_ms" set, the list of files is refreshed that
+ * often over a connection of its own, sending the version of the listing last
+ * received so the server only lists files again if they changed. The load
+ * generator keeps picking from as many files as there were at first.
+ *
+ */
+class Project2Client : public Client,
+                       protected util::state_machine<Project2Client> {
+   public:
+    Project2Client(Components& components);
+
+   private:
+    void Run() override;
+
+    void StopStateMachine();
+
+    /**
+     * @brief Handles a lane stopping, which stops generating load for the
+     * others, and finishes running once every lane has stopped.
+     *
+     * @param result
+     */
+    void OnLaneDone(util::result<void, util::error> result);
+
+    /**
+     * @brief Counts a new connection to a server.
+     *
+     * @return true Every connection is made
+     * @return false
+     */
+    bool OnConnected();
+
+    /**
+     * @brief Gets the name of the file at the given index, which wraps around
+     * if the list of files shrank.
+     *
+     * @param index
+     * @return std::string
+     */
+    std::string FileName(std::size_t index);
+
+    /**
+     * @brief Gets the name of a random file.
+     *
+     * @param rng
+     * @return std::string
+     */
+    std::string RandomFileName(std::mt19937& rng);
+
+    /**
+     * @brief Updates the list of files from the response to an enquiry.
+     *
+     * @param msg
+     * @return util::result<void, util::error>
+     */
+    util::result<void, util::error> UpdateFileNames(proto::Message&& msg);
+
+    /**
+     * @brief Schedules the next refresh of the list of files.
+     *
+     */
+    void ScheduleRefresh();
+
+    /**
+     * @brief Asks the server for the list of files, if it changed since the
+     * last version received.
+     *
+     */
+    void RefreshFileNames();
+
+    std::mutex mutex_;
+    service::Workload workload_;
+    std::vector<std::unique_ptr<Project2Lane>> lanes_;
+    std::size_t num_connections_;
+    std::size_t connected_;
+    std::size_t running_lanes_;
+    std::size_t write_quorum_;
+    proto::AsyncMessageService* enquiry_server_;
+    std::vector<std::string> file_names_;
+
+    // Version of the listing `file_names_` came from, or 0 if the server does
+    // not version listings.
+    std::uint64_t listing_version_;
+    std::chrono::milliseconds refresh_interval_;
+    bool refreshing_;
+    util::optional<thread::TimerService::timer_id_t> refresh_timer_;
+    std::shared_ptr<Connection> enquiry_connection_;
+    std::unique_ptr<proto::AsyncMessageService> enquiry_service_;
+    util::metrics::counter& listings_not_modified_;
+    util::metrics::counter& listings_changed_;
+    std::unique_ptr<service::LoadGenerator> generator_;
+    util::optional<util::sm_callback_t> lanes_done_callback_;
+    std::unique_ptr<service::ServerSelector> selector_;
+
+   public:
+    friend class Project2Lane;
     friend struct states::ConnectToServers;
     friend struct states::SendEnquiry;
     friend struct states::ReceiveEnquiryResponse;
+    friend struct states::RunLanes;
     friend struct states::Wait;
+    friend struct states::AwaitServers;
     friend struct states::SendRead;
     friend struct states::ReceiveReadResponse;
     friend struct states::SendWrite;
@@ -1,16 +1,25 @@
 #include "connection_service.h"
 
 #include <net/client/client_components.h>
+#include <util/console.h>
 
 namespace net {
 namespace client {
 namespace service {
 
+void ConnectionService::SetSocketOptions(const SocketOptions& options) {
+    socket_options_ = options;
+}
+
 void ConnectionService::NewConnection(const std::string& hostname,
                                       std::uint16_t port,
                                       const connect_callback_t& callback,
                                       std::size_t retries) {
     auto it = NewSocket();
+    auto options_result = it->SetOptions(socket_options_);
+    if (options_result.is_err()) {
+        util::safe_error_log::log(options_result.err());
+    }
     it->Connect(hostname, port, ConnectCallback(callback, it), retries);
 }
 
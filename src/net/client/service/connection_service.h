@@ -16,6 +16,13 @@ class ConnectionService : public shared::BaseConnectionService {
    public:
     using BaseConnectionService::BaseConnectionService;
 
+    /**
+     * @brief Sets the socket options of new connections.
+     *
+     * @param options
+     */
+    void SetSocketOptions(const SocketOptions& options);
+
     /**
      * @brief Starts a new connection.
      *
@@ -26,6 +33,9 @@ class ConnectionService : public shared::BaseConnectionService {
     void NewConnection(const std::string& hostname, std::uint16_t port,
                        const connect_callback_t& callback,
                        std::size_t retries = 0);
+
+   private:
+    SocketOptions socket_options_;
 };
 
 }  // namespace service
@@ -0,0 +1,313 @@
+#include "load_generator.h"
+
+#include <util/console.h>
+#include <util/mutex.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+
+namespace net {
+namespace client {
+namespace service {
+
+namespace {
+
+/**
+ * @brief Reads a number property, keeping the given default if it is not set.
+ *
+ * @tparam T
+ * @param props
+ * @param name
+ * @param out
+ * @return util::result<void, Error>
+ */
+template <typename T>
+util::result<void, Error> ReadNumber(const program::Properties& props,
+                                     const std::string& name, T& out) {
+    auto value = props.Get(name);
+    if (!value.has_value()) {
+        return util::ok;
+    }
+    auto result = util::num::string_to_num<T>(value.value());
+    if (result.is_err() || result.ok() < 0) {
+        return Error::Create(
+            util::string::stream("Invalid \"", name, "\" property"));
+    }
+    out = result.ok();
+    return util::ok;
+}
+
+}  // namespace
+
+util::result<Workload, Error> Workload::FromProperties(
+    const program::Properties& props) {
+    Workload workload;
+    RETURN_IF_ERROR(ReadNumber(props, "client_load_rate", workload.rate));
+    RETURN_IF_ERROR(
+        ReadNumber(props, "client_load_write_ratio", workload.write_ratio));
+    if (workload.write_ratio > 1) {
+        return Error::Create(
+            "Invalid \"client_load_write_ratio\" property, must be at most 1");
+    }
+    RETURN_IF_ERROR(
+        ReadNumber(props, "client_load_zipf", workload.zipf_exponent));
+    RETURN_IF_ERROR(
+        ReadNumber(props, "client_load_concurrency", workload.concurrency));
+    if (workload.concurrency == 0) {
+        return Error::Create(
+            "Invalid \"client_load_concurrency\" property, must be positive");
+    }
+
+    std::pair<const char*, std::chrono::milliseconds*> phases[] = {
+        {"client_load_warmup_ms", &workload.warmup},
+        {"client_load_duration_ms", &workload.duration},
+    };
+    for (const auto& phase : phases) {
+        std::size_t ms = 0;
+        RETURN_IF_ERROR(ReadNumber(props, phase.first, ms));
+        *phase.second = std::chrono::milliseconds(ms);
+    }
+
+    auto arrival = props.Get("client_load_arrival");
+    if (arrival.has_value()) {
+        if (arrival.value() == "poisson") {
+            workload.arrival = Arrival::kPoisson;
+        } else if (arrival.value() == "constant") {
+            workload.arrival = Arrival::kConstant;
+        } else {
+            return Error::Create(
+                "Invalid \"client_load_arrival\" property, must be "
+                "\"poisson\" or \"constant\"");
+        }
+    }
+    return workload;
+}
+
+LoadGenerator::LoadGenerator(Components& components, const Workload& workload,
+                             std::size_t num_files)
+    : components_(components),
+      workload_(workload),
+      rng_(std::random_device()()),
+      running_(false),
+      done_generating_(false),
+      timer_id_(0),
+      in_flight_(0),
+      measured_completed_(0),
+      summarized_(false),
+      issued_(components.metrics.get_counter("client.load.issued")),
+      completed_(components.metrics.get_counter("client.load.completed")),
+      dropped_(components.metrics.get_counter("client.load.dropped")),
+      backlog_size_(components.metrics.get_gauge("client.load.backlog")),
+      read_us_(components.metrics.get_histogram("client.load.read_us")),
+      write_us_(components.metrics.get_histogram("client.load.write_us")),
+      queue_us_(components.metrics.get_histogram("client.load.queue_us")) {
+    // File i is picked with weight 1 / (i + 1)^s.
+    double total = 0;
+    file_cdf_.reserve(num_files);
+    for (std::size_t i = 0; i < num_files; ++i) {
+        total += 1 / std::pow(static_cast<double>(i + 1),
+                              workload_.zipf_exponent);
+        file_cdf_.push_back(total);
+    }
+    for (auto& weight : file_cdf_) {
+        weight /= total;
+    }
+}
+
+void LoadGenerator::Start() {
+    util::safe_console::log("Generating", workload_.rate,
+                            "operations per second over",
+                            workload_.concurrency, "lanes");
+    CRITICAL_SECTION(mutex_, {
+        running_ = true;
+        auto now = clock_t::now();
+        next_arrival_ = now;
+        measure_from_ = now + workload_.warmup;
+        last_measured_done_ = measure_from_;
+        if (workload_.duration.count() > 0) {
+            measure_until_ = measure_from_ + workload_.duration;
+        }
+    });
+    Arrive();
+}
+
+void LoadGenerator::Stop() {
+    std::vector<std::function<void()>> calls;
+    CRITICAL_SECTION(mutex_, {
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        done_generating_ = true;
+        components_.timer_service.Cancel(timer_id_);
+        dropped_.increment(backlog_.size());
+        backlog_.clear();
+        backlog_size_.set(0);
+        calls = Dispatch();
+    });
+    for (const auto& call : calls) {
+        call();
+    }
+    Summarize();
+}
+
+void LoadGenerator::Next(const operation_callback_t& callback) {
+    std::vector<std::function<void()>> calls;
+    CRITICAL_SECTION(mutex_, {
+        waiting_.push_back(callback);
+        calls = Dispatch();
+    });
+    for (const auto& call : calls) {
+        call();
+    }
+}
+
+void LoadGenerator::Complete(const Operation& operation) {
+    auto now = clock_t::now();
+    std::uint64_t latency_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            now - operation.scheduled_at)
+            .count();
+    completed_.increment();
+    if (operation.measured) {
+        (operation.write ? write_us_ : read_us_).observe(latency_us);
+    }
+
+    bool drained = false;
+    CRITICAL_SECTION(mutex_, {
+        --in_flight_;
+        if (operation.measured) {
+            ++measured_completed_;
+            last_measured_done_ = std::max(last_measured_done_, now);
+        }
+        drained = done_generating_ && backlog_.empty() && in_flight_ == 0;
+    });
+    if (drained) {
+        Summarize();
+    }
+}
+
+void LoadGenerator::Arrive() {
+    std::vector<std::function<void()>> calls;
+    CRITICAL_SECTION(mutex_, {
+        if (!running_) {
+            return;
+        }
+
+        auto now = clock_t::now();
+        std::uniform_real_distribution<> write_dis(0, 1);
+        while (next_arrival_ <= now) {
+            if (measure_until_.has_value() &&
+                next_arrival_ >= measure_until_.value()) {
+                done_generating_ = true;
+                break;
+            }
+            Operation operation;
+            operation.write = write_dis(rng_) < workload_.write_ratio;
+            operation.file = NextFile();
+            operation.scheduled_at = next_arrival_;
+            operation.measured = next_arrival_ >= measure_from_;
+            backlog_.push_back(operation);
+            issued_.increment();
+            next_arrival_ += NextGap();
+        }
+        backlog_size_.set(backlog_.size());
+        calls = Dispatch();
+
+        if (!done_generating_) {
+            // Round up, so the timer never fires before the next arrival.
+            auto delay =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    next_arrival_ - now + std::chrono::milliseconds(1) -
+                    clock_t::duration(1));
+            timer_id_ = components_.timer_service.ScheduleAfter(
+                delay, [this]() { Arrive(); });
+        }
+    });
+    for (const auto& call : calls) {
+        call();
+    }
+}
+
+LoadGenerator::clock_t::duration LoadGenerator::NextGap() {
+    double mean_s = 1 / workload_.rate;
+    double gap_s = mean_s;
+    if (workload_.arrival == Workload::Arrival::kPoisson) {
+        std::exponential_distribution<> gap_dis(workload_.rate);
+        gap_s = gap_dis(rng_);
+    }
+    return std::chrono::duration_cast<clock_t::duration>(
+        std::chrono::duration<double>(gap_s));
+}
+
+std::size_t LoadGenerator::NextFile() {
+    std::uniform_real_distribution<> dis(0, 1);
+    auto it = std::lower_bound(file_cdf_.begin(), file_cdf_.end(), dis(rng_));
+    if (it == file_cdf_.end()) {
+        // Rounding may leave the last weight just under 1.
+        return file_cdf_.size() - 1;
+    }
+    return it - file_cdf_.begin();
+}
+
+std::vector<std::function<void()>> LoadGenerator::Dispatch() {
+    std::vector<std::function<void()>> calls;
+    auto now = clock_t::now();
+    while (!waiting_.empty() && !backlog_.empty()) {
+        Operation operation = backlog_.front();
+        backlog_.pop_front();
+        if (operation.measured) {
+            queue_us_.observe(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - operation.scheduled_at)
+                    .count());
+        }
+        ++in_flight_;
+        auto callback = std::move(waiting_.front());
+        waiting_.pop_front();
+        // Lanes start their operations on the thread pool, so one arrival
+        // does not start them all in turn.
+        calls.emplace_back([this, callback, operation]() {
+            components_.thread_pool.Schedule(
+                [callback, operation]() { callback(operation); });
+        });
+    }
+    backlog_size_.set(backlog_.size());
+
+    if (done_generating_ && backlog_.empty()) {
+        while (!waiting_.empty()) {
+            auto callback = std::move(waiting_.front());
+            waiting_.pop_front();
+            calls.emplace_back([callback]() { callback(util::none); });
+        }
+    }
+    return calls;
+}
+
+void LoadGenerator::Summarize() {
+    std::uint64_t measured = 0;
+    double seconds = 0;
+    CRITICAL_SECTION(mutex_, {
+        if (summarized_) {
+            return;
+        }
+        summarized_ = true;
+        measured = measured_completed_;
+        seconds =
+            std::chrono::duration<double>(last_measured_done_ - measure_from_)
+                .count();
+    });
+
+    double throughput = seconds > 0 ? measured / seconds : 0;
+    util::safe_console::log("Load generator completed", measured,
+                            "measured operations in", seconds, "seconds:",
+                            throughput, "operations per second, target",
+                            workload_.rate);
+}
+
+}  // namespace service
+}  // namespace client
+}  // namespace net
\ No newline at end of file
@@ -0,0 +1,224 @@
+#ifndef NET_CLIENT_SERVICE_LOAD_GENERATOR_
+#define NET_CLIENT_SERVICE_LOAD_GENERATOR_
+
+#include <net/components.h>
+#include <net/error.h>
+#include <program/properties.h>
+#include <thread/timer_service.h>
+#include <util/metrics.h>
+#include <util/optional.h>
+#include <util/result.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace net {
+namespace client {
+
+namespace service {
+
+/**
+ * @brief Shape of the load a client generates, read from the "client_load_*"
+ * properties.
+ *
+ */
+struct Workload {
+    enum class Arrival {
+        // Exponentially distributed gaps between operations.
+        kPoisson,
+        // Evenly spaced operations.
+        kConstant,
+    };
+
+    // Operations started per second, or 0 to wait between operations like a
+    // user would instead.
+    double rate = 0;
+
+    Arrival arrival = Arrival::kPoisson;
+
+    // Fraction of operations that are writes.
+    double write_ratio = 0.5;
+
+    // Exponent of the Zipfian distribution files are picked from, where 0
+    // picks every file equally.
+    double zipf_exponent = 0;
+
+    // Operations in progress at once, each over its own connections.
+    std::size_t concurrency = 16;
+
+    // Time operations are generated before latencies are recorded.
+    std::chrono::milliseconds warmup = std::chrono::milliseconds(0);
+
+    // Time latencies are recorded after the warmup, or 0 to generate load
+    // until the client stops.
+    std::chrono::milliseconds duration = std::chrono::milliseconds(0);
+
+    /**
+     * @brief Reads the workload from the properties `client_load_rate`,
+     * `client_load_arrival` ("poisson" or "constant"),
+     * `client_load_write_ratio`, `client_load_zipf`,
+     * `client_load_concurrency`, `client_load_warmup_ms`, and
+     * `client_load_duration_ms`, keeping the default of each one not set.
+     *
+     * @param props
+     * @return util::result<Workload, Error>
+     */
+    static util::result<Workload, Error> FromProperties(
+        const program::Properties& props);
+};
+
+/**
+ * @brief Generates operations at a target rate, independent of how fast they
+ * complete.
+ *
+ * Arrivals are generated on the timer service, which has millisecond
+ * resolution, so operations due within the same millisecond are released
+ * together. Every operation keeps the time it was scheduled to start, and its
+ * latency is measured from then. Time an operation spends waiting for a free
+ * lane is counted, so a slow server cannot hide latency by slowing the client
+ * down.
+ *
+ * Latencies are recorded in microseconds as the histograms
+ * "client.load.read_us" and "client.load.write_us", and the time operations
+ * wait for a lane as "client.load.queue_us".
+ *
+ */
+class LoadGenerator {
+   public:
+    using clock_t = std::chrono::steady_clock;
+
+    /**
+     * @brief A single operation to perform.
+     *
+     */
+    struct Operation {
+        bool write;
+
+        // Index of the file to operate on.
+        std::size_t file;
+
+        clock_t::time_point scheduled_at;
+
+        // The operation was scheduled after the warmup.
+        bool measured;
+    };
+
+    using operation_callback_t =
+        std::function<void(util::optional<Operation>)>;
+
+    LoadGenerator(Components& components, const Workload& workload,
+                  std::size_t num_files);
+
+    /**
+     * @brief Starts generating operations, beginning with the warmup.
+     *
+     */
+    void Start();
+
+    /**
+     * @brief Stops generating operations, and drops the ones not started,
+     * counting them as "client.load.dropped".
+     *
+     * Lanes waiting for an operation are told there are no more.
+     *
+     */
+    void Stop();
+
+    /**
+     * @brief Waits for the next operation.
+     *
+     * @param callback Called with the operation, or with none once no more
+     * operations will be generated
+     */
+    void Next(const operation_callback_t& callback);
+
+    /**
+     * @brief Records that the given operation is done.
+     *
+     * @param operation
+     */
+    void Complete(const Operation& operation);
+
+   private:
+    /**
+     * @brief Generates every operation due by now, hands them to waiting
+     * lanes, and schedules the next arrival.
+     *
+     */
+    void Arrive();
+
+    /**
+     * @brief Gets the time between the last operation and the next one.
+     *
+     * Must be called with the lock held.
+     *
+     * @return clock_t::duration
+     */
+    clock_t::duration NextGap();
+
+    /**
+     * @brief Picks the file for a new operation.
+     *
+     * Must be called with the lock held.
+     *
+     * @return std::size_t
+     */
+    std::size_t NextFile();
+
+    /**
+     * @brief Takes every waiting lane that can be handed an operation or told
+     * there are none left.
+     *
+     * Must be called with the lock held.
+     *
+     * @return std::vector<std::function<void()>> Calls to make without the
+     * lock held
+     */
+    std::vector<std::function<void()>> Dispatch();
+
+    /**
+     * @brief Logs the throughput reached during the measurement.
+     *
+     */
+    void Summarize();
+
+    Components& components_;
+    Workload workload_;
+
+    // Cumulative distribution of file popularity, by file index.
+    std::vector<double> file_cdf_;
+
+    std::mutex mutex_;
+    std::mt19937_64 rng_;
+    bool running_;
+    bool done_generating_;
+    thread::TimerService::timer_id_t timer_id_;
+    clock_t::time_point next_arrival_;
+    clock_t::time_point measure_from_;
+    util::optional<clock_t::time_point> measure_until_;
+    std::deque<Operation> backlog_;
+    std::deque<operation_callback_t> waiting_;
+    std::size_t in_flight_;
+    std::uint64_t measured_completed_;
+    clock_t::time_point last_measured_done_;
+    bool summarized_;
+
+    util::metrics::counter& issued_;
+    util::metrics::counter& completed_;
+    util::metrics::counter& dropped_;
+    util::metrics::gauge& backlog_size_;
+    util::metrics::histogram& read_us_;
+    util::metrics::histogram& write_us_;
+    util::metrics::histogram& queue_us_;
+};
+
+}  // namespace service
+}  // namespace client
+}  // namespace net
+
+#endif  // NET_CLIENT_SERVICE_LOAD_GENERATOR_
\ No newline at end of file
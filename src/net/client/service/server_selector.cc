@@ -0,0 +1,260 @@
+#include "server_selector.h"
+
+#include <net/location.h>
+#include <util/mutex.h>
+#include <util/number.h>
+#include <util/strings.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <utility>
+
+namespace net {
+namespace client {
+namespace service {
+
+namespace {
+
+// Weight of the newest response in the smoothed latency of a server.
+constexpr double kLatencyWeight = 0.3;
+
+// Reads answered before hedging starts, so the delay is not a guess.
+constexpr std::uint64_t kMinHedgeSamples = 100;
+
+// Reads answered between recomputing the hedging delay.
+constexpr std::uint64_t kHedgeRefreshInterval = 32;
+
+// The hedging delay follows the reads of the last one to two windows, so it
+// adapts when the latency of the servers changes.
+constexpr std::chrono::seconds kHedgeWindow(10);
+
+/**
+ * @brief Checks if a server location resolves to a loopback address.
+ *
+ * @param server
+ * @return true
+ * @return false
+ */
+bool IsLoopback(const std::string& server) {
+    auto host_port = util::strings::split(server, ':');
+    auto location = Location::FromHostName(host_port[0]);
+    return location.is_ok() &&
+           (ntohl(location.ok().address) >> 24) == IN_LOOPBACKNET;
+}
+
+}  // namespace
+
+ServerSelector::ServerStats::ServerStats(bool local)
+    : local_(local), outstanding_(0), latency_us_(0), sampled_(false) {}
+
+std::size_t ServerSelector::ServerStats::Outstanding() const {
+    return outstanding_;
+}
+
+double ServerSelector::ServerStats::LatencyUs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latency_us_;
+}
+
+bool ServerSelector::ServerStats::IsLocal() const { return local_; }
+
+util::result<std::unique_ptr<ServerSelector>, Error>
+ServerSelector::FromProperties(const program::Properties& props,
+                               const std::vector<std::string>& servers,
+                               util::metrics::registry& registry) {
+    Strategy strategy = Strategy::kRandom;
+    auto selection = props.Get("client_read_selection");
+    if (selection.has_value()) {
+        const std::pair<const char*, Strategy> strategies[] = {
+            {"random", Strategy::kRandom},
+            {"least_outstanding", Strategy::kLeastOutstanding},
+            {"p2c", Strategy::kPowerOfTwoChoices},
+            {"local", Strategy::kLocal},
+        };
+        auto it = std::find_if(
+            std::begin(strategies), std::end(strategies),
+            [&selection](const std::pair<const char*, Strategy>& pair) {
+                return selection.value() == pair.first;
+            });
+        if (it == std::end(strategies)) {
+            return Error::Create(
+                "Invalid \"client_read_selection\" property, must be "
+                "\"random\", \"least_outstanding\", \"p2c\", or \"local\"");
+        }
+        strategy = it->second;
+    }
+
+    bool hedging = false;
+    auto hedging_prop = props.Get("client_read_hedging");
+    if (hedging_prop.has_value()) {
+        if (hedging_prop.value() != "true" && hedging_prop.value() != "false") {
+            return Error::Create(
+                "Invalid \"client_read_hedging\" property, must be \"true\" "
+                "or \"false\"");
+        }
+        hedging = hedging_prop.value() == "true";
+    }
+
+    double hedge_percentile = 95;
+    auto percentile_prop = props.Get("client_read_hedge_percentile");
+    if (percentile_prop.has_value()) {
+        auto result = util::num::string_to_num<double>(percentile_prop.value());
+        if (result.is_err() || result.ok() <= 0 || result.ok() >= 100) {
+            return Error::Create(
+                "Invalid \"client_read_hedge_percentile\" property, must be "
+                "between 0 and 100");
+        }
+        hedge_percentile = result.ok();
+    }
+
+    std::unique_ptr<ServerSelector> selector(
+        new ServerSelector(strategy, hedging, hedge_percentile, registry));
+    auto local_prop = props.Get("client_local_servers");
+    std::set<std::string> local_servers;
+    if (local_prop.has_value()) {
+        for (auto& server : util::strings::split(local_prop.value(), ',')) {
+            local_servers.insert(std::move(server));
+        }
+    }
+    for (const auto& server : servers) {
+        bool local = local_prop.has_value() ? local_servers.count(server) > 0
+                                            : IsLoopback(server);
+        selector->stats_.emplace(server,
+                                 std::unique_ptr<ServerStats>(
+                                     new ServerStats(local)));
+    }
+    return selector;
+}
+
+ServerSelector::ServerSelector(Strategy strategy, bool hedging,
+                               double hedge_percentile,
+                               util::metrics::registry& registry)
+    : strategy_(strategy),
+      hedging_(hedging),
+      hedge_percentile_(hedge_percentile),
+      hedge_delay_us_(0),
+      window_rotated_(clock_t::now()),
+      hedge_delay_gauge_(registry.get_gauge("client.read.hedge_delay_us")) {}
+
+ServerSelector::ServerStats& ServerSelector::StatsFor(
+    const std::string& server) {
+    return *stats_.at(server);
+}
+
+std::size_t ServerSelector::Pick(
+    const std::vector<const ServerStats*>& servers, std::mt19937& rng) const {
+    std::uniform_int_distribution<std::size_t> dis(0, servers.size() - 1);
+    switch (strategy_) {
+        case Strategy::kRandom:
+            return dis(rng);
+        case Strategy::kPowerOfTwoChoices: {
+            if (servers.size() == 1) {
+                return 0;
+            }
+            std::size_t first = dis(rng);
+            std::uniform_int_distribution<std::size_t> other_dis(
+                0, servers.size() - 2);
+            std::size_t second = other_dis(rng);
+            if (second >= first) {
+                ++second;
+            }
+            // A server never heard from costs nothing, so it is tried.
+            auto cost = [&servers](std::size_t i) {
+                return servers[i]->LatencyUs() *
+                       (servers[i]->Outstanding() + 1);
+            };
+            return cost(second) < cost(first) ? second : first;
+        }
+        case Strategy::kLeastOutstanding:
+        case Strategy::kLocal:
+            break;
+    }
+
+    bool any_local =
+        strategy_ == Strategy::kLocal &&
+        std::any_of(servers.begin(), servers.end(),
+                    [](const ServerStats* stats) { return stats->IsLocal(); });
+
+    // Start at a random server, so ties are broken randomly.
+    std::size_t start = dis(rng);
+    std::size_t best = servers.size();
+    std::size_t best_outstanding = std::numeric_limits<std::size_t>::max();
+    for (std::size_t n = 0; n < servers.size(); ++n) {
+        std::size_t i = (start + n) % servers.size();
+        if (any_local && !servers[i]->IsLocal()) {
+            continue;
+        }
+        std::size_t outstanding = servers[i]->Outstanding();
+        if (outstanding < best_outstanding) {
+            best = i;
+            best_outstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+void ServerSelector::Begin(ServerStats& stats) { ++stats.outstanding_; }
+
+void ServerSelector::End(ServerStats& stats, clock_t::duration latency,
+                         bool read) {
+    --stats.outstanding_;
+    if (!read) {
+        return;
+    }
+
+    double latency_us =
+        std::chrono::duration<double, std::micro>(latency).count();
+    CRITICAL_SECTION(stats.mutex_, {
+        stats.latency_us_ =
+            stats.sampled_ ? kLatencyWeight * latency_us +
+                                 (1 - kLatencyWeight) * stats.latency_us_
+                           : latency_us;
+        stats.sampled_ = true;
+    });
+
+    if (!hedging_) {
+        return;
+    }
+    read_latencies_.observe(static_cast<std::uint64_t>(latency_us));
+    if (read_latencies_.count() % kHedgeRefreshInterval == 0) {
+        RefreshHedgeDelay();
+    }
+}
+
+void ServerSelector::RefreshHedgeDelay() {
+    CRITICAL_SECTION(window_mutex_, {
+        clock_t::time_point now = clock_t::now();
+        util::metrics::hdr_histogram::snapshot current =
+            read_latencies_.take_snapshot();
+        if (now - window_rotated_ >= kHedgeWindow) {
+            previous_window_ = std::move(current_window_);
+            current_window_ = current;
+            window_rotated_ = now;
+        }
+
+        // Until the recent windows have enough reads, the last delay stands.
+        util::metrics::hdr_histogram::snapshot recent =
+            current.since(previous_window_);
+        if (recent.count() < kMinHedgeSamples) {
+            return;
+        }
+        std::uint64_t delay_us = recent.percentile(hedge_percentile_);
+        hedge_delay_us_ = std::max<std::uint64_t>(delay_us, 1);
+        hedge_delay_gauge_.set(hedge_delay_us_);
+    });
+}
+
+bool ServerSelector::Hedges() const { return hedging_; }
+
+util::optional<std::chrono::microseconds> ServerSelector::HedgeDelay() const {
+    std::uint64_t delay_us = hedge_delay_us_;
+    if (delay_us == 0) {
+        return util::none;
+    }
+    return std::chrono::microseconds(delay_us);
+}
+
+}  // namespace service
+}  // namespace client
+}  // namespace net
\ No newline at end of file
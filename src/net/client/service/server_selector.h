@@ -0,0 +1,173 @@
+#ifndef NET_CLIENT_SERVICE_SERVER_SELECTOR_
+#define NET_CLIENT_SERVICE_SERVER_SELECTOR_
+
+#include <net/error.h>
+#include <program/properties.h>
+#include <util/metrics.h>
+#include <util/optional.h>
+#include <util/result.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace net {
+namespace client {
+namespace service {
+
+/**
+ * @brief Picks the server each read is sent to, from the load and latency
+ * observed on every server across all lanes of a client.
+ *
+ * The strategy is read from the "client_read_selection" property:
+ * "random" (default) picks any server, "least_outstanding" picks the server
+ * with the fewest requests in progress, "p2c" picks the better of two random
+ * servers by their smoothed latency weighted by requests in progress, and
+ * "local" picks the least loaded of the servers listed in
+ * "client_local_servers" (or, if not set, the servers on a loopback address),
+ * falling back to every server if none are.
+ *
+ * With "client_read_hedging=true", a read still unanswered after the
+ * "client_read_hedge_percentile" (95 by default) of recent read latencies is
+ * also sent to another server, and the first response is used.
+ *
+ */
+class ServerSelector {
+   public:
+    using clock_t = std::chrono::steady_clock;
+
+    enum class Strategy {
+        kRandom,
+        kLeastOutstanding,
+        kPowerOfTwoChoices,
+        kLocal,
+    };
+
+    /**
+     * @brief Load and latency of a single server.
+     *
+     */
+    class ServerStats {
+       public:
+        explicit ServerStats(bool local);
+
+        std::size_t Outstanding() const;
+
+        /**
+         * @brief Gets the smoothed response latency in microseconds, or 0 if
+         * no response was seen yet.
+         *
+         * @return double
+         */
+        double LatencyUs() const;
+
+        bool IsLocal() const;
+
+       private:
+        const bool local_;
+        std::atomic<std::size_t> outstanding_;
+        mutable std::mutex mutex_;
+        double latency_us_;
+        bool sampled_;
+
+        friend class ServerSelector;
+    };
+
+    /**
+     * @brief Reads the strategy and hedging from properties, and tracks the
+     * given servers.
+     *
+     * @param props
+     * @param servers Locations of the servers, as listed in "servers"
+     * @param registry
+     * @return util::result<std::unique_ptr<ServerSelector>, Error>
+     */
+    static util::result<std::unique_ptr<ServerSelector>, Error>
+    FromProperties(const program::Properties& props,
+                   const std::vector<std::string>& servers,
+                   util::metrics::registry& registry);
+
+    /**
+     * @brief Gets the stats of the server at the given location.
+     *
+     * @param server
+     * @return ServerStats&
+     */
+    ServerStats& StatsFor(const std::string& server);
+
+    /**
+     * @brief Picks one of the given servers for a read.
+     *
+     * @param servers
+     * @param rng
+     * @return std::size_t Index into the given servers
+     */
+    std::size_t Pick(const std::vector<const ServerStats*>& servers,
+                     std::mt19937& rng) const;
+
+    /**
+     * @brief Records that a request was sent to a server.
+     *
+     * @param stats
+     */
+    void Begin(ServerStats& stats);
+
+    /**
+     * @brief Records that a server answered a request.
+     *
+     * @param stats
+     * @param latency Time between sending the request and the response
+     * @param read Only read latencies are used to pick servers
+     */
+    void End(ServerStats& stats, clock_t::duration latency, bool read);
+
+    bool Hedges() const;
+
+    /**
+     * @brief Gets the time to wait for a response before hedging a read, or
+     * none until enough reads have been answered to know it.
+     *
+     * @return util::optional<std::chrono::microseconds>
+     */
+    util::optional<std::chrono::microseconds> HedgeDelay() const;
+
+   private:
+    ServerSelector(Strategy strategy, bool hedging, double hedge_percentile,
+                   util::metrics::registry& registry);
+
+    /**
+     * @brief Recomputes the hedging delay from the reads of the current and
+     * previous window, rotating the windows when the current one is over.
+     *
+     */
+    void RefreshHedgeDelay();
+
+    const Strategy strategy_;
+    const bool hedging_;
+    const double hedge_percentile_;
+    std::map<std::string, std::unique_ptr<ServerStats>> stats_;
+
+    // Latencies of every read response, to hedge by.
+    util::metrics::hdr_histogram read_latencies_;
+    std::atomic<std::uint64_t> hedge_delay_us_;
+
+    // Read latencies as of the start of the current and previous window.
+    std::mutex window_mutex_;
+    util::metrics::hdr_histogram::snapshot current_window_;
+    util::metrics::hdr_histogram::snapshot previous_window_;
+    clock_t::time_point window_rotated_;
+
+    util::metrics::gauge& hedge_delay_gauge_;
+};
+
+}  // namespace service
+}  // namespace client
+}  // namespace net
+
+#endif  // NET_CLIENT_SERVICE_SERVER_SELECTOR_
\ No newline at end of file
@@ -4,8 +4,9 @@ namespace net {
 
 Components::Components(const program::Options& options)
     : options(options),
-      // TODO: Make this an option.
-      thread_pool(8),
+      thread_pool(options.threads),
+      timer_service(thread_pool),
+      reactor(thread_pool),
       temp_file_service(options.temp_directory) {}
 
 }  // namespace net
\ No newline at end of file
@@ -1,10 +1,13 @@
 #ifndef NET_COMPONENTS_
 #define NET_COMPONENTS_
 
+#include <net/reactor.h>
 #include <net/shared/temp_file_service.h>
 #include <program/options.h>
 #include <program/properties.h>
 #include <thread/thread_pool.h>
+#include <thread/timer_service.h>
+#include <util/metrics.h>
 
 namespace net {
 
@@ -22,7 +25,10 @@ class Components {
     program::Options options;
     program::Properties props;
     thread::ThreadPool thread_pool;
+    thread::TimerService timer_service;
+    Reactor reactor;
     shared::TempFileService temp_file_service;
+    util::metrics::registry metrics;
 };
 
 }  // namespace net
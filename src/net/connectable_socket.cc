@@ -1,13 +1,25 @@
 #include "connectable_socket.h"
 
 #include <util/console.h>
+#include <util/mutex.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
+#include <random>
 
 namespace net {
 
-ConnectableSocket::ConnectableSocket(int timeout, int retry_timeout)
-    : Socket(timeout), retry_timeout_(retry_timeout) {}
+ConnectableSocket::ConnectableSocket(Components& components)
+    : Socket(components.options.timeout),
+      components_(components),
+      retry_timeout_(components.options.retry_timeout),
+      canceled_(false),
+      target_(0, 0),
+      attempt_(0) {}
+
+ConnectableSocket::~ConnectableSocket() { Close(); }
 
 util::result<void, Error> ConnectableSocket::Bind(std::uint16_t port) {
     struct addrinfo hints, *addr;
@@ -50,73 +62,171 @@ util::result<void, Error> ConnectableSocket::Listen(
 void ConnectableSocket::Connect(const std::string& hostname, std::uint16_t port,
                                 const connect_callback_t& callback,
                                 std::size_t retries) {
-    // To make our life easier, we let this call block the thread. We can't
-    // really do anything until we're connected anyway.
-    SetNonBlocking(false);
-
-    sockaddr_in server_addr;
-    hostent* server = ::gethostbyname(hostname.data());
-    if (!server) {
+    auto target = Location::FromHostName(hostname, port);
+    if (target.is_err()) {
         callback(Error::Create("No such host"));
         return;
     }
 
+    CRITICAL_SECTION(mutex_, {
+        target_ = target.ok();
+        callback_ = callback;
+        attempt_ = 0;
+        // Retries keep going for as long as the old fixed retry interval
+        // allowed, but start much sooner. The deadline saturates, so infinite
+        // retries never give up.
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::milliseconds interval(retry_timeout_);
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::time_point::max() - now);
+        if (retries == kInfiniteRetries ||
+            (interval.count() > 0 &&
+             retries > static_cast<std::size_t>(remaining / interval))) {
+            deadline_ = std::chrono::steady_clock::time_point::max();
+        } else {
+            deadline_ =
+                now + interval * static_cast<std::chrono::milliseconds::rep>(
+                                     retries);
+        }
+    });
+    Attempt();
+}
+
+void ConnectableSocket::Attempt() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    retry_timer_.reset();
+    if (canceled_) {
+        util::safe_debug::log("Stopping connection attempts");
+        return;
+    }
+
+    sockaddr_in server_addr;
     std::memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    std::memmove(&server_addr.sin_addr.s_addr, server->h_addr,
-                 server->h_length);
-    server_addr.sin_port = ::htons(port);
-
-    std::size_t attempts = std::max(retries, retries + 1);
-    for (std::size_t attempt = 0; attempt < attempts; ++attempt) {
-        if (attempt != 0) {
-            // Wait for retry timeout.
-            // Using a conditional variable allows this timeout to be
-            // canceled.
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto result =
-                cv_.wait_for(lock, std::chrono::milliseconds(retry_timeout_));
-            if (result == std::cv_status::no_timeout) {
-                util::safe_debug::log("Stopping connection attempts");
-                return;
-            }
-        }
+    server_addr.sin_addr.s_addr = target_.address;
+    server_addr.sin_port = ::htons(target_.port);
+
+    int res = ::connect(sockfd_, reinterpret_cast<sockaddr*>(&server_addr),
+                        sizeof(server_addr));
+    if (res == 0 || errno != EINPROGRESS) {
+        int error = res == 0 ? 0 : errno;
+        lock.unlock();
+        FinishAttempt(error);
+        return;
+    }
+
+    // The connection completes in the background, and the socket becomes
+    // writable once it does.
+    auto result = components_.reactor.Await(
+        sockfd_, Reactor::Event::kWrite, [this]() {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            CRITICAL_SECTION(mutex_, {
+                if (canceled_) {
+                    return;
+                }
+                if (::getsockopt(sockfd_, SOL_SOCKET, SO_ERROR, &error, &len) <
+                    0) {
+                    error = errno;
+                }
+            });
+            FinishAttempt(error);
+        });
+    if (result.is_err()) {
+        connect_callback_t callback = callback_;
+        lock.unlock();
+        callback(result.err());
+    }
+}
+
+void ConnectableSocket::FinishAttempt(int error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (canceled_) {
+        util::safe_debug::log("Stopping connection attempts");
+        return;
+    }
+    connect_callback_t callback = callback_;
 
-        int res = ::connect(sockfd_, reinterpret_cast<sockaddr*>(&server_addr),
-                            sizeof(server_addr));
-        if (res < 0) {
-            if (errno == ECONNREFUSED) {
-                util::safe_debug::stream("Attempt ", attempt + 1,
-                                         ": failed to connect to ", hostname,
-                                         ':', port, ", waiting to retry",
-                                         util::manip::endl);
+    if (error == 0) {
+        SetState(SocketState::kConnected);
+        lock.unlock();
+        callback(util::ok);
+        return;
+    }
 
-                continue;
-            }
+    ++attempt_;
+    bool retryable = error == ECONNREFUSED || error == ETIMEDOUT ||
+                     error == EHOSTUNREACH || error == ENETUNREACH;
+    if (!retryable) {
+        lock.unlock();
+        errno = error;
+        callback(Error::CreateFromErrNo("Failed to connect"));
+        return;
+    }
 
-            callback(Error::CreateFromErrNo("Failed to connect"));
-            return;
-        } else {
-            SetState(SocketState::kConnected);
-            SetNonBlocking(true);
-            callback(util::ok);
-            return;
-        }
+    auto delay = Backoff(attempt_);
+    if (std::chrono::steady_clock::now() + delay > deadline_) {
+        std::size_t attempts = attempt_;
+        Location target = target_;
+        lock.unlock();
+        callback(Error::Create(util::string::stream(
+            "Failed to connect to ", target, " in ", attempts, " attempt",
+            attempts == 1 ? "" : "s")));
+        return;
     }
 
-    callback(Error::Create(util::string::stream(
-        "Failed to connect to ", hostname, ':', port, " in ", attempts,
-        " attempt", attempts == 1 ? "" : "s")));
+    util::safe_debug::stream("Attempt ", attempt_, ": failed to connect to ",
+                             target_, ", retrying in ", delay.count(), "ms",
+                             util::manip::endl);
+
+    // A socket that failed to connect cannot be used again, so the next
+    // attempt uses a new one.
+    auto result = Socket::Close();
+    if (result.is_ok()) {
+        result = Initialize();
+    }
+    if (result.is_err()) {
+        lock.unlock();
+        callback(result.err());
+        return;
+    }
+
+    retry_timer_ =
+        components_.timer_service.ScheduleAfter(delay, [this]() { Attempt(); });
+}
+
+std::chrono::milliseconds ConnectableSocket::Backoff(std::size_t retry) const {
+    // Delays are jittered, so peers that start together do not retry in
+    // lockstep.
+    static constexpr std::uint64_t kInitialBackoffMs = 50;
+    static constexpr std::size_t kMaxDoublings = 20;
+
+    thread_local std::mt19937 rng{std::random_device()()};
+    std::uint64_t max_delay = static_cast<std::uint64_t>(retry_timeout_);
+    std::uint64_t delay =
+        std::min(kInitialBackoffMs << std::min(retry - 1, kMaxDoublings),
+                 max_delay);
+    std::uniform_int_distribution<std::uint64_t> jitter(delay / 2, delay);
+    return std::chrono::milliseconds(jitter(rng));
 }
 
 util::result<void, Error> ConnectableSocket::Close() {
-    cv_.notify_all();
+    CRITICAL_SECTION(mutex_, {
+        canceled_ = true;
+        if (retry_timer_.has_value()) {
+            components_.timer_service.Cancel(retry_timer_.value());
+            retry_timer_.reset();
+        }
+        if (!Closed()) {
+            components_.reactor.Cancel(sockfd_);
+        }
+    });
     return Socket::Close();
 }
 
 Socket ConnectableSocket::ToSocket() && {
     Socket out = Socket(sockfd_, state_, timeout_);
-    sockfd_ = 0;
+    sockfd_ = kInvalidSocket;
     state_ = SocketState::kClosed;
     return out;
 }
@@ -1,9 +1,13 @@
 #ifndef NET_CONNETABLE_SOCKET_
 #define NET_CONNETABLE_SOCKET_
 
+#include <net/components.h>
+#include <net/location.h>
 #include <net/socket.h>
+#include <thread/timer_service.h>
+#include <util/optional.h>
 
-#include <condition_variable>
+#include <chrono>
 #include <functional>
 #include <limits>
 #include <mutex>
@@ -15,6 +19,10 @@ namespace net {
  * @brief Interface for working with a socket that can be connected in various
  * ways.
  *
+ * Connecting never blocks a thread. Each attempt completes through the
+ * reactor, and retries wait on the timer service with jittered exponential
+ * backoff.
+ *
  */
 class ConnectableSocket : public Socket {
    public:
@@ -22,7 +30,8 @@ class ConnectableSocket : public Socket {
     static constexpr std::size_t kInfiniteRetries =
         std::numeric_limits<std::size_t>::max();
 
-    ConnectableSocket(int timeout, int retry_timeout);
+    ConnectableSocket(Components& components);
+    ~ConnectableSocket();
 
     /**
      * @brief Binds the socket to the given port.
@@ -44,11 +53,15 @@ class ConnectableSocket : public Socket {
     /**
      * @brief Connects the socket to a remote server.
      *
+     * Refused connections are retried after a delay that starts small and
+     * doubles up to the retry timeout. Retries stop once the retry timeout
+     * has passed as many times as there are retries.
+     *
      * @param hostname Target hostname
      * @param port Target port
      * @param callback Callback when connection is established or an error
      * occurs
-     * @param retries Number of retries allowed
+     * @param retries Number of retry timeouts to keep retrying for
      *
      */
     void Connect(const std::string& hostname, std::uint16_t port,
@@ -72,9 +85,38 @@ class ConnectableSocket : public Socket {
     Socket ToSocket() &&;
 
    private:
+    /**
+     * @brief Starts a single connection attempt.
+     *
+     */
+    void Attempt();
+
+    /**
+     * @brief Finishes a connection attempt, retrying it if allowed.
+     *
+     * @param error Error number of the attempt, or 0 if it succeeded
+     */
+    void FinishAttempt(int error);
+
+    /**
+     * @brief The delay before the given retry.
+     *
+     * @param retry Number of the retry, starting at 1
+     * @return std::chrono::milliseconds
+     */
+    std::chrono::milliseconds Backoff(std::size_t retry) const;
+
+    Components& components_;
     int retry_timeout_;
     std::mutex mutex_;
-    std::condition_variable cv_;
+    bool canceled_;
+
+    // State of the connection in progress.
+    Location target_;
+    connect_callback_t callback_;
+    std::size_t attempt_;
+    std::chrono::steady_clock::time_point deadline_;
+    util::optional<thread::TimerService::timer_id_t> retry_timer_;
 };
 
 }  // namespace net
@@ -4,6 +4,8 @@
 #include <unistd.h>
 
 #include <cstring>
+#include <mutex>
+#include <unordered_map>
 
 namespace net {
 
@@ -20,19 +22,41 @@ bool Location::operator==(const Location& rhs) const {
 bool Location::operator!=(const Location& rhs) const { return !(*this == rhs); }
 
 std::string Location::HostName() const {
-    return ::inet_ntoa(::in_addr{address});
+    char name[INET_ADDRSTRLEN];
+    ::in_addr addr{address};
+    return ::inet_ntop(AF_INET, &addr, name, sizeof(name));
 }
 
 util::result<Location, Error> Location::FromHostName(
     const std::string& hostname, port_t port) {
-    hostent* host_entry = ::gethostbyname(hostname.data());
-    if (!host_entry) {
-        return Error::Create("Host does not exist");
+    // Peers and servers are resolved over and over again while connecting,
+    // so every successful lookup is cached for the life of the process.
+    static std::mutex cache_mutex;
+    static std::unordered_map<std::string, address_t> cache;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.find(hostname);
+        if (it != cache.end()) {
+            return Location{it->second, port};
+        }
     }
 
-    address_t address;
-    std::memmove(&address, host_entry->h_addr, host_entry->h_length);
+    ::addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    ::addrinfo* info;
+    int res = ::getaddrinfo(hostname.data(), nullptr, &hints, &info);
+    if (res != 0) {
+        return Error::Create("Host does not exist");
+    }
+    address_t address =
+        reinterpret_cast<::sockaddr_in*>(info->ai_addr)->sin_addr.s_addr;
+    ::freeaddrinfo(info);
 
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache.emplace(hostname, address);
     return Location{address, port};
 }
 
@@ -68,7 +92,9 @@ util::result<Location, Error> Location::MyIpAddress() {
     }
 
     res = ::connect(sockfd, info->ai_addr, info->ai_addrlen);
+    ::freeaddrinfo(info);
     if (res < 0) {
+        ::close(sockfd);
         return Error::Create("Failed to connect to DNS sever");
     }
 
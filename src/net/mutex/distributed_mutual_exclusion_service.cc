@@ -3,12 +3,209 @@
 #include <net/client/client_components.h>
 #include <util/console.h>
 #include <util/mutex.h>
+#include <util/number.h>
 
 #include <algorithm>
+#include <future>
+#include <tuple>
+#include <utility>
 
 namespace net {
 namespace mutex {
 
+namespace {
+
+// Number of shards resources are partitioned into.
+constexpr std::size_t kNumShards = 16;
+
+// Time a leaving node waits for its requests to finish by default.
+constexpr std::size_t kDefaultDrainMs = 5000;
+
+using ResourceClock = std::chrono::steady_clock;
+
+const char* OpcodeName(proto::Opcode opcode) {
+    switch (opcode) {
+        case proto::Opcode::kRequest:
+            return "request";
+        case proto::Opcode::kReply:
+            return "reply";
+        case proto::Opcode::kRelease:
+            return "release";
+        case proto::Opcode::kInquire:
+            return "inquire";
+        case proto::Opcode::kRelinquish:
+            return "relinquish";
+        case proto::Opcode::kFailed:
+            return "failed";
+        case proto::Opcode::kTokenRequest:
+            return "token_request";
+        case proto::Opcode::kToken:
+            return "token";
+        default:
+            return "other";
+    }
+}
+
+void CountMessage(util::metrics::registry& registry,
+                  std::map<proto::Opcode, util::metrics::counter*>& counters,
+                  const std::string& prefix, proto::Opcode opcode) {
+    auto& counter = counters[opcode];
+    if (counter == nullptr) {
+        counter = &registry.get_counter(prefix + OpcodeName(opcode));
+    }
+    counter->increment();
+}
+
+std::uint64_t MicrosBetween(ResourceClock::time_point start,
+                            ResourceClock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+        .count();
+}
+
+// Messages a node only sends while asking for a resource for itself, as
+// opposed to the replies and votes it gives other nodes' requests.
+bool SentForOwnRequest(proto::Opcode opcode) {
+    return opcode == proto::Opcode::kRequest ||
+           opcode == proto::Opcode::kTokenRequest ||
+           opcode == proto::Opcode::kRelinquish;
+}
+
+// Messages a node only receives in answer to its own request for a resource.
+bool ReceivedForOwnRequest(proto::Opcode opcode) {
+    return opcode == proto::Opcode::kReply ||
+           opcode == proto::Opcode::kToken ||
+           opcode == proto::Opcode::kInquire ||
+           opcode == proto::Opcode::kFailed;
+}
+
+// Only messages that hand a resource over carry a release time.
+
+template <typename M>
+std::uint64_t ReleasedAt(const M&) {
+    return 0;
+}
+
+std::uint64_t ReleasedAt(const proto::mutex::ReplyMessage& msg) {
+    return msg.released_at;
+}
+
+std::uint64_t ReleasedAt(const proto::mutex::TokenMessage& msg) {
+    return msg.released_at;
+}
+
+}  // namespace
+
+DistributedMutualExclusionService::ResourceMetrics::ResourceMetrics(
+    util::metrics::registry& registry, const std::string& file_name)
+    : registry(registry),
+      prefix("mutex." + file_name + "."),
+      requests(registry.get_counter(prefix + "requests")),
+      immediate_entries(registry.get_counter(prefix + "immediate_entries")),
+      messages_per_cs(registry.get_histogram(prefix + "messages_per_cs")),
+      wait_us(registry.get_histogram(prefix + "wait_us")),
+      sync_delay_us(registry.get_histogram(prefix + "sync_delay_us")),
+      hold_us(registry.get_histogram(prefix + "hold_us")),
+      delayed_requests(registry.get_histogram(prefix + "delayed_requests")) {
+    // File names are unbounded, so they must not end up in metric names.
+    registry.label(prefix, "mutex.", "file", file_name);
+}
+
+void DistributedMutualExclusionService::ResourceMetrics::CountSent(
+    proto::Opcode opcode) {
+    CountMessage(registry, sent, prefix + "sent.", opcode);
+    if (waiting && SentForOwnRequest(opcode)) {
+        ++messages_for_request;
+    }
+}
+
+void DistributedMutualExclusionService::ResourceMetrics::CountReceived(
+    proto::Opcode opcode) {
+    CountMessage(registry, received, prefix + "received.", opcode);
+    if (waiting && ReceivedForOwnRequest(opcode)) {
+        ++messages_for_request;
+    }
+}
+
+DistributedMutualExclusionService::Shard::Shard(
+    DistributedMutualExclusionService& service,
+    thread::ThreadPool& thread_pool)
+    : service(service), executor(thread_pool) {}
+
+void DistributedMutualExclusionService::Shard::AddPeer(proto::node_id_t id) {
+    auto it = std::lower_bound(peer_ids.begin(), peer_ids.end(), id);
+    if (it != peer_ids.end() && *it == id) {
+        return;
+    }
+    peer_ids.insert(it, id);
+    for (auto& algorithm : algorithms) {
+        algorithm.second->OnPeerJoined(id);
+    }
+}
+
+void DistributedMutualExclusionService::Shard::RemovePeer(proto::node_id_t id) {
+    auto it = std::lower_bound(peer_ids.begin(), peer_ids.end(), id);
+    if (it == peer_ids.end() || *it != id) {
+        return;
+    }
+    peer_ids.erase(it);
+    for (auto& algorithm : algorithms) {
+        algorithm.second->OnPeerLeft(id);
+    }
+}
+
+proto::node_id_t DistributedMutualExclusionService::Shard::MyId() const {
+    return service.MyId();
+}
+
+const std::vector<proto::node_id_t>&
+DistributedMutualExclusionService::Shard::PeerIds() const {
+    return peer_ids;
+}
+
+const std::vector<proto::node_id_t>&
+DistributedMutualExclusionService::Shard::FoundingIds() const {
+    return founding_ids;
+}
+
+std::size_t DistributedMutualExclusionService::Shard::Timestamp() const {
+    return service.Timestamp();
+}
+
+void DistributedMutualExclusionService::Shard::ObserveTimestamp(
+    std::size_t timestamp) {
+    service.ObserveTimestamp(timestamp);
+}
+
+void DistributedMutualExclusionService::Shard::SendToPeer(
+    proto::node_id_t id, const std::string& file_name, proto::Message&& msg) {
+    service.SendToPeer(id, file_name, std::move(msg));
+}
+
+void DistributedMutualExclusionService::Shard::EnterCriticalSection(
+    const std::string& file_name) {
+    service.EnterCriticalSection(file_name);
+}
+
+void DistributedMutualExclusionService::Shard::RunAfter(
+    const std::string& file_name, std::chrono::milliseconds delay,
+    const std::function<void()>& job) {
+    service.RunAfter(file_name, delay, job);
+}
+
+const program::Properties& DistributedMutualExclusionService::Shard::Props()
+    const {
+    return service.components_.common.props;
+}
+
+void DistributedMutualExclusionService::Shard::RecordDelayedRequests(
+    const std::string& file_name, std::size_t count) {
+    service.RecordDelayedRequests(file_name, count);
+}
+
+util::metrics::registry& DistributedMutualExclusionService::Shard::Metrics() {
+    return service.components_.common.metrics;
+}
+
 DistributedMutualExclusionService::DistributedMutualExclusionService(
     client::ClientComponents& components,
     const ready_callback_t& ready_callback,
@@ -18,18 +215,55 @@ DistributedMutualExclusionService::DistributedMutualExclusionService(
       ready_callback_(ready_callback),
       error_callback_(error_callback),
       network_manager_(components_.common),
+      drain_timeout_(kDefaultDrainMs),
+      heartbeats_running_(false),
+      heartbeat_timer_(0),
+      network_connected_(false),
       timestamp_(0),
-      state_(State::kWaiting) {}
+      active_requests_(0),
+      leaving_(false) {
+    shards_.reserve(kNumShards);
+    for (std::size_t i = 0; i < kNumShards; ++i) {
+        shards_.emplace_back(new Shard(*this, components_.common.thread_pool));
+    }
+}
 
 std::size_t DistributedMutualExclusionService::Timestamp() const {
-    return timestamp_;
+    return timestamp_.load(std::memory_order_acquire);
 }
 
 util::result<void, Error> DistributedMutualExclusionService::SetUp() {
-    return util::ok;
+    auto algorithm_prop = components_.common.props.Get("mutex_algorithm");
+    default_algorithm_ = algorithm_prop.has_value()
+                             ? std::move(algorithm_prop).value()
+                             : "ricart_agrawala";
+
+    // Create the default algorithm now to catch a bad name early. No jobs are
+    // running yet, so the shards can be accessed directly.
+    for (auto& shard : shards_) {
+        RETURN_IF_ERROR(AlgorithmByName(*shard, default_algorithm_));
+    }
+
+    auto drain_ms = components_.common.props.Get("peer_drain_timeout_ms");
+    if (drain_ms.has_value()) {
+        auto result = util::num::string_to_num<std::size_t>(drain_ms.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"peer_drain_timeout_ms\" property");
+        }
+        drain_timeout_ = std::chrono::milliseconds(result.ok());
+    }
+    return failure_detector_.Configure(components_.common.props);
 }
 
 util::result<void, Error> DistributedMutualExclusionService::OnStart() {
+    network_manager_.SetReconnectedCallback(
+        [this](const peer::PeerConnectionReference& connection) {
+            OnPeerReconnected(connection);
+        });
+    network_manager_.SetJoinedCallback(
+        [this](const peer::PeerConnectionReference& connection) {
+            OnPeerJoined(connection);
+        });
     network_manager_.AwaitConnected(
         [this](util::result<typename peer::PeerNetworkManager::PeerNetworkList,
                             Error>
@@ -45,71 +279,435 @@ util::result<void, Error> DistributedMutualExclusionService::OnStart() {
 }
 
 util::result<void, Error> DistributedMutualExclusionService::CleanUp() {
-    for (auto& entry : network_) {
-        entry.service->Stop();
+    if (network_manager_.DynamicMembership() &&
+        network_connected_.load(std::memory_order_acquire)) {
+        if (network_manager_.IsConnected()) {
+            Leave();
+        } else {
+            util::safe_error_log::log(
+                "Peer network is not connected, so this node stops without "
+                "leaving");
+        }
     }
+
+    CRITICAL_SECTION(services_mutex_, {
+        if (heartbeats_running_) {
+            heartbeats_running_ = false;
+            components_.common.timer_service.Cancel(heartbeat_timer_);
+        }
+        for (auto& service : services_) {
+            service.second->Stop();
+        }
+    });
     return network_manager_.Stop();
 }
 
 void DistributedMutualExclusionService::OnNetworkConnected(
     typename peer::PeerNetworkManager::PeerNetworkList network) {
-    network_.reserve(network.size());
-    for (auto& connection : network) {
-        network_.emplace_back(PeerNetworkEntry{connection, nullptr});
-        auto& back = network_.back();
-        back.service.reset(
-            new MutualExclusionService(components_.common, back.connection));
-        back.service->StartReceivingMessages(
-            [this, &back](util::result<proto::Message, Error> result) {
-                OnReceiveMessage(back, std::move(result));
+    // A peer that joined before the network was handed to this service is
+    // added as a new member, even if it is part of the network.
+    std::vector<proto::node_id_t> peer_ids;
+    CRITICAL_SECTION(services_mutex_, {
+        for (auto& connection : network) {
+            if (early_joins_.find(connection.id) == early_joins_.end()) {
+                peer_ids.push_back(connection.id);
+            }
+        }
+    });
+    std::sort(peer_ids.begin(), peer_ids.end());
+
+    // A node that joins a running network does not know who founded it.
+    std::vector<proto::node_id_t> founding_ids;
+    if (!network_manager_.Joining()) {
+        founding_ids = peer_ids;
+        founding_ids.insert(
+            std::upper_bound(founding_ids.begin(), founding_ids.end(), MyId()),
+            MyId());
+    }
+
+    // No message has been received and no request has been made, so the
+    // shards can still be accessed directly.
+    for (auto& shard : shards_) {
+        shard->peer_ids = peer_ids;
+        shard->founding_ids = founding_ids;
+        for (auto& algorithm : shard->algorithms) {
+            algorithm.second->OnNetworkConnected();
+        }
+    }
+
+    // Only start receiving once the algorithms are ready for messages.
+    bool ready;
+    CRITICAL_SECTION(services_mutex_, {
+        network_connected_.store(true, std::memory_order_release);
+        if (network_manager_.Joining()) {
+            awaiting_members_.insert(peer_ids.begin(), peer_ids.end());
+        }
+        for (auto& connection : network) {
+            if (early_joins_.find(connection.id) == early_joins_.end()) {
+                auto early = early_reconnects_.find(connection.id);
+                InstallService(early == early_reconnects_.end()
+                                   ? connection
+                                   : early->second);
+            }
+        }
+        for (auto& pair : early_joins_) {
+            auto early = early_reconnects_.find(pair.first);
+            AddMember(early == early_reconnects_.end() ? pair.second
+                                                       : early->second);
+        }
+        early_reconnects_.clear();
+        early_joins_.clear();
+
+        if (failure_detector_.Enabled()) {
+            heartbeats_running_ = true;
+            ScheduleHeartbeats();
+        }
+        ready = awaiting_members_.empty();
+    });
+
+    // A joining node is ready once every member has listed the others.
+    if (ready) {
+        network_manager_.OpenToJoins();
+        ready_callback_(util::ok);
+    }
+}
+
+void DistributedMutualExclusionService::OnPeerReconnected(
+    const peer::PeerConnectionReference& connection) {
+    CRITICAL_SECTION(services_mutex_, {
+        if (!network_connected_.load(std::memory_order_acquire)) {
+            early_reconnects_.erase(connection.id);
+            early_reconnects_.emplace(connection.id, connection);
+            return;
+        }
+
+        // Algorithms resend before any message from the new connection is
+        // delivered, and after every message from the old connection.
+        proto::node_id_t id = connection.id;
+        for (auto& shard : shards_) {
+            Shard* raw = shard.get();
+            shard->executor.Schedule([raw, id]() {
+                for (auto& algorithm : raw->algorithms) {
+                    algorithm.second->OnPeerReconnected(id);
+                }
             });
+        }
+        InstallService(connection);
+    });
+}
+
+void DistributedMutualExclusionService::OnPeerJoined(
+    const peer::PeerConnectionReference& connection) {
+    CRITICAL_SECTION(services_mutex_, {
+        if (!network_connected_.load(std::memory_order_acquire)) {
+            early_joins_.erase(connection.id);
+            early_joins_.emplace(connection.id, connection);
+            return;
+        }
+        AddMember(connection);
+    });
+}
+
+void DistributedMutualExclusionService::AddMember(
+    const peer::PeerConnectionReference& connection) {
+    proto::node_id_t id = connection.id;
+    proto::MembersMessage members;
+    for (auto& pair : services_) {
+        if (pair.first != id) {
+            members.ids.push_back(pair.first);
+        }
+    }
+
+    // Algorithms learn about the new member before any message from it is
+    // delivered.
+    for (auto& shard : shards_) {
+        Shard* raw = shard.get();
+        shard->executor.Schedule([raw, id]() { raw->AddPeer(id); });
     }
+    InstallService(connection);
+
+    peer::PeerConnectionReference peer_connection = connection;
+    services_[id]->SendMessage(
+        std::move(members).ToMessage(),
+        [this, peer_connection](util::result<void, Error> result) {
+            OnSendMessage(peer_connection, std::move(result));
+        });
+}
 
-    ready_callback_(util::ok);
+void DistributedMutualExclusionService::RemoveMember(
+    const peer::PeerConnectionReference& connection) {
+    proto::node_id_t id = connection.id;
+    bool ready = false;
+    CRITICAL_SECTION(services_mutex_, {
+        if (!IsCurrent(connection)) {
+            return;
+        }
+
+        auto it = services_.find(id);
+        it->second->Stop();
+        services_.erase(it);
+        failure_detector_.Unwatch(id);
+
+        // Algorithms stop waiting on the peer after every message it sent.
+        for (auto& shard : shards_) {
+            Shard* raw = shard.get();
+            shard->executor.Schedule([raw, id]() { raw->RemovePeer(id); });
+        }
+        ready = awaiting_members_.erase(id) > 0 && awaiting_members_.empty();
+    });
+
+    // Closing the connection tells the peer that its Leave was read.
+    network_manager_.RemovePeer(id);
+    if (ready) {
+        network_manager_.OpenToJoins();
+        ready_callback_(util::ok);
+    }
+}
+
+void DistributedMutualExclusionService::OnMembers(
+    proto::node_id_t from, proto::MembersMessage members) {
+    util::optional<Error> error;
+    bool ready = false;
+    CRITICAL_SECTION(services_mutex_, {
+        if (awaiting_members_.erase(from) == 0) {
+            return;
+        }
+
+        // I only ask my peers for mutual exclusion, so every member must be
+        // one of them.
+        for (auto id : members.ids) {
+            if (id != MyId() && services_.find(id) == services_.end()) {
+                error = Error::Create(util::string::stream(
+                    "Peer ", id,
+                    " is a member of the network but is not listed in "
+                    "\"clients\""));
+                awaiting_members_.clear();
+                break;
+            }
+        }
+        ready = awaiting_members_.empty();
+    });
+
+    if (error.has_value()) {
+        ready_callback_(error.value());
+    } else if (ready) {
+        network_manager_.OpenToJoins();
+        ready_callback_(util::ok);
+    }
+}
+
+void DistributedMutualExclusionService::Leave() {
+    util::safe_console::log("Leaving the peer network");
+
+    // Requests already made finish first, so this node is not using anything
+    // its peers are waiting for.
+    bool drained;
+    {
+        std::unique_lock<std::mutex> lock(drain_mutex_);
+        leaving_ = true;
+        drained = drained_.wait_for(
+            lock, drain_timeout_, [this]() { return active_requests_ == 0; });
+    }
+    if (!drained) {
+        util::safe_error_log::log(
+            "Requests did not finish in time, so this node stops without "
+            "leaving");
+        return;
+    }
+
+    // Messages to a peer are sent in order, so whatever the algorithms hand
+    // over arrives before the peer hears that this node left.
+    using handed_over_t = util::result<void, Error>;
+    std::vector<std::future<handed_over_t>> handed_over;
+    for (auto& shard : shards_) {
+        auto done = std::make_shared<std::promise<handed_over_t>>();
+        handed_over.push_back(done->get_future());
+        Shard* raw = shard.get();
+        shard->executor.Schedule([raw, done]() {
+            for (auto& algorithm : raw->algorithms) {
+                auto result = algorithm.second->OnLeaving();
+                if (result.is_err()) {
+                    done->set_value(std::move(result));
+                    return;
+                }
+            }
+            done->set_value(util::ok);
+        });
+    }
+
+    // Shards usually run into the same error, so only the first is logged.
+    util::optional<Error> error;
+    for (auto& future : handed_over) {
+        auto result = future.get();
+        if (result.is_err() && !error.has_value()) {
+            error = std::move(result).err();
+        }
+    }
+    if (error.has_value()) {
+        util::safe_error_log::log("Cannot leave the peer network, so this node "
+                                  "stops as if it failed:",
+                                  error.value());
+        return;
+    }
+
+    network_manager_.Leave();
+    std::vector<std::shared_ptr<MutualExclusionService>> services;
+    CRITICAL_SECTION(services_mutex_, {
+        for (auto& pair : services_) {
+            services.push_back(pair.second);
+        }
+    });
+    for (auto& service : services) {
+        auto connection = service->Connection();
+        service->SendMessage(
+            proto::LeaveMessage().ToMessage(),
+            [this, connection](util::result<void, Error> result) {
+                OnSendMessage(connection, std::move(result));
+            });
+    }
+
+    // Peers close their connections once they remove this node.
+    if (!network_manager_.AwaitPeersClosed(drain_timeout_)) {
+        util::safe_error_log::log("Not every peer saw this node leave");
+    }
+}
+
+void DistributedMutualExclusionService::InstallService(
+    const peer::PeerConnectionReference& connection) {
+    auto& service = services_[connection.id];
+    if (service) {
+        service->Stop();
+    }
+
+    service = std::make_shared<MutualExclusionService>(components_.common,
+                                                       connection);
+    failure_detector_.Watch(connection.id,
+                            peer::FailureDetector::clock_t::now());
+    service->StartReceivingMessages(
+        [this, connection](util::result<proto::Message, Error> result) {
+            OnReceiveMessage(connection, std::move(result));
+        });
+}
+
+bool DistributedMutualExclusionService::IsCurrent(
+    const peer::PeerConnectionReference& connection) const {
+    auto it = services_.find(connection.id);
+    return it != services_.end() &&
+           it->second->Connection().connection == connection.connection;
 }
 
 void DistributedMutualExclusionService::OnReceiveMessage(
-    PeerNetworkEntry& entry, util::result<proto::Message, Error> result) {
+    const peer::PeerConnectionReference& connection,
+    util::result<proto::Message, Error> result) {
     if (result.is_err()) {
-        network_manager_.ReportError(entry.connection.in,
-                                     [this](util::result<void, Error> result) {
-                                         OnNetworkRecovery(std::move(result));
-                                     });
+        ReportConnectionError(connection);
         return;
     }
 
     auto msg = std::move(result).ok();
-    switch (msg.opcode) {
-        case proto::Opcode::kError: {
-            // An Error message is sent between peers when a distributed
-            // operation fails.
-            //
-            // For now, we report an error here.
-            auto error = std::move(msg).ToError().ok();
-            util::safe_error_log::log("Received Error from a peer:",
-                                      error.message);
-            network_manager_.ReportError(
-                entry.connection.in, [this](util::result<void, Error> result) {
-                    OnNetworkRecovery(std::move(result));
-                });
-        } break;
-        case proto::Opcode::kReply: {
-            auto reply = std::move(msg).ToReply().ok();
-            std::string& file_name = reply.file_name;
+    if (msg.opcode == proto::Opcode::kHeartbeat) {
+        failure_detector_.Heartbeat(connection.id,
+                                    peer::FailureDetector::clock_t::now());
+        return;
+    }
 
-            util::safe_debug::log("Received Reply from peer",
-                                  static_cast<int>(entry.connection.id), "for",
-                                  file_name);
+    if (msg.opcode == proto::Opcode::kMembers) {
+        auto members = std::move(msg).ToMembers();
+        if (members.is_err()) {
+            util::safe_error_log::log("Received malformed message from peer",
+                                      connection.id, members.err());
+        } else {
+            OnMembers(connection.id, std::move(members).ok());
+        }
+        return;
+    }
 
-            // Replies force the timestamp higher.
-            CRITICAL_SECTION(state_mutex_, {
-                timestamp_ = std::max(reply.timestamp + 1, timestamp_ + 1);
-                entry.have_permission_for.emplace(file_name);
-            });
-            CheckForMutualExclusion();
-        } break;
+    if (msg.opcode == proto::Opcode::kLeave) {
+        RemoveMember(connection);
+        return;
+    }
+
+    if (msg.opcode == proto::Opcode::kError) {
+        // An Error message is sent between peers when a distributed
+        // operation fails.
+        //
+        // For now, we report an error here.
+        auto error = std::move(msg).ToError().ok();
+        util::safe_error_log::log("Received Error from a peer:",
+                                  error.message);
+        ReportConnectionError(connection);
+        return;
+    }
+
+    // A message from a replaced connection is dropped, because the peer
+    // resends anything still needed on the new connection.
+    CRITICAL_SECTION(services_mutex_, {
+        if (IsCurrent(connection)) {
+            DeliverToAlgorithm(connection.id, std::move(msg));
+        }
+    });
+}
+
+template <typename M>
+void DistributedMutualExclusionService::DeliverToAlgorithm(
+    proto::node_id_t from, proto::Opcode opcode, util::result<M, Error> result,
+    void (MutualExclusionAlgorithm::*handler)(proto::node_id_t, M)) {
+    if (result.is_err()) {
+        util::safe_error_log::log("Received malformed message from peer",
+                                  from, result.err());
+        return;
+    }
+
+    auto msg = std::move(result).ok();
+    auto& shard = ShardFor(msg.file_name);
+    shard.executor.Schedule([this, &shard, from, opcode, msg, handler]() {
+        auto algorithm = AlgorithmFor(shard, msg.file_name);
+        if (algorithm.is_err()) {
+            util::safe_error_log::log(algorithm.err());
+            return;
+        }
+        MetricsFor(shard, msg.file_name).CountReceived(opcode);
+        shard.delivering_released_at = ReleasedAt(msg);
+        (algorithm.ok()->*handler)(from, msg);
+        shard.delivering_released_at = 0;
+    });
+}
+
+void DistributedMutualExclusionService::DeliverToAlgorithm(
+    proto::node_id_t from, proto::Message&& msg) {
+    proto::Opcode opcode = msg.opcode;
+    switch (opcode) {
         case proto::Opcode::kRequest: {
-            OnReceiveRequest(entry, std::move(msg).ToRequest().ok());
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToRequest(),
+                               &MutualExclusionAlgorithm::OnRequest);
+        } break;
+        case proto::Opcode::kReply: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToReply(),
+                               &MutualExclusionAlgorithm::OnReply);
+        } break;
+        case proto::Opcode::kRelease: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToRelease(),
+                               &MutualExclusionAlgorithm::OnRelease);
+        } break;
+        case proto::Opcode::kInquire: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToInquire(),
+                               &MutualExclusionAlgorithm::OnInquire);
+        } break;
+        case proto::Opcode::kRelinquish: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToRelinquish(),
+                               &MutualExclusionAlgorithm::OnRelinquish);
+        } break;
+        case proto::Opcode::kFailed: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToFailed(),
+                               &MutualExclusionAlgorithm::OnFailed);
+        } break;
+        case proto::Opcode::kTokenRequest: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToTokenRequest(),
+                               &MutualExclusionAlgorithm::OnTokenRequest);
+        } break;
+        case proto::Opcode::kToken: {
+            DeliverToAlgorithm(from, opcode, std::move(msg).ToToken(),
+                               &MutualExclusionAlgorithm::OnToken);
         } break;
         default: {
             // Ignore invalid opcodes.
@@ -117,97 +715,137 @@ void DistributedMutualExclusionService::OnReceiveMessage(
     }
 }
 
-void DistributedMutualExclusionService::OnReceiveRequest(
-    PeerNetworkEntry& entry, proto::mutex::RequestMessage request) {
-    std::string& file_name = request.file_name;
+DistributedMutualExclusionService::Shard&
+DistributedMutualExclusionService::ShardFor(const std::string& file_name) {
+    return *shards_[std::hash<std::string>()(file_name) % shards_.size()];
+}
 
-    util::safe_debug::log("Received Request from peer",
-                          static_cast<int>(entry.connection.id), "for",
-                          file_name);
+util::result<MutualExclusionAlgorithm*, Error>
+DistributedMutualExclusionService::AlgorithmFor(Shard& shard,
+                                                const std::string& file_name) {
+    auto it = shard.algorithm_for_file.find(file_name);
+    if (it != shard.algorithm_for_file.end()) {
+        return it->second;
+    }
 
-    // Requests force the timestamp higher.
-    CRITICAL_SECTION(state_mutex_, {
-        timestamp_ = std::max(request.timestamp + 1, timestamp_ + 1);
-    });
+    auto name_prop =
+        components_.common.props.Get("mutex_algorithm." + file_name);
+    const std::string& name =
+        name_prop.has_value() ? name_prop.value() : default_algorithm_;
+    ASSIGN_OR_RETURN(MutualExclusionAlgorithm * algorithm,
+                     AlgorithmByName(shard, name));
+    shard.algorithm_for_file.emplace(file_name, algorithm);
+    return algorithm;
+}
 
-    switch (state_) {
-        case State::kWaiting: {
-            // I am not requesting for the critical section nor in it, so I will
-            // send my reply now.
-
-            // I lost permission for this filefrom the sender.
-            CRITICAL_SECTION(state_mutex_,
-                             entry.have_permission_for.erase(file_name));
-            entry.service->SendMessage(
-                proto::mutex::ReplyMessage(timestamp_, file_name).ToMessage(),
-                [this, &entry](util::result<void, Error> result) {
-                    OnSendMessage(entry, std::move(result));
-                });
-        } break;
-        case State::kInCriticalSection: {
-            // I am in the critical section, so wait to reply.
-            CRITICAL_SECTION(state_mutex_,
-                             delayed_requests_.emplace(
-                                 DelayedRequest{entry, std::move(request)}));
-        } break;
-        case State::kRequesting: {
-            // I am not in my critical section, but I have a request out.
-            auto& mine = my_request_.value();
-            if (mine.file_name != file_name) {
-                // Different file, so we can reply.
-                CRITICAL_SECTION(state_mutex_,
-                                 entry.have_permission_for.erase(file_name));
-                entry.service->SendMessage(
-                    proto::mutex::ReplyMessage(timestamp_, file_name)
-                        .ToMessage(),
-                    [this, &entry](util::result<void, Error> result) {
-                        OnSendMessage(entry, std::move(result));
-                    });
-            } else if (mine.timestamp > request.timestamp ||
-                       (mine.timestamp == request.timestamp &&
-                        components_.common.options.id > entry.connection.id)) {
-                // Their request for the same file has higher priority over
-                // mine.
-                //
-                // I should not even have their permission anyway.
-                entry.service->SendMessage(
-                    proto::mutex::ReplyMessage(timestamp_, file_name)
-                        .ToMessage(),
-                    [this, &entry](util::result<void, Error> result) {
-                        OnSendMessage(entry, std::move(result));
-                    });
-            } else {
-                // My request has higher priority, so I will not reply now.
-                CRITICAL_SECTION(state_mutex_,
-                                 delayed_requests_.emplace(DelayedRequest{
-                                     entry, std::move(request)}));
-            }
-        } break;
+DistributedMutualExclusionService::ResourceMetrics&
+DistributedMutualExclusionService::MetricsFor(Shard& shard,
+                                              const std::string& file_name) {
+    auto it = shard.metrics.find(file_name);
+    if (it == shard.metrics.end()) {
+        it = shard.metrics
+                 .emplace(std::piecewise_construct,
+                          std::forward_as_tuple(file_name),
+                          std::forward_as_tuple(components_.common.metrics,
+                                                file_name))
+                 .first;
     }
+    return it->second;
+}
+
+util::result<MutualExclusionAlgorithm*, Error>
+DistributedMutualExclusionService::AlgorithmByName(Shard& shard,
+                                                   const std::string& name) {
+    auto it = shard.algorithms.find(name);
+    if (it != shard.algorithms.end()) {
+        return it->second.get();
+    }
+
+    auto created = MutualExclusionAlgorithm::Create(name, shard);
+    if (created.is_err()) {
+        return std::move(created).err();
+    }
+    auto algorithm = std::move(created).ok();
+    if (network_connected_.load(std::memory_order_acquire)) {
+        algorithm->OnNetworkConnected();
+    }
+    auto* raw = algorithm.get();
+    shard.algorithms.emplace(name, std::move(algorithm));
+    return raw;
 }
 
 void DistributedMutualExclusionService::OnSendMessage(
-    PeerNetworkEntry& entry, util::result<void, Error> result) {
+    const peer::PeerConnectionReference& connection,
+    util::result<void, Error> result) {
     if (result.is_err()) {
-        network_manager_.ReportError(entry.connection.out,
-                                     [this](util::result<void, Error> result) {
-                                         OnNetworkRecovery(std::move(result));
-                                     });
+        ReportConnectionError(connection);
         return;
     }
 
     // Nothing else to do after a message is sent. We await a reply.
 }
 
+void DistributedMutualExclusionService::ReportConnectionError(
+    const peer::PeerConnectionReference& connection) {
+    network_manager_.ReportError(connection,
+                                 [this](util::result<void, Error> result) {
+                                     OnNetworkRecovery(std::move(result));
+                                 });
+}
+
 void DistributedMutualExclusionService::OnNetworkRecovery(
     util::result<void, Error> result) {
     if (result.is_err()) {
         error_callback_(std::move(result).err());
     } else {
-        // This never actually happens, because recovery is not implemented.
-        // When recovery is implemented, iterate over all of the network
-        // entries and see what messages need to be sent (such as a reply or
-        // a request).
+        // Each reconnected peer was already handed to the algorithms.
+        util::safe_debug::log("Peer network recovered");
+    }
+}
+
+void DistributedMutualExclusionService::ScheduleHeartbeats() {
+    heartbeats_due_ = peer::FailureDetector::clock_t::now() +
+                      failure_detector_.HeartbeatInterval();
+    heartbeat_timer_ = components_.common.timer_service.ScheduleAfter(
+        failure_detector_.HeartbeatInterval(), [this]() { SendHeartbeats(); });
+}
+
+void DistributedMutualExclusionService::SendHeartbeats() {
+    std::vector<std::shared_ptr<MutualExclusionService>> services;
+    std::vector<peer::PeerConnectionReference> suspects;
+    CRITICAL_SECTION(services_mutex_, {
+        if (!heartbeats_running_) {
+            return;
+        }
+
+        auto now = peer::FailureDetector::clock_t::now();
+        bool paused =
+            now - heartbeats_due_ > failure_detector_.HeartbeatInterval();
+        for (auto& pair : services_) {
+            services.push_back(pair.second);
+            if (paused) {
+                failure_detector_.Watch(pair.first, now);
+            } else if (failure_detector_.Suspect(pair.first, now)) {
+                // The peer is watched again once it reconnects.
+                util::safe_console::log("Peer", pair.first,
+                                        "is suspected to have failed");
+                failure_detector_.Unwatch(pair.first);
+                suspects.push_back(pair.second->Connection());
+            }
+        }
+        ScheduleHeartbeats();
+    });
+
+    for (auto& service : services) {
+        auto connection = service->Connection();
+        service->SendMessage(
+            proto::HeartbeatMessage().ToMessage(),
+            [this, connection](util::result<void, Error> result) {
+                OnSendMessage(connection, std::move(result));
+            });
+    }
+    for (auto& connection : suspects) {
+        ReportConnectionError(connection);
     }
 }
 
@@ -215,90 +853,171 @@ void DistributedMutualExclusionService::RunWithMutualExclusion(
     const std::string& file_name, const mutex_operation_t& operation) {
     util::safe_debug::log("Requesting mutual exclusion for", file_name);
 
-    CRITICAL_SECTION(state_mutex_, {
-        if (my_request_.has_value() || state_ != State::kWaiting) {
-            operation(Error::Create("Operation already in progress"));
+    bool leaving;
+    CRITICAL_SECTION(drain_mutex_, {
+        leaving = leaving_;
+        if (!leaving) {
+            ++active_requests_;
+        }
+    });
+    if (leaving) {
+        components_.common.thread_pool.Schedule([operation]() {
+            operation(Error::Create("Leaving the peer network"));
+        });
+        return;
+    }
+
+    auto& shard = ShardFor(file_name);
+    shard.executor.Schedule([this, &shard, file_name, operation]() {
+        auto algorithm = AlgorithmFor(shard, file_name);
+        if (algorithm.is_err()) {
+            FinishRequest();
+            Error error = std::move(algorithm).err();
+            components_.common.thread_pool.Schedule(
+                [operation, error]() { operation(error); });
             return;
         }
 
-        my_request_.emplace(
-            MutualExclusionRequest{file_name, operation, timestamp_});
+        // Only the first request for a file is sent out. Others wait for the
+        // request before them to be released.
+        auto& requests = shard.requests[file_name];
+        requests.push(MutualExclusionRequest{file_name, operation});
+        if (requests.size() == 1) {
+            RequestMutualExclusion(shard, file_name);
+        }
+    });
+}
 
-        // Request mutual exclusion from all nodes.
-        // This will send a request to every node we need permission from.
-        RequestMutualExclusion();
+void DistributedMutualExclusionService::RequestMutualExclusion(
+    Shard& shard, const std::string& file_name) {
+    auto& metrics = MetricsFor(shard, file_name);
+    metrics.requests.increment();
+    metrics.waiting = true;
+    metrics.messages_for_request = 0;
+    metrics.requested_at = ResourceClock::now();
 
-        // We may already have permission from everyone, so immediately check
-        // for mutual exclusion.
-        CheckForMutualExclusion();
-    });
+    // The algorithm sends any messages it needs, and it may grant mutual
+    // exclusion immediately.
+    shard.handling_request = true;
+    AlgorithmFor(shard, file_name).ok()->Request(file_name, Timestamp());
+    shard.handling_request = false;
 }
 
-void DistributedMutualExclusionService::RequestMutualExclusion() {
-    state_ = State::kRequesting;
-    auto& req = my_request_.value();
-
-    // Request permission from every node I do not have permission from.
-    for (auto& entry : network_) {
-        if (entry.have_permission_for.find(req.file_name) ==
-            entry.have_permission_for.end()) {
-            util::safe_debug::log("Sending Request to peer",
-                                  static_cast<int>(entry.connection.id));
-            entry.service->SendMessage(
-                proto::mutex::RequestMessage(req.timestamp, req.file_name)
-                    .ToMessage(),
-                [this, &entry](util::result<void, Error> result) {
-                    OnSendMessage(entry, std::move(result));
-                });
-        } else {
-            util::safe_debug::log("Already have permission from peer",
-                                  static_cast<int>(entry.connection.id));
+void DistributedMutualExclusionService::ReleaseMutualExclusion(
+    const std::string& file_name, const release_callback_t& callback) {
+    util::safe_debug::log("Releasing mutual exclusion for", file_name);
+
+    auto& shard = ShardFor(file_name);
+    shard.executor.Schedule([this, &shard, file_name, callback]() {
+        auto& metrics = MetricsFor(shard, file_name);
+        metrics.hold_us.observe(
+            MicrosBetween(metrics.entered_at, ResourceClock::now()));
+
+        AlgorithmFor(shard, file_name).ok()->Release(file_name);
+
+        auto& requests = shard.requests[file_name];
+        requests.pop();
+        if (!requests.empty()) {
+            RequestMutualExclusion(shard, file_name);
         }
-    }
-}
+        FinishRequest();
 
-void DistributedMutualExclusionService::PerformCriticalSection() {
-    util::safe_debug::log("Entering the critical section");
-    auto& req = my_request_.value();
-    req.operation([this](const release_callback_t& callback) {
-        ReleaseMutualExclusion();
-        callback(util::ok);
+        components_.common.thread_pool.Schedule(
+            [callback]() { callback(util::ok); });
     });
 }
 
-void DistributedMutualExclusionService::ReleaseMutualExclusion() {
-    util::safe_debug::log("Releasing mutual exclusion");
+void DistributedMutualExclusionService::FinishRequest() {
+    CRITICAL_SECTION(drain_mutex_, {
+        if (--active_requests_ == 0) {
+            drained_.notify_all();
+        }
+    });
+}
 
-    // Schedule the callback for another thread.
-    my_request_.reset();
-    state_ = State::kWaiting;
+proto::node_id_t DistributedMutualExclusionService::MyId() const {
+    return static_cast<proto::node_id_t>(components_.common.options.id);
+}
 
-    DeliverDelayedRequests();
+void DistributedMutualExclusionService::ObserveTimestamp(
+    std::size_t timestamp) {
+    std::size_t current = timestamp_.load(std::memory_order_acquire);
+    std::size_t next;
+    do {
+        next = std::max(timestamp + 1, current + 1);
+    } while (!timestamp_.compare_exchange_weak(current, next,
+                                               std::memory_order_acq_rel));
 }
 
-void DistributedMutualExclusionService::DeliverDelayedRequests() {
-    util::safe_debug::log("Delivering delayed requests");
-    while (!delayed_requests_.empty()) {
-        auto& next = delayed_requests_.front();
-        OnReceiveRequest(next.entry, std::move(next.request));
-        delayed_requests_.pop();
+void DistributedMutualExclusionService::SendToPeer(
+    proto::node_id_t id, const std::string& file_name, proto::Message&& msg) {
+    std::shared_ptr<MutualExclusionService> service;
+    CRITICAL_SECTION(services_mutex_, {
+        auto it = services_.find(id);
+        if (it != services_.end()) {
+            service = it->second;
+        }
+    });
+    if (!service) {
+        // The peer may have left while the algorithm still knew about it.
+        util::safe_debug::log("No peer with ID", id);
+        return;
     }
+
+    // Algorithms only send messages from jobs on the file's shard.
+    MetricsFor(ShardFor(file_name), file_name).CountSent(msg.opcode);
+
+    auto connection = service->Connection();
+    service->SendMessage(
+        std::move(msg), [this, connection](util::result<void, Error> result) {
+            OnSendMessage(connection, std::move(result));
+        });
 }
 
-void DistributedMutualExclusionService::CheckForMutualExclusion() {
-    auto& req = my_request_.value();
-    std::string& file_name = req.file_name;
+void DistributedMutualExclusionService::EnterCriticalSection(
+    const std::string& file_name) {
+    util::safe_debug::log("Entering the critical section for", file_name);
+
+    // This runs on the shard's executor, so the operation runs elsewhere to
+    // keep the shard free for messages.
+    auto& shard = ShardFor(file_name);
+    auto& metrics = MetricsFor(shard, file_name);
+    auto now = ResourceClock::now();
+    if (shard.handling_request) {
+        metrics.immediate_entries.increment();
+    }
+    metrics.waiting = false;
+    metrics.messages_per_cs.observe(metrics.messages_for_request);
+    metrics.wait_us.observe(MicrosBetween(metrics.requested_at, now));
+    metrics.entered_at = now;
 
-    bool has_mutual_exclusion =
-        std::all_of(network_.begin(), network_.end(),
-                    [&file_name](PeerNetworkEntry& entry) {
-                        return entry.have_permission_for.find(file_name) !=
-                               entry.have_permission_for.end();
-                    });
-    if (has_mutual_exclusion) {
-        state_ = State::kInCriticalSection;
-        PerformCriticalSection();
+    // The release time comes from another node's clock, so a release that
+    // appears to be in the future is not recorded.
+    std::uint64_t released_at = shard.delivering_released_at;
+    std::uint64_t entered_at = MutualExclusionAlgorithm::WallClockTime();
+    if (released_at != 0 && released_at <= entered_at) {
+        metrics.sync_delay_us.observe(entered_at - released_at);
     }
+
+    mutex_operation_t operation = shard.requests[file_name].front().operation;
+    components_.common.thread_pool.Schedule([this, file_name, operation]() {
+        operation([this, file_name](const release_callback_t& callback) {
+            ReleaseMutualExclusion(file_name, callback);
+        });
+    });
+}
+
+void DistributedMutualExclusionService::RunAfter(
+    const std::string& file_name, std::chrono::milliseconds delay,
+    const std::function<void()>& job) {
+    auto& shard = ShardFor(file_name);
+    components_.common.timer_service.ScheduleAfter(
+        delay, [&shard, job]() { shard.executor.Schedule(job); });
+}
+
+void DistributedMutualExclusionService::RecordDelayedRequests(
+    const std::string& file_name, std::size_t count) {
+    MetricsFor(ShardFor(file_name), file_name).delayed_requests.observe(count);
 }
 
 }  // namespace mutex
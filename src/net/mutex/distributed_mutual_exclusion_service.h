@@ -1,14 +1,25 @@
 #ifndef NET_MUTEX_DISTRIBUTED_MUTUAL_EXCLUSION_SERVICE_
 #define NET_MUTEX_DISTRIBUTED_MUTUAL_EXCLUSION_SERVICE_
 
+#include <net/mutex/mutual_exclusion_algorithm.h>
 #include <net/mutex/mutual_exclusion_service.h>
 #include <net/network_service.h>
+#include <net/peer/failure_detector.h>
 #include <net/peer/peer_network_manager.h>
+#include <thread/serial_executor.h>
+#include <thread/timer_service.h>
+#include <util/metrics.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -26,6 +37,23 @@ namespace mutex {
  * @brief Class for gaining mutual exclusion among a distributed network of
  * peer servers to perform an operation at multiple locations.
  *
+ * The algorithm used to gain mutual exclusion is chosen by the
+ * "mutex_algorithm" property, and may be overridden for a single file by the
+ * "mutex_algorithm.<file_name>" property. These properties must be the same on
+ * every client.
+ *
+ * Peers exchange heartbeats to detect failed connections. When a peer
+ * reconnects, every algorithm resends what the peer may have missed, so a
+ * short outage only delays requests.
+ *
+ * With dynamic peer membership, a member sends a node that joins the IDs of
+ * every other member, and the new node is ready once every member's list
+ * matches its own. A node stopping with dynamic membership leaves the network:
+ * it refuses new requests, waits up to "peer_drain_timeout_ms" milliseconds
+ * (5000 by default) for the ones already made, lets every algorithm hand over
+ * what it holds, and tells every peer it left. A node that cannot drain in
+ * time stops as if it failed.
+ *
  */
 class DistributedMutualExclusionService : public NetworkService {
    public:
@@ -45,25 +73,23 @@ class DistributedMutualExclusionService : public NetworkService {
      * @brief Runs the given callback with distributed mutual exclusion gained
      * over the peer network.
      *
-     * @param msg Message to perform
-     * @param callback
+     * Requests for the same file are granted in the order they are made.
+     * Requests for different files may be in progress at the same time.
+     *
+     * @param file_name
+     * @param operation
      */
     void RunWithMutualExclusion(const std::string& file_name,
                                 const mutex_operation_t& operation);
 
-    std::size_t Timestamp() const;
-
-   private:
     /**
-     * @brief An entry in the peer network list.
+     * @brief The current value of the Lamport clock.
      *
+     * @return std::size_t
      */
-    struct PeerNetworkEntry {
-        peer::PeerConnectionReference connection;
-        std::unique_ptr<MutualExclusionService> service;
-        std::unordered_set<std::string> have_permission_for;
-    };
+    std::size_t Timestamp() const;
 
+   private:
     /**
      * @brief A request for mutual exclusion.
      *
@@ -71,26 +97,134 @@ class DistributedMutualExclusionService : public NetworkService {
     struct MutualExclusionRequest {
         std::string file_name;
         mutex_operation_t operation;
-        std::size_t timestamp;
     };
 
     /**
-     * @brief A delayed request received from another peer.
+     * @brief Metrics for a single resource, named "mutex.<file_name>.*", and
+     * exported to Prometheus as "mutex_*" with a file label.
      *
      */
-    struct DelayedRequest {
-        PeerNetworkEntry& entry;
-        proto::mutex::RequestMessage request;
+    struct ResourceMetrics {
+        using clock_t = std::chrono::steady_clock;
+
+        ResourceMetrics(util::metrics::registry& registry,
+                        const std::string& file_name);
+
+        /**
+         * @brief Counts a message sent for the resource.
+         *
+         * @param opcode
+         */
+        void CountSent(proto::Opcode opcode);
+
+        /**
+         * @brief Counts a message received for the resource.
+         *
+         * @param opcode
+         */
+        void CountReceived(proto::Opcode opcode);
+
+        util::metrics::registry& registry;
+        std::string prefix;
+        util::metrics::counter& requests;
+        util::metrics::counter& immediate_entries;
+        util::metrics::histogram& messages_per_cs;
+        util::metrics::histogram& wait_us;
+        util::metrics::histogram& sync_delay_us;
+        util::metrics::histogram& hold_us;
+        util::metrics::histogram& delayed_requests;
+        std::map<proto::Opcode, util::metrics::counter*> sent;
+        std::map<proto::Opcode, util::metrics::counter*> received;
+
+        // Messages sent and received for the local request currently waiting
+        // for the critical section, leaving out those for other nodes'
+        // requests handled meanwhile.
+        bool waiting = false;
+        std::size_t messages_for_request = 0;
+        clock_t::time_point requested_at;
+        clock_t::time_point entered_at;
     };
 
     /**
-     * @brief State of mutual exclusion for a write on the current file.
+     * @brief A partition of the resources, by hash of the file name.
+     *
+     * All state in a shard is only accessed by jobs on its executor, so
+     * resources in different shards never contend with each other.
+     *
+     * A shard is the context of its algorithms. It keeps its own view of the
+     * peer network, so a peer joins or leaves in order with the messages its
+     * algorithms handle.
      *
      */
-    enum class State {
-        kWaiting,
-        kRequesting,
-        kInCriticalSection,
+    struct Shard : public MutualExclusionAlgorithm::Context {
+        Shard(DistributedMutualExclusionService& service,
+              thread::ThreadPool& thread_pool);
+
+        /**
+         * @brief Adds a peer that joined the network, and tells every
+         * algorithm.
+         *
+         * Must run on the shard's executor.
+         *
+         * @param id
+         */
+        void AddPeer(proto::node_id_t id);
+
+        /**
+         * @brief Removes a peer that left the network, and tells every
+         * algorithm.
+         *
+         * Must run on the shard's executor.
+         *
+         * @param id
+         */
+        void RemovePeer(proto::node_id_t id);
+
+        proto::node_id_t MyId() const override;
+        const std::vector<proto::node_id_t>& PeerIds() const override;
+        const std::vector<proto::node_id_t>& FoundingIds() const override;
+        std::size_t Timestamp() const override;
+        void ObserveTimestamp(std::size_t timestamp) override;
+        void SendToPeer(proto::node_id_t id, const std::string& file_name,
+                        proto::Message&& msg) override;
+        void EnterCriticalSection(const std::string& file_name) override;
+        void RunAfter(const std::string& file_name,
+                      std::chrono::milliseconds delay,
+                      const std::function<void()>& job) override;
+        const program::Properties& Props() const override;
+        void RecordDelayedRequests(const std::string& file_name,
+                                   std::size_t count) override;
+        util::metrics::registry& Metrics() override;
+
+        DistributedMutualExclusionService& service;
+        thread::SerialExecutor executor;
+
+        // Written once when the network connects, before any message is
+        // received or request is made, and then only changed by jobs.
+        std::vector<proto::node_id_t> peer_ids;
+        std::vector<proto::node_id_t> founding_ids;
+
+        std::unordered_map<std::string,
+                           std::unique_ptr<MutualExclusionAlgorithm>>
+            algorithms;
+        std::unordered_map<std::string, MutualExclusionAlgorithm*>
+            algorithm_for_file;
+
+        // Local requests for each resource, in order. The request at the front
+        // is requesting mutual exclusion or is in the critical section.
+        std::unordered_map<std::string, std::queue<MutualExclusionRequest>>
+            requests;
+
+        std::unordered_map<std::string, ResourceMetrics> metrics;
+
+        // Set while an algorithm handles a local request, to detect requests
+        // granted without any messages.
+        bool handling_request = false;
+
+        // Release time carried by the message being delivered, to measure
+        // synchronization delay if it lets this node enter the critical
+        // section.
+        std::uint64_t delivering_released_at = 0;
     };
 
     util::result<void, Error> SetUp() override;
@@ -100,56 +234,237 @@ class DistributedMutualExclusionService : public NetworkService {
     void OnNetworkConnected(
         typename peer::PeerNetworkManager::PeerNetworkList network);
 
-    void OnReceiveMessage(PeerNetworkEntry& entry,
+    void OnPeerReconnected(const peer::PeerConnectionReference& connection);
+    void OnPeerJoined(const peer::PeerConnectionReference& connection);
+
+    /**
+     * @brief Adds a peer that joined the network, and sends it the IDs of
+     * every other member.
+     *
+     * Must be called with the services lock held.
+     *
+     * @param connection
+     */
+    void AddMember(const peer::PeerConnectionReference& connection);
+
+    /**
+     * @brief Removes a peer that sent `Leave` on the given connection.
+     *
+     * @param connection
+     */
+    void RemoveMember(const peer::PeerConnectionReference& connection);
+
+    /**
+     * @brief Checks the members a peer listed while this node joins, and
+     * signals that this node is ready once every peer has.
+     *
+     * @param from
+     * @param members
+     */
+    void OnMembers(proto::node_id_t from, proto::MembersMessage members);
+
+    /**
+     * @brief Leaves the peer network on purpose, once every local request is
+     * done.
+     *
+     */
+    void Leave();
+
+    /**
+     * @brief Starts a service for the given connection, replacing the service
+     * for the peer's old connection.
+     *
+     * Must be called with the services lock held.
+     *
+     * @param connection
+     */
+    void InstallService(const peer::PeerConnectionReference& connection);
+
+    /**
+     * @brief Checks if the given connection is the current connection to its
+     * peer.
+     *
+     * Must be called with the services lock held.
+     *
+     * @param connection
+     * @return true
+     * @return false
+     */
+    bool IsCurrent(const peer::PeerConnectionReference& connection) const;
+
+    void OnReceiveMessage(const peer::PeerConnectionReference& connection,
                           util::result<proto::Message, Error> result);
-    void OnReceiveRequest(PeerNetworkEntry& entry,
-                          proto::mutex::RequestMessage request);
-    void OnSendMessage(PeerNetworkEntry& entry,
+    void OnSendMessage(const peer::PeerConnectionReference& connection,
                        util::result<void, Error> result);
 
+    void ReportConnectionError(
+        const peer::PeerConnectionReference& connection);
     void OnNetworkRecovery(util::result<void, Error> result);
 
     /**
-     * @brief Requests mutual exclusion on the network.
+     * @brief Schedules the next round of heartbeats.
+     *
+     * Must be called with the services lock held.
+     *
+     */
+    void ScheduleHeartbeats();
+
+    /**
+     * @brief Sends a heartbeat to every peer, and reports every peer
+     * suspected to have failed.
+     *
+     * If this node itself was paused long enough to miss a round, the silence
+     * of its peers says nothing about them, so every peer is watched again
+     * instead.
+     *
+     */
+    void SendHeartbeats();
+
+    /**
+     * @brief Delivers a mutual exclusion message to the algorithm for the
+     * file it refers to.
+     *
+     * @param from ID of the peer that sent the message
+     * @param msg
+     */
+    void DeliverToAlgorithm(proto::node_id_t from, proto::Message&& msg);
+
+    /**
+     * @brief Delivers a parsed message to a handler of the algorithm for the
+     * file it refers to, on the executor of the file's shard.
      *
+     * @tparam M Message type
+     * @param from ID of the peer that sent the message
+     * @param opcode Opcode of the message
+     * @param result Result of parsing the message
+     * @param handler
      */
-    void RequestMutualExclusion();
+    template <typename M>
+    void DeliverToAlgorithm(proto::node_id_t from, proto::Opcode opcode,
+                            util::result<M, Error> result,
+                            void (MutualExclusionAlgorithm::*handler)(
+                                proto::node_id_t, M));
 
     /**
-     * @brief Performs the operation in the critical section.
+     * @brief Gets the shard that owns the given file.
      *
+     * @param file_name
+     * @return Shard&
      */
-    void PerformCriticalSection();
+    Shard& ShardFor(const std::string& file_name);
 
     /**
-     * @brief Releases mutual exclusion on the network.
+     * @brief Gets the algorithm used for the given file, creating it if
+     * needed.
      *
-     * This method does not send any messages over the network. This process has
-     * access to the critical section until another request comes in.
+     * Must run on the shard's executor.
      *
+     * @param shard
+     * @param file_name
+     * @return util::result<MutualExclusionAlgorithm*, Error>
      */
-    void ReleaseMutualExclusion();
+    util::result<MutualExclusionAlgorithm*, Error> AlgorithmFor(
+        Shard& shard, const std::string& file_name);
 
     /**
-     * @brief Delivers and handles new incoming and outgoing requests since we
-     * have been in the critical section.
+     * @brief Gets the algorithm with the given name, creating it if needed.
      *
+     * Must run on the shard's executor.
+     *
+     * @param shard
+     * @param name
+     * @return util::result<MutualExclusionAlgorithm*, Error>
+     */
+    util::result<MutualExclusionAlgorithm*, Error> AlgorithmByName(
+        Shard& shard, const std::string& name);
+
+    /**
+     * @brief Gets the metrics for the given file, creating them if needed.
+     *
+     * Must run on the shard's executor.
+     *
+     * @param shard
+     * @param file_name
+     * @return ResourceMetrics&
      */
-    void DeliverDelayedRequests();
+    ResourceMetrics& MetricsFor(Shard& shard, const std::string& file_name);
 
-    void CheckForMutualExclusion();
+    /**
+     * @brief Requests mutual exclusion for the request at the front of the
+     * file's queue.
+     *
+     * Must run on the shard's executor.
+     *
+     * @param shard
+     * @param file_name
+     */
+    void RequestMutualExclusion(Shard& shard, const std::string& file_name);
+
+    /**
+     * @brief Releases mutual exclusion for the given file, and starts the next
+     * local request for it.
+     *
+     * @param file_name
+     * @param callback Called once mutual exclusion is released
+     */
+    void ReleaseMutualExclusion(const std::string& file_name,
+                                const release_callback_t& callback);
+
+    /**
+     * @brief Counts a local request as done, for draining before leaving.
+     *
+     */
+    void FinishRequest();
+
+    proto::node_id_t MyId() const;
+    void ObserveTimestamp(std::size_t timestamp);
+    void SendToPeer(proto::node_id_t id, const std::string& file_name,
+                    proto::Message&& msg);
+    void EnterCriticalSection(const std::string& file_name);
+    void RunAfter(const std::string& file_name,
+                  std::chrono::milliseconds delay,
+                  const std::function<void()>& job);
+    void RecordDelayedRequests(const std::string& file_name,
+                               std::size_t count);
 
     client::ClientComponents& components_;
     ready_callback_t ready_callback_;
     error_callback_t error_callback_;
     peer::PeerNetworkManager network_manager_;
-    std::vector<PeerNetworkEntry> network_;
+    peer::FailureDetector failure_detector_;
+    std::chrono::milliseconds drain_timeout_;
+
+    // Services for the current connection to each peer. A replaced service
+    // frees itself, and its connection, once its pending jobs finish.
+    std::mutex services_mutex_;
+    std::unordered_map<proto::node_id_t,
+                       std::shared_ptr<MutualExclusionService>>
+        services_;
+
+    // Connections replaced or joined before the network was handed to this
+    // service.
+    std::unordered_map<proto::node_id_t, peer::PeerConnectionReference>
+        early_reconnects_;
+    std::unordered_map<proto::node_id_t, peer::PeerConnectionReference>
+        early_joins_;
+
+    // Peers yet to list their members while this node joins.
+    std::unordered_set<proto::node_id_t> awaiting_members_;
+    bool heartbeats_running_;
+    thread::TimerService::timer_id_t heartbeat_timer_;
+    peer::FailureDetector::clock_t::time_point heartbeats_due_;
+
+    std::string default_algorithm_;
+    std::atomic<bool> network_connected_;
+    std::atomic<std::size_t> timestamp_;
+    std::vector<std::unique_ptr<Shard>> shards_;
 
-    std::mutex state_mutex_;
-    std::size_t timestamp_;
-    State state_;
-    util::optional<MutualExclusionRequest> my_request_;
-    std::queue<DelayedRequest> delayed_requests_;
+    // Local requests not yet released, which must finish before this node
+    // leaves.
+    std::mutex drain_mutex_;
+    std::condition_variable drained_;
+    std::size_t active_requests_;
+    bool leaving_;
 };
 
 }  // namespace mutex
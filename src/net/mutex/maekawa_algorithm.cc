@@ -0,0 +1,389 @@
+#include "maekawa_algorithm.h"
+
+#include <util/console.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace net {
+namespace mutex {
+
+bool MaekawaAlgorithm::Priority::operator<(const Priority& rhs) const {
+    return timestamp < rhs.timestamp ||
+           (timestamp == rhs.timestamp && id < rhs.id);
+}
+
+bool MaekawaAlgorithm::Priority::operator==(const Priority& rhs) const {
+    return timestamp == rhs.timestamp && id == rhs.id;
+}
+
+void MaekawaAlgorithm::OnNetworkConnected() {
+    // Every node orders the network the same way, so every node places every
+    // other node in the same grid cell.
+    std::vector<proto::node_id_t> nodes = context_.PeerIds();
+    nodes.push_back(context_.MyId());
+    std::sort(nodes.begin(), nodes.end());
+    if (nodes != context_.FoundingIds()) {
+        // Other nodes placed the founders in the grid, so a grid of the
+        // current nodes would not intersect their quorums.
+        UseWholeNetworkQuorum();
+        return;
+    }
+
+    std::size_t side = static_cast<std::size_t>(
+        std::ceil(std::sqrt(static_cast<double>(nodes.size()))));
+    std::size_t me = std::distance(
+        nodes.begin(), std::find(nodes.begin(), nodes.end(), context_.MyId()));
+
+    // My quorum is my row and my column. If the last row is incomplete, two
+    // quorums still intersect, because at most one of the two nodes is in the
+    // last row, and the other node's row is full.
+    quorum_.clear();
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        if (i / side == me / side || i % side == me % side) {
+            quorum_.push_back(nodes[i]);
+        }
+    }
+
+    util::safe_debug::log("Maekawa quorum has", quorum_.size(), "of",
+                          nodes.size(), "nodes");
+}
+
+void MaekawaAlgorithm::OnPeerReconnected(proto::node_id_t id) {
+    bool in_quorum = std::binary_search(quorum_.begin(), quorum_.end(), id);
+    for (auto& pair : resources_) {
+        const std::string& file_name = pair.first;
+
+        // As an arbiter, resend what the peer may be waiting on.
+        auto& arbiter = pair.second.arbiter;
+        if (arbiter.locked_for.has_value()) {
+            const Priority& holder = arbiter.locked_for.value();
+            if (holder.id == id) {
+                Send(id, proto::mutex::ReplyMessage(holder.timestamp, 0,
+                                                    file_name));
+                if (arbiter.inquired) {
+                    Send(id, proto::mutex::InquireMessage(holder.timestamp,
+                                                          file_name));
+                }
+            }
+            for (const auto& waiting : arbiter.waiting) {
+                bool inquiring =
+                    waiting < holder && *arbiter.waiting.begin() == waiting;
+                if (waiting.id == id && !inquiring) {
+                    Send(id, proto::mutex::FailedMessage(waiting.timestamp,
+                                                         file_name));
+                }
+            }
+        }
+
+        // As a requester, resend what the arbiter may be waiting on.
+        auto& requester = pair.second.requester;
+        if (!in_quorum || requester.in_critical_section) {
+            continue;
+        }
+        if (requester.requesting) {
+            if (requester.locked.find(id) == requester.locked.end()) {
+                Send(id, proto::mutex::RequestMessage(requester.timestamp,
+                                                      file_name));
+            }
+        } else {
+            Send(id,
+                 proto::mutex::ReleaseMessage(requester.timestamp, file_name));
+        }
+    }
+}
+
+void MaekawaAlgorithm::OnPeerJoined(proto::node_id_t) {
+    UseWholeNetworkQuorum();
+}
+
+void MaekawaAlgorithm::OnPeerLeft(proto::node_id_t id) {
+    UseWholeNetworkQuorum();
+    for (auto& pair : resources_) {
+        const std::string& file_name = pair.first;
+
+        // As an arbiter, the peer's lock and requests are gone with it.
+        auto& arbiter = pair.second.arbiter;
+        for (auto it = arbiter.waiting.begin(); it != arbiter.waiting.end();) {
+            it = it->id == id ? arbiter.waiting.erase(it) : std::next(it);
+        }
+        if (arbiter.locked_for.has_value() &&
+            arbiter.locked_for.value().id == id) {
+            arbiter.locked_for.reset();
+            LockNextWaiting(file_name, arbiter);
+        }
+
+        // As a requester, the peer is no longer in my quorum.
+        auto& requester = pair.second.requester;
+        requester.locked.erase(id);
+        requester.inquiries.erase(id);
+        CheckForMutualExclusion(file_name, requester);
+    }
+}
+
+void MaekawaAlgorithm::Request(const std::string& file_name,
+                               std::size_t timestamp) {
+    auto& requester = resources_[file_name].requester;
+    requester.requesting = true;
+    requester.failed = false;
+    requester.timestamp = timestamp;
+    requester.locked.clear();
+    requester.inquiries.clear();
+
+    for (auto id : quorum_) {
+        Send(id, proto::mutex::RequestMessage(timestamp, file_name));
+    }
+}
+
+void MaekawaAlgorithm::Release(const std::string& file_name) {
+    auto& requester = resources_[file_name].requester;
+    requester.in_critical_section = false;
+    requester.locked.clear();
+    requester.inquiries.clear();
+
+    for (auto id : quorum_) {
+        Send(id, proto::mutex::ReleaseMessage(requester.timestamp, file_name));
+    }
+}
+
+void MaekawaAlgorithm::OnRequest(proto::node_id_t from,
+                                 proto::mutex::RequestMessage request) {
+    std::string& file_name = request.file_name;
+    util::safe_debug::log("Received Request from node", from, "for",
+                          file_name);
+    context_.ObserveTimestamp(request.timestamp);
+
+    auto& arbiter = resources_[file_name].arbiter;
+    Priority priority{request.timestamp, from};
+    if (!arbiter.locked_for.has_value()) {
+        Lock(file_name, arbiter, priority);
+        return;
+    }
+
+    if (arbiter.locked_for.value() == priority) {
+        // A resent request I already granted.
+        Send(from, proto::mutex::ReplyMessage(request.timestamp, 0, file_name));
+        return;
+    }
+
+    Priority holder = arbiter.locked_for.value();
+    arbiter.waiting.insert(priority);
+    if (priority < holder && *arbiter.waiting.begin() == priority) {
+        // This request beats the lock holder and everyone waiting, so ask the
+        // holder if it can give the lock up.
+        if (!arbiter.inquired) {
+            arbiter.inquired = true;
+            Send(holder.id,
+                 proto::mutex::InquireMessage(holder.timestamp, file_name));
+        }
+        auto displaced = std::next(arbiter.waiting.begin());
+        if (displaced != arbiter.waiting.end() && *displaced < holder) {
+            // The request that was next in line was never told it failed, so
+            // it would hold on to its other locks waiting for this one.
+            Send(displaced->id, proto::mutex::FailedMessage(
+                                    displaced->timestamp, file_name));
+        }
+    } else {
+        // This request must wait behind another request.
+        Send(from, proto::mutex::FailedMessage(request.timestamp, file_name));
+    }
+}
+
+void MaekawaAlgorithm::OnReply(proto::node_id_t from,
+                               proto::mutex::ReplyMessage reply) {
+    std::string& file_name = reply.file_name;
+    util::safe_debug::log("Received lock from node", from, "for",
+                          file_name);
+    context_.ObserveTimestamp(reply.timestamp);
+
+    auto& requester = resources_[file_name].requester;
+    if (requester.in_critical_section) {
+        // A resent grant for a lock I am using.
+        return;
+    }
+    if (!requester.requesting || requester.timestamp != reply.timestamp) {
+        // This lock is not for a request I have out, so give it right back.
+        Send(from, proto::mutex::ReleaseMessage(reply.timestamp, file_name));
+        return;
+    }
+
+    requester.locked.emplace(from);
+    CheckForMutualExclusion(file_name, requester);
+}
+
+void MaekawaAlgorithm::OnRelease(proto::node_id_t from,
+                                 proto::mutex::ReleaseMessage release) {
+    std::string& file_name = release.file_name;
+    context_.ObserveTimestamp(release.timestamp);
+
+    auto& arbiter = resources_[file_name].arbiter;
+    if (!arbiter.locked_for.has_value() ||
+        !(arbiter.locked_for.value() == Priority{release.timestamp, from})) {
+        // Only the request holding the lock can give it up.
+        return;
+    }
+
+    context_.RecordDelayedRequests(file_name, arbiter.waiting.size());
+    arbiter.locked_for.reset();
+    LockNextWaiting(file_name, arbiter);
+}
+
+void MaekawaAlgorithm::OnInquire(proto::node_id_t from,
+                                 proto::mutex::InquireMessage inquire) {
+    std::string& file_name = inquire.file_name;
+    context_.ObserveTimestamp(inquire.timestamp);
+
+    auto& requester = resources_[file_name].requester;
+    if (!requester.requesting || requester.timestamp != inquire.timestamp) {
+        // I am already in the critical section, or this inquiry is for an old
+        // request. My `Release` resolves it either way.
+        return;
+    }
+
+    if (requester.failed) {
+        // I cannot get every lock yet, so I give this one up.
+        Relinquish(file_name, requester, from);
+    } else {
+        // I may still get every lock, so wait to see if a `Failed` comes.
+        requester.inquiries.emplace(from);
+    }
+}
+
+void MaekawaAlgorithm::OnRelinquish(
+    proto::node_id_t from, proto::mutex::RelinquishMessage relinquish) {
+    std::string& file_name = relinquish.file_name;
+    context_.ObserveTimestamp(relinquish.timestamp);
+
+    auto& arbiter = resources_[file_name].arbiter;
+    if (!arbiter.locked_for.has_value() ||
+        !(arbiter.locked_for.value() == Priority{relinquish.timestamp, from})) {
+        // Only the request holding the lock can give it up.
+        return;
+    }
+
+    // The old holder waits again, and the highest priority request gets the
+    // lock.
+    arbiter.waiting.insert(arbiter.locked_for.value());
+    arbiter.locked_for.reset();
+    LockNextWaiting(file_name, arbiter);
+}
+
+void MaekawaAlgorithm::OnFailed(proto::node_id_t,
+                                proto::mutex::FailedMessage failed) {
+    std::string& file_name = failed.file_name;
+    context_.ObserveTimestamp(failed.timestamp);
+
+    auto& requester = resources_[file_name].requester;
+    if (!requester.requesting || requester.timestamp != failed.timestamp) {
+        return;
+    }
+
+    requester.failed = true;
+
+    // Any inquiry I held on to can now be answered.
+    std::unordered_set<proto::node_id_t> inquiries;
+    std::swap(inquiries, requester.inquiries);
+    for (auto id : inquiries) {
+        Relinquish(file_name, requester, id);
+    }
+}
+
+void MaekawaAlgorithm::Deliver(proto::mutex::RequestMessage&& msg) {
+    OnRequest(context_.MyId(), std::move(msg));
+}
+
+void MaekawaAlgorithm::Deliver(proto::mutex::ReplyMessage&& msg) {
+    OnReply(context_.MyId(), std::move(msg));
+}
+
+void MaekawaAlgorithm::Deliver(proto::mutex::ReleaseMessage&& msg) {
+    OnRelease(context_.MyId(), std::move(msg));
+}
+
+void MaekawaAlgorithm::Deliver(proto::mutex::InquireMessage&& msg) {
+    OnInquire(context_.MyId(), std::move(msg));
+}
+
+void MaekawaAlgorithm::Deliver(proto::mutex::RelinquishMessage&& msg) {
+    OnRelinquish(context_.MyId(), std::move(msg));
+}
+
+void MaekawaAlgorithm::Deliver(proto::mutex::FailedMessage&& msg) {
+    OnFailed(context_.MyId(), std::move(msg));
+}
+
+void MaekawaAlgorithm::Lock(const std::string& file_name,
+                            ArbiterState& arbiter, const Priority& priority) {
+    arbiter.locked_for = priority;
+    arbiter.inquired = false;
+    Send(priority.id,
+         proto::mutex::ReplyMessage(priority.timestamp, 0, file_name));
+}
+
+void MaekawaAlgorithm::LockNextWaiting(const std::string& file_name,
+                                       ArbiterState& arbiter) {
+    arbiter.inquired = false;
+    if (arbiter.waiting.empty()) {
+        return;
+    }
+
+    Priority next = *arbiter.waiting.begin();
+    arbiter.waiting.erase(arbiter.waiting.begin());
+    Lock(file_name, arbiter, next);
+}
+
+void MaekawaAlgorithm::Relinquish(const std::string& file_name,
+                                  RequesterState& requester,
+                                  proto::node_id_t arbiter_id) {
+    if (requester.locked.erase(arbiter_id) == 0) {
+        return;
+    }
+    Send(arbiter_id,
+         proto::mutex::RelinquishMessage(requester.timestamp, file_name));
+}
+
+void MaekawaAlgorithm::CheckForMutualExclusion(const std::string& file_name,
+                                               RequesterState& requester) {
+    if (!requester.requesting) {
+        return;
+    }
+
+    // Locks only come from members of my quorum, and a member's lock is
+    // dropped when it leaves, so the counts match once every member has
+    // locked for me.
+    bool has_mutual_exclusion = requester.locked.size() == quorum_.size();
+    if (has_mutual_exclusion) {
+        requester.requesting = false;
+        requester.in_critical_section = true;
+        requester.inquiries.clear();
+        context_.EnterCriticalSection(file_name);
+    }
+}
+
+void MaekawaAlgorithm::UseWholeNetworkQuorum() {
+    std::vector<proto::node_id_t> quorum = context_.PeerIds();
+    quorum.push_back(context_.MyId());
+    std::sort(quorum.begin(), quorum.end());
+
+    // Only a node I have not asked yet needs my request.
+    for (auto& pair : resources_) {
+        auto& requester = pair.second.requester;
+        if (!requester.requesting) {
+            continue;
+        }
+        for (auto id : quorum) {
+            if (!std::binary_search(quorum_.begin(), quorum_.end(), id)) {
+                Send(id, proto::mutex::RequestMessage(requester.timestamp,
+                                                      pair.first));
+            }
+        }
+    }
+    quorum_ = std::move(quorum);
+
+    util::safe_debug::log("Maekawa quorum is the whole network of",
+                          quorum_.size(), "nodes");
+}
+
+}  // namespace mutex
+}  // namespace net
\ No newline at end of file
@@ -0,0 +1,182 @@
+#ifndef NET_MUTEX_MAEKAWA_ALGORITHM_
+#define NET_MUTEX_MAEKAWA_ALGORITHM_
+
+#include <net/mutex/mutual_exclusion_algorithm.h>
+#include <util/optional.h>
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace net {
+namespace mutex {
+
+/**
+ * @brief Maekawa's quorum-based algorithm over a grid of nodes.
+ *
+ * Nodes are placed in a square grid ordered by ID. A node's quorum is every
+ * node in its row and column, so any two quorums intersect and a critical
+ * section requires O(sqrt N) messages instead of O(N).
+ *
+ * Every node is an arbiter that locks itself for one request at a time.
+ * Deadlocks between overlapping quorums are resolved with `Inquire`,
+ * `Relinquish`, and `Failed` messages, which let a lower priority request give
+ * up a lock it cannot use yet.
+ *
+ * When a peer reconnects, both sides resend the messages the other may have
+ * missed. Arbiters resend grants, inquiries, and failures, and requesters
+ * resend requests and releases. Each of these is safe to receive twice.
+ *
+ * The grid only holds for the nodes that founded the network. Once a node
+ * joins or leaves, every quorum becomes the whole network, which intersects
+ * both the old grid quorums and every other whole-network quorum.
+ *
+ */
+class MaekawaAlgorithm : public MutualExclusionAlgorithm {
+   public:
+    using MutualExclusionAlgorithm::MutualExclusionAlgorithm;
+
+    void OnNetworkConnected() override;
+    void OnPeerReconnected(proto::node_id_t id) override;
+    void OnPeerJoined(proto::node_id_t id) override;
+    void OnPeerLeft(proto::node_id_t id) override;
+
+    void Request(const std::string& file_name, std::size_t timestamp) override;
+    void Release(const std::string& file_name) override;
+
+    void OnRequest(proto::node_id_t from,
+                   proto::mutex::RequestMessage request) override;
+    void OnReply(proto::node_id_t from,
+                 proto::mutex::ReplyMessage reply) override;
+    void OnRelease(proto::node_id_t from,
+                   proto::mutex::ReleaseMessage release) override;
+    void OnInquire(proto::node_id_t from,
+                   proto::mutex::InquireMessage inquire) override;
+    void OnRelinquish(proto::node_id_t from,
+                      proto::mutex::RelinquishMessage relinquish) override;
+    void OnFailed(proto::node_id_t from,
+                  proto::mutex::FailedMessage failed) override;
+
+   private:
+    /**
+     * @brief Priority of a request, where lower values have higher priority.
+     *
+     */
+    struct Priority {
+        std::size_t timestamp;
+        proto::node_id_t id;
+
+        bool operator<(const Priority& rhs) const;
+        bool operator==(const Priority& rhs) const;
+    };
+
+    /**
+     * @brief State of this node as an arbiter for other nodes' requests.
+     *
+     */
+    struct ArbiterState {
+        util::optional<Priority> locked_for;
+        std::set<Priority> waiting;
+        bool inquired = false;
+    };
+
+    /**
+     * @brief State of this node's own request.
+     *
+     */
+    struct RequesterState {
+        bool requesting = false;
+        bool in_critical_section = false;
+        bool failed = false;
+        std::size_t timestamp = 0;
+        std::unordered_set<proto::node_id_t> locked;
+        std::unordered_set<proto::node_id_t> inquiries;
+    };
+
+    struct ResourceState {
+        ArbiterState arbiter;
+        RequesterState requester;
+    };
+
+    /**
+     * @brief Sends a message to a member of the quorum, which may be this
+     * node.
+     *
+     * @tparam M Message type
+     * @param to
+     * @param msg
+     */
+    template <typename M>
+    void Send(proto::node_id_t to, M&& msg) {
+        if (to == context_.MyId()) {
+            Deliver(std::move(msg));
+        } else {
+            std::string file_name = msg.file_name;
+            context_.SendToPeer(to, file_name, std::move(msg).ToMessage());
+        }
+    }
+
+    void Deliver(proto::mutex::RequestMessage&& msg);
+    void Deliver(proto::mutex::ReplyMessage&& msg);
+    void Deliver(proto::mutex::ReleaseMessage&& msg);
+    void Deliver(proto::mutex::InquireMessage&& msg);
+    void Deliver(proto::mutex::RelinquishMessage&& msg);
+    void Deliver(proto::mutex::FailedMessage&& msg);
+
+    /**
+     * @brief Locks this arbiter for the given request.
+     *
+     * @param file_name
+     * @param arbiter
+     * @param priority
+     */
+    void Lock(const std::string& file_name, ArbiterState& arbiter,
+              const Priority& priority);
+
+    /**
+     * @brief Locks this arbiter for the highest priority waiting request, if
+     * any.
+     *
+     * @param file_name
+     * @param arbiter
+     */
+    void LockNextWaiting(const std::string& file_name, ArbiterState& arbiter);
+
+    /**
+     * @brief Gives up a lock in response to an `Inquire` message.
+     *
+     * @param file_name
+     * @param requester
+     * @param arbiter_id
+     */
+    void Relinquish(const std::string& file_name, RequesterState& requester,
+                    proto::node_id_t arbiter_id);
+
+    /**
+     * @brief Enters the critical section if every member of the quorum is
+     * locked for my request.
+     *
+     * @param file_name
+     * @param requester
+     */
+    void CheckForMutualExclusion(const std::string& file_name,
+                                 RequesterState& requester);
+
+    /**
+     * @brief Switches to a quorum of every node in the network, and asks any
+     * new member for the lock I am requesting.
+     *
+     */
+    void UseWholeNetworkQuorum();
+
+    // Sorted by ID.
+    std::vector<proto::node_id_t> quorum_;
+    std::unordered_map<std::string, ResourceState> resources_;
+};
+
+}  // namespace mutex
+}  // namespace net
+
+#endif  // NET_MUTEX_MAEKAWA_ALGORITHM_
\ No newline at end of file
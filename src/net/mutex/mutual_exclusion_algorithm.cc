@@ -0,0 +1,80 @@
+#include "mutual_exclusion_algorithm.h"
+
+#include <net/mutex/maekawa_algorithm.h>
+#include <net/mutex/ricart_agrawala_algorithm.h>
+#include <net/mutex/suzuki_kasami_algorithm.h>
+
+namespace net {
+namespace mutex {
+
+MutualExclusionAlgorithm::MutualExclusionAlgorithm(Context& context)
+    : context_(context) {}
+
+util::result<std::unique_ptr<MutualExclusionAlgorithm>, Error>
+MutualExclusionAlgorithm::Create(const std::string& name, Context& context) {
+    std::unique_ptr<MutualExclusionAlgorithm> algorithm;
+    if (name == "ricart_agrawala") {
+        algorithm.reset(new RicartAgrawalaAlgorithm(context));
+    } else if (name == "maekawa") {
+        algorithm.reset(new MaekawaAlgorithm(context));
+    } else if (name == "suzuki_kasami") {
+        algorithm.reset(new SuzukiKasamiAlgorithm(context));
+    } else {
+        return Error::Create("Unknown mutual exclusion algorithm \"" + name +
+                             "\"");
+    }
+    RETURN_IF_ERROR(algorithm->Configure());
+    return algorithm;
+}
+
+util::result<void, Error> MutualExclusionAlgorithm::Configure() {
+    return util::ok;
+}
+
+void MutualExclusionAlgorithm::OnNetworkConnected() {}
+
+void MutualExclusionAlgorithm::OnPeerReconnected(proto::node_id_t) {}
+
+void MutualExclusionAlgorithm::OnPeerJoined(proto::node_id_t) {}
+
+void MutualExclusionAlgorithm::OnPeerLeft(proto::node_id_t) {}
+
+util::result<void, Error> MutualExclusionAlgorithm::OnLeaving() {
+    return util::ok;
+}
+
+std::uint64_t MutualExclusionAlgorithm::WallClockTime() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Algorithms only override the handlers for messages they use. Any other
+// message is ignored.
+
+void MutualExclusionAlgorithm::OnRequest(proto::node_id_t,
+                                         proto::mutex::RequestMessage) {}
+
+void MutualExclusionAlgorithm::OnReply(proto::node_id_t,
+                                       proto::mutex::ReplyMessage) {}
+
+void MutualExclusionAlgorithm::OnRelease(proto::node_id_t,
+                                         proto::mutex::ReleaseMessage) {}
+
+void MutualExclusionAlgorithm::OnInquire(proto::node_id_t,
+                                         proto::mutex::InquireMessage) {}
+
+void MutualExclusionAlgorithm::OnRelinquish(proto::node_id_t,
+                                            proto::mutex::RelinquishMessage) {}
+
+void MutualExclusionAlgorithm::OnFailed(proto::node_id_t,
+                                        proto::mutex::FailedMessage) {}
+
+void MutualExclusionAlgorithm::OnTokenRequest(
+    proto::node_id_t, proto::mutex::TokenRequestMessage) {}
+
+void MutualExclusionAlgorithm::OnToken(proto::node_id_t,
+                                       proto::mutex::TokenMessage) {}
+
+}  // namespace mutex
+}  // namespace net
\ No newline at end of file
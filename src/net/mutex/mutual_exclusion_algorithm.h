@@ -0,0 +1,259 @@
+#ifndef NET_MUTEX_MUTUAL_EXCLUSION_ALGORITHM_
+#define NET_MUTEX_MUTUAL_EXCLUSION_ALGORITHM_
+
+#include <net/error.h>
+#include <net/proto/messages.h>
+#include <program/properties.h>
+#include <util/metrics.h>
+#include <util/result.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace net {
+namespace mutex {
+
+/**
+ * @brief Base class for an algorithm that decides when this node may enter
+ * the critical section for a resource.
+ *
+ * Algorithms are driven by `DistributedMutualExclusionService`, which owns the
+ * peer network, delivers every mutual exclusion message to the algorithm, and
+ * serializes all calls into it.
+ *
+ */
+class MutualExclusionAlgorithm {
+   public:
+    /**
+     * @brief Operations an algorithm may perform on the service driving it.
+     *
+     */
+    class Context {
+       public:
+        virtual ~Context() = default;
+
+        /**
+         * @brief The ID of this node.
+         *
+         * @return proto::node_id_t
+         */
+        virtual proto::node_id_t MyId() const = 0;
+
+        /**
+         * @brief The IDs of every other node in the peer network.
+         *
+         * @return const std::vector<proto::node_id_t>&
+         */
+        virtual const std::vector<proto::node_id_t>& PeerIds() const = 0;
+
+        /**
+         * @brief The IDs of the nodes that founded the peer network, in order
+         * and including this node.
+         *
+         * Empty if this node joined a network that was already running. The
+         * peer IDs differ from the founding IDs once any node joins or
+         * leaves.
+         *
+         * @return const std::vector<proto::node_id_t>&
+         */
+        virtual const std::vector<proto::node_id_t>& FoundingIds() const = 0;
+
+        /**
+         * @brief The current value of the Lamport clock.
+         *
+         * @return std::size_t
+         */
+        virtual std::size_t Timestamp() const = 0;
+
+        /**
+         * @brief Forces the Lamport clock higher after receiving a message with
+         * the given timestamp.
+         *
+         * @param timestamp
+         */
+        virtual void ObserveTimestamp(std::size_t timestamp) = 0;
+
+        /**
+         * @brief Sends a message about the given resource to the peer with the
+         * given ID.
+         *
+         * @param id
+         * @param file_name
+         * @param msg
+         */
+        virtual void SendToPeer(proto::node_id_t id,
+                                const std::string& file_name,
+                                proto::Message&& msg) = 0;
+
+        /**
+         * @brief Signals that this node has gained mutual exclusion for the
+         * given resource.
+         *
+         * @param file_name
+         */
+        virtual void EnterCriticalSection(const std::string& file_name) = 0;
+
+        /**
+         * @brief Runs a job after a delay, serialized with every other call
+         * into the algorithm for the given resource.
+         *
+         * @param file_name
+         * @param delay
+         * @param job
+         */
+        virtual void RunAfter(const std::string& file_name,
+                              std::chrono::milliseconds delay,
+                              const std::function<void()>& job) = 0;
+
+        /**
+         * @brief The properties file, for algorithm settings.
+         *
+         * @return const program::Properties&
+         */
+        virtual const program::Properties& Props() const = 0;
+
+        /**
+         * @brief Records how many peer requests for the given resource were
+         * waiting on this node when it handed the resource over.
+         *
+         * @param file_name
+         * @param count
+         */
+        virtual void RecordDelayedRequests(const std::string& file_name,
+                                           std::size_t count) = 0;
+
+        /**
+         * @brief The metrics registry, for reporting how the algorithm
+         * performs.
+         *
+         * @return util::metrics::registry&
+         */
+        virtual util::metrics::registry& Metrics() = 0;
+    };
+
+    MutualExclusionAlgorithm(Context& context);
+    virtual ~MutualExclusionAlgorithm() = default;
+
+    /**
+     * @brief Creates an algorithm by the name used in the properties file.
+     *
+     * @param name
+     * @param context
+     * @return util::result<std::unique_ptr<MutualExclusionAlgorithm>, Error>
+     */
+    static util::result<std::unique_ptr<MutualExclusionAlgorithm>, Error>
+    Create(const std::string& name, Context& context);
+
+    /**
+     * @brief The wall clock time in microseconds, for stamping messages that
+     * hand a resource over when leaving the critical section.
+     *
+     * @return std::uint64_t
+     */
+    static std::uint64_t WallClockTime();
+
+    /**
+     * @brief Reads the algorithm's settings from the properties file.
+     *
+     * @return util::result<void, Error>
+     */
+    virtual util::result<void, Error> Configure();
+
+    /**
+     * @brief Runs once the peer network is connected, before any request is
+     * made.
+     *
+     */
+    virtual void OnNetworkConnected();
+
+    /**
+     * @brief Runs when the connection to a peer is replaced after a failure.
+     *
+     * Messages sent to the peer since the old connection failed may have
+     * been lost, so the algorithm should resend whatever the peer still
+     * needs. Peers may receive a resent message twice.
+     *
+     * @param id
+     */
+    virtual void OnPeerReconnected(proto::node_id_t id);
+
+    /**
+     * @brief Runs when a node joins the network that was already running.
+     *
+     * The node is already one of the peer IDs, and it has not sent any
+     * message yet.
+     *
+     * @param id
+     */
+    virtual void OnPeerJoined(proto::node_id_t id);
+
+    /**
+     * @brief Runs when a peer leaves the network on purpose.
+     *
+     * The peer is no longer one of the peer IDs. It was not using any
+     * resource when it left, but the algorithm must stop waiting on it.
+     *
+     * @param id
+     */
+    virtual void OnPeerLeft(proto::node_id_t id);
+
+    /**
+     * @brief Runs when this node is about to leave the network, once it has
+     * no local requests left.
+     *
+     * The algorithm must hand over anything its peers may need from this
+     * node. An error keeps this node from leaving, and it stops as if it
+     * failed instead.
+     *
+     * @return util::result<void, Error>
+     */
+    virtual util::result<void, Error> OnLeaving();
+
+    /**
+     * @brief Requests mutual exclusion for the given resource.
+     *
+     * `Context::EnterCriticalSection` must be called once mutual exclusion is
+     * gained, which may happen before this method returns.
+     *
+     * @param file_name
+     * @param timestamp Timestamp of the request
+     */
+    virtual void Request(const std::string& file_name,
+                         std::size_t timestamp) = 0;
+
+    /**
+     * @brief Releases mutual exclusion for the given resource.
+     *
+     * @param file_name
+     */
+    virtual void Release(const std::string& file_name) = 0;
+
+    virtual void OnRequest(proto::node_id_t from,
+                           proto::mutex::RequestMessage request);
+    virtual void OnReply(proto::node_id_t from,
+                         proto::mutex::ReplyMessage reply);
+    virtual void OnRelease(proto::node_id_t from,
+                           proto::mutex::ReleaseMessage release);
+    virtual void OnInquire(proto::node_id_t from,
+                           proto::mutex::InquireMessage inquire);
+    virtual void OnRelinquish(proto::node_id_t from,
+                              proto::mutex::RelinquishMessage relinquish);
+    virtual void OnFailed(proto::node_id_t from,
+                          proto::mutex::FailedMessage failed);
+    virtual void OnTokenRequest(proto::node_id_t from,
+                                proto::mutex::TokenRequestMessage request);
+    virtual void OnToken(proto::node_id_t from,
+                         proto::mutex::TokenMessage token);
+
+   protected:
+    Context& context_;
+};
+
+}  // namespace mutex
+}  // namespace net
+
+#endif  // NET_MUTEX_MUTUAL_EXCLUSION_ALGORITHM_
\ No newline at end of file
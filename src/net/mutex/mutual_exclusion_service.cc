@@ -1,14 +1,17 @@
 #include "mutual_exclusion_service.h"
 
+#include <util/mutex.h>
+
 namespace net {
 namespace mutex {
 
 MutualExclusionService::MutualExclusionService(
-    Components& components, peer::PeerConnectionReference& connection)
+    Components& components, const peer::PeerConnectionReference& connection)
     : components_(components),
       connection_(connection),
-      message_reader_(connection_.in.socket, components_),
-      message_writer_(connection_.out.socket, components_) {}
+      message_reader_(connection_.connection->socket, components_),
+      message_writer_(connection_.connection->socket, components_),
+      running_(false) {}
 
 void MutualExclusionService::StartReceivingMessages(
     const proto::AsyncMessageService::recv_callback_t& callback) {
@@ -18,15 +21,21 @@ void MutualExclusionService::StartReceivingMessages(
 }
 
 void MutualExclusionService::ScheduleNextRead() {
-    components_.thread_pool.Schedule([this]() {
+    auto self = shared_from_this();
+    components_.thread_pool.Schedule([this, self]() {
         message_reader_.ReadMessage(
-            [this](util::result<proto::Message, Error> result) {
+            [this, self](util::result<proto::Message, Error> result) {
                 if (result.is_err()) {
                     running_ = false;
                     recv_callback_(std::move(result));
                 } else {
-                    ScheduleNextRead();
+                    // The message is handed off before the next read starts,
+                    // so messages from a peer are handled in the order it
+                    // sent them.
                     recv_callback_(std::move(result));
+                    if (running_) {
+                        ScheduleNextRead();
+                    }
                 }
             });
     });
@@ -35,12 +44,46 @@ void MutualExclusionService::ScheduleNextRead() {
 void MutualExclusionService::SendMessage(
     proto::Message&& msg,
     const proto::AsyncMessageService::send_callback_t& callback) {
-    message_writer_.WriteMessage(std::move(msg), callback);
+    bool start_writing;
+    CRITICAL_SECTION(send_mutex_, {
+        start_writing = send_queue_.empty();
+        send_queue_.emplace(std::move(msg), callback);
+    });
+
+    // The message at the front of the queue is always the one being written,
+    // so only an empty queue needs to be started again.
+    if (start_writing) {
+        auto self = shared_from_this();
+        components_.thread_pool.Schedule(
+            [this, self]() { WriteNextMessage(); });
+    }
+}
+
+void MutualExclusionService::WriteNextMessage() {
+    proto::Message msg;
+    CRITICAL_SECTION(send_mutex_, msg = std::move(send_queue_.front().first));
+    auto self = shared_from_this();
+    message_writer_.WriteMessage(
+        std::move(msg), [this, self](util::result<void, Error> result) {
+            proto::AsyncMessageService::send_callback_t callback;
+            bool write_next;
+            CRITICAL_SECTION(send_mutex_, {
+                callback = std::move(send_queue_.front().second);
+                send_queue_.pop();
+                write_next = !send_queue_.empty();
+            });
+            if (write_next) {
+                components_.thread_pool.Schedule(
+                    [this, self]() { WriteNextMessage(); });
+            }
+            callback(std::move(result));
+        });
 }
 
 void MutualExclusionService::Stop() { running_ = false; }
 
-peer::PeerConnectionReference& MutualExclusionService::Connection() {
+const peer::PeerConnectionReference& MutualExclusionService::Connection()
+    const {
     return connection_;
 }
 
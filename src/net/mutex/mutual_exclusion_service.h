@@ -5,7 +5,12 @@
 #include <net/peer/peer_connection.h>
 #include <net/proto/async_message_service.h>
 
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <utility>
 
 namespace net {
 namespace mutex {
@@ -13,11 +18,17 @@ namespace mutex {
 /**
  * @brief A service for a peer connection in a mutual exclusion algorithm.
  *
+ * Messages are read and written on the same connection at the same time, so
+ * the reader and writer keep separate state. Each pending read or write holds
+ * a reference to the service, so it must be owned by a std::shared_ptr and
+ * may outlive its owner until those jobs finish.
+ *
  */
-class MutualExclusionService {
+class MutualExclusionService
+    : public std::enable_shared_from_this<MutualExclusionService> {
    public:
     MutualExclusionService(Components& components,
-                           peer::PeerConnectionReference& connection_);
+                           const peer::PeerConnectionReference& connection);
 
     /**
      * @brief Starts continually receiving messages, with each message being
@@ -31,28 +42,48 @@ class MutualExclusionService {
     /**
      * @brief Sends a message to the peer contained in the service.
      *
-     * Use this method for responding to received messages.
+     * Use this method for responding to received messages. Messages are queued
+     * and written in order, so this method may be called while another
+     * message is being written.
      *
+     * @param msg
      * @param callback
      */
     void SendMessage(
         proto::Message&& msg,
         const proto::AsyncMessageService::send_callback_t& callback);
 
+    /**
+     * @brief Stops reading once the pending read finishes. Messages already
+     * queued are still written.
+     *
+     */
     void Stop();
 
-    peer::PeerConnectionReference& Connection();
+    const peer::PeerConnectionReference& Connection() const;
     bool Running() const;
 
    private:
+    using pending_message_t =
+        std::pair<proto::Message, proto::AsyncMessageService::send_callback_t>;
+
     void ScheduleNextRead();
 
+    /**
+     * @brief Writes the message at the front of the send queue.
+     *
+     */
+    void WriteNextMessage();
+
     Components& components_;
-    peer::PeerConnectionReference& connection_;
+    peer::PeerConnectionReference connection_;
     proto::AsyncMessageService message_reader_;
     proto::AsyncMessageService message_writer_;
-    bool running_;
+    std::atomic<bool> running_;
     proto::AsyncMessageService::recv_callback_t recv_callback_;
+
+    std::mutex send_mutex_;
+    std::queue<pending_message_t> send_queue_;
 };
 
 }  // namespace mutex
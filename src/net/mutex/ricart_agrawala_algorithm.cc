@@ -0,0 +1,301 @@
+#include "ricart_agrawala_algorithm.h"
+
+#include <util/console.h>
+#include <util/number.h>
+
+#include <algorithm>
+
+namespace net {
+namespace mutex {
+
+RicartAgrawalaAlgorithm::RicartAgrawalaAlgorithm(Context& context)
+    : MutualExclusionAlgorithm(context),
+      lease_duration_(0),
+      max_lease_entries_(0),
+      lease_hits_(context.Metrics().get_counter("mutex.lease_hits")),
+      leases_revoked_(context.Metrics().get_counter("mutex.leases_revoked")),
+      lease_delayed_requests_(
+          context.Metrics().get_counter("mutex.lease_delayed_requests")) {}
+
+util::result<void, Error> RicartAgrawalaAlgorithm::Configure() {
+    const auto& props = context_.Props();
+
+    auto lease_ms = props.Get("mutex_lease_ms");
+    if (lease_ms.has_value()) {
+        auto result = util::num::string_to_num<std::size_t>(lease_ms.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"mutex_lease_ms\" property");
+        }
+        lease_duration_ = std::chrono::milliseconds(result.ok());
+    }
+
+    auto lease_entries = props.Get("mutex_lease_entries");
+    if (lease_entries.has_value()) {
+        auto result =
+            util::num::string_to_num<std::size_t>(lease_entries.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"mutex_lease_entries\" property");
+        }
+        max_lease_entries_ = result.ok();
+    }
+
+    return util::ok;
+}
+
+void RicartAgrawalaAlgorithm::Request(const std::string& file_name,
+                                      std::size_t timestamp) {
+    auto& state = resources_[file_name];
+    state.requesting = true;
+    state.timestamp = timestamp;
+
+    if (state.leased) {
+        // A lease means I kept permission from everyone.
+        ++state.lease_entries;
+        lease_hits_.increment();
+        CheckForMutualExclusion(file_name, state);
+        return;
+    }
+
+    // Request permission from every node I do not have permission from.
+    for (auto id : context_.PeerIds()) {
+        if (state.have_permission_from.find(id) ==
+            state.have_permission_from.end()) {
+            util::safe_debug::log("Sending Request to peer", id);
+            SendRequest(id, file_name, timestamp);
+        } else {
+            util::safe_debug::log("Already have permission from peer", id);
+        }
+    }
+
+    // We may already have permission from everyone.
+    CheckForMutualExclusion(file_name, state);
+}
+
+void RicartAgrawalaAlgorithm::Release(const std::string& file_name) {
+    auto& state = resources_[file_name];
+    state.in_critical_section = false;
+
+    if (state.leased) {
+        // The lease may have run out of time or entries while I was in the
+        // critical section.
+        bool out_of_entries = max_lease_entries_ != 0 &&
+                              state.lease_entries >= max_lease_entries_;
+        if (state.lease_expired || out_of_entries) {
+            EndLease(file_name, state);
+        }
+        return;
+    }
+
+    if (lease_duration_.count() > 0) {
+        StartLease(file_name, state);
+        return;
+    }
+
+    DeliverDelayedReplies(file_name, state);
+}
+
+void RicartAgrawalaAlgorithm::OnPeerReconnected(proto::node_id_t id) {
+    // My requests to the peer, or its replies, may have been lost. The peer
+    // resends its own requests, which covers replies I sent it.
+    for (auto& pair : resources_) {
+        auto& state = pair.second;
+        if (state.requesting && state.have_permission_from.find(id) ==
+                                    state.have_permission_from.end()) {
+            SendRequest(id, pair.first, state.timestamp);
+        }
+    }
+}
+
+void RicartAgrawalaAlgorithm::OnPeerJoined(proto::node_id_t id) {
+    // The new node has never asked for anything, so I hold its permission
+    // until it asks for it. It starts without permission from anyone.
+    for (auto& pair : resources_) {
+        pair.second.have_permission_from.emplace(id);
+    }
+}
+
+void RicartAgrawalaAlgorithm::OnPeerLeft(proto::node_id_t id) {
+    for (auto& pair : resources_) {
+        auto& state = pair.second;
+        state.have_permission_from.erase(id);
+        state.delayed_replies.erase(
+            std::remove_if(state.delayed_replies.begin(),
+                           state.delayed_replies.end(),
+                           [id](const DelayedReply& reply) {
+                               return reply.to == id;
+                           }),
+            state.delayed_replies.end());
+
+        // The peer may have been the last one I was waiting for.
+        CheckForMutualExclusion(pair.first, state);
+    }
+}
+
+util::result<void, Error> RicartAgrawalaAlgorithm::OnLeaving() {
+    // Peers may be waiting on a lease I hold.
+    for (auto& pair : resources_) {
+        if (pair.second.leased) {
+            EndLease(pair.first, pair.second);
+        }
+    }
+    return util::ok;
+}
+
+void RicartAgrawalaAlgorithm::OnRequest(proto::node_id_t from,
+                                        proto::mutex::RequestMessage request) {
+    std::string& file_name = request.file_name;
+
+    util::safe_debug::log("Received Request from peer", from, "for",
+                          file_name);
+
+    // Requests force the timestamp higher.
+    context_.ObserveTimestamp(request.timestamp);
+
+    auto& state = resources_[file_name];
+    bool already_delayed =
+        std::any_of(state.delayed_replies.begin(), state.delayed_replies.end(),
+                    [from](const DelayedReply& reply) {
+                        return reply.to == from;
+                    });
+    if (already_delayed) {
+        // A resent request that is already waiting for my reply.
+        return;
+    }
+
+    DelayedReply delayed{from, request.timestamp};
+    if (state.in_critical_section ||
+        (state.requesting && HasPriority(state, request.timestamp, from))) {
+        // I am in the critical section, or my request has higher priority, so
+        // I will not reply now.
+        state.delayed_replies.push_back(delayed);
+        return;
+    }
+
+    if (state.leased) {
+        // I am holding on to permission until my lease ends.
+        lease_delayed_requests_.increment();
+        state.delayed_replies.push_back(delayed);
+        return;
+    }
+
+    // I am not using this file, or their request has higher priority, so I
+    // reply now and lose permission for this file from the sender.
+    bool had_permission = state.have_permission_from.erase(from) > 0;
+    SendReply(from, file_name, request.timestamp, 0);
+
+    if (state.requesting && had_permission) {
+        // I gave away permission I was counting on for my own request, so I
+        // must ask for it back.
+        SendRequest(from, file_name, state.timestamp);
+    }
+}
+
+void RicartAgrawalaAlgorithm::OnReply(proto::node_id_t from,
+                                      proto::mutex::ReplyMessage reply) {
+    std::string& file_name = reply.file_name;
+
+    util::safe_debug::log("Received Reply from peer", from, "for",
+                          file_name);
+
+    // Replies force the timestamp higher.
+    context_.ObserveTimestamp(reply.timestamp);
+
+    auto& state = resources_[file_name];
+    if (!state.requesting || reply.timestamp != state.timestamp) {
+        // A reply resent for a request I am no longer making.
+        return;
+    }
+    state.have_permission_from.emplace(from);
+    CheckForMutualExclusion(file_name, state);
+}
+
+bool RicartAgrawalaAlgorithm::HasPriority(const ResourceState& state,
+                                          std::size_t timestamp,
+                                          proto::node_id_t from) const {
+    return state.timestamp < timestamp ||
+           (state.timestamp == timestamp && context_.MyId() < from);
+}
+
+void RicartAgrawalaAlgorithm::SendRequest(proto::node_id_t to,
+                                          const std::string& file_name,
+                                          std::size_t timestamp) {
+    context_.SendToPeer(
+        to, file_name,
+        proto::mutex::RequestMessage(timestamp, file_name).ToMessage());
+}
+
+void RicartAgrawalaAlgorithm::SendReply(proto::node_id_t to,
+                                        const std::string& file_name,
+                                        std::size_t timestamp,
+                                        std::uint64_t released_at) {
+    context_.SendToPeer(
+        to, file_name,
+        proto::mutex::ReplyMessage(timestamp, released_at, file_name)
+            .ToMessage());
+}
+
+void RicartAgrawalaAlgorithm::CheckForMutualExclusion(
+    const std::string& file_name, ResourceState& state) {
+    if (!state.requesting) {
+        return;
+    }
+
+    // Permission only comes from peers, and a peer's permission is dropped
+    // when it leaves, so the counts match once every peer has given it.
+    bool has_mutual_exclusion =
+        state.have_permission_from.size() == context_.PeerIds().size();
+    if (has_mutual_exclusion) {
+        state.requesting = false;
+        state.in_critical_section = true;
+        context_.EnterCriticalSection(file_name);
+    }
+}
+
+void RicartAgrawalaAlgorithm::StartLease(const std::string& file_name,
+                                         ResourceState& state) {
+    state.leased = true;
+    state.lease_expired = false;
+    state.lease_entries = 0;
+    std::size_t lease_id = ++state.lease_id;
+
+    context_.RunAfter(
+        file_name, lease_duration_, [this, file_name, lease_id]() {
+            auto& state = resources_[file_name];
+            if (!state.leased || state.lease_id != lease_id) {
+                return;
+            }
+
+            if (state.in_critical_section) {
+                // The lease ends when I leave the critical section.
+                state.lease_expired = true;
+                return;
+            }
+            EndLease(file_name, state);
+        });
+}
+
+void RicartAgrawalaAlgorithm::EndLease(const std::string& file_name,
+                                       ResourceState& state) {
+    state.leased = false;
+    state.lease_expired = false;
+    if (!state.delayed_replies.empty()) {
+        leases_revoked_.increment();
+    }
+    DeliverDelayedReplies(file_name, state);
+}
+
+void RicartAgrawalaAlgorithm::DeliverDelayedReplies(
+    const std::string& file_name, ResourceState& state) {
+    util::safe_debug::log("Delivering delayed replies");
+    context_.RecordDelayedRequests(file_name, state.delayed_replies.size());
+    std::uint64_t released_at = WallClockTime();
+    for (const auto& reply : state.delayed_replies) {
+        // I lose permission from every node I reply to.
+        state.have_permission_from.erase(reply.to);
+        SendReply(reply.to, file_name, reply.timestamp, released_at);
+    }
+    state.delayed_replies.clear();
+}
+
+}  // namespace mutex
+}  // namespace net
\ No newline at end of file
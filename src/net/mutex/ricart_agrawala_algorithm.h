@@ -0,0 +1,143 @@
+#ifndef NET_MUTEX_RICART_AGRAWALA_ALGORITHM_
+#define NET_MUTEX_RICART_AGRAWALA_ALGORITHM_
+
+#include <net/mutex/mutual_exclusion_algorithm.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace net {
+namespace mutex {
+
+/**
+ * @brief The Ricart-Agrawala algorithm, with the optimization proposed by
+ * Roucairol and Carvalho.
+ *
+ * A node needs permission from every other node to enter the critical section.
+ * Permission is kept until the other node asks for it back, so repeated
+ * requests for an uncontended resource require no messages.
+ *
+ * Permission can also be leased after leaving the critical section. While the
+ * lease lasts, requests from other nodes wait, so a node that comes back to
+ * the same resource soon enters again without any messages. A lease lasts
+ * "mutex_lease_ms" milliseconds, for at most "mutex_lease_entries" entries if
+ * set. Leases are off by default.
+ *
+ * A reply carries the timestamp of the request it answers, so a reply resent
+ * after a peer reconnects is not mistaken for permission for a later request.
+ *
+ * A node that joins a running network starts without permission from anyone,
+ * and every member starts with permission from it. A node leaving the network
+ * ends its leases first, and its peers stop waiting for its permission.
+ *
+ */
+class RicartAgrawalaAlgorithm : public MutualExclusionAlgorithm {
+   public:
+    RicartAgrawalaAlgorithm(Context& context);
+
+    util::result<void, Error> Configure() override;
+
+    void Request(const std::string& file_name, std::size_t timestamp) override;
+    void Release(const std::string& file_name) override;
+
+    void OnPeerReconnected(proto::node_id_t id) override;
+    void OnPeerJoined(proto::node_id_t id) override;
+    void OnPeerLeft(proto::node_id_t id) override;
+    util::result<void, Error> OnLeaving() override;
+
+    void OnRequest(proto::node_id_t from,
+                   proto::mutex::RequestMessage request) override;
+    void OnReply(proto::node_id_t from,
+                 proto::mutex::ReplyMessage reply) override;
+
+   private:
+    /**
+     * @brief A reply delayed until this node is done with the resource.
+     *
+     */
+    struct DelayedReply {
+        proto::node_id_t to;
+        std::size_t timestamp;
+    };
+
+    /**
+     * @brief State of mutual exclusion for a single resource.
+     *
+     */
+    struct ResourceState {
+        bool requesting = false;
+        bool in_critical_section = false;
+        std::size_t timestamp = 0;
+        std::unordered_set<proto::node_id_t> have_permission_from;
+        std::vector<DelayedReply> delayed_replies;
+
+        bool leased = false;
+        bool lease_expired = false;
+        std::size_t lease_id = 0;
+        std::size_t lease_entries = 0;
+    };
+
+    /**
+     * @brief Checks if my outstanding request has priority over a request
+     * from another node.
+     *
+     * @param state
+     * @param timestamp Timestamp of the other request
+     * @param from ID of the other node
+     * @return true
+     * @return false
+     */
+    bool HasPriority(const ResourceState& state, std::size_t timestamp,
+                     proto::node_id_t from) const;
+
+    void SendRequest(proto::node_id_t to, const std::string& file_name,
+                     std::size_t timestamp);
+    void SendReply(proto::node_id_t to, const std::string& file_name,
+                   std::size_t timestamp, std::uint64_t released_at);
+
+    void CheckForMutualExclusion(const std::string& file_name,
+                                 ResourceState& state);
+
+    /**
+     * @brief Starts a lease on permission for the resource, which delays
+     * requests from other nodes until it ends.
+     *
+     * @param file_name
+     * @param state
+     */
+    void StartLease(const std::string& file_name, ResourceState& state);
+
+    /**
+     * @brief Ends the lease on the resource, replying to every delayed
+     * request.
+     *
+     * @param file_name
+     * @param state
+     */
+    void EndLease(const std::string& file_name, ResourceState& state);
+
+    /**
+     * @brief Replies to every delayed request, giving up permission.
+     *
+     * @param file_name
+     * @param state
+     */
+    void DeliverDelayedReplies(const std::string& file_name,
+                               ResourceState& state);
+
+    std::chrono::milliseconds lease_duration_;
+    std::size_t max_lease_entries_;
+    util::metrics::counter& lease_hits_;
+    util::metrics::counter& leases_revoked_;
+    util::metrics::counter& lease_delayed_requests_;
+    std::unordered_map<std::string, ResourceState> resources_;
+};
+
+}  // namespace mutex
+}  // namespace net
+
+#endif  // NET_MUTEX_RICART_AGRAWALA_ALGORITHM_
\ No newline at end of file
@@ -0,0 +1,226 @@
+#include "suzuki_kasami_algorithm.h"
+
+#include <util/console.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace net {
+namespace mutex {
+
+void SuzukiKasamiAlgorithm::OnPeerReconnected(proto::node_id_t id) {
+    // A request only raises the sequence number the peer has seen, and a
+    // token the peer already received is of an old generation, so both are
+    // safe to receive twice.
+    for (auto& pair : resources_) {
+        auto& state = pair.second;
+        if (state.sent_to == id) {
+            util::safe_debug::log("Resending Token to peer", id, "for",
+                                  pair.first);
+            proto::Message token = state.sent_token;
+            context_.SendToPeer(id, pair.first, std::move(token));
+        }
+        if (state.requesting && !state.has_token) {
+            context_.SendToPeer(
+                id, pair.first,
+                proto::mutex::TokenRequestMessage(
+                    context_.Timestamp(),
+                    state.last_requested[context_.MyId()], pair.first)
+                    .ToMessage());
+        }
+    }
+}
+
+void SuzukiKasamiAlgorithm::OnPeerLeft(proto::node_id_t id) {
+    // The peer has no outstanding request, and a node that joins later under
+    // the same ID starts counting its requests again. A leaving peer passes
+    // on the tokens it holds, so none is resent to it.
+    for (auto& pair : resources_) {
+        auto& state = pair.second;
+        if (state.sent_to == id) {
+            state.sent_to = proto::kNoId;
+            state.sent_token = proto::Message();
+        }
+        state.last_requested.erase(id);
+        state.last_granted.erase(id);
+        state.queue.erase(
+            std::remove(state.queue.begin(), state.queue.end(), id),
+            state.queue.end());
+    }
+}
+
+util::result<void, Error> SuzukiKasamiAlgorithm::OnLeaving() {
+    if (IsHome()) {
+        return Error::Create(util::string::stream(
+            "Node ", context_.MyId(),
+            " holds every unused Suzuki-Kasami token, so it cannot leave"));
+    }
+
+    const auto& peers = context_.PeerIds();
+    for (auto& pair : resources_) {
+        auto& state = pair.second;
+        if (!state.has_token) {
+            continue;
+        }
+
+        // If nobody is waiting, any peer can hold the token until it is
+        // requested again.
+        PassToken(pair.first, state, 0);
+        if (state.has_token && !peers.empty()) {
+            SendToken(peers.front(), pair.first, state, 0);
+        }
+    }
+    return util::ok;
+}
+
+void SuzukiKasamiAlgorithm::Request(const std::string& file_name,
+                                    std::size_t) {
+    auto& state = State(file_name);
+    state.requesting = true;
+
+    if (state.has_token) {
+        util::safe_debug::log("Already have the token for", file_name);
+        EnterCriticalSection(file_name, state);
+        return;
+    }
+
+    std::size_t sequence = ++state.last_requested[context_.MyId()];
+    for (auto id : context_.PeerIds()) {
+        context_.SendToPeer(
+            id, file_name,
+            proto::mutex::TokenRequestMessage(context_.Timestamp(), sequence,
+                                              file_name)
+                .ToMessage());
+    }
+}
+
+void SuzukiKasamiAlgorithm::Release(const std::string& file_name) {
+    auto& state = State(file_name);
+    state.in_critical_section = false;
+    state.last_granted[context_.MyId()] =
+        state.last_requested[context_.MyId()];
+    PassToken(file_name, state, WallClockTime());
+}
+
+void SuzukiKasamiAlgorithm::OnTokenRequest(
+    proto::node_id_t from, proto::mutex::TokenRequestMessage request) {
+    std::string& file_name = request.file_name;
+
+    util::safe_debug::log("Received TokenRequest from peer", from, "for",
+                          file_name);
+
+    context_.ObserveTimestamp(request.timestamp);
+
+    auto& state = State(file_name);
+    auto& last_requested = state.last_requested[from];
+    last_requested = std::max(last_requested, request.sequence);
+
+    // An idle holder gives the token away immediately. Otherwise, the request
+    // is queued when the holder leaves the critical section.
+    if (state.has_token && !state.in_critical_section &&
+        HasOutstandingRequest(state, from)) {
+        SendToken(from, file_name, state, 0);
+    }
+}
+
+void SuzukiKasamiAlgorithm::OnToken(proto::node_id_t from,
+                                    proto::mutex::TokenMessage token) {
+    std::string& file_name = token.file_name;
+
+    util::safe_debug::log("Received Token from peer", from, "for",
+                          file_name);
+
+    context_.ObserveTimestamp(token.timestamp);
+
+    auto& state = State(file_name);
+    if (token.generation <= state.generation) {
+        util::safe_debug::log("Ignoring resent Token for", file_name);
+        return;
+    }
+    // The token came back, so the one this node sent last arrived.
+    state.generation = token.generation;
+    state.sent_to = proto::kNoId;
+    state.sent_token = proto::Message();
+    state.has_token = true;
+    state.last_granted = std::move(token.last_granted);
+    state.queue = std::move(token.queue);
+
+    if (state.requesting) {
+        EnterCriticalSection(file_name, state);
+    } else {
+        // The next node has waited since the token was released.
+        PassToken(file_name, state, token.released_at);
+    }
+}
+
+SuzukiKasamiAlgorithm::ResourceState& SuzukiKasamiAlgorithm::State(
+    const std::string& file_name) {
+    auto it = resources_.find(file_name);
+    if (it != resources_.end()) {
+        return it->second;
+    }
+
+    // The token starts at the founding node with the lowest ID.
+    auto& state = resources_[file_name];
+    state.has_token = IsHome();
+    return state;
+}
+
+bool SuzukiKasamiAlgorithm::IsHome() const {
+    const auto& founders = context_.FoundingIds();
+    return !founders.empty() && founders.front() == context_.MyId();
+}
+
+bool SuzukiKasamiAlgorithm::HasOutstandingRequest(ResourceState& state,
+                                                  proto::node_id_t id) {
+    return state.last_requested[id] == state.last_granted[id] + 1;
+}
+
+void SuzukiKasamiAlgorithm::PassToken(const std::string& file_name,
+                                      ResourceState& state,
+                                      std::uint64_t released_at) {
+    std::unordered_set<proto::node_id_t> queued(state.queue.begin(),
+                                                 state.queue.end());
+    for (auto id : context_.PeerIds()) {
+        if (HasOutstandingRequest(state, id) && queued.count(id) == 0) {
+            state.queue.push_back(id);
+        }
+    }
+
+    context_.RecordDelayedRequests(file_name, state.queue.size());
+    if (!state.queue.empty()) {
+        proto::node_id_t next = state.queue.front();
+        state.queue.pop_front();
+        SendToken(next, file_name, state, released_at);
+    }
+}
+
+void SuzukiKasamiAlgorithm::SendToken(proto::node_id_t to,
+                                      const std::string& file_name,
+                                      ResourceState& state,
+                                      std::uint64_t released_at) {
+    util::safe_debug::log("Sending Token to peer", to);
+    state.has_token = false;
+    state.sent_to = to;
+    state.sent_token =
+        proto::mutex::TokenMessage(context_.Timestamp(), released_at,
+                                   ++state.generation,
+                                   std::move(state.last_granted),
+                                   std::move(state.queue), file_name)
+            .ToMessage();
+    state.last_granted.clear();
+    state.queue.clear();
+
+    proto::Message token = state.sent_token;
+    context_.SendToPeer(to, file_name, std::move(token));
+}
+
+void SuzukiKasamiAlgorithm::EnterCriticalSection(const std::string& file_name,
+                                                 ResourceState& state) {
+    state.requesting = false;
+    state.in_critical_section = true;
+    context_.EnterCriticalSection(file_name);
+}
+
+}  // namespace mutex
+}  // namespace net
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef NET_MUTEX_SUZUKI_KASAMI_ALGORITHM_
+#define NET_MUTEX_SUZUKI_KASAMI_ALGORITHM_
+
+#include <net/mutex/mutual_exclusion_algorithm.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+namespace net {
+namespace mutex {
+
+/**
+ * @brief The Suzuki-Kasami token-based algorithm.
+ *
+ * Every resource has a single token, which starts at the founding node with
+ * the lowest ID. The holder of the token may enter the critical section
+ * without sending any messages. Other nodes broadcast a request for the token,
+ * which is passed along in request order when the holder leaves the critical
+ * section.
+ *
+ * This algorithm suits resources that are used repeatedly by a small number of
+ * nodes.
+ *
+ * Requests are resent to a peer that reconnects. So is the last token sent
+ * to it, which may have been lost with the failed connection. Every token
+ * carries the number of times it was passed, so a peer that did receive it
+ * ignores the copy.
+ *
+ * A node leaving the network passes on every token it holds. The founding
+ * node with the lowest ID holds every token that was never used, so it cannot
+ * leave.
+ *
+ */
+class SuzukiKasamiAlgorithm : public MutualExclusionAlgorithm {
+   public:
+    using MutualExclusionAlgorithm::MutualExclusionAlgorithm;
+
+    void OnPeerReconnected(proto::node_id_t id) override;
+    void OnPeerLeft(proto::node_id_t id) override;
+    util::result<void, Error> OnLeaving() override;
+
+    void Request(const std::string& file_name, std::size_t timestamp) override;
+    void Release(const std::string& file_name) override;
+
+    void OnTokenRequest(proto::node_id_t from,
+                        proto::mutex::TokenRequestMessage request) override;
+    void OnToken(proto::node_id_t from,
+                 proto::mutex::TokenMessage token) override;
+
+   private:
+    /**
+     * @brief State of mutual exclusion for a single resource.
+     *
+     * `last_granted` and `queue` are only meaningful while holding the token.
+     *
+     */
+    struct ResourceState {
+        bool requesting = false;
+        bool in_critical_section = false;
+        bool has_token = false;
+        std::unordered_map<proto::node_id_t, std::size_t> last_requested;
+        std::unordered_map<proto::node_id_t, std::size_t> last_granted;
+        std::deque<proto::node_id_t> queue;
+
+        // Generation of the newest token this node has received or sent.
+        std::uint64_t generation = 0;
+
+        // The token this node sent last, until it is seen again, to resend if
+        // the connection it was sent on fails.
+        proto::node_id_t sent_to = proto::kNoId;
+        proto::Message sent_token;
+    };
+
+    /**
+     * @brief Gets the state for a resource, creating it if needed.
+     *
+     * @param file_name
+     * @return ResourceState&
+     */
+    ResourceState& State(const std::string& file_name);
+
+    /**
+     * @brief Checks if this node holds every token that was never used.
+     *
+     * @return true
+     * @return false
+     */
+    bool IsHome() const;
+
+    /**
+     * @brief Checks if a node has a request that the token has not granted.
+     *
+     * @param state
+     * @param id
+     * @return true
+     * @return false
+     */
+    bool HasOutstandingRequest(ResourceState& state, proto::node_id_t id);
+
+    /**
+     * @brief Passes the token to the next waiting node, if any.
+     *
+     * @param file_name
+     * @param state
+     * @param released_at Time the token was released, or 0
+     */
+    void PassToken(const std::string& file_name, ResourceState& state,
+                   std::uint64_t released_at);
+
+    /**
+     * @brief Passes the token to the given node, keeping a copy in case the
+     * connection to the node fails.
+     *
+     * @param to
+     * @param file_name
+     * @param state
+     * @param released_at Time the token was released, or 0
+     */
+    void SendToken(proto::node_id_t to, const std::string& file_name,
+                   ResourceState& state, std::uint64_t released_at);
+    void EnterCriticalSection(const std::string& file_name,
+                              ResourceState& state);
+
+    std::unordered_map<std::string, ResourceState> resources_;
+};
+
+}  // namespace mutex
+}  // namespace net
+
+#endif  // NET_MUTEX_SUZUKI_KASAMI_ALGORITHM_
\ No newline at end of file
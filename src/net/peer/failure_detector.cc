@@ -0,0 +1,171 @@
+#include "failure_detector.h"
+
+#include <util/mutex.h>
+#include <util/number.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace net {
+namespace peer {
+
+namespace {
+
+constexpr std::size_t kDefaultHeartbeatMs = 1000;
+constexpr double kDefaultPhiThreshold = 8;
+constexpr std::size_t kDefaultTimeoutHeartbeats = 5;
+
+double MillisBetween(FailureDetector::clock_t::time_point start,
+                     FailureDetector::clock_t::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}  // namespace
+
+constexpr std::size_t FailureDetector::kMaxSamples;
+
+FailureDetector::FailureDetector()
+    : mode_(Mode::kPhi),
+      heartbeat_interval_(kDefaultHeartbeatMs),
+      phi_threshold_(kDefaultPhiThreshold),
+      timeout_(kDefaultHeartbeatMs * kDefaultTimeoutHeartbeats) {}
+
+util::result<void, Error> FailureDetector::Configure(
+    const program::Properties& props) {
+    auto heartbeat_ms = props.Get("peer_heartbeat_ms");
+    if (heartbeat_ms.has_value()) {
+        auto result =
+            util::num::string_to_num<std::size_t>(heartbeat_ms.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"peer_heartbeat_ms\" property");
+        }
+        heartbeat_interval_ = std::chrono::milliseconds(result.ok());
+        timeout_ = heartbeat_interval_ * kDefaultTimeoutHeartbeats;
+    }
+
+    auto detector = props.Get("peer_failure_detector");
+    if (detector.has_value()) {
+        if (detector.value() == "phi") {
+            mode_ = Mode::kPhi;
+        } else if (detector.value() == "timeout") {
+            mode_ = Mode::kTimeout;
+        } else {
+            return Error::Create("Unknown failure detector \"" +
+                                 detector.value() + "\"");
+        }
+    }
+
+    auto threshold = props.Get("peer_phi_threshold");
+    if (threshold.has_value()) {
+        auto result = util::num::string_to_num<double>(threshold.value());
+        if (result.is_err() || result.ok() <= 0) {
+            return Error::Create("Invalid \"peer_phi_threshold\" property");
+        }
+        phi_threshold_ = result.ok();
+    }
+
+    auto timeout_ms = props.Get("peer_failure_timeout_ms");
+    if (timeout_ms.has_value()) {
+        auto result = util::num::string_to_num<std::size_t>(timeout_ms.value());
+        if (result.is_err()) {
+            return Error::Create(
+                "Invalid \"peer_failure_timeout_ms\" property");
+        }
+        timeout_ = std::chrono::milliseconds(result.ok());
+    }
+
+    return util::ok;
+}
+
+bool FailureDetector::Enabled() const {
+    return heartbeat_interval_.count() > 0;
+}
+
+std::chrono::milliseconds FailureDetector::HeartbeatInterval() const {
+    return heartbeat_interval_;
+}
+
+void FailureDetector::Watch(proto::node_id_t id, clock_t::time_point now) {
+    CRITICAL_SECTION(mutex_, {
+        History& history = peers_[id];
+        history = History();
+        history.last = now;
+    });
+}
+
+void FailureDetector::Unwatch(proto::node_id_t id) {
+    CRITICAL_SECTION(mutex_, peers_.erase(id));
+}
+
+void FailureDetector::Heartbeat(proto::node_id_t id, clock_t::time_point now) {
+    CRITICAL_SECTION(mutex_, {
+        auto it = peers_.find(id);
+        if (it == peers_.end()) {
+            return;
+        }
+
+        History& history = it->second;
+        double interval = MillisBetween(history.last, now);
+        history.last = now;
+        history.intervals_ms.push_back(interval);
+        history.sum += interval;
+        history.sum_of_squares += interval * interval;
+        if (history.intervals_ms.size() > kMaxSamples) {
+            double oldest = history.intervals_ms.front();
+            history.intervals_ms.pop_front();
+            history.sum -= oldest;
+            history.sum_of_squares -= oldest * oldest;
+        }
+    });
+}
+
+bool FailureDetector::Suspect(proto::node_id_t id,
+                              clock_t::time_point now) const {
+    CRITICAL_SECTION(mutex_, {
+        auto it = peers_.find(id);
+        if (it == peers_.end()) {
+            return false;
+        }
+
+        const History& history = it->second;
+        double elapsed = MillisBetween(history.last, now);
+        switch (mode_) {
+            case Mode::kTimeout:
+                return elapsed > timeout_.count();
+            case Mode::kPhi:
+            default:
+                return Phi(history, elapsed) > phi_threshold_;
+        }
+    });
+}
+
+double FailureDetector::Phi(const History& history, double elapsed_ms) const {
+    // Until heartbeats arrive, assume they arrive on time.
+    double interval = static_cast<double>(heartbeat_interval_.count());
+    double mean = interval;
+    double variance = 0;
+    std::size_t samples = history.intervals_ms.size();
+    if (samples > 0) {
+        mean = history.sum / samples;
+        variance =
+            std::max(0.0, history.sum_of_squares / samples - mean * mean);
+    }
+
+    // A single late heartbeat is expected, and a perfectly steady peer should
+    // not be suspected the moment it is slightly late.
+    mean += interval;
+    double stddev = std::max(std::sqrt(variance), interval / 4);
+
+    // Logistic approximation of the normal distribution's tail, which avoids
+    // computing the error function.
+    double y = (elapsed_ms - mean) / stddev;
+    double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+    if (elapsed_ms > mean) {
+        return -std::log10(e / (1 + e));
+    }
+    return -std::log10(1 - 1 / (1 + e));
+}
+
+}  // namespace peer
+}  // namespace net
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef NET_PEER_FAILURE_DETECTOR_
+#define NET_PEER_FAILURE_DETECTOR_
+
+#include <net/error.h>
+#include <net/proto/messages.h>
+#include <program/properties.h>
+#include <util/result.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace net {
+namespace peer {
+
+/**
+ * @brief Heartbeat-based failure detector for peers.
+ *
+ * Peers send each other a heartbeat every "peer_heartbeat_ms" milliseconds
+ * (1000 by default, and 0 turns failure detection off).
+ *
+ * With "peer_failure_detector=phi", the default, a peer is suspected once the
+ * phi-accrual suspicion level of its silence passes "peer_phi_threshold" (8 by
+ * default). The level adapts to the heartbeat arrival times seen so far, so a
+ * slow but steady peer is not suspected.
+ *
+ * With "peer_failure_detector=timeout", a peer is suspected once it has been
+ * silent for "peer_failure_timeout_ms" milliseconds (five heartbeats by
+ * default).
+ *
+ */
+class FailureDetector {
+   public:
+    using clock_t = std::chrono::steady_clock;
+
+    FailureDetector();
+
+    util::result<void, Error> Configure(const program::Properties& props);
+
+    /**
+     * @brief Returns if heartbeats are sent and peers are watched.
+     *
+     * @return true
+     * @return false
+     */
+    bool Enabled() const;
+
+    /**
+     * @brief The interval between heartbeats sent to each peer.
+     *
+     * @return std::chrono::milliseconds
+     */
+    std::chrono::milliseconds HeartbeatInterval() const;
+
+    /**
+     * @brief Starts watching a peer as if it just sent a heartbeat, forgetting
+     * any previous heartbeats.
+     *
+     * @param id
+     * @param now
+     */
+    void Watch(proto::node_id_t id, clock_t::time_point now);
+
+    /**
+     * @brief Stops watching a peer.
+     *
+     * @param id
+     */
+    void Unwatch(proto::node_id_t id);
+
+    /**
+     * @brief Records a heartbeat from a watched peer.
+     *
+     * @param id
+     * @param now
+     */
+    void Heartbeat(proto::node_id_t id, clock_t::time_point now);
+
+    /**
+     * @brief Returns if a watched peer is suspected to have failed.
+     *
+     * @param id
+     * @param now
+     * @return true
+     * @return false
+     */
+    bool Suspect(proto::node_id_t id, clock_t::time_point now) const;
+
+   private:
+    enum class Mode {
+        kPhi,
+        kTimeout,
+    };
+
+    /**
+     * @brief Heartbeat arrival history of a single peer.
+     *
+     */
+    struct History {
+        clock_t::time_point last;
+        std::deque<double> intervals_ms;
+        double sum = 0;
+        double sum_of_squares = 0;
+    };
+
+    /**
+     * @brief Suspicion level for a peer that has been silent for the given
+     * time.
+     *
+     * @param history
+     * @param elapsed_ms
+     * @return double
+     */
+    double Phi(const History& history, double elapsed_ms) const;
+
+    // Number of heartbeat intervals kept for each peer.
+    static constexpr std::size_t kMaxSamples = 100;
+
+    Mode mode_;
+    std::chrono::milliseconds heartbeat_interval_;
+    double phi_threshold_;
+    std::chrono::milliseconds timeout_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<proto::node_id_t, History> peers_;
+};
+
+}  // namespace peer
+}  // namespace net
+
+#endif  // NET_PEER_FAILURE_DETECTOR_
\ No newline at end of file
@@ -11,7 +11,8 @@ PeerAcceptor::PeerAcceptor(PeerComponents& components,
     : NetworkService(false),
       components_(components),
       callback_(callback),
-      acceptor_(components_.common, [this](int sockfd) { OnAccept(sockfd); }) {}
+      acceptor_(components_.common, [this](int sockfd) { OnAccept(sockfd); }),
+      accept_any_(false) {}
 
 util::result<void, Error> PeerAcceptor::SetUp() {
     port_t port = components_.common.options.port;
@@ -45,6 +46,11 @@ void PeerAcceptor::AwaitConnectionFrom(const Location& location) {
     CRITICAL_SECTION(mutex_, allowed_.emplace(location.address));
 }
 
+void PeerAcceptor::AcceptAnyPeer() {
+    util::safe_debug::log("Accepting connections from any peer");
+    CRITICAL_SECTION(mutex_, accept_any_ = true);
+}
+
 void PeerAcceptor::OnAccept(int sockfd) {
     Socket socket(sockfd, SocketState::kConnected,
                   components_.common.options.timeout);
@@ -62,7 +68,7 @@ void PeerAcceptor::OnAccept(int sockfd) {
 
     CRITICAL_SECTION_SAME_SCOPE(
         mutex_, auto it = allowed_.find(peer_name.address);
-        if (it == allowed_.end()) {
+        if (!accept_any_ && it == allowed_.end()) {
             util::safe_debug::log("Rejecting connection from", peer_name);
             return;
         }
@@ -36,6 +36,13 @@ class PeerAcceptor : public NetworkService {
      */
     void AwaitConnectionFrom(const Location& location);
 
+    /**
+     * @brief Allows connections from any client, which must still pass the
+     * handshake.
+     *
+     */
+    void AcceptAnyPeer();
+
    private:
     util::result<void, Error> SetUp() override;
     util::result<void, Error> OnStart() override;
@@ -50,6 +57,7 @@ class PeerAcceptor : public NetworkService {
     // We use unordered multiset in the case of servers running on the same
     // machine.
     std::unordered_multiset<address_t> allowed_;
+    bool accept_any_;
     std::unordered_map<Location,
                        std::shared_ptr<service::ReceiveHandshakeService>>
         pending_connections_;
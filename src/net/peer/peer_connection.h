@@ -5,6 +5,7 @@
 #include <net/location.h>
 #include <net/proto/messages.h>
 
+#include <memory>
 #include <string>
 
 namespace net {
@@ -13,26 +14,29 @@ namespace peer {
 /**
  * @brief A connection to another peer.
  *
- * The `in` connection was established by the other peer. The `out`
- * connection was established by this peer.
+ * There is a single connection between each pair of peers, which carries
+ * messages both ways. `dialed` is set if the connection was established by
+ * this peer.
  *
  */
 struct PeerConnection {
     Location location;
     proto::node_id_t id;
-    std::shared_ptr<Connection> in;
-    std::shared_ptr<Connection> out;
+    std::shared_ptr<Connection> connection;
+    bool dialed;
 };
 
 /**
- * @brief A reference to a peer connection and the underlying connections
+ * @brief A reference to a peer connection and the underlying connection
  * inside of it.
  *
+ * The reference shares ownership of the connection, so a connection that is
+ * replaced after a failure stays valid until everyone using it lets go.
+ *
  */
 struct PeerConnectionReference {
     proto::node_id_t id;
-    Connection& in;
-    Connection& out;
+    std::shared_ptr<Connection> connection;
 };
 
 }  // namespace peer
@@ -23,18 +23,19 @@ void PeerConnector::Connect(const Location& target) {
     auto emplace_result = emplace();
 
     if (!emplace_result.second) {
-        callback_(Error::Create("Duplicate peer server target found"));
+        callback_(target,
+                  Error::Create("Duplicate peer server target found"));
     } else {
         auto service = emplace_result.first->second;
-        components_.common.thread_pool.Schedule([this, &target, service]() {
-            service->start([this, &target,
+        components_.common.thread_pool.Schedule([this, target, service]() {
+            service->start([this, target,
                             service](util::result<void, util::error> result) {
                 CRITICAL_SECTION(mutex_, {
                     pending_connections_.erase(target);
                     if (result.is_err()) {
-                        callback_(Error::Create(result.err().what()));
+                        callback_(target, Error::Create(result.err().what()));
                     } else {
-                        callback_(std::move(*service).Export());
+                        callback_(target, std::move(*service).Export());
                     }
                 });
             });
@@ -23,6 +23,7 @@ namespace peer {
 class PeerConnector : public NetworkService {
    public:
     using connect_callback_t = std::function<void(
+        const Location& target,
         util::result<service::SendHandshakeService::Out, Error>)>;
 
     PeerConnector(PeerComponents& components,
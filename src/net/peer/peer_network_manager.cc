@@ -3,22 +3,37 @@
 #include <util/console.h>
 #include <util/mutex.h>
 #include <util/number.h>
+#include <util/optional.h>
 #include <util/strings.h>
 
 #include <sstream>
+#include <utility>
 
 namespace net {
 namespace peer {
 
+namespace {
+
+// Number of retry timeouts a lost peer has to come back by default.
+constexpr int kRecoveryRetries = 10;
+
+}  // namespace
+
 PeerNetworkManager::PeerNetworkManager(Components& components)
     : NetworkService(false),
       components_(components),
+      recovery_timeout_(0),
+      dynamic_membership_(false),
+      joining_(false),
       state_(State::kInitializing),
+      handed_out_(false),
+      leaving_(false),
       connector_(
           components_,
-          [this](
-              util::result<service::SendHandshakeService::Out, Error> result) {
-              OnClientConnection(std::move(result));
+          [this](const Location& target,
+                 util::result<service::SendHandshakeService::Out, Error>
+                     result) {
+              OnClientConnection(target, std::move(result));
           }),
       acceptor_(
           components_,
@@ -37,25 +52,114 @@ void PeerNetworkManager::AwaitConnected(const connected_callback_t& callback) {
                      connected_callbacks_.emplace_back(callback));
 }
 
-void PeerNetworkManager::ReportError(Connection& connection,
-                                     const recovered_callback_t& callback) {
-    CRITICAL_SECTION(callback_mutex_,
-                     recovered_callbacks_.emplace_back(callback));
+void PeerNetworkManager::SetReconnectedCallback(
+    const reconnected_callback_t& callback) {
+    reconnected_callback_ = callback;
+}
 
-    // For now, we do not implement dynamic network recovery. The network
-    // immediately breaks.
-    //
-    // In the future:
-    //  Save a set of connections that have been reported broken, so the same
-    //  connection that is reported in multiple locations is handled only once.
-    //
-    //  Find the connection in the `managed_connections_` map.
-    //
-    //  Issue the appropriate request to the connector or acceptor.
-    //
-    //  When network is once again complete, the recovered callbacks will be
-    //  called.
-    UpdateState(State::kBroken);
+void PeerNetworkManager::SetJoinedCallback(const joined_callback_t& callback) {
+    joined_callback_ = callback;
+}
+
+void PeerNetworkManager::OpenToJoins() {
+    if (dynamic_membership_) {
+        acceptor_.AcceptAnyPeer();
+    }
+}
+
+void PeerNetworkManager::RemovePeer(proto::node_id_t id) {
+    CRITICAL_SECTION(connections_mutex_, {
+        util::safe_console::log("Peer", id, "left the network");
+        auto timer = recovery_timers_.find(id);
+        if (timer != recovery_timers_.end()) {
+            components_.common.timer_service.Cancel(timer->second);
+            recovery_timers_.erase(timer);
+        }
+        auto it = managed_connections_.find(id);
+        if (it != managed_connections_.end()) {
+            it->second.connection->socket.Close();
+            managed_connections_.erase(it);
+        }
+        components_.node_id_service.Remove(id);
+
+        // The peer may have been the last one the network was waiting for.
+        CheckIfConnected();
+    });
+}
+
+void PeerNetworkManager::Leave() {
+    CRITICAL_SECTION(connections_mutex_, {
+        leaving_ = true;
+        for (auto& timer : recovery_timers_) {
+            components_.common.timer_service.Cancel(timer.second);
+        }
+        recovery_timers_.clear();
+    });
+}
+
+bool PeerNetworkManager::AwaitPeersClosed(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(connections_mutex_);
+    return peers_closed_.wait_for(lock, timeout, [this]() {
+        return managed_connections_.empty();
+    });
+}
+
+bool PeerNetworkManager::DynamicMembership() const {
+    return dynamic_membership_;
+}
+
+bool PeerNetworkManager::Joining() const { return joining_; }
+
+void PeerNetworkManager::ReportError(
+    const PeerConnectionReference& connection,
+    const recovered_callback_t& callback) {
+    util::optional<Location> redial;
+    CRITICAL_SECTION(connections_mutex_, {
+        // The peer may have reconnected since, on a connection that is fine.
+        auto it = managed_connections_.find(connection.id);
+        if (it != managed_connections_.end() &&
+            it->second.connection != connection.connection) {
+            it = managed_connections_.end();
+        }
+        if (leaving_) {
+            // Peers close their connections once they see this node leave.
+            if (it != managed_connections_.end()) {
+                it->second.connection->socket.Close();
+                managed_connections_.erase(it);
+            }
+            if (managed_connections_.empty()) {
+                peers_closed_.notify_all();
+            }
+            return;
+        }
+
+        CRITICAL_SECTION(callback_mutex_,
+                         recovered_callbacks_.emplace_back(callback));
+        if (it == managed_connections_.end()) {
+            // This connection was already reported or replaced, so the network
+            // may have recovered already.
+            if (state_ == State::kConnected) {
+                SendSuccessToCallbacks(Callbacks::kRecovering);
+            }
+            return;
+        }
+
+        PeerConnection lost = std::move(it->second);
+        managed_connections_.erase(it);
+        util::safe_console::log("Lost connection to peer", lost.id);
+        lost.connection->socket.Close();
+        UpdateState(State::kRecovering);
+        StartRecovery(lost);
+        if (lost.dialed && state_ == State::kRecovering) {
+            redial = lost.location;
+        }
+    });
+
+    // The connector may report a failure right away, so it is called without
+    // the lock.
+    if (redial.has_value()) {
+        connector_.Connect(redial.value());
+    }
 }
 
 util::result<void, Error> PeerNetworkManager::SetUp() {
@@ -70,10 +174,18 @@ util::result<void, Error> PeerNetworkManager::SetUp() {
 
     ASSIGN_OR_RETURN(Location localhost,
                      Location::FromHostName("localhost", my_port_));
-    ASSIGN_OR_RETURN(Location my_ip, Location::MyIpAddress());
-    my_ip.port = my_port_;
+    // Finding our own IP address opens a connection out of the machine, so
+    // it is only done if a peer on our port might be us by another name.
+    util::optional<Location> my_ip;
 
     // For each server, save the actual host name in the host entry table.
+    //
+    // Only one peer of each pair dials the other, so we dial the servers
+    // after us in the list and await the servers before us. If we are not in
+    // the list, we do both.
+    bool found_myself = false;
+    std::vector<Location> before_me;
+    std::vector<Location> after_me;
     auto servers = util::strings::split(servers_list.value(), ',');
     for (const auto& server : servers) {
         auto name_port = util::strings::split(server, ':');
@@ -96,24 +208,91 @@ util::result<void, Error> PeerNetworkManager::SetUp() {
         ASSIGN_OR_RETURN(auto target_location,
                          Location::FromHostName(name, port));
 
-        if (localhost == target_location || my_ip == target_location) {
+        if (localhost != target_location && port == my_port_ &&
+            !my_ip.has_value()) {
+            ASSIGN_OR_RETURN(Location ip, Location::MyIpAddress());
+            ip.port = my_port_;
+            my_ip = ip;
+        }
+        if (localhost == target_location ||
+            (my_ip.has_value() && my_ip.value() == target_location)) {
             // Don't connect to yourself.
+            found_myself = true;
             continue;
         }
 
+        (found_myself ? after_me : before_me).push_back(target_location);
         peer_locations_.emplace_back(std::move(target_location));
     }
 
+    auto membership = components_.common.props.Get("peer_membership");
+    if (membership.has_value()) {
+        if (membership.value() == "dynamic") {
+            dynamic_membership_ = true;
+        } else if (membership.value() != "static") {
+            return Error::Create("Unknown peer membership \"" +
+                                 membership.value() + "\"");
+        }
+    }
+    auto join = components_.common.props.Get("peer_join");
+    if (join.has_value()) {
+        if (join.value() != "true" && join.value() != "false") {
+            return Error::Create("Invalid \"peer_join\" property");
+        }
+        joining_ = join.value() == "true";
+    }
+    if (joining_ && !dynamic_membership_) {
+        return Error::Create(
+            "Property \"peer_join\" requires \"peer_membership=dynamic\"");
+    }
+
+    peers_to_dial_ = std::move(after_me);
+    peers_to_await_ = std::move(before_me);
+    if (!found_myself) {
+        peers_to_dial_ = peer_locations_;
+        peers_to_await_ = peer_locations_;
+    }
+    if (joining_) {
+        // The members are already connected to each other, and none of them
+        // knows about me yet.
+        peers_to_dial_ = peer_locations_;
+        peers_to_await_.clear();
+    }
+
+    // By default, a lost peer has as long to come back as a dialing peer keeps
+    // trying to reach it.
+    recovery_timeout_ = std::chrono::milliseconds(
+        components_.common.options.retry_timeout * kRecoveryRetries);
+    auto recovery_ms = components_.common.props.Get("peer_recovery_timeout_ms");
+    if (recovery_ms.has_value()) {
+        auto result =
+            util::num::string_to_num<std::size_t>(recovery_ms.value());
+        if (result.is_err()) {
+            return Error::Create(
+                "Invalid \"peer_recovery_timeout_ms\" property");
+        }
+        recovery_timeout_ = std::chrono::milliseconds(result.ok());
+    }
+
+    ASSIGN_OR_RETURN(
+        socket_options_,
+        SocketOptions::FromProperties(components_.common.props, "peer"));
+
     return util::ok;
 }
 
 util::result<void, Error> PeerNetworkManager::OnStart() {
     util::safe_console::log("Starting peer network");
+
+    // Peers are allowed before the acceptor starts, so an early connection is
+    // not rejected.
+    for (auto& location : peers_to_await_) {
+        acceptor_.AwaitConnectionFrom(location);
+    }
     RETURN_IF_ERROR(acceptor_.Start());
     RETURN_IF_ERROR(connector_.Start());
-    for (auto& location : peer_locations_) {
+    for (auto& location : peers_to_dial_) {
         connector_.Connect(location);
-        acceptor_.AwaitConnectionFrom(location);
     }
     return util::ok;
 }
@@ -128,25 +307,134 @@ void PeerNetworkManager::OnStop() {
 util::result<void, Error> PeerNetworkManager::CleanUp() {
     connector_.Stop();
     acceptor_.Stop();
-    for (auto& conn : managed_connections_) {
-        if (conn.second.in) {
-            conn.second.in->socket.Close();
+    CRITICAL_SECTION(connections_mutex_, {
+        for (auto& timer : recovery_timers_) {
+            components_.common.timer_service.Cancel(timer.second);
         }
-        if (conn.second.out) {
-            conn.second.out->socket.Close();
+        recovery_timers_.clear();
+        for (auto& conn : managed_connections_) {
+            conn.second.connection->socket.Close();
         }
-    }
+    });
     return util::ok;
 }
 
-PeerConnection& PeerNetworkManager::GetConnectionMapEntry(proto::node_id_t id) {
-    auto it = managed_connections_.find(id);
-    if (it == managed_connections_.end()) {
-        auto res = managed_connections_.emplace(
-            id, PeerConnection{Location(0, 0), id, nullptr, nullptr});
-        return res.first->second;
+void PeerNetworkManager::AddConnection(proto::node_id_t id,
+                                       const Location& location,
+                                       Socket&& socket, bool dialed) {
+    // Peers may not send anything for a long time, so the connection never
+    // times out.
+    socket.SetTimeout(Socket::kNoTimeout);
+    auto options_result = socket.SetOptions(socket_options_);
+    if (options_result.is_err()) {
+        util::safe_error_log::log(options_result.err());
+    }
+    auto connection = std::make_shared<Connection>(std::move(socket));
+
+    CRITICAL_SECTION(connections_mutex_, {
+        if (leaving_) {
+            connection->socket.Close();
+            return;
+        }
+
+        auto it = managed_connections_.find(id);
+        if (it == managed_connections_.end()) {
+            // Members stay registered while their connection is recovered, so
+            // an unregistered ID is a new member.
+            bool member =
+                components_.node_id_service.GetLocationById(id).has_value();
+            components_.node_id_service.Remove(id);
+            components_.node_id_service.Add(location, id);
+
+            auto& entry =
+                managed_connections_
+                    .emplace(id,
+                             PeerConnection{location, id, connection, dialed})
+                    .first->second;
+            if (handed_out_) {
+                if (dynamic_membership_ && !member) {
+                    OnJoined(entry);
+                } else {
+                    OnReconnected(entry);
+                }
+            }
+            CheckIfConnected();
+            return;
+        }
+
+        // We already have a connection to this peer. Both peers keep the
+        // connection dialed by the lower ID.
+        //
+        // Once the network is handed out, a connection made the same way as
+        // the old one means the peer lost the old one before we noticed.
+        auto& entry = it->second;
+        bool my_id_is_lower =
+            static_cast<proto::node_id_t>(components_.common.options.id) < id;
+        bool replace =
+            handed_out_
+                ? dialed == entry.dialed || dialed == my_id_is_lower
+                : entry.dialed != my_id_is_lower && dialed == my_id_is_lower;
+        if (replace) {
+            std::swap(entry.connection, connection);
+            entry.location = location;
+            entry.dialed = dialed;
+            components_.node_id_service.Remove(id);
+            components_.node_id_service.Add(location, id);
+            if (handed_out_) {
+                OnReconnected(entry);
+            }
+        }
+        util::safe_debug::log("Closing duplicate connection to peer", id);
+        connection->socket.Close();
+    });
+}
+
+void PeerNetworkManager::StartRecovery(const PeerConnection& lost) {
+    proto::node_id_t id = lost.id;
+    if (recovery_timers_.find(id) != recovery_timers_.end()) {
+        return;
+    }
+
+    // An accepted peer is still allowed by the acceptor, so it only needs to
+    // dial back in.
+    if (!lost.dialed) {
+        util::safe_console::log("Awaiting reconnection from peer", id);
+    }
+    recovery_timers_[id] = components_.common.timer_service.ScheduleAfter(
+        recovery_timeout_, [this, id]() { OnRecoveryTimeout(id); });
+}
+
+void PeerNetworkManager::OnRecoveryTimeout(proto::node_id_t id) {
+    CRITICAL_SECTION(connections_mutex_, {
+        recovery_timers_.erase(id);
+        if (managed_connections_.find(id) != managed_connections_.end()) {
+            return;
+        }
+        stopping_error_ = Error::Create(
+            util::string::stream("Peer ", id, " did not reconnect"));
+        UpdateState(State::kBroken);
+    });
+}
+
+void PeerNetworkManager::OnReconnected(const PeerConnection& connection) {
+    util::safe_console::log("Reconnected to peer", connection.id);
+    auto timer = recovery_timers_.find(connection.id);
+    if (timer != recovery_timers_.end()) {
+        components_.common.timer_service.Cancel(timer->second);
+        recovery_timers_.erase(timer);
+    }
+    if (reconnected_callback_) {
+        reconnected_callback_(
+            PeerConnectionReference{connection.id, connection.connection});
+    }
+}
+
+void PeerNetworkManager::OnJoined(const PeerConnection& connection) {
+    util::safe_console::log("Peer", connection.id, "joined the network");
+    if (joined_callback_) {
+        joined_callback_(
+            PeerConnectionReference{connection.id, connection.connection});
     }
-    return it->second;
 }
 
 void PeerNetworkManager::UpdateState(State new_state) {
@@ -159,6 +447,7 @@ void PeerNetworkManager::UpdateState(State new_state) {
 
     switch (state_) {
         case State::kConnected: {
+            handed_out_ = true;
             switch (old_state) {
                 case State::kRecovering: {
                     // We were in the recovering state, so run all recovered
@@ -248,8 +537,13 @@ void PeerNetworkManager::SendErrorToCallbacks(Error error,
 }
 
 void PeerNetworkManager::OnClientConnection(
+    const Location& target,
     util::result<service::SendHandshakeService::Out, Error> result) {
     if (result.is_err()) {
+        if (RetryRedial(target, result.err())) {
+            return;
+        }
+
         // If we failed to initiate a connection to a peer server, it must be
         // down.
         //
@@ -262,18 +556,54 @@ void PeerNetworkManager::OnClientConnection(
 
     auto out = std::move(result).ok();
     util::safe_debug::log("Verified client connection to", out.target);
-    CRITICAL_SECTION(connections_mutex_, {
-        auto& entry = GetConnectionMapEntry(out.server_id);
-        entry.location = out.target;
-        entry.out = std::make_shared<Connection>(std::move(out).socket);
+    AddConnection(out.server_id, out.target, std::move(out.socket), true);
+}
 
-        CheckIfConnected();
+bool PeerNetworkManager::RetryRedial(const Location& target,
+                                     const Error& error) {
+    // A lost peer has until its recovery timeout to come back, which may be
+    // longer than the connector keeps trying, so we keep dialing until then.
+    CRITICAL_SECTION(connections_mutex_, {
+        if (!handed_out_) {
+            return false;
+        }
+        bool connected = std::any_of(
+            managed_connections_.begin(), managed_connections_.end(),
+            [&target](const std::pair<const proto::node_id_t, PeerConnection>&
+                          entry) { return entry.second.location == target; });
+        if (state_ != State::kRecovering || connected || leaving_) {
+            // The failed attempt is no longer needed.
+            return true;
+        }
+        util::safe_debug::log("Redial to", target, "failed, retrying:", error);
     });
+    components_.common.timer_service.ScheduleAfter(
+        std::chrono::milliseconds(components_.common.options.retry_timeout),
+        [this, target]() {
+            CRITICAL_SECTION(connections_mutex_, {
+                if (state_ != State::kRecovering) {
+                    return;
+                }
+            });
+            connector_.Connect(target);
+        });
+    return true;
 }
 
 void PeerNetworkManager::OnServerConnection(
     util::result<service::ReceiveHandshakeService::Out, Error> result) {
     if (result.is_err()) {
+        // Once the network is handed out, the connection may come from a
+        // node that failed to join or a peer that will dial again, and
+        // neither is a problem for the running network.
+        bool handed_out;
+        CRITICAL_SECTION(connections_mutex_, handed_out = handed_out_);
+        if (handed_out) {
+            util::safe_error_log::log("Rejected a peer connection:",
+                                      result.err());
+            return;
+        }
+
         // Currently, our callback for server connections only yields an error
         // if the socket failed to properly handshake with this peer server.
         //
@@ -286,13 +616,8 @@ void PeerNetworkManager::OnServerConnection(
 
     auto out = std::move(result).ok();
     util::safe_debug::log("Verified server connection from client",
-                          static_cast<int>(out.client_id));
-    CRITICAL_SECTION(connections_mutex_, {
-        auto& entry = GetConnectionMapEntry(out.client_id);
-        entry.in = std::make_shared<Connection>(std::move(out).socket);
-
-        CheckIfConnected();
-    });
+                          out.client_id);
+    AddConnection(out.client_id, out.location, std::move(out.socket), false);
 }
 
 bool PeerNetworkManager::IsConnected() const {
@@ -305,21 +630,16 @@ bool PeerNetworkManager::IsConnectedImpl() const {
         return true;
     }
 
-    // Every location should have an associated `PeerConnection` object with
-    // two active connections.
-    std::unordered_set<Location> unconnected_locations_(peer_locations_.begin(),
-                                                        peer_locations_.end());
-
-    for (const auto& pair : managed_connections_) {
-        auto& connection = pair.second;
-        unconnected_locations_.erase(connection.location);
-        if (!connection.in || !connection.out) {
-            return false;
-        }
+    // Once the network is handed out, members may have joined or left, so it
+    // is connected again once no lost peer is left to recover.
+    if (handed_out_) {
+        return recovery_timers_.empty();
     }
 
-    // Saw all peer locations in the managed connections map.
-    return unconnected_locations_.empty();
+    // Every peer should have an associated `PeerConnection` object. Accepted
+    // connections come from an ephemeral port, so peers are counted by ID
+    // rather than matched by location.
+    return managed_connections_.size() == peer_locations_.size();
 }
 
 void PeerNetworkManager::CheckIfConnected() {
@@ -332,11 +652,13 @@ PeerNetworkManager::PeerNetworkList PeerNetworkManager::ConstructNetwork() {
     // This method assumes the network is ready to go, which means
     // `IsConnected()` returns true.
     PeerNetworkList network;
-    for (const auto& pair : managed_connections_) {
-        auto& connection = pair.second;
-        network.push_back(PeerConnectionReference{connection.id, *connection.in,
-                                                  *connection.out});
-    }
+    CRITICAL_SECTION(connections_mutex_, {
+        for (const auto& pair : managed_connections_) {
+            auto& connection = pair.second;
+            network.push_back(
+                PeerConnectionReference{connection.id, connection.connection});
+        }
+    });
     return network;
 }
 
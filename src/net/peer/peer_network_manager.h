@@ -8,7 +8,10 @@
 #include <net/peer/peer_components.h>
 #include <net/peer/peer_connection.h>
 #include <net/peer/peer_connector.h>
+#include <thread/timer_service.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <mutex>
 #include <string>
@@ -21,6 +24,23 @@ namespace peer {
 /**
  * @brief Manager for all connections in a connected peer network.
  *
+ * Each pair of peers shares a single connection. A peer dials every peer
+ * listed after it in the "clients" property and accepts connections from
+ * every peer listed before it. If two peers dial each other anyway, the
+ * connection dialed by the peer with the lower ID is kept.
+ *
+ * A lost connection is recovered by the peer that dialed it, while the other
+ * peer waits for it to dial back in. The network breaks if a lost peer does
+ * not come back within "peer_recovery_timeout_ms" milliseconds (ten retry
+ * timeouts by default).
+ *
+ * With "peer_membership=dynamic", peers may join and leave once the network
+ * is connected. A node started with "peer_join=true" joins a running network
+ * by dialing every peer in "clients", which must list every current member.
+ * Members accept a connection from any peer that passes the handshake, and
+ * register every member's ID with the node ID service. A connection from an
+ * unregistered ID is a new member rather than a reconnection.
+ *
  */
 class PeerNetworkManager : public NetworkService {
    public:
@@ -28,6 +48,10 @@ class PeerNetworkManager : public NetworkService {
     using connected_callback_t =
         std::function<void(util::result<PeerNetworkList, Error>)>;
     using recovered_callback_t = std::function<void(util::result<void, Error>)>;
+    using reconnected_callback_t =
+        std::function<void(const PeerConnectionReference&)>;
+    using joined_callback_t =
+        std::function<void(const PeerConnectionReference&)>;
 
     PeerNetworkManager(Components& components);
 
@@ -40,14 +64,94 @@ class PeerNetworkManager : public NetworkService {
     void AwaitConnected(const connected_callback_t& callback);
 
     /**
-     * @brief Reports an error with a connection in the peer network.
+     * @brief Sets the callback for a connection that replaces a lost
+     * connection to a peer, after the network has connected.
+     *
+     * The callback runs with the network manager locked, so it must not call
+     * back into the network manager. Must be set before the network manager
+     * starts.
+     *
+     * @param callback
+     */
+    void SetReconnectedCallback(const reconnected_callback_t& callback);
+
+    /**
+     * @brief Sets the callback for a connection from a peer that joins the
+     * network after it has connected.
+     *
+     * The callback runs with the network manager locked, so it must not call
+     * back into the network manager. Must be set before the network manager
+     * starts.
+     *
+     * @param callback
+     */
+    void SetJoinedCallback(const joined_callback_t& callback);
+
+    /**
+     * @brief Starts accepting connections from peers that are not listed in
+     * the "clients" property, so they can join the network.
+     *
+     * Does nothing unless membership is dynamic.
+     *
+     */
+    void OpenToJoins();
+
+    /**
+     * @brief Removes a peer that left the network on purpose, without
+     * recovering its connection.
+     *
+     * @param id
+     */
+    void RemovePeer(proto::node_id_t id);
+
+    /**
+     * @brief Stops recovering lost connections, because this node is leaving
+     * the network.
+     *
+     * Connections lost from then on are simply removed.
+     *
+     */
+    void Leave();
+
+    /**
+     * @brief Waits for every peer to close its connection after this node
+     * leaves.
+     *
+     * @param timeout
+     * @return true if every connection closed in time
+     * @return false
+     */
+    bool AwaitPeersClosed(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Returns if peers may join and leave the running network.
+     *
+     * @return true
+     * @return false
+     */
+    bool DynamicMembership() const;
+
+    /**
+     * @brief Returns if this node is joining a network that is already
+     * running.
+     *
+     * @return true
+     * @return false
+     */
+    bool Joining() const;
+
+    /**
+     * @brief Reports an error with a connection in the peer network, which
+     * closes the connection and starts recovering it.
      *
-     * The given callback is called as soon as the network has recovered.
+     * Errors on a connection that has already been reported or replaced are
+     * ignored. The given callback is called as soon as the network has
+     * recovered.
      *
-     * @param connection Faulty connection
+     * @param connection Faulty connection, and the peer it belongs to
      * @param callback
      */
-    void ReportError(Connection& connection,
+    void ReportError(const PeerConnectionReference& connection,
                      const recovered_callback_t& callback);
 
     /**
@@ -76,9 +180,54 @@ class PeerNetworkManager : public NetworkService {
     void OnStop() override;
     util::result<void, Error> CleanUp() override;
 
-    PeerConnection& GetConnectionMapEntry(proto::node_id_t id);
+    /**
+     * @brief Adds a handshaken connection to the network, resolving duplicate
+     * connections to the same peer.
+     *
+     * @param id ID of the peer
+     * @param location Location of the peer
+     * @param socket
+     * @param dialed The connection was established by this peer
+     */
+    void AddConnection(proto::node_id_t id, const Location& location,
+                       Socket&& socket, bool dialed);
     void UpdateState(State new_state);
 
+    /**
+     * @brief Starts recovering a lost connection.
+     *
+     * Must be called with the connections lock held.
+     *
+     * @param lost
+     */
+    void StartRecovery(const PeerConnection& lost);
+
+    /**
+     * @brief Breaks the network if the given peer has not reconnected.
+     *
+     * @param id
+     */
+    void OnRecoveryTimeout(proto::node_id_t id);
+
+    /**
+     * @brief Ends recovery of the given peer, and passes its new connection
+     * on.
+     *
+     * Must be called with the connections lock held.
+     *
+     * @param connection
+     */
+    void OnReconnected(const PeerConnection& connection);
+
+    /**
+     * @brief Passes on the connection of a peer that just joined the network.
+     *
+     * Must be called with the connections lock held.
+     *
+     * @param connection
+     */
+    void OnJoined(const PeerConnection& connection);
+
     void SignalStopWithError(net::Error&& error);
 
     using callbacks_t = std::uint8_t;
@@ -93,7 +242,20 @@ class PeerNetworkManager : public NetworkService {
     void SendErrorToCallbacks(Error error, callbacks_t callbacks);
 
     void OnClientConnection(
+        const Location& target,
         util::result<service::SendHandshakeService::Out, Error> result);
+
+    /**
+     * @brief Dials a lost peer again if the last attempt failed and the peer
+     * has not come back some other way.
+     *
+     * @param target
+     * @param error
+     * @return true if the failure belongs to recovery, so it is not fatal
+     * @return false
+     */
+    bool RetryRedial(const Location& target, const Error& error);
+
     void OnServerConnection(
         util::result<service::ReceiveHandshakeService::Out, Error> result);
 
@@ -104,10 +266,23 @@ class PeerNetworkManager : public NetworkService {
     PeerComponents components_;
     std::uint16_t my_port_;
     std::vector<Location> peer_locations_;
+    std::vector<Location> peers_to_dial_;
+    std::vector<Location> peers_to_await_;
+    std::chrono::milliseconds recovery_timeout_;
+    SocketOptions socket_options_;
+    bool dynamic_membership_;
+    bool joining_;
     State state_;
+    bool handed_out_;
+    bool leaving_;
 
     std::mutex connections_mutex_;
     std::unordered_map<proto::node_id_t, PeerConnection> managed_connections_;
+    std::unordered_map<proto::node_id_t, thread::TimerService::timer_id_t>
+        recovery_timers_;
+    reconnected_callback_t reconnected_callback_;
+    joined_callback_t joined_callback_;
+    std::condition_variable peers_closed_;
 
     std::mutex callback_mutex_;
     std::vector<connected_callback_t> connected_callbacks_;
@@ -70,7 +70,7 @@ class NodeIdService {
         Location location;
     };
 
-    std::mutex mutex_;
+    mutable std::mutex mutex_;
     std::list<NodeIdEntry> entries_list_;
 
     using value_type = decltype(entries_list_)::iterator;
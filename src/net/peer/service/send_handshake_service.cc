@@ -13,8 +13,7 @@ SendHandshakeService::SendHandshakeService(PeerComponents& components,
       components_(components),
       target_(target),
       server_id_(proto::kNoId),
-      socket_(components_.common.options.timeout,
-              components_.common.options.retry_timeout),
+      socket_(components_.common),
       message_service_(socket_, components_.common) {}
 
 const Location& SendHandshakeService::Target() const { return target_; }
@@ -88,9 +87,12 @@ IMPL_STATE_HANDLER(SendHandshakeService, ReceiveHandshake) {
                 if (msg.opcode == proto::Opcode::kEstablishConnection) {
                     util::safe_debug::log("Received handshake response from",
                                           instance.target_);
-                    auto establish =
-                        std::move(msg).ToEstablishConnection().ok();
-                    instance.server_id_ = establish.id;
+                    auto establish = std::move(msg).ToEstablishConnection();
+                    if (establish.is_err()) {
+                        callback(establish.err().what());
+                        return;
+                    }
+                    instance.server_id_ = establish.ok().id;
                     callback(util::ok);
                 } else {
                     callback(util::error("Peer server denied handshake"));
@@ -16,7 +16,11 @@ AsyncMessageService::AsyncMessageService(Socket& socket, Components& components)
       reading_(false),
       writing_(false),
       expected_(),
-      attempting_to_send_() {}
+      attempting_to_send_(),
+      bytes_received_(components.metrics.get_counter("net.bytes_received")),
+      bytes_sent_(components.metrics.get_counter("net.bytes_sent")),
+      frames_received_(components.metrics.get_counter("net.frames_received")),
+      frames_sent_(components.metrics.get_counter("net.frames_sent")) {}
 
 bool AsyncMessageService::ReadingMessage() const { return reading_; }
 
@@ -90,6 +94,7 @@ void AsyncMessageService::ReceiveBytes(const recv_callback_t& callback) {
             callback(result.err());
             return;
         }
+        bytes_received_.increment(result.ok());
 
         // Process the bytes received.
         auto res = ProcessAllBytes();
@@ -155,6 +160,8 @@ util::result<bool, Error> AsyncMessageService::ProcessBytes(
     RETURN_IF_ERROR(res);
 
     if (FinishedReadingCurrentMessage()) {
+        frames_received_.increment();
+
         // We have finished reading a complete message, but compound
         // messages may requires multiple messages in a row to be read. The
         // logic below handles compound messages.
@@ -380,6 +387,7 @@ util::result<void, Error> AsyncMessageService::PutMessageInOutputBuffer(
     // Used for detecting when we have finished sending all of a message to
     // the endpoint.
     attempting_to_send_ += kOpcodeLength + kBodySizeLength + body_size;
+    frames_sent_.increment();
     return util::ok;
 }
 
@@ -416,6 +424,7 @@ void AsyncMessageService::SendBytes(const send_callback_t& callback) {
         }
 
         std::size_t bytes_sent = result.ok();
+        bytes_sent_.increment(bytes_sent);
         if (bytes_sent > attempting_to_send_) {
             attempting_to_send_ = 0;
         } else {
@@ -4,6 +4,7 @@
 #include <net/components.h>
 #include <net/proto/messages.h>
 #include <net/socket.h>
+#include <util/metrics.h>
 #include <util/optional.h>
 #include <util/result.h>
 
@@ -217,6 +218,13 @@ class AsyncMessageService {
 
     std::size_t attempting_to_send_;
 
+    // Totals over every message service, counting each frame of a compound
+    // message.
+    util::metrics::counter& bytes_received_;
+    util::metrics::counter& bytes_sent_;
+    util::metrics::counter& frames_received_;
+    util::metrics::counter& frames_sent_;
+
     static std::atomic<std::size_t> file_transfer_count_;
 };
 
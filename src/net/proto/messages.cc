@@ -2,6 +2,7 @@
 
 #include <util/buffer.h>
 #include <util/bytes.h>
+#include <util/strings.h>
 
 #define ASSERT_OPCODE(expected)                            \
     if (opcode != expected) {                              \
@@ -24,7 +25,15 @@ util::result<ErrorMessage, Error> Message::ToError() && {
 util::result<EstablishConnectionMessage, Error>
 Message::ToEstablishConnection() && {
     ASSERT_OPCODE(Opcode::kEstablishConnection);
-    std::uint8_t id = util::bytes::extract<1>(body);
+    if (body.size() < 1 + sizeof(node_id_t)) {
+        return Error::Create("Malformed EstablishConnection message");
+    }
+    std::uint8_t version = util::bytes::extract<1>(body);
+    if (version != kHandshakeVersion) {
+        return Error::Create("Unsupported handshake version " +
+                             std::to_string(version));
+    }
+    node_id_t id = util::bytes::extract<sizeof(node_id_t)>(body);
     return EstablishConnectionMessage{id, body.to_string()};
 }
 
@@ -51,7 +60,14 @@ util::result<compound::FinishedMessage, Error> Message::ToFinished() && {
 
 util::result<EnquiryMessage, Error> Message::ToEnquiry() && {
     ASSERT_OPCODE(Opcode::kEnquiry);
-    return EnquiryMessage{};
+    if (body.size() == 0) {
+        return EnquiryMessage{};
+    }
+    if (body.size() < sizeof(std::uint64_t)) {
+        return Error::Create("Malformed Enquiry message");
+    }
+    std::uint64_t version = util::bytes::extract<sizeof(std::uint64_t)>(body);
+    return EnquiryMessage{version};
 }
 
 util::result<ReadMessage, Error> Message::ToRead() && {
@@ -67,8 +83,53 @@ util::result<WriteMessage, Error> Message::ToWrite() && {
     return WriteMessage{{file_name.begin(), file_name.end()}, line};
 }
 
+util::result<HeartbeatMessage, Error> Message::ToHeartbeat() && {
+    ASSERT_OPCODE(Opcode::kHeartbeat);
+    return HeartbeatMessage{};
+}
+
+util::result<MembersMessage, Error> Message::ToMembers() && {
+    ASSERT_OPCODE(Opcode::kMembers);
+    if (body.size() < sizeof(node_id_t)) {
+        return Error::Create("Malformed Members message");
+    }
+    std::size_t num_ids = util::bytes::extract<sizeof(node_id_t)>(body);
+    if (body.size() < num_ids * sizeof(node_id_t)) {
+        return Error::Create("Malformed Members message");
+    }
+    std::vector<node_id_t> ids;
+    ids.reserve(num_ids);
+    for (std::size_t i = 0; i < num_ids; ++i) {
+        ids.push_back(util::bytes::extract<sizeof(node_id_t)>(body));
+    }
+    return MembersMessage{std::move(ids)};
+}
+
+util::result<LeaveMessage, Error> Message::ToLeave() && {
+    ASSERT_OPCODE(Opcode::kLeave);
+    return LeaveMessage{};
+}
+
+util::result<ListingMessage, Error> Message::ToListing() && {
+    ASSERT_OPCODE(Opcode::kListing);
+    if (body.size() < sizeof(std::uint64_t)) {
+        return Error::Create("Malformed Listing message");
+    }
+    auto version = util::bytes::extract<sizeof(std::uint64_t)>(body);
+    return ListingMessage{version,
+                          util::strings::split_trim(body.to_string(), ',')};
+}
+
+util::result<NotModifiedMessage, Error> Message::ToNotModified() && {
+    ASSERT_OPCODE(Opcode::kNotModified);
+    return NotModifiedMessage{};
+}
+
 util::result<mutex::RequestMessage, Error> Message::ToRequest() && {
     ASSERT_OPCODE(Opcode::kRequest);
+    if (body.size() < sizeof(std::size_t)) {
+        return Error::Create("Malformed Request message");
+    }
     auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
     auto file_name = body.to_string();
     return mutex::RequestMessage{clock, file_name};
@@ -76,9 +137,102 @@ util::result<mutex::RequestMessage, Error> Message::ToRequest() && {
 
 util::result<mutex::ReplyMessage, Error> Message::ToReply() && {
     ASSERT_OPCODE(Opcode::kReply);
+    if (body.size() < sizeof(std::size_t) + sizeof(std::uint64_t)) {
+        return Error::Create("Malformed Reply message");
+    }
+    auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto released_at = util::bytes::extract<sizeof(std::uint64_t)>(body);
+    auto file_name = body.to_string();
+    return mutex::ReplyMessage{clock, released_at, file_name};
+}
+
+util::result<mutex::ReleaseMessage, Error> Message::ToRelease() && {
+    ASSERT_OPCODE(Opcode::kRelease);
+    if (body.size() < sizeof(std::size_t)) {
+        return Error::Create("Malformed Release message");
+    }
+    auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto file_name = body.to_string();
+    return mutex::ReleaseMessage{clock, file_name};
+}
+
+util::result<mutex::InquireMessage, Error> Message::ToInquire() && {
+    ASSERT_OPCODE(Opcode::kInquire);
+    if (body.size() < sizeof(std::size_t)) {
+        return Error::Create("Malformed Inquire message");
+    }
     auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
     auto file_name = body.to_string();
-    return mutex::ReplyMessage{clock, file_name};
+    return mutex::InquireMessage{clock, file_name};
+}
+
+util::result<mutex::RelinquishMessage, Error> Message::ToRelinquish() && {
+    ASSERT_OPCODE(Opcode::kRelinquish);
+    if (body.size() < sizeof(std::size_t)) {
+        return Error::Create("Malformed Relinquish message");
+    }
+    auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto file_name = body.to_string();
+    return mutex::RelinquishMessage{clock, file_name};
+}
+
+util::result<mutex::FailedMessage, Error> Message::ToFailed() && {
+    ASSERT_OPCODE(Opcode::kFailed);
+    if (body.size() < sizeof(std::size_t)) {
+        return Error::Create("Malformed Failed message");
+    }
+    auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto file_name = body.to_string();
+    return mutex::FailedMessage{clock, file_name};
+}
+
+util::result<mutex::TokenRequestMessage, Error> Message::ToTokenRequest() && {
+    ASSERT_OPCODE(Opcode::kTokenRequest);
+    if (body.size() < 2 * sizeof(std::size_t)) {
+        return Error::Create("Malformed TokenRequest message");
+    }
+    auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto sequence = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto file_name = body.to_string();
+    return mutex::TokenRequestMessage{clock, sequence, file_name};
+}
+
+util::result<mutex::TokenMessage, Error> Message::ToToken() && {
+    ASSERT_OPCODE(Opcode::kToken);
+    static constexpr std::size_t kEntrySize =
+        sizeof(node_id_t) + sizeof(std::size_t);
+
+    if (body.size() < sizeof(std::size_t) + 2 * sizeof(std::uint64_t) +
+                          sizeof(node_id_t)) {
+        return Error::Create("Malformed Token message");
+    }
+    auto clock = util::bytes::extract<sizeof(std::size_t)>(body);
+    auto released_at = util::bytes::extract<sizeof(std::uint64_t)>(body);
+    auto generation = util::bytes::extract<sizeof(std::uint64_t)>(body);
+
+    std::size_t num_entries = util::bytes::extract<sizeof(node_id_t)>(body);
+    if (body.size() < num_entries * kEntrySize + sizeof(node_id_t)) {
+        return Error::Create("Malformed Token message");
+    }
+    std::unordered_map<node_id_t, std::size_t> last_granted;
+    for (std::size_t i = 0; i < num_entries; ++i) {
+        node_id_t id = util::bytes::extract<sizeof(node_id_t)>(body);
+        last_granted[id] = util::bytes::extract<sizeof(std::size_t)>(body);
+    }
+
+    std::size_t queue_size = util::bytes::extract<sizeof(node_id_t)>(body);
+    if (body.size() < queue_size * sizeof(node_id_t)) {
+        return Error::Create("Malformed Token message");
+    }
+    std::deque<node_id_t> queue;
+    for (std::size_t i = 0; i < queue_size; ++i) {
+        queue.push_back(util::bytes::extract<sizeof(node_id_t)>(body));
+    }
+
+    auto file_name = body.to_string();
+    return mutex::TokenMessage{clock, released_at, generation,
+                               std::move(last_granted), std::move(queue),
+                               file_name};
 }
 
 Message OkMessage::ToMessage() && { return {Opcode::kOk, {}}; }
@@ -89,7 +243,8 @@ Message ErrorMessage::ToMessage() && {
 
 Message EstablishConnectionMessage::ToMessage() && {
     auto msg = Message{Opcode::kEstablishConnection};
-    util::bytes::insert<1>(msg.body, id);
+    util::bytes::insert<1>(msg.body, kHandshakeVersion);
+    util::bytes::insert<sizeof(node_id_t)>(msg.body, id);
     msg.body.put_iter(message.begin(), message.end());
     return msg;
 }
@@ -110,7 +265,14 @@ Message compound::FinishedMessage::ToMessage() && {
     return {Opcode::kFinished};
 }
 
-Message EnquiryMessage::ToMessage() && { return Message{Opcode::kEnquiry}; }
+Message EnquiryMessage::ToMessage() && {
+    auto msg = Message{Opcode::kEnquiry};
+    if (known_version.has_value()) {
+        util::bytes::insert<sizeof(std::uint64_t)>(msg.body,
+                                                   known_version.value());
+    }
+    return msg;
+}
 
 Message ReadMessage::ToMessage() && {
     return Message{Opcode::kRead, util::buffer(std::move(file_name))};
@@ -124,6 +286,35 @@ Message WriteMessage::ToMessage() && {
     return msg;
 }
 
+Message HeartbeatMessage::ToMessage() && {
+    return Message{Opcode::kHeartbeat};
+}
+
+Message MembersMessage::ToMessage() && {
+    // The count is the width of a node ID, since every node is listed at most
+    // once.
+    auto msg = Message{Opcode::kMembers};
+    util::bytes::insert<sizeof(node_id_t)>(msg.body, ids.size());
+    for (auto id : ids) {
+        util::bytes::insert<sizeof(node_id_t)>(msg.body, id);
+    }
+    return msg;
+}
+
+Message LeaveMessage::ToMessage() && { return Message{Opcode::kLeave}; }
+
+Message ListingMessage::ToMessage() && {
+    auto msg = Message{Opcode::kListing};
+    util::bytes::insert<sizeof(std::uint64_t)>(msg.body, version);
+    auto names = util::strings::join(file_names, ",");
+    msg.body.put_iter(names.begin(), names.end(), true);
+    return msg;
+}
+
+Message NotModifiedMessage::ToMessage() && {
+    return Message{Opcode::kNotModified};
+}
+
 mutex::RequestMessage::RequestMessage(std::size_t timestamp,
                                       std::string file_name)
     : LamportClock{timestamp}, file_name(file_name) {}
@@ -135,15 +326,107 @@ Message mutex::RequestMessage::ToMessage() && {
     return msg;
 }
 
-mutex::ReplyMessage::ReplyMessage(std::size_t timestamp, std::string file_name)
-    : LamportClock{timestamp}, file_name(file_name) {}
+mutex::ReplyMessage::ReplyMessage(std::size_t timestamp,
+                                  std::uint64_t released_at,
+                                  std::string file_name)
+    : LamportClock{timestamp}, released_at(released_at), file_name(file_name) {}
 
 Message mutex::ReplyMessage::ToMessage() && {
     auto msg = Message{Opcode::kReply};
     util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    util::bytes::insert<sizeof(std::uint64_t)>(msg.body, released_at);
     msg.body.put_iter(file_name.begin(), file_name.end());
     return msg;
 }
 
+mutex::ReleaseMessage::ReleaseMessage(std::size_t timestamp,
+                                      std::string file_name)
+    : LamportClock{timestamp}, file_name(file_name) {}
+
+Message mutex::ReleaseMessage::ToMessage() && {
+    auto msg = Message{Opcode::kRelease};
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    msg.body.put_iter(file_name.begin(), file_name.end());
+    return msg;
+}
+
+mutex::InquireMessage::InquireMessage(std::size_t timestamp,
+                                      std::string file_name)
+    : LamportClock{timestamp}, file_name(file_name) {}
+
+Message mutex::InquireMessage::ToMessage() && {
+    auto msg = Message{Opcode::kInquire};
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    msg.body.put_iter(file_name.begin(), file_name.end());
+    return msg;
+}
+
+mutex::RelinquishMessage::RelinquishMessage(std::size_t timestamp,
+                                            std::string file_name)
+    : LamportClock{timestamp}, file_name(file_name) {}
+
+Message mutex::RelinquishMessage::ToMessage() && {
+    auto msg = Message{Opcode::kRelinquish};
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    msg.body.put_iter(file_name.begin(), file_name.end());
+    return msg;
+}
+
+mutex::FailedMessage::FailedMessage(std::size_t timestamp,
+                                    std::string file_name)
+    : LamportClock{timestamp}, file_name(file_name) {}
+
+Message mutex::FailedMessage::ToMessage() && {
+    auto msg = Message{Opcode::kFailed};
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    msg.body.put_iter(file_name.begin(), file_name.end());
+    return msg;
+}
+
+mutex::TokenRequestMessage::TokenRequestMessage(std::size_t timestamp,
+                                                std::size_t sequence,
+                                                std::string file_name)
+    : LamportClock{timestamp}, sequence(sequence), file_name(file_name) {}
+
+Message mutex::TokenRequestMessage::ToMessage() && {
+    auto msg = Message{Opcode::kTokenRequest};
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, sequence);
+    msg.body.put_iter(file_name.begin(), file_name.end());
+    return msg;
+}
+
+mutex::TokenMessage::TokenMessage(
+    std::size_t timestamp, std::uint64_t released_at, std::uint64_t generation,
+    std::unordered_map<node_id_t, std::size_t> last_granted,
+    std::deque<node_id_t> queue, std::string file_name)
+    : LamportClock{timestamp},
+      released_at(released_at),
+      generation(generation),
+      last_granted(std::move(last_granted)),
+      queue(std::move(queue)),
+      file_name(file_name) {}
+
+Message mutex::TokenMessage::ToMessage() && {
+    // Counts are the width of a node ID, since there is at most one entry for
+    // every node.
+    auto msg = Message{Opcode::kToken};
+    util::bytes::insert<sizeof(std::size_t)>(msg.body, timestamp);
+    util::bytes::insert<sizeof(std::uint64_t)>(msg.body, released_at);
+    util::bytes::insert<sizeof(std::uint64_t)>(msg.body, generation);
+    util::bytes::insert<sizeof(node_id_t)>(msg.body, last_granted.size());
+    for (const auto& entry : last_granted) {
+        util::bytes::insert<sizeof(node_id_t)>(msg.body, entry.first);
+        util::bytes::insert<sizeof(std::size_t)>(msg.body, entry.second);
+    }
+    util::bytes::insert<sizeof(node_id_t)>(msg.body, queue.size());
+    for (auto id : queue) {
+        util::bytes::insert<sizeof(node_id_t)>(msg.body, id);
+    }
+    // A token for a large network does not fit in the default body.
+    msg.body.put_iter(file_name.begin(), file_name.end(), true);
+    return msg;
+}
+
 }  // namespace proto
 }  // namespace net
\ No newline at end of file
@@ -3,10 +3,14 @@
 
 #include <net/error.h>
 #include <util/buffer.h>
+#include <util/optional.h>
 #include <util/result.h>
 
 #include <cstdint>
+#include <deque>
+#include <limits>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace net {
@@ -17,6 +21,9 @@ static constexpr std::size_t kBodySizeLength = 4;
 static constexpr std::size_t kMaxBodySize = (1ULL << 32) - 1;
 static constexpr char kStringDelimiter[] = "\r\n";
 
+// Error a server answers with when it is overloaded.
+static constexpr char kBusyError[] = "busy";
+
 /**
  * @brief Opcode for a message.
  *
@@ -32,8 +39,19 @@ enum class Opcode : std::uint8_t {
     kEnquiry = 7,
     kRead = 8,
     kWrite = 9,
+    kHeartbeat = 10,
+    kMembers = 11,
+    kLeave = 12,
+    kListing = 13,
+    kNotModified = 14,
     kRequest = 100,
     kReply = 101,
+    kRelease = 102,
+    kInquire = 103,
+    kRelinquish = 104,
+    kFailed = 105,
+    kTokenRequest = 106,
+    kToken = 107,
     kShutdown = 200,
 };
 
@@ -68,12 +86,23 @@ struct ErrorMessage {
     Message ToMessage() &&;
 };
 
-using node_id_t = std::uint8_t;
+using node_id_t = std::uint32_t;
 static constexpr node_id_t kNoId = std::numeric_limits<node_id_t>::max();
 
+/**
+ * @brief Version of the `EstablishConnection` encoding.
+ *
+ * Version 1 sent the node ID as a single byte with no version. Version 2
+ * leads with this version byte and sends a 4-byte node ID.
+ *
+ */
+static constexpr std::uint8_t kHandshakeVersion = 2;
+
 /**
  * @brief Message establishing a connection with a server.
  *
+ * The body is the handshake version, the sender's node ID, and the password.
+ *
  */
 struct EstablishConnectionMessage {
     node_id_t id;
@@ -129,8 +158,37 @@ struct FinishedMessage {
  * @brief Message sent from client to server to get all file names available for
  * reading.
  *
+ * A client that knows a version of the listing sends it, and is answered with
+ * `Listing`, or `NotModified` if its version is still current. Without a
+ * version, the body is empty, and the server answers with a `Response`
+ * listing the files, as it did before listings were versioned.
+ *
  */
 struct EnquiryMessage {
+    // Version of the listing the client has, if it has one yet.
+    util::optional<std::uint64_t> known_version;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message answering a versioned `Enquiry` with the files available for
+ * reading.
+ *
+ */
+struct ListingMessage {
+    std::uint64_t version;
+    std::vector<std::string> file_names;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message answering a versioned `Enquiry` when the listing has not
+ * changed since the version the client has.
+ *
+ */
+struct NotModifiedMessage {
     Message ToMessage() &&;
 };
 
@@ -155,6 +213,35 @@ struct WriteMessage {
     Message ToMessage() &&;
 };
 
+/**
+ * @brief Message sent periodically between peers to show they are still
+ * alive.
+ *
+ */
+struct HeartbeatMessage {
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message sent from a member of the peer network to a node that just
+ * joined, listing the IDs of every other member.
+ *
+ */
+struct MembersMessage {
+    std::vector<node_id_t> ids;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message sent from a peer to every other peer when it leaves the
+ * network on purpose.
+ *
+ */
+struct LeaveMessage {
+    Message ToMessage() &&;
+};
+
 namespace mutex {
 
 /**
@@ -181,10 +268,120 @@ struct RequestMessage : LamportClock {
  * @brief Message replying to a `Request` message, allowing permission until
  * further notice.
  *
+ * The timestamp is the timestamp of the request being answered. A reply
+ * delayed until the sender left the critical section carries the wall clock
+ * time it left, in microseconds. Otherwise, the release time is 0.
+ *
  */
 struct ReplyMessage : LamportClock {
-    ReplyMessage(std::size_t timestamp, std::string file_name);
+    ReplyMessage(std::size_t timestamp, std::uint64_t released_at,
+                 std::string file_name);
 
+    std::uint64_t released_at;
+    std::string file_name;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message releasing a lock granted by a quorum member.
+ *
+ * The timestamp is the timestamp of the request being released.
+ *
+ */
+struct ReleaseMessage : LamportClock {
+    ReleaseMessage(std::size_t timestamp, std::string file_name);
+
+    std::string file_name;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message asking the holder of a quorum member's lock if it has
+ * entered the critical section yet.
+ *
+ * The timestamp is the timestamp of the request holding the lock.
+ *
+ */
+struct InquireMessage : LamportClock {
+    InquireMessage(std::size_t timestamp, std::string file_name);
+
+    std::string file_name;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message giving a quorum member's lock back in response to an
+ * `Inquire` message.
+ *
+ * The timestamp is the timestamp of the request giving up the lock.
+ *
+ */
+struct RelinquishMessage : LamportClock {
+    RelinquishMessage(std::size_t timestamp, std::string file_name);
+
+    std::string file_name;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message telling a requester that a quorum member's lock is held by a
+ * request of higher priority.
+ *
+ * The timestamp is the timestamp of the request that failed.
+ *
+ */
+struct FailedMessage : LamportClock {
+    FailedMessage(std::size_t timestamp, std::string file_name);
+
+    std::string file_name;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message broadcast to request the token for a resource.
+ *
+ * The sequence number counts the requests the sender has made for the
+ * resource.
+ *
+ */
+struct TokenRequestMessage : LamportClock {
+    TokenRequestMessage(std::size_t timestamp, std::size_t sequence,
+                        std::string file_name);
+
+    std::size_t sequence;
+    std::string file_name;
+
+    Message ToMessage() &&;
+};
+
+/**
+ * @brief Message passing the token for a resource to the next node to enter
+ * the critical section.
+ *
+ * The token holds the sequence number of the last request granted for each
+ * node, and the queue of nodes waiting for the token. A token passed when a
+ * node left the critical section carries the wall clock time it left, in
+ * microseconds. Otherwise, the release time is 0.
+ *
+ * The generation counts the times the token was passed, so a token that is
+ * sent again can be told apart from a newer one.
+ *
+ */
+struct TokenMessage : LamportClock {
+    TokenMessage(std::size_t timestamp, std::uint64_t released_at,
+                 std::uint64_t generation,
+                 std::unordered_map<node_id_t, std::size_t> last_granted,
+                 std::deque<node_id_t> queue, std::string file_name);
+
+    std::uint64_t released_at;
+    std::uint64_t generation;
+    std::unordered_map<node_id_t, std::size_t> last_granted;
+    std::deque<node_id_t> queue;
     std::string file_name;
 
     Message ToMessage() &&;
@@ -212,8 +409,19 @@ struct Message {
     util::result<EnquiryMessage, Error> ToEnquiry() &&;
     util::result<ReadMessage, Error> ToRead() &&;
     util::result<WriteMessage, Error> ToWrite() &&;
+    util::result<HeartbeatMessage, Error> ToHeartbeat() &&;
+    util::result<MembersMessage, Error> ToMembers() &&;
+    util::result<LeaveMessage, Error> ToLeave() &&;
+    util::result<ListingMessage, Error> ToListing() &&;
+    util::result<NotModifiedMessage, Error> ToNotModified() &&;
     util::result<mutex::RequestMessage, Error> ToRequest() &&;
     util::result<mutex::ReplyMessage, Error> ToReply() &&;
+    util::result<mutex::ReleaseMessage, Error> ToRelease() &&;
+    util::result<mutex::InquireMessage, Error> ToInquire() &&;
+    util::result<mutex::RelinquishMessage, Error> ToRelinquish() &&;
+    util::result<mutex::FailedMessage, Error> ToFailed() &&;
+    util::result<mutex::TokenRequestMessage, Error> ToTokenRequest() &&;
+    util::result<mutex::TokenMessage, Error> ToToken() &&;
 };
 
 }  // namespace proto
@@ -0,0 +1,186 @@
+#include "reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <util/console.h>
+#include <util/error.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace net {
+
+namespace {
+
+// Maximum number of events handled per wakeup.
+constexpr int kMaxEvents = 64;
+
+}  // namespace
+
+Reactor::Reactor(thread::ThreadPool& thread_pool)
+    : thread_pool_(thread_pool), running_(false) {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        util::fatal_error(Error::CreateFromErrNo("Failed to create epoll"));
+    }
+
+    // Writing to the wake file descriptor interrupts the event loop when
+    // stopping.
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        util::fatal_error(Error::CreateFromErrNo("Failed to create eventfd"));
+    }
+
+    ::epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) < 0) {
+        util::fatal_error(
+            Error::CreateFromErrNo("Failed to register eventfd with epoll"));
+    }
+}
+
+Reactor::~Reactor() {
+    Stop();
+    ::close(wake_fd_);
+    ::close(epoll_fd_);
+}
+
+void Reactor::Start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    thread_ = std::thread([this]() { EventLoop(); });
+}
+
+void Reactor::Stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    util::safe_debug::log("Stopping reactor");
+
+    std::uint64_t one = 1;
+    if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+        util::safe_error_log::log(
+            Error::CreateFromErrNo("Failed to wake reactor"));
+    }
+    thread_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : interests_) {
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry.first, nullptr);
+    }
+    interests_.clear();
+}
+
+util::result<void, Error> Reactor::Await(int fd, Event event, const Job& job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = interests_.find(fd);
+    bool registered = it != interests_.end();
+    if (!registered) {
+        it = interests_.emplace(fd, Interest()).first;
+    }
+
+    Interest& interest = it->second;
+    (event == Event::kRead ? interest.read : interest.write) = job;
+    auto result = Arm(fd, interest, registered);
+    if (result.is_err() && !registered) {
+        interests_.erase(it);
+    }
+    return result;
+}
+
+void Reactor::Cancel(int fd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = interests_.find(fd);
+    if (it == interests_.end()) {
+        return;
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    interests_.erase(it);
+}
+
+util::result<void, Error> Reactor::Arm(int fd, const Interest& interest,
+                                       bool registered) {
+    ::epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLONESHOT;
+    if (interest.read) {
+        event.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (interest.write) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.fd = fd;
+
+    int res = ::epoll_ctl(epoll_fd_, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                          fd, &event);
+    if (res < 0) {
+        return Error::CreateFromErrNo("Failed to register with epoll");
+    }
+    return util::ok;
+}
+
+void Reactor::EventLoop() {
+    ::epoll_event events[kMaxEvents];
+    std::vector<Job> ready;
+    while (running_) {
+        int count = ::epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno != EINTR) {
+                util::safe_error_log::log(
+                    Error::CreateFromErrNo("Failed to wait on epoll"));
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                auto it = interests_.find(fd);
+                if (fd == wake_fd_ || it == interests_.end()) {
+                    continue;
+                }
+
+                // Errors and hangups wake every job, so they can see the
+                // failure for themselves.
+                std::uint32_t fired = events[i].events;
+                bool failed = fired & (EPOLLERR | EPOLLHUP);
+                bool readable = failed || fired & (EPOLLIN | EPOLLRDHUP);
+                bool writable = failed || fired & EPOLLOUT;
+                Interest& interest = it->second;
+                if (interest.read && readable) {
+                    ready.push_back(std::move(interest.read));
+                    interest.read = nullptr;
+                }
+                if (interest.write && writable) {
+                    ready.push_back(std::move(interest.write));
+                    interest.write = nullptr;
+                }
+
+                // One-shot registrations are disabled once they fire, so any
+                // job still waiting must be armed again.
+                if (interest.read || interest.write) {
+                    auto result = Arm(fd, interest, true);
+                    if (result.is_err()) {
+                        util::safe_error_log::log(result.err());
+                    }
+                } else {
+                    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+                    interests_.erase(it);
+                }
+            }
+        }
+
+        for (auto& job : ready) {
+            thread_pool_.Schedule(job);
+        }
+        ready.clear();
+    }
+}
+
+}  // namespace net
\ No newline at end of file
@@ -0,0 +1,111 @@
+#ifndef NET_REACTOR_
+#define NET_REACTOR_
+
+#include <net/error.h>
+#include <thread/thread_pool.h>
+#include <util/result.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace net {
+
+/**
+ * @brief Event loop for running jobs when file descriptors become ready.
+ *
+ * A single thread waits on epoll and hands each ready job to the thread pool,
+ * so no pool thread blocks waiting on a socket. Every job runs at most once,
+ * and must be awaited again for the next event.
+ *
+ */
+class Reactor {
+   public:
+    using Job = thread::ThreadPool::Job;
+
+    /**
+     * @brief Event to wait for on a file descriptor.
+     *
+     */
+    enum class Event {
+        kRead,
+        kWrite,
+    };
+
+    Reactor(thread::ThreadPool& thread_pool);
+    ~Reactor();
+
+    /**
+     * @brief Starts the event loop thread.
+     *
+     */
+    void Start();
+
+    /**
+     * @brief Stops the event loop thread, dropping every pending job.
+     *
+     */
+    void Stop();
+
+    /**
+     * @brief Runs a job once the file descriptor is ready for the given event.
+     *
+     * The job also runs if an error or hangup occurs on the file descriptor,
+     * so it should check the result of its own operation. A file descriptor
+     * may have a read job and a write job pending at the same time.
+     *
+     * @param fd
+     * @param event
+     * @param job
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> Await(int fd, Event event, const Job& job);
+
+    /**
+     * @brief Drops every pending job for the file descriptor.
+     *
+     * Must be called before the file descriptor is closed, because a closed
+     * file descriptor number may be reused.
+     *
+     * @param fd
+     */
+    void Cancel(int fd);
+
+   private:
+    /**
+     * @brief Pending jobs for a single file descriptor.
+     *
+     */
+    struct Interest {
+        Job read;
+        Job write;
+    };
+
+    /**
+     * @brief Updates epoll with the events a file descriptor is waiting for.
+     *
+     * Must be called with the lock held.
+     *
+     * @param fd
+     * @param interest
+     * @param registered The file descriptor is already registered
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> Arm(int fd, const Interest& interest,
+                                  bool registered);
+
+    void EventLoop();
+
+    thread::ThreadPool& thread_pool_;
+    int epoll_fd_;
+    int wake_fd_;
+    std::atomic<bool> running_;
+    std::mutex mutex_;
+    std::unordered_map<int, Interest> interests_;
+    std::thread thread_;
+};
+
+}  // namespace net
+
+#endif  // NET_REACTOR_
\ No newline at end of file
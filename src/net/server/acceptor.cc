@@ -1,33 +1,81 @@
 #include "acceptor.h"
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <util/console.h>
 
+#include <cerrno>
+#include <chrono>
+
 namespace net {
 namespace server {
 
+namespace {
+
+// Maximum number of connections accepted per wakeup, so one busy listener
+// does not hold a pool thread forever.
+constexpr std::size_t kMaxAcceptBatch = 64;
+
+// Delay before accepting again once the process runs out of file
+// descriptors.
+constexpr std::chrono::milliseconds kAcceptBackoff(100);
+
+}  // namespace
+
+Acceptor::Listener::Listener(Components& components)
+    : socket(components), reactor(components.thread_pool) {}
+
 Acceptor::Acceptor(Components& components, const accept_callback_t& on_accept)
     : NetworkService(false),
       components_(components),
       on_accept_(on_accept),
       port_(0),
-      listener_(components_.options.timeout,
-                components_.options.retry_timeout) {}
+      num_listeners_(1) {}
 
 util::result<void, Error> Acceptor::SetUp() {
-    // Start by setting up the listener socket, which will receive and accept
-    // connections.
-    RETURN_IF_ERROR(listener_.Bind(port_));
-    RETURN_IF_ERROR(listener_.Listen());
+    // Start by setting up the listener sockets, which will receive and accept
+    // connections. Every listener after the first binds to the port the
+    // first one got, in case the port was chosen by the system.
+    std::uint16_t port = port_;
+    bool reuse_port = num_listeners_ > 1;
+    for (std::size_t i = 0; i < num_listeners_; ++i) {
+        std::unique_ptr<Listener> listener(new Listener(components_));
+        if (reuse_port) {
+            RETURN_IF_ERROR(listener->socket.SetReusePort(true));
+        }
+        RETURN_IF_ERROR(listener->socket.Bind(port));
+        RETURN_IF_ERROR(listener->socket.Listen(SOMAXCONN));
+        if (i == 0) {
+            ASSIGN_OR_RETURN(port, listener->socket.Port());
+        }
+        listeners_.emplace_back(std::move(listener));
+    }
     return util::ok;
 }
 
 util::result<void, Error> Acceptor::OnStart() {
-    components_.thread_pool.Schedule([this]() { AcceptConnections(); });
+    for (auto& listener : listeners_) {
+        listener->reactor.Start();
+        AwaitConnections(*listener);
+    }
     return util::ok;
 }
 
-util::result<void, Error> Acceptor::CleanUp() { return listener_.Close(); }
+util::result<void, Error> Acceptor::CleanUp() {
+    util::result<void, Error> result = util::ok;
+    for (auto& listener : listeners_) {
+        listener->reactor.Stop();
+        auto close_result = listener->socket.Close();
+        if (close_result.is_err()) {
+            result = close_result;
+        }
+    }
+    // Nothing uses the listeners once their reactors stop, so they go now to
+    // free the port.
+    listeners_.clear();
+    return result;
+}
 
 void* GetInAddr(sockaddr* sa) {
     if (sa->sa_family == AF_INET) {
@@ -36,45 +84,84 @@ void* GetInAddr(sockaddr* sa) {
     return &((reinterpret_cast<sockaddr_in6*>(sa))->sin6_addr);
 }
 
-void Acceptor::AcceptConnections() {
+void Acceptor::AwaitConnections(Listener& listener) {
+    if (!Running()) {
+        return;
+    }
+
+    auto result =
+        listener.reactor.Await(listener.socket.Native(), Reactor::Event::kRead,
+                               [this, &listener]() {
+                                   AcceptConnections(listener);
+                               });
+    if (result.is_err()) {
+        util::safe_error_log::log(result.err());
+    }
+}
+
+void Acceptor::AcceptConnections(Listener& listener) {
     char ip_str[INET6_ADDRSTRLEN];
-    // To make our life easier, just allow `accept` to block the listener
-    // thread.
-    listener_.SetNonBlocking(false);
-    while (Running()) {
+    for (std::size_t i = 0; i < kMaxAcceptBatch; ++i) {
         sockaddr client_addr;
         socklen_t client_addr_size = sizeof(client_addr);
-        int new_fd =
-            ::accept(listener_.Native(), &client_addr, &client_addr_size);
+        int new_fd = ::accept4(listener.socket.Native(), &client_addr,
+                               &client_addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        // Logging may overwrite errno, so branch on the value accept left.
+        int accept_errno = errno;
 
         // Server may have stopped at this point, in which case we don't start a
         // connection here.
         if (!Running()) {
-            break;
+            if (new_fd >= 0) {
+                ::close(new_fd);
+            }
+            return;
         }
 
         if (new_fd < 0) {
+            if (accept_errno == EAGAIN || accept_errno == EWOULDBLOCK) {
+                break;
+            }
+            if (accept_errno == EINTR || accept_errno == ECONNABORTED) {
+                continue;
+            }
+
+            errno = accept_errno;
             util::safe_error_log::log(
                 Error::CreateFromErrNo("Failed to accept new connection"));
-
-            continue;
+            if (accept_errno == EMFILE || accept_errno == ENFILE) {
+                // The connection stays pending, so accepting again right away
+                // would only fail again.
+                components_.timer_service.ScheduleAfter(
+                    kAcceptBackoff,
+                    [this, &listener]() { AwaitConnections(listener); });
+                return;
+            }
+            break;
         }
 
         ::inet_ntop(client_addr.sa_family,
                     GetInAddr(static_cast<sockaddr*>(&client_addr)), ip_str,
                     sizeof(ip_str));
-        util::safe_console::stream("Received connection from ", ip_str,
-                                   " (sockfd = ", new_fd, ")",
-                                   util::manip::endl);
+        util::safe_debug::log("Received connection from", ip_str,
+                              "(sockfd =", new_fd, ")");
 
-        components_.thread_pool.Schedule(
-            [this, new_fd]() { on_accept_(new_fd); });
+        on_accept_(new_fd);
     }
+
+    AwaitConnections(listener);
 }
 
 void Acceptor::SetPort(std::uint16_t port) { port_ = port; }
 
-std::uint16_t Acceptor::Port() const { return listener_.Port().ok_or(0); }
+std::uint16_t Acceptor::Port() const {
+    if (listeners_.empty()) {
+        return 0;
+    }
+    return listeners_.front()->socket.Port().ok_or(0);
+}
+
+void Acceptor::SetListeners(std::size_t count) { num_listeners_ = count; }
 
 }  // namespace server
 }  // namespace net
\ No newline at end of file
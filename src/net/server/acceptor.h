@@ -4,9 +4,12 @@
 #include <net/components.h>
 #include <net/connectable_socket.h>
 #include <net/network_service.h>
+#include <net/reactor.h>
 #include <util/optional.h>
 
 #include <functional>
+#include <memory>
+#include <vector>
 
 namespace net {
 namespace server {
@@ -14,6 +17,11 @@ namespace server {
 /**
  * @brief Class for accepting incoming connections over a listening port.
  *
+ * The acceptor may run several listeners bound to the same port with
+ * `SO_REUSEPORT`, so the kernel spreads incoming connections between them.
+ * Each listener has its own reactor, which wakes when connections are pending
+ * and accepts them in batches without blocking a thread.
+ *
  */
 class Acceptor : public NetworkService {
    public:
@@ -24,12 +32,40 @@ class Acceptor : public NetworkService {
     void SetPort(std::uint16_t port);
     std::uint16_t Port() const;
 
+    /**
+     * @brief Sets the number of listeners to bind to the port, which must be
+     * called before starting.
+     *
+     * @param count
+     */
+    void SetListeners(std::size_t count);
+
    private:
     /**
-     * @brief Loop for accepting connections from the listener port.
+     * @brief A listening socket and the event loop that waits on it.
+     *
+     */
+    struct Listener {
+        Listener(Components& components);
+
+        ConnectableSocket socket;
+        Reactor reactor;
+    };
+
+    /**
+     * @brief Waits for the listener to have pending connections.
+     *
+     * @param listener
+     */
+    void AwaitConnections(Listener& listener);
+
+    /**
+     * @brief Accepts a batch of pending connections from the listener, then
+     * waits for more.
      *
+     * @param listener
      */
-    void AcceptConnections();
+    void AcceptConnections(Listener& listener);
 
     util::result<void, Error> SetUp() override;
     util::result<void, Error> OnStart() override;
@@ -38,7 +74,8 @@ class Acceptor : public NetworkService {
     Components& components_;
     accept_callback_t on_accept_;
     std::uint16_t port_;
-    ConnectableSocket listener_;
+    std::size_t num_listeners_;
+    std::vector<std::unique_ptr<Listener>> listeners_;
 };
 
 }  // namespace server
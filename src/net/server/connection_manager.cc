@@ -1,56 +1,230 @@
 #include "connection_manager.h"
 
+#include <net/proto/messages.h>
 #include <net/server/server_components.h>
+#include <util/bytes.h>
 #include <util/console.h>
 #include <util/mutex.h>
 
+#include <algorithm>
+
 namespace net {
 namespace server {
 
+namespace {
+
+// Number of shards connections are partitioned into.
+constexpr std::size_t kNumShards = 16;
+
+// Number of wheel slots the idle timeout is divided into, so connections are
+// reaped at most this fraction of the timeout late.
+constexpr std::size_t kSlotsPerIdleTimeout = 8;
+
+}  // namespace
+
 ConnectionManager::ConnectionManager(ServerComponents& components)
-    : data_mutex_(), connections_(), handlers_(), components_(components) {}
+    : components_(components),
+      idle_timeout_(0),
+      tick_(0),
+      reaping_(false),
+      current_slot_(0),
+      num_connections_(0),
+      num_requests_(0),
+      connections_(components.common.metrics.get_gauge("server.connections")),
+      accepted_connections_(components.common.metrics.get_counter(
+          "server.accepted_connections")),
+      rejected_connections_(components.common.metrics.get_counter(
+          "server.rejected_connections")),
+      busy_requests_(
+          components.common.metrics.get_counter("server.busy_requests")),
+      reaped_connections_(components.common.metrics.get_counter(
+          "server.reaped_connections")) {
+    shards_.reserve(kNumShards);
+    for (std::size_t i = 0; i < kNumShards; ++i) {
+        shards_.emplace_back(new Shard());
+    }
+}
+
+void ConnectionManager::SetLimits(const Limits& limits) { limits_ = limits; }
+
+void ConnectionManager::SetSocketOptions(const SocketOptions& options) {
+    socket_options_ = options;
+}
+
+void ConnectionManager::SetIdleTimeout(std::chrono::milliseconds timeout) {
+    idle_timeout_ = timeout;
+    tick_ = std::max(timeout / static_cast<int>(kSlotsPerIdleTimeout),
+                     std::chrono::milliseconds(1));
+    // One more slot than the timeout covers, so a connection is never added
+    // to the slot being handled.
+    wheel_.assign(kSlotsPerIdleTimeout + 1, std::vector<Connection::id_t>());
+    current_slot_ = 0;
+}
+
+void ConnectionManager::Start() {
+    if (idle_timeout_.count() == 0) {
+        return;
+    }
+    reaping_ = true;
+    components_.common.timer_service.ScheduleAfter(tick_,
+                                                   [this]() { Tick(); });
+}
+
+void ConnectionManager::Accept(int sockfd) {
+    std::size_t open = num_connections_.fetch_add(1);
+    if (limits_.max_connections != 0 && open >= limits_.max_connections) {
+        --num_connections_;
+        Reject(sockfd);
+        return;
+    }
+    connections_.add(1);
+    accepted_connections_.increment();
 
-Connection& ConnectionManager::NewConnection(int sockfd) {
-    Connection connection(Socket(sockfd, SocketState::kConnected,
-                                 components_.common.options.timeout));
-    // Be careful allocating here, because `ClientConnection` must know its
+    // Be careful allocating here, because `Connection` must know its
     // shared_ptr!
-    CRITICAL_SECTION(data_mutex_, {
-        auto res = connections_.emplace(
-            connection.id(),
-            std::make_shared<Connection>(std::move(connection)));
-        return *res.first->second;
-    });
+    auto client = std::make_shared<Connection>(Socket(
+        sockfd, SocketState::kConnected, components_.common.options.timeout));
+    Connection::id_t id = client->id();
+    auto& shard = ShardFor(id);
+    util::safe_debug::log("Starting handler for connection", id);
+
+    auto options_result = client->socket.SetOptions(socket_options_);
+    if (options_result.is_err()) {
+        util::safe_error_log::log(options_result.err());
+    }
+
+    auto handler =
+        components_.connection_handler_factory->Create(client, components_);
+    BaseConnectionHandler* raw = handler.get();
+    CRITICAL_SECTION(shard.mutex,
+                     shard.handlers.emplace(id, std::move(handler)));
+    if (reaping_) {
+        Watch(id, client->socket.LastActive());
+    }
+
+    // The handler may finish before it returns, so it starts without the
+    // lock held.
+    raw->Start([this, &shard, id]() { Stop(shard, id); });
 }
 
-void ConnectionManager::Destroy(Connection& client) {
-    CRITICAL_SECTION(data_mutex_, connections_.erase(client.id()));
+bool ConnectionManager::BeginRequest() {
+    std::size_t in_flight = num_requests_.fetch_add(1);
+    bool busy =
+        (limits_.max_requests != 0 && in_flight >= limits_.max_requests) ||
+        (limits_.max_queued_jobs != 0 &&
+         components_.common.thread_pool.QueueDepth() >
+             limits_.max_queued_jobs);
+    if (busy) {
+        --num_requests_;
+        busy_requests_.increment();
+        return false;
+    }
+    return true;
 }
 
-void ConnectionManager::Start(Connection& client) {
-    util::safe_debug::log("Starting handler for connection", client.id());
-    CRITICAL_SECTION(data_mutex_, {
-        auto res = handlers_.emplace(
-            std::move(components_.connection_handler_factory->Create(
-                client.shared_from_this(), components_)));
-        const std::unique_ptr<BaseConnectionHandler>& handler = *res.first;
-        handler->Start([this, &handler]() { Stop(handler); });
-    });
+void ConnectionManager::EndRequest() { --num_requests_; }
+
+void ConnectionManager::CloseAll() {
+    reaping_ = false;
+    for (auto& shard : shards_) {
+        CRITICAL_SECTION(shard->mutex, {
+            for (auto& pair : shard->handlers) {
+                pair.second->Client().socket.Close();
+            }
+        });
+    }
 }
 
-void ConnectionManager::Stop(
-    const std::unique_ptr<BaseConnectionHandler>& service) {
-    Connection& client = service->Client();
-    util::safe_debug::log("Stopping handler for connection", client.id());
-    CRITICAL_SECTION(data_mutex_, {
-        handlers_.erase(service);
-        connections_.erase(client.id());
+ConnectionManager::Shard& ConnectionManager::ShardFor(Connection::id_t id) {
+    return *shards_[id % shards_.size()];
+}
+
+void ConnectionManager::Stop(Shard& shard, Connection::id_t id) {
+    util::safe_debug::log("Stopping handler for connection", id);
+    CRITICAL_SECTION(shard.mutex, shard.handlers.erase(id));
+    --num_connections_;
+    connections_.add(-1);
+}
+
+void ConnectionManager::Watch(Connection::id_t id,
+                              Socket::clock_t::time_point last_active) {
+    auto remaining = last_active + idle_timeout_ - Socket::clock_t::now();
+    std::size_t ticks = 1;
+    if (remaining.count() > 0) {
+        // Round up, so the connection is never checked before it is idle.
+        ticks = (remaining + tick_ - Socket::clock_t::duration(1)) / tick_;
+        ticks = std::min(std::max(ticks, std::size_t(1)), kSlotsPerIdleTimeout);
+    }
+    CRITICAL_SECTION(
+        wheel_mutex_,
+        wheel_[(current_slot_ + ticks) % wheel_.size()].push_back(id));
+}
+
+void ConnectionManager::Tick() {
+    if (!reaping_) {
+        return;
+    }
+
+    std::vector<Connection::id_t> due;
+    CRITICAL_SECTION(wheel_mutex_, {
+        current_slot_ = (current_slot_ + 1) % wheel_.size();
+        due.swap(wheel_[current_slot_]);
     });
+
+    auto now = Socket::clock_t::now();
+    for (auto id : due) {
+        auto& shard = ShardFor(id);
+        bool open = false;
+        bool idle = false;
+        Socket::clock_t::time_point last_active;
+        CRITICAL_SECTION(shard.mutex, {
+            auto it = shard.handlers.find(id);
+            if (it != shard.handlers.end()) {
+                open = true;
+                Socket& socket = it->second->Client().socket;
+                last_active = socket.LastActive();
+                if (now - last_active >= idle_timeout_) {
+                    // The handler may be using the socket on another thread,
+                    // so it is only shut down here. The handler stops once
+                    // its operations fail, and closing the socket is left to
+                    // it, so the acceptor cannot reuse the file descriptor
+                    // while the handler still reads from it.
+                    idle = true;
+                    socket.Shutdown();
+                }
+            }
+        });
+
+        if (idle) {
+            util::safe_debug::log("Closed idle connection", id);
+            reaped_connections_.increment();
+        } else if (open) {
+            Watch(id, last_active);
+        }
+    }
+
+    components_.common.timer_service.ScheduleAfter(tick_,
+                                                   [this]() { Tick(); });
 }
 
-void ConnectionManager::CloseAll() {
-    for (auto& client : connections_) {
-        client.second->socket.Close();
+void ConnectionManager::Reject(int sockfd) {
+    util::safe_debug::log("Rejecting connection (sockfd =", sockfd,
+                          "), server is busy");
+    rejected_connections_.increment();
+
+    // The error is small enough to fit in the send buffer of a new socket,
+    // so it is sent without waiting, and the socket closes on destruction.
+    Socket socket(sockfd, SocketState::kConnected,
+                  components_.common.options.timeout);
+    auto msg = proto::ErrorMessage{proto::kBusyError}.ToMessage();
+    util::buffer& output = socket.Output();
+    output.put(&msg.opcode, proto::kOpcodeLength, true);
+    util::bytes::insert<proto::kBodySizeLength>(
+        output, static_cast<std::uint32_t>(msg.body.size()));
+    output.move_buffer(msg.body, true);
+    auto result = socket.Send();
+    if (result.is_err()) {
+        util::safe_debug::log(result.err());
     }
 }
 
@@ -3,13 +3,15 @@
 
 #include <net/connection.h>
 #include <net/server/base_connection_handler.h>
-#include <util/optional.h>
+#include <util/metrics.h>
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <set>
 #include <unordered_map>
+#include <vector>
 
 namespace net {
 namespace server {
@@ -17,45 +19,91 @@ namespace server {
 /**
  * @brief Class for managing all connections and their respective handlers.
  *
+ * Connections are partitioned into shards by ID, and each shard owns the
+ * handlers of its connections behind its own lock, so accepting and stopping
+ * connections in different shards never contend. Operations over every
+ * connection, like `CloseAll`, visit the shards one at a time.
+ *
+ * The manager also admits work under the configured `Limits`, so an
+ * overloaded server answers "busy" right away instead of queueing without
+ * bound, and reaps connections that stay idle for too long.
+ *
+ * Idle connections are tracked in a timer wheel, whose slots each cover a
+ * fraction of the idle timeout. Traffic never touches the wheel: when a slot
+ * comes due, each of its connections is either closed or moved to the slot in
+ * which it would next become idle, based on when its socket was last active.
+ *
  */
 class ConnectionManager {
    public:
-    using stop_callback_t = std::function<void()>;
+    /**
+     * @brief Limits on the work the server takes on, where 0 means no limit.
+     *
+     */
+    struct Limits {
+        // Open connections.
+        std::size_t max_connections = 0;
+
+        // Requests being handled at once over all connections.
+        std::size_t max_requests = 0;
+
+        // Jobs waiting in the thread pool.
+        std::size_t max_queued_jobs = 0;
+    };
 
     ConnectionManager(ServerComponents& components);
 
+    void SetLimits(const Limits& limits);
+
     /**
-     * @brief Creates a new connection over the given socket.
+     * @brief Sets the socket options of accepted connections.
      *
-     * @param sockfd Connected socket, received from `accept`.
-     * @return ClientConnection&
+     * @param options
+     */
+    void SetSocketOptions(const SocketOptions& options);
+
+    /**
+     * @brief Sets how long a connection may go without traffic before it is
+     * closed, where 0 means forever.
+     *
+     * Must be called before starting.
+     *
+     * @param timeout
      */
-    Connection& NewConnection(int sockfd);
+    void SetIdleTimeout(std::chrono::milliseconds timeout);
 
     /**
-     * @brief Destroys the given client, assuming it has not yet been started.
+     * @brief Starts reaping idle connections, if there is an idle timeout.
      *
-     * @param client
      */
-    void Destroy(Connection& client);
+    void Start();
 
     /**
-     * @brief Starts handling and interacting with the given client.
+     * @brief Creates a new connection over the given socket, and starts
+     * handling and interacting with it.
+     *
+     * If the server already has the maximum number of connections, the
+     * client is answered with a "busy" error and the socket is closed.
      *
-     * @param client
+     * @param sockfd Connected socket, received from `accept`.
      */
-    void Start(Connection& client);
+    void Accept(int sockfd);
 
     /**
-     * @brief Stops the given connection handler and its associated client
-     * connection.
+     * @brief Admits a request for handling, unless too many requests are
+     * already being handled or too many jobs are queued.
+     *
+     * Every admitted request must be finished with `EndRequest`.
      *
-     * @param service
+     * @return true The request was admitted
+     * @return false The server is busy, and the request should be rejected
      */
-    void Stop(const std::unique_ptr<BaseConnectionHandler>& service);
+    bool BeginRequest();
+
+    void EndRequest();
 
     /**
-     * @brief Closes all connection handlers and sockets.
+     * @brief Closes all connection handlers and sockets, and stops reaping.
      *
      * Used to stop the server.
      *
@@ -63,11 +111,73 @@ class ConnectionManager {
     void CloseAll();
 
    private:
-    std::mutex data_mutex_;
-    std::unordered_map<Connection::id_t, std::shared_ptr<Connection>>
-        connections_;
-    std::set<std::unique_ptr<BaseConnectionHandler>> handlers_;
+    /**
+     * @brief A partition of the connections.
+     *
+     * Connection handlers block pool threads while waiting on their sockets,
+     * so shards are guarded by locks rather than serial executors, which
+     * could not run while the pool is busy.
+     *
+     */
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Connection::id_t,
+                           std::unique_ptr<BaseConnectionHandler>>
+            handlers;
+    };
+
+    Shard& ShardFor(Connection::id_t id);
+
+    /**
+     * @brief Destroys the handler of the given connection, and with it the
+     * connection.
+     *
+     * @param shard
+     * @param id
+     */
+    void Stop(Shard& shard, Connection::id_t id);
+
+    /**
+     * @brief Adds a connection to the slot of the wheel in which it becomes
+     * idle.
+     *
+     * @param id
+     * @param last_active
+     */
+    void Watch(Connection::id_t id, Socket::clock_t::time_point last_active);
+
+    /**
+     * @brief Advances the wheel by one slot, and handles the connections in
+     * the slot that came due.
+     *
+     */
+    void Tick();
+
+    /**
+     * @brief Answers a client the server has no room for, and closes its
+     * socket.
+     *
+     * @param sockfd
+     */
+    void Reject(int sockfd);
+
     ServerComponents& components_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    Limits limits_;
+    SocketOptions socket_options_;
+    std::chrono::milliseconds idle_timeout_;
+    std::chrono::milliseconds tick_;
+    std::atomic<bool> reaping_;
+    std::mutex wheel_mutex_;
+    std::vector<std::vector<Connection::id_t>> wheel_;
+    std::size_t current_slot_;
+    std::atomic<std::size_t> num_connections_;
+    std::atomic<std::size_t> num_requests_;
+    util::metrics::gauge& connections_;
+    util::metrics::counter& accepted_connections_;
+    util::metrics::counter& rejected_connections_;
+    util::metrics::counter& busy_requests_;
+    util::metrics::counter& reaped_connections_;
 };
 
 }  // namespace server
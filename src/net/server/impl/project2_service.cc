@@ -4,17 +4,39 @@
 #include <util/console.h>
 #include <util/strings.h>
 
+#include <string>
+
 namespace net {
 namespace server {
 namespace impl {
 
+namespace {
+
+// Names of the kinds of request in metrics, indexed by `RequestKind`.
+constexpr const char* kRequestKindNames[] = {"enquiry", "read", "write",
+                                             "invalid"};
+
+}  // namespace
+
 Project2Service::Project2Service(ServerComponents& components,
                                  Connection& client,
                                  BaseConnectionHandler& owner)
     : BaseService(components, client, owner),
       util::state_machine<Project2Service>(*this,
                                            states::AwaitMessage::instance()),
-      message_service_(client_.socket, components_.common) {}
+      message_service_(client_.socket, components_.common),
+      in_request_(false),
+      current_request_(kInvalid),
+      not_modified_(components.common.metrics.get_counter(
+          "server.enquiries_not_modified")) {
+    auto& metrics = components.common.metrics;
+    for (std::size_t i = 0; i < kNumRequestKinds; ++i) {
+        std::string name = kRequestKindNames[i];
+        request_metrics_[i] = {
+            &metrics.get_counter("server.requests." + name),
+            &metrics.get_histogram("server.request_us." + name)};
+    }
+}
 
 void Project2Service::Run() {
     util::state_machine<Project2Service>::start(
@@ -22,15 +44,37 @@ void Project2Service::Run() {
             if (result.is_err()) {
                 util::safe_error_log::log(result.err().what());
             }
+            EndRequest();
             BaseService::Stop();
         });
 }
 
 void Project2Service::Stop() { util::state_machine<Project2Service>::stop(); }
 
+void Project2Service::BeginRequest(RequestKind kind) {
+    in_request_ = true;
+    current_request_ = kind;
+    request_started_ = std::chrono::steady_clock::now();
+    request_metrics_[kind].requests->increment();
+}
+
+void Project2Service::EndRequest() {
+    if (in_request_) {
+        in_request_ = false;
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - request_started_);
+        request_metrics_[current_request_].latency_us->observe(
+            static_cast<std::uint64_t>(elapsed.count()));
+        components_.connection_manager.EndRequest();
+    }
+}
+
 namespace states {
 
 IMPL_STATE_HANDLER(Project2Service, AwaitMessage) {
+    // Requests are handled one at a time, so the last one is done.
+    instance.EndRequest();
+
     instance.message_service_.ReadMessage(
         [&instance, callback](util::result<proto::Message, Error> result) {
             if (result.is_err()) {
@@ -40,17 +84,27 @@ IMPL_STATE_HANDLER(Project2Service, AwaitMessage) {
 
             instance.last_received_ = std::move(result).ok();
 
+            if (!instance.components_.connection_manager.BeginRequest()) {
+                instance.set_next_state(RejectBusy::instance());
+                callback(util::ok);
+                return;
+            }
+
             switch (instance.last_received_.opcode) {
                 case proto::Opcode::kEnquiry: {
+                    instance.BeginRequest(Project2Service::kEnquiry);
                     instance.set_next_state(HandleEnquiry::instance());
                 } break;
                 case proto::Opcode::kRead: {
+                    instance.BeginRequest(Project2Service::kRead);
                     instance.set_next_state(HandleRead::instance());
                 } break;
                 case proto::Opcode::kWrite: {
+                    instance.BeginRequest(Project2Service::kWrite);
                     instance.set_next_state(HandleWrite::instance());
                 } break;
                 default: {
+                    instance.BeginRequest(Project2Service::kInvalid);
                     instance.set_next_state(HandleInvalidOpcode::instance());
                 } break;
             }
@@ -69,16 +123,49 @@ IMPL_STATE_HANDLER(Project2Service, HandleEnquiry) {
     }
     util::safe_console::log("Received Enquiry from", peer_name.ok());
 
-    auto files = instance.components_.file_service_.GetFiles();
-    if (files.is_err()) {
-        callback(std::move(files).err());
+    auto enquiry = std::move(instance.last_received_).ToEnquiry();
+    if (enquiry.is_err()) {
+        callback(std::move(enquiry).err());
         return;
     }
+    auto& file_service = instance.components_.file_service_;
+    auto known_version = enquiry.ok().known_version;
+
+    proto::Message response;
+    bool not_modified = false;
+    if (known_version.has_value()) {
+        // Answering a client whose listing is current only takes a stat of
+        // the directory.
+        auto version = file_service.ListingVersion();
+        if (version.is_err()) {
+            callback(std::move(version).err());
+            return;
+        }
+        not_modified = version.ok() == known_version.value();
+    }
+
+    if (not_modified) {
+        instance.not_modified_.increment();
+        response = proto::NotModifiedMessage{}.ToMessage();
+    } else {
+        auto listing = file_service.GetListing();
+        if (listing.is_err()) {
+            callback(std::move(listing).err());
+            return;
+        }
+        if (known_version.has_value()) {
+            response = proto::ListingMessage{listing.ok().version,
+                                             std::move(listing).ok().files}
+                           .ToMessage();
+        } else {
+            response = proto::ResponseMessage{
+                util::strings::join(listing.ok().files, ", ")}
+                           .ToMessage();
+        }
+    }
 
     instance.message_service_.WriteMessage(
-        proto::ResponseMessage{util::strings::join(files.ok(), ", ")}
-            .ToMessage(),
-        [callback](util::result<void, Error> result) {
+        std::move(response), [callback](util::result<void, Error> result) {
             callback(std::move(result).map_err(
                 [](Error&& error) -> util::error { return error; }));
         });
@@ -168,6 +255,23 @@ IMPL_STATE_HANDLER(Project2Service, HandleInvalidOpcode) {
 
 IMPL_NEXT_STATE(Project2Service, HandleInvalidOpcode, Stop);
 
+IMPL_STATE_HANDLER(Project2Service, RejectBusy) {
+    // Rejections come in floods when the server is overloaded, so they are
+    // counted in "server.busy_requests" and only logged when debugging.
+    util::safe_debug::log("Server busy, rejecting request on connection",
+                          instance.client_.id());
+
+    // The connection stays open, so the client may try again.
+    instance.message_service_.WriteMessage(
+        proto::ErrorMessage{proto::kBusyError}.ToMessage(),
+        [callback](util::result<void, Error> result) {
+            callback(std::move(result).map_err(
+                [](Error&& error) -> util::error { return error; }));
+        });
+}
+
+IMPL_NEXT_STATE(Project2Service, RejectBusy, AwaitMessage);
+
 IMPL_STATE_HANDLER(Project2Service, Stop) {}
 IMPL_STATE_HANDLER_SETS_NEXT_STATE(Project2Service, Stop);
 IMPL_STOP_STATE_SHOULD_STOP(Stop);
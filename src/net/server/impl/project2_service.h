@@ -3,8 +3,12 @@
 
 #include <net/proto/async_message_service.h>
 #include <net/server/base_service.h>
+#include <util/metrics.h>
 #include <util/state_machine.h>
 
+#include <array>
+#include <chrono>
+
 namespace net {
 namespace server {
 namespace impl {
@@ -18,6 +22,7 @@ DEFINE_ASYNC_STATE(Project2Service, HandleEnquiry);
 DEFINE_ASYNC_STATE(Project2Service, HandleRead);
 DEFINE_ASYNC_STATE(Project2Service, HandleWrite);
 DEFINE_ASYNC_STATE(Project2Service, HandleInvalidOpcode);
+DEFINE_ASYNC_STATE(Project2Service, RejectBusy);
 DEFINE_STOP_STATE(Project2Service, Stop);
 
 }  // namespace states
@@ -36,16 +41,50 @@ class Project2Service : public BaseService,
     void Stop() override;
 
    private:
+    /**
+     * @brief Metrics kept for each kind of request.
+     *
+     */
+    struct RequestMetrics {
+        util::metrics::counter* requests;
+        util::metrics::histogram* latency_us;
+    };
+
+    enum RequestKind { kEnquiry, kRead, kWrite, kInvalid, kNumRequestKinds };
+
     void Run();
 
+    /**
+     * @brief Starts timing an admitted request of the given kind.
+     *
+     * @param kind
+     */
+    void BeginRequest(RequestKind kind);
+
+    /**
+     * @brief Finishes the request being handled, if any, so the server may
+     * admit another.
+     *
+     */
+    void EndRequest();
+
     proto::AsyncMessageService message_service_;
     proto::Message last_received_;
+    bool in_request_;
+    RequestKind current_request_;
+    std::chrono::steady_clock::time_point request_started_;
+    std::array<RequestMetrics, kNumRequestKinds> request_metrics_;
+
+    // Enquiries answered without listing files, because the client's listing
+    // was current.
+    util::metrics::counter& not_modified_;
 
     friend struct states::AwaitMessage;
     friend struct states::HandleEnquiry;
     friend struct states::HandleRead;
     friend struct states::HandleWrite;
     friend struct states::HandleInvalidOpcode;
+    friend struct states::RejectBusy;
     friend struct states::Stop;
 };
 
@@ -1,6 +1,10 @@
 #include "server.h"
 
 #include <util/console.h>
+#include <util/number.h>
+
+#include <chrono>
+#include <utility>
 
 namespace net {
 namespace server {
@@ -15,6 +19,16 @@ Server::Server(
 util::result<void, Error> Server::SetUp() {
     std::uint16_t port = components_.common.options.port;
     acceptor_.SetPort(port);
+    auto acceptors_prop = components_.common.props.Get("server_acceptors");
+    if (acceptors_prop.has_value()) {
+        auto result =
+            util::num::string_to_num<std::size_t>(acceptors_prop.value());
+        if (result.is_err() || result.ok() == 0) {
+            return Error::Create("Invalid \"server_acceptors\" property");
+        }
+        acceptor_.SetListeners(result.ok());
+    }
+    RETURN_IF_ERROR(SetUpConnectionManager());
     auto root_dir_prop = components_.common.props.Get("root_dir");
     if (!root_dir_prop.has_value()) {
         return Error::Create(
@@ -25,9 +39,50 @@ util::result<void, Error> Server::SetUp() {
     return util::ok;
 }
 
+util::result<void, Error> Server::SetUpConnectionManager() {
+    auto& connection_manager = components_.connection_manager;
+    ConnectionManager::Limits limits;
+    std::pair<const char*, std::size_t*> props[] = {
+        {"server_max_connections", &limits.max_connections},
+        {"server_max_requests", &limits.max_requests},
+        {"server_max_queued_jobs", &limits.max_queued_jobs},
+    };
+    for (const auto& prop : props) {
+        auto value = components_.common.props.Get(prop.first);
+        if (!value.has_value()) {
+            continue;
+        }
+        auto result = util::num::string_to_num<std::size_t>(value.value());
+        if (result.is_err()) {
+            return Error::Create(util::string::stream("Invalid \"", prop.first,
+                                                      "\" property"));
+        }
+        *prop.second = result.ok();
+    }
+    connection_manager.SetLimits(limits);
+
+    ASSIGN_OR_RETURN(
+        auto socket_options,
+        SocketOptions::FromProperties(components_.common.props, "server"));
+    connection_manager.SetSocketOptions(socket_options);
+
+    auto idle_prop = components_.common.props.Get("server_idle_timeout_ms");
+    if (idle_prop.has_value()) {
+        auto result = util::num::string_to_num<std::size_t>(idle_prop.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"server_idle_timeout_ms\" property");
+        }
+        connection_manager.SetIdleTimeout(
+            std::chrono::milliseconds(result.ok()));
+    }
+    return util::ok;
+}
+
 util::result<void, Error> Server::OnStart() {
     util::safe_console::log("Starting server on port",
                             components_.common.options.port);
+    RETURN_IF_ERROR(components_.metrics_service.Start());
+    components_.connection_manager.Start();
     return acceptor_.Start();
 }
 
@@ -37,14 +92,15 @@ util::result<void, Error> Server::CleanUp() {
     util::safe_debug::log("Cleaning up server");
     acceptor_.Stop();
     components_.connection_manager.CloseAll();
+    components_.metrics_service.Stop();
+    components_.common.reactor.Stop();
+    components_.common.timer_service.Stop();
     components_.common.thread_pool.Stop();
     return util::ok;
 }
 
 void Server::OnAccept(int sockfd) {
-    Connection& new_connection =
-        components_.connection_manager.NewConnection(sockfd);
-    components_.connection_manager.Start(new_connection);
+    components_.connection_manager.Accept(sockfd);
 }
 
 std::uint16_t Server::Port() const { return acceptor_.Port(); }
@@ -30,6 +30,14 @@ class Server : public NetworkService {
     void OnStop() override;
     util::result<void, Error> CleanUp() override;
 
+    /**
+     * @brief Reads the admission limits, socket options, and idle timeout of
+     * client connections from the properties.
+     *
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> SetUpConnectionManager();
+
     void OnAccept(int sockfd);
 
     ServerComponents components_;
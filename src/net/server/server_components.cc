@@ -9,7 +9,8 @@ ServerComponents::ServerComponents(
     : common(common),
       connection_handler_factory(std::move(connection_handler_factory)),
       connection_manager(*this),
-      file_service_() {}
+      file_service_(),
+      metrics_service(common) {}
 
 }  // namespace server
 }  // namespace net
\ No newline at end of file
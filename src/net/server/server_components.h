@@ -5,6 +5,7 @@
 #include <net/server/base_connection_handler_factory.h>
 #include <net/server/connection_manager.h>
 #include <net/server/service/file_service.h>
+#include <net/shared/metrics_service.h>
 
 namespace net {
 namespace server {
@@ -25,6 +26,7 @@ struct ServerComponents {
     std::unique_ptr<BaseConnectionHandlerFactory> connection_handler_factory;
     ConnectionManager connection_manager;
     service::FileService file_service_;
+    shared::MetricsService metrics_service;
 };
 
 }  // namespace server
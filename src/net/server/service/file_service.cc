@@ -1,12 +1,34 @@
 #include "file_service.h"
 
+#include <util/mutex.h>
+
 #include <algorithm>
 #include <fstream>
+#include <random>
 
 namespace net {
 namespace server {
 namespace service {
 
+namespace {
+
+/**
+ * @brief Mixes the bits of a value, so nearby inputs give unrelated outputs.
+ *
+ * This is the finalizer of SplitMix64.
+ *
+ * @param value
+ * @return std::uint64_t
+ */
+std::uint64_t Mix(std::uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+}  // namespace
+
 util::result<void, Error> FileService::Initialize(const std::string& root) {
     if (!util::fs::exists(root)) {
         return Error::Create("Managed directory root does not exist");
@@ -19,6 +41,11 @@ util::result<void, Error> FileService::Initialize(const std::string& root) {
 
     root_ = util::fs::path(root).lexically_normal();
 
+    // Clients keep versions across server restarts, so a version from an
+    // earlier run must never match one from this run.
+    std::random_device random;
+    epoch_ = (static_cast<std::uint64_t>(random()) << 32) ^ random();
+
     return util::ok;
 }
 
@@ -37,6 +64,38 @@ util::result<std::vector<std::string>, Error> FileService::GetFiles() {
         });
 }
 
+util::result<std::uint64_t, Error> FileService::ListingVersion() {
+    CRITICAL_SECTION(listing_mutex_, {
+        RETURN_IF_ERROR(RefreshListing());
+        return listing_.version;
+    });
+}
+
+util::result<FileService::Listing, Error> FileService::GetListing() {
+    CRITICAL_SECTION(listing_mutex_, {
+        RETURN_IF_ERROR(RefreshListing());
+        return listing_;
+    });
+}
+
+util::result<void, Error> FileService::RefreshListing() {
+    auto modified = util::fs::modified_time(root_.string());
+    if (modified.is_err()) {
+        return Error::Create(modified.err().what());
+    }
+    if (listed_at_.has_value() && listed_at_.value() == modified.ok()) {
+        return util::ok;
+    }
+
+    // The time is taken before scanning, so a change during the scan is seen
+    // by the next one.
+    ASSIGN_OR_RETURN(listing_.files, GetFiles());
+    // Clients use 0 for a listing they do not have yet.
+    listing_.version = std::max<std::uint64_t>(Mix(epoch_ ^ modified.ok()), 1);
+    listed_at_ = modified.ok();
+    return util::ok;
+}
+
 util::result<std::string, Error> FileService::ReadLastLine(
     const std::string& name) {
     auto full_path = root_ / name;
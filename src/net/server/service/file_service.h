@@ -3,9 +3,13 @@
 
 #include <net/error.h>
 #include <util/filesystem.h>
+#include <util/optional.h>
 #include <util/result.h>
 
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace net {
 namespace server {
@@ -18,6 +22,17 @@ namespace service {
  */
 class FileService {
    public:
+    /**
+     * @brief The files in the root directory, and the version of the listing,
+     * which changes whenever files are added, removed, or renamed, and
+     * whenever the server restarts.
+     *
+     */
+    struct Listing {
+        std::uint64_t version = 0;
+        std::vector<std::string> files;
+    };
+
     /**
      * @brief Initializes the file system to manage the directory at the given
      * root path.
@@ -34,6 +49,23 @@ class FileService {
      */
     util::result<std::vector<std::string>, Error> GetFiles();
 
+    /**
+     * @brief Gets the version of the listing of the root directory.
+     *
+     * The listing is cached, and only scanned again once the modification time
+     * of the root directory changes, so this is cheap while it does not.
+     *
+     * @return util::result<std::uint64_t, Error>
+     */
+    util::result<std::uint64_t, Error> ListingVersion();
+
+    /**
+     * @brief Gets the listing of the root directory.
+     *
+     * @return util::result<Listing, Error>
+     */
+    util::result<Listing, Error> GetListing();
+
     /**
      * @brief Reads the last line of the given file.
      *
@@ -56,7 +88,26 @@ class FileService {
                                          const std::string& line);
 
    private:
+    /**
+     * @brief Scans the root directory again if it changed since the last scan.
+     *
+     * Must be called with the lock held.
+     *
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> RefreshListing();
+
     util::fs::path root_;
+
+    std::mutex listing_mutex_;
+    Listing listing_;
+
+    // Modification time of the root directory when it was last scanned.
+    util::optional<std::uint64_t> listed_at_;
+
+    // Random for every run of the server, and mixed with the modification
+    // time of the root directory to give the version of the listing.
+    std::uint64_t epoch_ = 0;
 };
 
 }  // namespace service
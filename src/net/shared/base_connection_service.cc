@@ -12,8 +12,7 @@ typename BaseConnectionService::PendingConnectionIterator
 BaseConnectionService::NewSocket() {
     CRITICAL_SECTION(mutex_, {
         return pending_connections_.emplace(pending_connections_.end(),
-                                            components_.options.timeout,
-                                            components_.options.retry_timeout);
+                                            components_);
     });
 }
 
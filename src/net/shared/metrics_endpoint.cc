@@ -0,0 +1,209 @@
+#include "metrics_endpoint.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <util/console.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace net {
+namespace shared {
+
+namespace {
+
+// Longest request accepted, since a scrape needs little more than its
+// request line.
+constexpr std::size_t kMaxRequestSize = 8192;
+
+// Maximum number of connections accepted per wakeup.
+constexpr std::size_t kMaxAcceptBatch = 16;
+
+constexpr const char kEndOfHeaders[] = "\r\n\r\n";
+
+std::string HttpResponse(const std::string& status,
+                         const std::string& content_type,
+                         const std::string& body) {
+    return util::string::stream("HTTP/1.0 ", status,
+                                "\r\nContent-Type: ", content_type,
+                                "\r\nContent-Length: ", body.size(),
+                                "\r\nConnection: close\r\n\r\n", body);
+}
+
+}  // namespace
+
+MetricsEndpoint::Scrape::Scrape(int sockfd, int timeout)
+    : socket(sockfd, SocketState::kConnected, timeout) {}
+
+MetricsEndpoint::MetricsEndpoint(Components& components,
+                                 const render_t& render)
+    : components_(components),
+      render_(render),
+      reactor_(components.thread_pool),
+      running_(false) {}
+
+MetricsEndpoint::~MetricsEndpoint() { Stop(); }
+
+util::result<void, Error> MetricsEndpoint::Start(std::uint16_t port) {
+    int sockfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        return Error::CreateFromErrNo("Failed to create metrics socket");
+    }
+    // The socket is closed with the listener from here on.
+    listener_.reset(new Socket(sockfd, SocketState::kInitialized,
+                               components_.options.timeout));
+
+    int yes = 1;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) <
+        0) {
+        return Error::CreateFromErrNo(
+            "Failed to set reuse address option on metrics socket");
+    }
+
+    // Metrics are only for the operator of this machine.
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (::bind(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        return Error::CreateFromErrNo("Failed to bind metrics port");
+    }
+    if (::listen(sockfd, SOMAXCONN) < 0) {
+        return Error::CreateFromErrNo("Failed to listen on metrics port");
+    }
+
+    running_ = true;
+    reactor_.Start();
+    AwaitConnections();
+    util::safe_console::log("Serving metrics on port", Port());
+    return util::ok;
+}
+
+void MetricsEndpoint::Stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    // Stopping the reactor drops the pending jobs, and with them the last
+    // references to open scrapes, which closes them.
+    reactor_.Stop();
+    listener_->Close();
+}
+
+std::uint16_t MetricsEndpoint::Port() const {
+    if (!listener_) {
+        return 0;
+    }
+    return listener_->Port().ok_or(0);
+}
+
+void MetricsEndpoint::AwaitConnections() {
+    if (!running_) {
+        return;
+    }
+
+    auto result = reactor_.Await(listener_->Native(), Reactor::Event::kRead,
+                                 [this]() { AcceptConnections(); });
+    if (result.is_err()) {
+        util::safe_error_log::log(result.err());
+    }
+}
+
+void MetricsEndpoint::AcceptConnections() {
+    for (std::size_t i = 0; i < kMaxAcceptBatch && running_; ++i) {
+        int new_fd = ::accept4(listener_->Native(), nullptr, nullptr,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                util::safe_error_log::log(Error::CreateFromErrNo(
+                    "Failed to accept metrics connection"));
+            }
+            break;
+        }
+        ReadRequest(std::make_shared<Scrape>(new_fd,
+                                             components_.options.timeout));
+    }
+
+    AwaitConnections();
+}
+
+void MetricsEndpoint::ReadRequest(std::shared_ptr<Scrape> scrape) {
+    auto& socket = scrape->socket;
+    auto received = socket.Receive();
+    if (received.is_err()) {
+        Close(*scrape);
+        return;
+    }
+    scrape->request += socket.Input().to_string();
+
+    if (scrape->request.find(kEndOfHeaders) != std::string::npos) {
+        std::string response = Respond(scrape->request);
+        socket.Output().put(response.data(), response.size(), true);
+        WriteResponse(std::move(scrape));
+        return;
+    }
+    if (scrape->request.size() > kMaxRequestSize || !running_) {
+        Close(*scrape);
+        return;
+    }
+
+    auto result = reactor_.Await(socket.Native(), Reactor::Event::kRead,
+                                 [this, scrape]() { ReadRequest(scrape); });
+    if (result.is_err()) {
+        util::safe_error_log::log(result.err());
+        Close(*scrape);
+    }
+}
+
+void MetricsEndpoint::WriteResponse(std::shared_ptr<Scrape> scrape) {
+    auto& socket = scrape->socket;
+    auto sent = socket.Send();
+    if (sent.is_err() || socket.Output().empty() || !running_) {
+        Close(*scrape);
+        return;
+    }
+
+    auto result = reactor_.Await(socket.Native(), Reactor::Event::kWrite,
+                                 [this, scrape]() { WriteResponse(scrape); });
+    if (result.is_err()) {
+        util::safe_error_log::log(result.err());
+        Close(*scrape);
+    }
+}
+
+std::string MetricsEndpoint::Respond(const std::string& request) {
+    // Only the request line matters, e.g. "GET /metrics HTTP/1.1".
+    std::string line = request.substr(0, request.find("\r\n"));
+    std::size_t method_end = line.find(' ');
+    std::size_t target_end = line.find(' ', method_end + 1);
+    if (method_end == std::string::npos || target_end == std::string::npos) {
+        return HttpResponse("400 Bad Request", "text/plain", "Bad request\n");
+    }
+
+    std::string method = line.substr(0, method_end);
+    std::string target =
+        line.substr(method_end + 1, target_end - method_end - 1);
+    target = target.substr(0, target.find('?'));
+    if (method != "GET") {
+        return HttpResponse("405 Method Not Allowed", "text/plain",
+                            "Only GET is supported\n");
+    }
+    if (target != "/metrics") {
+        return HttpResponse("404 Not Found", "text/plain",
+                            "Metrics are served at /metrics\n");
+    }
+    return HttpResponse("200 OK", "text/plain; version=0.0.4", render_());
+}
+
+void MetricsEndpoint::Close(Scrape& scrape) {
+    reactor_.Cancel(scrape.socket.Native());
+    scrape.socket.Close();
+}
+
+}  // namespace shared
+}  // namespace net
\ No newline at end of file
@@ -0,0 +1,111 @@
+#ifndef NET_SHARED_METRICS_ENDPOINT_
+#define NET_SHARED_METRICS_ENDPOINT_
+
+#include <net/components.h>
+#include <net/error.h>
+#include <net/reactor.h>
+#include <net/socket.h>
+#include <util/result.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace net {
+namespace shared {
+
+/**
+ * @brief Minimal HTTP endpoint serving metrics for scrapers such as
+ * Prometheus.
+ *
+ * The endpoint only listens on the loopback interface. Each connection may
+ * make one `GET /metrics` request, which is answered with the rendered
+ * metrics before the connection is closed. Everything runs on the endpoint's
+ * own reactor, so a slow scraper never blocks a pool thread.
+ *
+ */
+class MetricsEndpoint {
+   public:
+    using render_t = std::function<std::string()>;
+
+    /**
+     * @param components
+     * @param render Renders the body of a response, called once per scrape
+     */
+    MetricsEndpoint(Components& components, const render_t& render);
+    ~MetricsEndpoint();
+
+    /**
+     * @brief Starts listening on the given port, where 0 lets the system
+     * choose one.
+     *
+     * @param port
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> Start(std::uint16_t port);
+
+    /**
+     * @brief Stops listening, and drops any scrape in progress.
+     *
+     */
+    void Stop();
+
+    /**
+     * @brief The port the endpoint listens on, or 0 if it is not running.
+     *
+     * @return std::uint16_t
+     */
+    std::uint16_t Port() const;
+
+   private:
+    /**
+     * @brief A connection from a scraper.
+     *
+     */
+    struct Scrape {
+        Scrape(int sockfd, int timeout);
+
+        Socket socket;
+        std::string request;
+    };
+
+    void AwaitConnections();
+    void AcceptConnections();
+
+    /**
+     * @brief Reads the request of a scrape, and answers it once complete.
+     *
+     * @param scrape
+     */
+    void ReadRequest(std::shared_ptr<Scrape> scrape);
+
+    /**
+     * @brief Sends the rest of the response of a scrape, and closes it once
+     * sent.
+     *
+     * @param scrape
+     */
+    void WriteResponse(std::shared_ptr<Scrape> scrape);
+
+    /**
+     * @brief Builds the response to a complete request.
+     *
+     * @param request
+     * @return std::string
+     */
+    std::string Respond(const std::string& request);
+
+    void Close(Scrape& scrape);
+
+    Components& components_;
+    render_t render_;
+    Reactor reactor_;
+    std::atomic<bool> running_;
+    std::unique_ptr<Socket> listener_;
+};
+
+}  // namespace shared
+}  // namespace net
+
+#endif  // NET_SHARED_METRICS_ENDPOINT_
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "metrics_service.h"
+
+#include <util/console.h>
+#include <util/number.h>
+
+#include <string>
+
+namespace net {
+namespace shared {
+
+MetricsService::MetricsService(Components& components)
+    : components_(components),
+      queue_depth_(components.metrics.get_gauge("thread_pool.queue_depth")),
+      endpoint_(components,
+                [this]() {
+                    Refresh();
+                    return components_.metrics.dump_prometheus();
+                }),
+      interval_(0),
+      json_(false),
+      running_(false),
+      timer_id_(0) {}
+
+util::result<void, Error> MetricsService::Start() {
+    auto dump_ms = components_.props.Get("metrics_dump_ms");
+    if (dump_ms.has_value()) {
+        auto result = util::num::string_to_num<std::size_t>(dump_ms.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"metrics_dump_ms\" property");
+        }
+        interval_ = std::chrono::milliseconds(result.ok());
+    }
+
+    auto format = components_.props.Get("metrics_format");
+    if (format.has_value()) {
+        if (format.value() != "text" && format.value() != "json") {
+            return Error::Create(
+                "Invalid \"metrics_format\" property, must be \"text\" or "
+                "\"json\"");
+        }
+        json_ = format.value() == "json";
+    }
+
+    auto file = components_.props.Get("metrics_file");
+    if (file.has_value()) {
+        file_.open(file.value(), std::ios::app);
+        if (!file_) {
+            return Error::Create(util::string::stream(
+                "Failed to open metrics file \"", file.value(), '"'));
+        }
+    }
+
+    auto port = components_.props.Get("metrics_port");
+    if (port.has_value()) {
+        auto result = util::num::string_to_num<std::uint16_t>(port.value());
+        if (result.is_err()) {
+            return Error::Create("Invalid \"metrics_port\" property");
+        }
+        RETURN_IF_ERROR(endpoint_.Start(result.ok()));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = true;
+    if (interval_.count() > 0) {
+        ScheduleDump();
+    }
+    return util::ok;
+}
+
+void MetricsService::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        components_.timer_service.Cancel(timer_id_);
+    }
+    endpoint_.Stop();
+    Dump();
+}
+
+void MetricsService::ScheduleDump() {
+    timer_id_ = components_.timer_service.ScheduleAfter(interval_, [this]() {
+        Dump();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            ScheduleDump();
+        }
+    });
+}
+
+void MetricsService::Refresh() {
+    queue_depth_.set(components_.thread_pool.QueueDepth());
+}
+
+void MetricsService::Dump() {
+    Refresh();
+    std::string dump;
+    if (json_) {
+        auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+        dump = util::string::stream("{\"time_ms\":", now_ms, ",\"metrics\":",
+                                    components_.metrics.dump_json(), "}\n");
+    } else {
+        dump = components_.metrics.dump();
+        if (dump.empty()) {
+            return;
+        }
+    }
+
+    if (file_.is_open()) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_ << dump << std::flush;
+        return;
+    }
+
+    dump.pop_back();
+    util::safe_console::log(json_ ? dump : "Metrics:\n" + dump);
+}
+
+}  // namespace shared
+}  // namespace net
\ No newline at end of file
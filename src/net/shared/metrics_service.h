@@ -0,0 +1,85 @@
+#ifndef NET_SHARED_METRICS_SERVICE_
+#define NET_SHARED_METRICS_SERVICE_
+
+#include <net/components.h>
+#include <net/error.h>
+#include <net/shared/metrics_endpoint.h>
+#include <thread/timer_service.h>
+#include <util/metrics.h>
+#include <util/result.h>
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace net {
+namespace shared {
+
+/**
+ * @brief Service for periodically logging the metrics registry.
+ *
+ * Metrics are logged every "metrics_dump_ms" milliseconds, and once more when
+ * the service stops. Periodic logging is off by default.
+ *
+ * With "metrics_format=json", each dump is a single line of JSON with the time
+ * it was taken, for tools to read. With "metrics_file", dumps are appended to
+ * that file instead of the console.
+ *
+ * With "metrics_port", metrics are also served in the Prometheus text format
+ * at "/metrics" on that port of the loopback interface, where 0 lets the
+ * system choose the port.
+ *
+ */
+class MetricsService {
+   public:
+    MetricsService(Components& components);
+
+    /**
+     * @brief Starts logging metrics periodically, if configured.
+     *
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> Start();
+
+    /**
+     * @brief Stops logging and serving metrics, and logs them one last time.
+     *
+     * Should be called before the timer service stops.
+     *
+     */
+    void Stop();
+
+   private:
+    /**
+     * @brief Schedules the next periodic dump.
+     *
+     * Must be called with the lock held.
+     *
+     */
+    void ScheduleDump();
+    void Dump();
+
+    /**
+     * @brief Updates the metrics that are sampled rather than recorded as
+     * they change.
+     *
+     */
+    void Refresh();
+
+    Components& components_;
+    util::metrics::gauge& queue_depth_;
+    MetricsEndpoint endpoint_;
+    std::chrono::milliseconds interval_;
+    bool json_;
+    std::mutex file_mutex_;
+    std::ofstream file_;
+    std::mutex mutex_;
+    bool running_;
+    thread::TimerService::timer_id_t timer_id_;
+};
+
+}  // namespace shared
+}  // namespace net
+
+#endif  // NET_SHARED_METRICS_SERVICE_
\ No newline at end of file
@@ -15,24 +15,35 @@ namespace net {
 Socket::Socket(int timeout)
     : state_(SocketState::kUninitialized),
       sockfd_(kInvalidSocket),
-      timeout_(timeout) {
+      timeout_(timeout),
+      quick_ack_(false) {
+    MarkActive();
     EXIT_IF_ERROR(Initialize());
 }
 
 Socket::Socket(int sockfd, SocketState state, int timeout)
-    : state_(state), sockfd_(sockfd), timeout_(timeout) {
+    : state_(state), sockfd_(sockfd), timeout_(timeout), quick_ack_(false) {
+    MarkActive();
     SetNonBlocking(true);
-    SetKeepAlive(true);
+    SetOptions(SocketOptions());
 }
 
-Socket::~Socket() { Close(); }
+Socket::~Socket() {
+    Close();
+    if (sockfd_ != kInvalidSocket) {
+        util::safe_debug::log("Closing fd", sockfd_);
+        ::close(sockfd_);
+    }
+}
 
 Socket::Socket(Socket&& other) noexcept
-    : state_(std::move(other.state_)),
-      sockfd_(other.sockfd_),
+    : state_(other.state_.load()),
+      sockfd_(other.sockfd_.load()),
       timeout_(other.timeout_),
       input_buffer_(std::move(other.input_buffer_)),
-      output_buffer_(std::move(other.output_buffer_)) {
+      output_buffer_(std::move(other.output_buffer_)),
+      last_active_(other.last_active_.load(std::memory_order_relaxed)),
+      quick_ack_(other.quick_ack_) {
     // This is important so that the socket is not destroyed.
     other.sockfd_ = kInvalidSocket;
     other.state_ = SocketState::kClosed;
@@ -47,37 +58,56 @@ util::result<void, Error> Socket::Initialize() {
     state_ = SocketState::kInitialized;
 
     RETURN_IF_ERROR(SetNonBlocking(true));
-    RETURN_IF_ERROR(SetKeepAlive(true));
+    RETURN_IF_ERROR(SetOptions(SocketOptions()));
 
     return util::ok;
 }
 
+util::result<void, Error> Socket::Shutdown() {
+    CRITICAL_SECTION(close_mutex_, {
+        if (state_ != SocketState::kConnected) {
+            return util::ok;
+        }
+        if (::shutdown(sockfd_, SHUT_RDWR) < 0) {
+            return Error::CreateFromErrNo("Failed to shutdown socket");
+        }
+        // Closing later must not shut down again, which fails once the
+        // connection is gone.
+        state_ = SocketState::kHalfClosed;
+    });
+    return util::ok;
+}
+
 util::result<void, Error> Socket::Close() {
     if (Closed()) {
         return util::ok;
     }
 
-    int res = 0;
     CRITICAL_SECTION(close_mutex_, {
-        switch (state_) {
-            case SocketState::kConnected:
-                // This helps stop poll, recv, and send operations.
-                res = ::shutdown(sockfd_, SHUT_RDWR);
-                if (res < 0) {
-                    return Error::CreateFromErrNo("Failed to shutdown socket");
-                }
-            case SocketState::kHalfClosed:
-            case SocketState::kInitialized:
-                // This closes the file descriptor for good.
-                util::safe_debug::log("Closing fd", sockfd_);
-                res = ::close(sockfd_);
-                if (res < 0) {
-                    return Error::CreateFromErrNo("Failed to close socket");
-                }
+        SocketState state = state_;
+        if (state == SocketState::kConnected ||
+            state == SocketState::kHalfClosed) {
+            // This stops poll, recv, and send operations. Another thread may
+            // still be about to use the descriptor, so it stays open until
+            // the socket is destroyed, rather than letting a new socket take
+            // its number.
+            state_ = SocketState::kClosed;
+            if (state == SocketState::kConnected &&
+                ::shutdown(sockfd_, SHUT_RDWR) < 0) {
+                return Error::CreateFromErrNo("Failed to shutdown socket");
+            }
+            return util::ok;
         }
 
+        // Nothing waits on a socket that never connected, such as a
+        // listener, so it is closed right away.
+        util::safe_debug::log("Closing fd", sockfd_);
+        int res = ::close(sockfd_);
         sockfd_ = kInvalidSocket;
         state_ = SocketState::kClosed;
+        if (res < 0) {
+            return Error::CreateFromErrNo("Failed to close socket");
+        }
         return util::ok;
     });
 }
@@ -156,38 +186,90 @@ util::result<void, Error> Socket::SetNonBlocking(bool val) {
     return util::ok;
 }
 
-util::result<void, Error> Socket::SetKeepAlive(bool val) {
+util::result<void, Error> Socket::SetKeepAlive(const KeepAlive& keep_alive) {
     if (Closed()) {
         return Error::Create("Cannot set option on closed socket");
     }
 
-    int flags = val ? 1 : 0;
+    int flags = keep_alive.enabled ? 1 : 0;
     if (::setsockopt(sockfd_, SOL_SOCKET, SO_KEEPALIVE, &flags,
                      sizeof(flags))) {
         return Error::CreateFromErrNo("Failed to change keep alive setting");
     };
+    if (!keep_alive.enabled) {
+        return util::ok;
+    }
 
-    flags = 1;
-    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_KEEPIDLE, &flags,
-                     sizeof(flags))) {
+    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_KEEPIDLE, &keep_alive.idle_s,
+                     sizeof(keep_alive.idle_s))) {
         return Error::CreateFromErrNo("Failed to change keep alive setting");
     }
 
-    flags = 1;
-    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_KEEPINTVL, &flags,
-                     sizeof(flags))) {
+    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_KEEPINTVL,
+                     &keep_alive.interval_s, sizeof(keep_alive.interval_s))) {
         return Error::CreateFromErrNo("Failed to change keep alive setting");
     }
 
-    flags = 10;
-    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_KEEPCNT, &flags,
-                     sizeof(flags))) {
+    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_KEEPCNT, &keep_alive.count,
+                     sizeof(keep_alive.count))) {
         return Error::CreateFromErrNo("Failed to change keep alive setting");
     }
 
     return util::ok;
 }
 
+util::result<void, Error> Socket::SetOptions(const SocketOptions& options) {
+    if (Closed()) {
+        return Error::Create("Cannot set option on closed socket");
+    }
+
+    util::result<void, Error> result = SetKeepAlive(options.keep_alive);
+    auto set = [this, &result](int level, int name, int value,
+                               const char* what) {
+        if (::setsockopt(sockfd_, level, name, &value, sizeof(value)) &&
+            result.is_ok()) {
+            result = Error::CreateFromErrNo(what);
+        }
+    };
+
+    set(IPPROTO_TCP, TCP_NODELAY, options.no_delay ? 1 : 0,
+        "Failed to change no delay setting");
+    quick_ack_ = options.quick_ack;
+    if (quick_ack_) {
+        set(IPPROTO_TCP, TCP_QUICKACK, 1, "Failed to change quick ACK setting");
+    }
+    if (options.busy_poll_us > 0) {
+        set(SOL_SOCKET, SO_BUSY_POLL, options.busy_poll_us,
+            "Failed to change busy poll setting");
+    }
+    if (options.send_buffer > 0) {
+        set(SOL_SOCKET, SO_SNDBUF, options.send_buffer,
+            "Failed to change send buffer size");
+    }
+    if (options.receive_buffer > 0) {
+        set(SOL_SOCKET, SO_RCVBUF, options.receive_buffer,
+            "Failed to change receive buffer size");
+    }
+    if (options.not_sent_lowat > 0) {
+        set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.not_sent_lowat,
+            "Failed to change unsent low water mark");
+    }
+    return result;
+}
+
+util::result<void, Error> Socket::SetReusePort(bool val) {
+    if (Closed()) {
+        return Error::Create("Cannot set option on closed socket");
+    }
+
+    int flags = val ? 1 : 0;
+    if (::setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &flags,
+                     sizeof(flags))) {
+        return Error::CreateFromErrNo("Failed to change reuse port setting");
+    }
+    return util::ok;
+}
+
 util::result<std::size_t, Error> Socket::Send() {
     if (!Open()) {
         return Error::Create("Cannot send over a closed socket");
@@ -200,7 +282,11 @@ util::result<std::size_t, Error> Socket::Send() {
     for (auto view : views) {
         std::size_t local_bytes_sent = 0;
         while (local_bytes_sent < view.size) {
-            auto bytes_sent = ::write(sockfd_, view.data, view.size);
+            // A peer that closed its end must surface as an error, not as a
+            // SIGPIPE that ends the process.
+            auto bytes_sent =
+                ::send(sockfd_, view.data + local_bytes_sent,
+                       view.size - local_bytes_sent, MSG_NOSIGNAL);
             if (bytes_sent < 0) {
                 if (errno == EWOULDBLOCK) {
                     break;
@@ -210,8 +296,15 @@ util::result<std::size_t, Error> Socket::Send() {
             local_bytes_sent += bytes_sent;
         }
         total_bytes_sent += local_bytes_sent;
+        if (local_bytes_sent < view.size) {
+            // Sending the next view now would send its bytes out of order.
+            break;
+        }
     }
     output_buffer_.consume(total_bytes_sent);
+    if (total_bytes_sent > 0) {
+        MarkActive();
+    }
     return total_bytes_sent;
 }
 
@@ -229,7 +322,16 @@ util::result<std::size_t, Error> Socket::Receive(std::size_t bytes) {
         }
         return Error::CreateFromErrNo("Failed to receive");
     }
+    if (bytes_received == 0 && bytes > 0) {
+        return Error::Create("Connection closed by peer");
+    }
     input_buffer_.commit(bytes_received);
+    MarkActive();
+    if (quick_ack_) {
+        // The kernel may fall back to delayed ACKs after any receive.
+        int flags = 1;
+        ::setsockopt(sockfd_, IPPROTO_TCP, TCP_QUICKACK, &flags, sizeof(flags));
+    }
     return bytes_received;
 }
 
@@ -281,4 +383,14 @@ void Socket::SetTimeout(int timeout) { timeout_ = timeout; }
 
 int Socket::Native() { return sockfd_; }
 
+Socket::clock_t::time_point Socket::LastActive() const {
+    return clock_t::time_point(
+        clock_t::duration(last_active_.load(std::memory_order_relaxed)));
+}
+
+void Socket::MarkActive() {
+    last_active_.store(clock_t::now().time_since_epoch().count(),
+                       std::memory_order_relaxed);
+}
+
 }  // namespace net
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <net/error.h>
 #include <net/location.h>
+#include <net/socket_options.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -10,6 +11,8 @@
 #include <util/buffer.h>
 #include <util/result.h>
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <stdexcept>
 
@@ -53,6 +56,8 @@ enum class PollStatus {
  */
 class Socket {
    public:
+    using clock_t = std::chrono::steady_clock;
+
     static constexpr int kInvalidSocket =
         std::numeric_limits<port_t>::max() + 1;
 
@@ -81,12 +86,33 @@ class Socket {
     util::result<void, Error> SetNonBlocking(bool val);
 
     /**
-     * @brief Set the keep alive proprety on the socket accordingly.
+     * @brief Sets the keep alive settings of the socket.
+     *
+     * @param keep_alive
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> SetKeepAlive(const KeepAlive& keep_alive);
+
+    /**
+     * @brief Applies the options of the socket's role.
+     *
+     * Every option is attempted, and the first failure is returned.
+     *
+     * @param options
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> SetOptions(const SocketOptions& options);
+
+    /**
+     * @brief Sets whether several sockets may bind to the same port, with the
+     * kernel spreading incoming connections between them.
+     *
+     * Must be set before binding.
      *
      * @param value
      * @return util::result<void, Error>
      */
-    util::result<void, Error> SetKeepAlive(bool value);
+    util::result<void, Error> SetReusePort(bool value);
 
     /**
      * @brief Sends as much of the output buffer as possible without blocking.
@@ -99,14 +125,31 @@ class Socket {
      * @brief Receives as much data as readily available from the socket into
      * the input buffer.
      *
+     * Fails once the peer has closed its end, so readers do not keep polling
+     * a socket that will never have data.
+     *
      * @param bytes Maximum number of bytes to receive.
      * @return util::result<std::size_t, Error>
      */
     util::result<std::size_t, Error> Receive(std::size_t bytes = 1024);
 
+    /**
+     * @brief Shuts down the socket without closing it.
+     *
+     * Safe to call while another thread uses the socket: its operations
+     * fail, and it closes the socket itself, so the file descriptor number
+     * cannot be reused while it is still in use.
+     *
+     * @return util::result<void, Error>
+     */
+    util::result<void, Error> Shutdown();
+
     /**
      * @brief Shuts down and closes the socket.
      *
+     * The descriptor of a connection is only released when the socket is
+     * destroyed, since other threads may still hold it.
+     *
      * @return util::result<void, Error>
      */
     util::result<void, Error> Close();
@@ -121,6 +164,14 @@ class Socket {
     bool Open() const;
     bool Closed() const;
 
+    /**
+     * @brief Returns when bytes were last sent or received over the socket,
+     * or when it was created if there were none.
+     *
+     * @return clock_t::time_point
+     */
+    clock_t::time_point LastActive() const;
+
     /**
      * @brief Returns the socket state.
      *
@@ -152,12 +203,18 @@ class Socket {
    protected:
     util::result<void, Error> Initialize();
 
+    void MarkActive();
+
+    // Closing takes the lock, but the state and descriptor are also read by
+    // threads blocked on the socket, which closing is meant to wake.
     std::mutex close_mutex_;
-    SocketState state_;
-    int sockfd_;
+    std::atomic<SocketState> state_;
+    std::atomic<int> sockfd_;
     int timeout_;
     util::buffer input_buffer_;
     util::buffer output_buffer_;
+    std::atomic<clock_t::rep> last_active_;
+    bool quick_ack_;
 };
 
 }  // namespace net
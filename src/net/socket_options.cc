@@ -0,0 +1,88 @@
+#include "socket_options.h"
+
+#include <util/console.h>
+#include <util/number.h>
+#include <util/strings.h>
+
+#include <utility>
+
+namespace net {
+
+util::result<KeepAlive, Error> KeepAlive::Parse(const std::string& value) {
+    KeepAlive keep_alive;
+    if (value == "off") {
+        keep_alive.enabled = false;
+        return keep_alive;
+    }
+
+    auto parts = util::strings::split(value, ',');
+    if (parts.size() != 3) {
+        return Error::Create(
+            "Keep alive settings must be \"off\" or \"idle,interval,count\"");
+    }
+    int* fields[] = {&keep_alive.idle_s, &keep_alive.interval_s,
+                     &keep_alive.count};
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        auto result = util::num::string_to_num<int>(parts[i]);
+        if (result.is_err() || result.ok() <= 0) {
+            return Error::Create("Keep alive settings must be positive");
+        }
+        *fields[i] = result.ok();
+    }
+    return keep_alive;
+}
+
+util::result<SocketOptions, Error> SocketOptions::FromProperties(
+    const program::Properties& props, const std::string& role) {
+    SocketOptions options;
+
+    auto keep_alive_prop = props.Get(role + "_keepalive");
+    if (keep_alive_prop.has_value()) {
+        auto keep_alive = KeepAlive::Parse(keep_alive_prop.value());
+        if (keep_alive.is_err()) {
+            return Error::Create(util::string::stream(
+                "Invalid \"", role, "_keepalive\" property: ",
+                keep_alive.err().what()));
+        }
+        options.keep_alive = keep_alive.ok();
+    }
+
+    std::pair<const char*, bool*> flags[] = {
+        {"_nodelay", &options.no_delay},
+        {"_quickack", &options.quick_ack},
+    };
+    for (const auto& flag : flags) {
+        auto value = props.Get(role + flag.first);
+        if (!value.has_value()) {
+            continue;
+        }
+        if (value.value() != "true" && value.value() != "false") {
+            return Error::Create(util::string::stream(
+                "Invalid \"", role, flag.first, "\" property"));
+        }
+        *flag.second = value.value() == "true";
+    }
+
+    std::pair<const char*, int*> sizes[] = {
+        {"_busy_poll_us", &options.busy_poll_us},
+        {"_sndbuf", &options.send_buffer},
+        {"_rcvbuf", &options.receive_buffer},
+        {"_notsent_lowat", &options.not_sent_lowat},
+    };
+    for (const auto& size : sizes) {
+        auto value = props.Get(role + size.first);
+        if (!value.has_value()) {
+            continue;
+        }
+        auto result = util::num::string_to_num<int>(value.value());
+        if (result.is_err() || result.ok() < 0) {
+            return Error::Create(util::string::stream(
+                "Invalid \"", role, size.first, "\" property"));
+        }
+        *size.second = result.ok();
+    }
+
+    return options;
+}
+
+}  // namespace net
\ No newline at end of file
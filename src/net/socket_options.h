@@ -0,0 +1,90 @@
+#ifndef NET_SOCKET_OPTIONS_
+#define NET_SOCKET_OPTIONS_
+
+#include <net/error.h>
+#include <program/properties.h>
+#include <util/result.h>
+
+#include <string>
+
+namespace net {
+
+/**
+ * @brief TCP keepalive settings for a socket.
+ *
+ * Every probe is a packet on an otherwise idle connection, so probing stays
+ * rare unless a role asks for faster detection of dead peers.
+ *
+ */
+struct KeepAlive {
+    bool enabled = true;
+
+    // Seconds a connection is idle before the first probe.
+    int idle_s = 60;
+
+    // Seconds between unanswered probes.
+    int interval_s = 10;
+
+    // Unanswered probes before the connection is dropped.
+    int count = 6;
+
+    /**
+     * @brief Parses keepalive settings, either "off" or "idle,interval,count"
+     * in seconds.
+     *
+     * @param value
+     * @return util::result<KeepAlive, Error>
+     */
+    static util::result<KeepAlive, Error> Parse(const std::string& value);
+};
+
+/**
+ * @brief Options applied to the sockets of one role.
+ *
+ * Most messages are a few bytes long and answered right away, so Nagle's
+ * algorithm is disabled by default. Otherwise, a message sent while another
+ * is unacknowledged waits for the receiver's delayed ACK.
+ *
+ */
+struct SocketOptions {
+    KeepAlive keep_alive;
+
+    // Sends small segments right away (`TCP_NODELAY`).
+    bool no_delay = true;
+
+    // Acknowledges received data right away instead of delaying the ACK
+    // (`TCP_QUICKACK`), which the kernel resets, so it is set after every
+    // receive.
+    bool quick_ack = false;
+
+    // Microseconds to busy poll the device for data on a read before
+    // sleeping (`SO_BUSY_POLL`), or 0 to never busy poll.
+    int busy_poll_us = 0;
+
+    // Kernel buffer sizes in bytes (`SO_SNDBUF` and `SO_RCVBUF`), or 0 for
+    // the system default.
+    int send_buffer = 0;
+    int receive_buffer = 0;
+
+    // Unsent bytes the kernel queues before the socket stops being writable
+    // (`TCP_NOTSENT_LOWAT`), or 0 for no limit. Keeps bulk transfers from
+    // filling the send buffer far ahead of the network.
+    int not_sent_lowat = 0;
+
+    /**
+     * @brief Reads the options of a role from the properties
+     * `<role>_keepalive`, `<role>_nodelay`, `<role>_quickack`,
+     * `<role>_busy_poll_us`, `<role>_sndbuf`, `<role>_rcvbuf`, and
+     * `<role>_notsent_lowat`, keeping the default of each one not set.
+     *
+     * @param props
+     * @param role
+     * @return util::result<SocketOptions, Error>
+     */
+    static util::result<SocketOptions, Error> FromProperties(
+        const program::Properties& props, const std::string& role);
+};
+
+}  // namespace net
+
+#endif  // NET_SOCKET_OPTIONS_
\ No newline at end of file
@@ -54,6 +54,10 @@ util::result<void, util::error> Options::AddOptions() {
         "Timeout for retrying a connection to a server in milliseconds.",
         [](int timeout) { return timeout != 0; }, {}));
 
+    RETURN_IF_ERROR(parser_.AddOption<int>(
+        "threads", 'n', &threads, 8, "Number of threads in the thread pool.",
+        [](int threads) { return threads > 0; }, {}));
+
     RETURN_IF_ERROR(parser_.AddOptionRequired<int>(
         "port", 'p', &port, 0, "Port of the server.",
         [](const int& port) { return port > 0 && port < (1 << 16); }, {}));
@@ -26,6 +26,7 @@ class Options {
     std::string temp_directory;
     int timeout;
     int retry_timeout;
+    int threads;
 
     bool server;
     int port;
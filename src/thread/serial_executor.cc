@@ -0,0 +1,94 @@
+#include "serial_executor.h"
+
+#include <thread>
+
+namespace thread {
+
+namespace {
+
+// Jobs run by one call to `Drain` before yielding the thread to other jobs in
+// the pool.
+constexpr std::size_t kMaxBatchSize = 64;
+
+}  // namespace
+
+SerialExecutor::SerialExecutor(ThreadPool& thread_pool)
+    : thread_pool_(thread_pool), head_(&stub_), tail_(&stub_), pending_(0) {
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+}
+
+SerialExecutor::~SerialExecutor() {
+    while (Node* node = Pop()) {
+        delete node;
+    }
+}
+
+void SerialExecutor::Schedule(Job job) {
+    Node* node = new Node;
+    node->job = std::move(job);
+    Push(node);
+
+    if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        thread_pool_.Schedule([this]() { Drain(); });
+    }
+}
+
+void SerialExecutor::Drain() {
+    for (std::size_t i = 0; i < kMaxBatchSize; ++i) {
+        // A job is counted before its node is linked into the queue, so the
+        // node may not be visible for a moment.
+        Node* node;
+        while ((node = Pop()) == nullptr) {
+            std::this_thread::yield();
+        }
+
+        node->job();
+        delete node;
+
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            return;
+        }
+    }
+
+    // More jobs are waiting, so let other jobs in the pool run first.
+    thread_pool_.Schedule([this]() { Drain(); });
+}
+
+void SerialExecutor::Push(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+SerialExecutor::Node* SerialExecutor::Pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+        if (next == nullptr) {
+            return nullptr;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+
+    if (tail != head_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    // The tail is the last node, so put the stub behind it before taking it.
+    Push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+}  // namespace thread
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef THREAD_SERIAL_EXECUTOR_
+#define THREAD_SERIAL_EXECUTOR_
+
+#include <thread/thread_pool.h>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace thread {
+
+/**
+ * @brief Runs jobs one at a time, in the order they were scheduled, on a
+ * thread pool.
+ *
+ * Jobs scheduled on the same executor never run concurrently, so state owned
+ * by the executor needs no lock. Scheduling is lock-free, and the executor
+ * only occupies a thread in the pool while it has jobs to run.
+ *
+ */
+class SerialExecutor {
+   public:
+    using Job = ThreadPool::Job;
+
+    SerialExecutor(ThreadPool& thread_pool);
+    ~SerialExecutor();
+
+    SerialExecutor(const SerialExecutor& other) = delete;
+    SerialExecutor& operator=(const SerialExecutor& rhs) = delete;
+
+    /**
+     * @brief Schedules a job to run after every job scheduled before it.
+     *
+     * Safe to call from any thread, including from a job on this executor.
+     *
+     * @param job
+     */
+    void Schedule(Job job);
+
+   private:
+    /**
+     * @brief A node in the job queue.
+     *
+     */
+    struct Node {
+        std::atomic<Node*> next;
+        Job job;
+    };
+
+    /**
+     * @brief Runs jobs until the queue is empty, or until the batch limit is
+     * reached.
+     *
+     */
+    void Drain();
+
+    void Push(Node* node);
+
+    /**
+     * @brief Pops the oldest node in the queue.
+     *
+     * Only called by the thread running `Drain`.
+     *
+     * @return Node* The oldest node, or `nullptr` if the queue is empty or a
+     * push is not yet visible
+     */
+    Node* Pop();
+
+    ThreadPool& thread_pool_;
+
+    // Multi-producer, single-consumer queue from Dmitry Vyukov. Producers
+    // swap themselves into `head_`, and the consumer reads from `tail_`.
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+
+    // Number of jobs scheduled but not yet finished. The producer that moves
+    // this from zero starts draining on the thread pool.
+    std::atomic<std::size_t> pending_;
+};
+
+}  // namespace thread
+
+#endif  // THREAD_SERIAL_EXECUTOR_
\ No newline at end of file
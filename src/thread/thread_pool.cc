@@ -5,7 +5,21 @@
 
 namespace thread {
 
-ThreadPool::ThreadPool(std::size_t num_threads) : num_threads_(num_threads) {}
+namespace {
+
+// Jobs scheduled by this thread on any pool, to pick the ones to time.
+thread_local std::size_t scheduled = 0;
+
+std::uint64_t Nanoseconds(std::chrono::steady_clock::duration duration) {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+            .count());
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t num_threads)
+    : num_threads_(num_threads), running_(false), depth_(0) {}
 
 ThreadPool::~ThreadPool() {
     if (running_) {
@@ -26,7 +40,10 @@ void ThreadPool::Stop() {
     CRITICAL_SECTION(stop_mutex_, {
         if (running_) {
             util::safe_debug::log("Stopping thread pool");
-            running_ = false;
+
+            // Threads check this flag under the jobs lock, so it must be set
+            // under the same lock for them to see it.
+            CRITICAL_SECTION(jobs_mutex_, running_ = false);
             cv_.notify_all();
             for (auto& thread : threads_) {
                 thread.join();
@@ -38,23 +55,106 @@ void ThreadPool::Stop() {
 }
 
 void ThreadPool::Schedule(const Job& job) {
-    CRITICAL_SECTION(jobs_mutex_, jobs_.push(job));
+    // The same sample times the job and the taking of the lock to queue it.
+    Instruments* instruments = instruments_.get();
+    if (!instruments || scheduled++ % instruments->sample_every != 0) {
+        CRITICAL_SECTION(jobs_mutex_, {
+            jobs_.push(Entry{job, false, {}});
+            depth_.store(jobs_.size(), std::memory_order_relaxed);
+        });
+        cv_.notify_one();
+        return;
+    }
+
+    auto start = clock_t::now();
+    clock_t::time_point locked;
+    clock_t::time_point unlocked;
+    std::size_t depth;
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex_);
+        locked = clock_t::now();
+        jobs_.push(Entry{job, true, locked});
+        depth = jobs_.size();
+        depth_.store(depth, std::memory_order_relaxed);
+        unlocked = clock_t::now();
+    }
     cv_.notify_one();
+
+    instruments->queue_depth.set(static_cast<std::int64_t>(depth));
+    instruments->lock_wait_ns.observe(Nanoseconds(locked - start));
+    instruments->lock_hold_ns.observe(Nanoseconds(unlocked - locked));
+}
+
+std::size_t ThreadPool::QueueDepth() const {
+    return depth_.load(std::memory_order_relaxed);
+}
+
+void ThreadPool::Instrument(util::metrics::registry& metrics,
+                            std::size_t sample_every,
+                            const std::string& prefix) {
+    instruments_.reset(new Instruments{
+        sample_every == 0 ? 1 : sample_every,
+        metrics.get_gauge(prefix + "queue_depth"),
+        metrics.get_histogram(prefix + "wait_ns"),
+        metrics.get_histogram(prefix + "run_ns"),
+        metrics.get_histogram(prefix + "lock_wait_ns"),
+        metrics.get_histogram(prefix + "lock_hold_ns")});
 }
 
 void ThreadPool::ThreadLoop() {
+    Instruments* instruments = instruments_.get();
+    std::size_t taken = 0;
     while (true) {
-        Job job;
+        Entry entry;
+        std::size_t depth;
+        // Only the wait for the lock itself is timed, not the wait for a job.
+        bool timed_lock =
+            instruments && taken++ % instruments->sample_every == 0;
+        clock_t::time_point start;
+        clock_t::time_point woken;
+        if (timed_lock) {
+            start = clock_t::now();
+        }
         {
             std::unique_lock<std::mutex> lock(jobs_mutex_);
+            clock_t::time_point locked;
+            if (timed_lock) {
+                locked = clock_t::now();
+            }
             cv_.wait(lock, [this] { return !jobs_.empty() || !running_; });
             if (!running_) {
                 return;
             }
-            job = jobs_.front();
+            if (timed_lock) {
+                woken = clock_t::now();
+                instruments->lock_wait_ns.observe(Nanoseconds(locked - start));
+            }
+            entry = std::move(jobs_.front());
             jobs_.pop();
+            depth = jobs_.size();
+            depth_.store(depth, std::memory_order_relaxed);
+        }
+
+        if (!instruments) {
+            entry.job();
+            continue;
+        }
+
+        clock_t::time_point now;
+        if (timed_lock || entry.timed) {
+            now = clock_t::now();
+        }
+        if (timed_lock) {
+            instruments->lock_hold_ns.observe(Nanoseconds(now - woken));
+            instruments->queue_depth.set(static_cast<std::int64_t>(depth));
+        }
+        if (!entry.timed) {
+            entry.job();
+            continue;
         }
-        job();
+        instruments->wait_ns.observe(Nanoseconds(now - entry.scheduled_at));
+        entry.job();
+        instruments->run_ns.observe(Nanoseconds(clock_t::now() - now));
     }
 }
 
@@ -1,10 +1,16 @@
 #ifndef THREAD_THREAD_POOL_
 #define THREAD_THREAD_POOL_
 
+#include <util/metrics.h>
+
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -44,16 +50,77 @@ class ThreadPool {
 
     bool IsRunning() const;
 
+    /**
+     * @brief Returns the number of jobs waiting for a thread.
+     *
+     * Does not take the job queue lock, so it is cheap enough to check on
+     * every request.
+     *
+     * @return std::size_t
+     */
+    std::size_t QueueDepth() const;
+
+    /**
+     * @brief Records how the pool is used in the given registry.
+     *
+     * Every thread that schedules or runs jobs samples one in every
+     * `sample_every` of them, so that nothing is shared between threads for
+     * jobs that are not sampled. A sampled job records how long it waited for
+     * a thread and how long it ran, in nanoseconds, in "<prefix>wait_ns" and
+     * "<prefix>run_ns". A sampled taking of the jobs lock records how long it
+     * was waited for and held in "<prefix>lock_wait_ns" and
+     * "<prefix>lock_hold_ns", and the number of jobs left in the queue in the
+     * "<prefix>queue_depth" gauge.
+     *
+     * Must be called before the pool starts.
+     *
+     * @param metrics
+     * @param sample_every
+     * @param prefix
+     */
+    void Instrument(util::metrics::registry& metrics, std::size_t sample_every,
+                    const std::string& prefix = "thread_pool.");
+
    private:
+    using clock_t = std::chrono::steady_clock;
+
+    /**
+     * @brief A scheduled job, with the time it was scheduled if it is timed.
+     *
+     */
+    struct Entry {
+        Job job;
+        bool timed;
+        clock_t::time_point scheduled_at;
+    };
+
+    /**
+     * @brief Metrics the pool records into, if instrumented.
+     *
+     */
+    struct Instruments {
+        std::size_t sample_every;
+        util::metrics::gauge& queue_depth;
+        util::metrics::histogram& wait_ns;
+        util::metrics::histogram& run_ns;
+        util::metrics::histogram& lock_wait_ns;
+        util::metrics::histogram& lock_hold_ns;
+    };
+
     void ThreadLoop();
 
     std::size_t num_threads_;
-    bool running_;
+    std::atomic<bool> running_;
     std::mutex stop_mutex_;
     std::mutex jobs_mutex_;
     std::condition_variable cv_;
-    std::queue<Job> jobs_;
+    std::queue<Entry> jobs_;
+
+    // Size of `jobs_`, only changed under the lock but read without it.
+    std::atomic<std::size_t> depth_;
+
     std::vector<std::thread> threads_;
+    std::unique_ptr<Instruments> instruments_;
 };
 }  // namespace thread
 
@@ -0,0 +1,91 @@
+#include "timer_service.h"
+
+#include <util/console.h>
+
+namespace thread {
+
+TimerService::TimerService(ThreadPool& thread_pool)
+    : thread_pool_(thread_pool), running_(false), next_id_(0) {}
+
+TimerService::~TimerService() { Stop(); }
+
+void TimerService::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread([this]() { TimerLoop(); });
+}
+
+void TimerService::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        util::safe_debug::log("Stopping timer service");
+        running_ = false;
+        timers_.clear();
+        deadlines_.clear();
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+TimerService::timer_id_t TimerService::ScheduleAfter(
+    std::chrono::milliseconds delay, const Job& job) {
+    auto deadline = clock_t::now() + delay;
+    timer_id_t id;
+    bool earliest;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_id_++;
+        timers_.emplace(timer_key_t{deadline, id}, job);
+        deadlines_.emplace(id, deadline);
+        earliest = timers_.begin()->first.second == id;
+    }
+
+    // Only a new earliest deadline changes how long the timer thread waits.
+    if (earliest) {
+        cv_.notify_one();
+    }
+    return id;
+}
+
+bool TimerService::Cancel(timer_id_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = deadlines_.find(id);
+    if (it == deadlines_.end()) {
+        return false;
+    }
+    timers_.erase(timer_key_t{it->second, id});
+    deadlines_.erase(it);
+    return true;
+}
+
+void TimerService::TimerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        if (timers_.empty()) {
+            cv_.wait(lock);
+            continue;
+        }
+
+        // The deadline is copied, because the timer may be canceled while we
+        // wait for it.
+        auto next = timers_.begin();
+        clock_t::time_point deadline = next->first.first;
+        if (clock_t::now() < deadline) {
+            cv_.wait_until(lock, deadline);
+            continue;
+        }
+
+        Job job = std::move(next->second);
+        deadlines_.erase(next->first.second);
+        timers_.erase(next);
+        thread_pool_.Schedule(job);
+    }
+}
+
+}  // namespace thread
\ No newline at end of file
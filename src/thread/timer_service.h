@@ -0,0 +1,82 @@
+#ifndef THREAD_TIMER_SERVICE_
+#define THREAD_TIMER_SERVICE_
+
+#include <thread/thread_pool.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace thread {
+
+/**
+ * @brief Service for running jobs on a thread pool after a delay.
+ *
+ * A single thread waits for the earliest deadline and hands each expired job
+ * to the thread pool, so jobs never run on the timer thread.
+ *
+ */
+class TimerService {
+   public:
+    using Job = ThreadPool::Job;
+    using clock_t = std::chrono::steady_clock;
+    using timer_id_t = std::uint64_t;
+
+    TimerService(ThreadPool& thread_pool);
+    ~TimerService();
+
+    /**
+     * @brief Starts the timer thread.
+     *
+     */
+    void Start();
+
+    /**
+     * @brief Stops the timer thread, dropping all pending timers.
+     *
+     * Should NOT be called from a job scheduled by this service.
+     *
+     */
+    void Stop();
+
+    /**
+     * @brief Schedules a job to be run after the given delay.
+     *
+     * @param delay
+     * @param job
+     * @return timer_id_t ID for canceling the timer
+     */
+    timer_id_t ScheduleAfter(std::chrono::milliseconds delay, const Job& job);
+
+    /**
+     * @brief Cancels a timer that has not expired yet.
+     *
+     * @param id
+     * @return true The timer was canceled
+     * @return false The timer already expired or does not exist
+     */
+    bool Cancel(timer_id_t id);
+
+   private:
+    using timer_key_t = std::pair<clock_t::time_point, timer_id_t>;
+
+    void TimerLoop();
+
+    ThreadPool& thread_pool_;
+    bool running_;
+    timer_id_t next_id_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<timer_key_t, Job> timers_;
+    std::unordered_map<timer_id_t, clock_t::time_point> deadlines_;
+    std::thread thread_;
+};
+
+}  // namespace thread
+
+#endif  // THREAD_TIMER_SERVICE_
\ No newline at end of file
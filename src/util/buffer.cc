@@ -102,6 +102,10 @@ std::size_t buffer::size() const {
 std::size_t buffer::space_remaining() const { return capacity_ - size(); }
 
 std::size_t buffer::space_remaining_until_end() const {
+    // A full buffer has its pointers equal, just like an empty one.
+    if (full_) {
+        return 0;
+    }
     if (read_ > write_) {
         return read_ - write_;
     } else {
@@ -200,15 +204,17 @@ void buffer::move_buffer(util::buffer& other, bool allow_resize) {
 }
 
 void buffer::read_into(void* dest, std::size_t size) {
-    std::size_t first_write_max_size = space_remaining_until_end();
-    if (first_write_max_size >= size) {
-        // We can fit this data without any circling back.
+    // Data only continues past the end of the memory space when it circles
+    // back, so reading up to the end never passes the write pointer.
+    std::size_t first_read_max_size = capacity_ - read_;
+    if (first_read_max_size >= size) {
+        // We can read this data without any circling back.
         std::memcpy(dest, data_ + read_, size);
     } else {
-        // Write to the end of the buffer, then circle back and write the rest.
-        std::memcpy(dest, data_ + read_, first_write_max_size);
-        std::memcpy(static_cast<std::uint8_t*>(dest) + first_write_max_size,
-                    data_, size - first_write_max_size);
+        // Read to the end of the buffer, then circle back and read the rest.
+        std::memcpy(dest, data_ + read_, first_read_max_size);
+        std::memcpy(static_cast<std::uint8_t*>(dest) + first_read_max_size,
+                    data_, size - first_read_max_size);
     }
 }
 
@@ -219,7 +225,8 @@ void buffer::resize(std::size_t to_fit) {
     }
 
     std::size_t needed = current_size + to_fit;
-    std::size_t new_capacity = capacity_;
+    // A moved-from buffer has no capacity to double.
+    std::size_t new_capacity = capacity_ == 0 ? default_size : capacity_;
     while (new_capacity < needed) {
         if (new_capacity > (max_size >> 1)) {
             // We cannot double the capacity again or we will overflow.
@@ -232,6 +239,7 @@ void buffer::resize(std::size_t to_fit) {
     std::uint8_t* new_data = new std::uint8_t[new_capacity];
     read_into(new_data, current_size);
 
+    delete[] data_;
     data_ = new_data;
     capacity_ = new_capacity;
     read_ = 0;
@@ -385,12 +393,13 @@ void buffer::shift() {
         // Update pointers.
         std::size_t data_size = size();
         read_ = 0;
-        write_ = data_size;
+        write_ = full_ ? 0 : data_size;
     }
 }
 
 std::vector<buffer_view> buffer::view() const {
-    if (write_ >= read_) {
+    // A full buffer only fits in one view if it starts at the beginning.
+    if (full_ ? read_ == 0 : write_ >= read_) {
         return {{data_ + read_, size()}};
     } else {
         return {{data_ + read_, capacity_ - read_}, {data_, write_}};
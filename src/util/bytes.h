@@ -146,7 +146,7 @@ typename std::enable_if<bytes_detail::is_valid_byte_string_size<N>::value,
 extract(buffer& src) {
     minimum_byte_string_t<N> result = 0;
     for (std::size_t i = 0; i < N; ++i) {
-        result |= src.get() << (i << 3);
+        result |= static_cast<minimum_byte_string_t<N>>(src.get()) << (i << 3);
     }
     return result;
 }
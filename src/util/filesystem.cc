@@ -120,6 +120,15 @@ bool exists(const std::string& path) {
     return ::stat(path.c_str(), &statbuf) == 0;
 }
 
+result<std::uint64_t, error> modified_time(const std::string& path) {
+    struct stat statbuf;
+    if (::stat(path.c_str(), &statbuf) != 0) {
+        return error("Failed to stat " + path);
+    }
+    return static_cast<std::uint64_t>(statbuf.st_mtim.tv_sec) * 1000000000 +
+           statbuf.st_mtim.tv_nsec;
+}
+
 result<std::vector<std::string>, error> get_files_in_directory(
     const std::string& path) {
     DIR* dir = ::opendir(path.c_str());
@@ -5,6 +5,7 @@
 #include <util/path.h>
 #include <util/result.h>
 
+#include <cstdint>
 #include <vector>
 
 namespace util {
@@ -70,6 +71,17 @@ util::result<void, error> delete_file(const std::string& path);
  */
 bool exists(const std::string& path);
 
+/**
+ * @brief Gets the time the file or directory at the given path was last
+ * modified, in nanoseconds since the epoch.
+ *
+ * A directory is modified when an entry is added, removed, or renamed.
+ *
+ * @param path
+ * @return result<std::uint64_t, error>
+ */
+result<std::uint64_t, error> modified_time(const std::string& path);
+
 /**
  * @brief Get the names of files in the given directory.
  *
@@ -0,0 +1,620 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <sstream>
+#include <utility>
+
+namespace util {
+namespace metrics {
+
+namespace {
+
+std::size_t bucket_for(std::uint64_t value) {
+    std::size_t bucket = 0;
+    while (value != 0 && bucket < histogram::num_buckets - 1) {
+        value >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+constexpr std::size_t kHalfSubBuckets = hdr_histogram::sub_buckets / 2;
+
+std::size_t hdr_bucket_for(std::uint64_t value) {
+    if (value < hdr_histogram::sub_buckets) {
+        return value;
+    }
+    // Keep the highest `precision_bits` bits of the value, and count how many
+    // were dropped to find its power of two.
+    std::size_t highest_bit = 63 - __builtin_clzll(value);
+    std::size_t shift = highest_bit - hdr_histogram::precision_bits + 1;
+    std::uint64_t top = value >> shift;
+    return hdr_histogram::sub_buckets + (shift - 1) * kHalfSubBuckets +
+           (top - kHalfSubBuckets);
+}
+
+std::uint64_t hdr_bucket_upper_bound(std::size_t bucket) {
+    if (bucket < hdr_histogram::sub_buckets) {
+        return bucket;
+    }
+    std::size_t offset = bucket - hdr_histogram::sub_buckets;
+    std::size_t shift = offset / kHalfSubBuckets + 1;
+    std::uint64_t top = offset % kHalfSubBuckets + kHalfSubBuckets;
+    return ((top + 1) << shift) - 1;
+}
+
+/**
+ * @brief Formats a string as a JSON string literal.
+ *
+ * @param out
+ * @param str
+ */
+void put_json_string(std::ostream& out, const std::string& str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf]
+                << "0123456789abcdef"[c & 0xf];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+/**
+ * @brief Formats a metric or label name as a valid Prometheus name.
+ *
+ * @param name
+ * @return std::string
+ */
+std::string prometheus_name(const std::string& name) {
+    std::string formatted = name;
+    for (std::size_t i = 0; i < formatted.size(); ++i) {
+        char c = formatted[i];
+        bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     c == '_' || (i > 0 && c >= '0' && c <= '9');
+        if (!valid) {
+            formatted[i] = '_';
+        }
+    }
+    return formatted;
+}
+
+/**
+ * @brief Formats a string as a Prometheus label value.
+ *
+ * @param out
+ * @param value
+ */
+void put_prometheus_label_value(std::ostream& out, const std::string& value) {
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+/**
+ * @brief Formats the labels of a sample, if it has any.
+ *
+ * @param out
+ * @param labels Labels of the metric
+ * @param extra Labels of the sample within the metric, like a quantile
+ */
+void put_prometheus_labels(std::ostream& out, const std::string& labels,
+                           const std::string& extra) {
+    if (labels.empty() && extra.empty()) {
+        return;
+    }
+    out << '{' << labels;
+    if (!labels.empty() && !extra.empty()) {
+        out << ',';
+    }
+    out << extra << '}';
+}
+
+/**
+ * @brief Formats the type comment that starts a Prometheus metric.
+ *
+ * @param out
+ * @param name
+ * @param type
+ */
+void put_prometheus_type(std::ostream& out, const std::string& name,
+                         const char* type) {
+    out << "# TYPE " << name << ' ' << type << '\n';
+}
+
+/**
+ * @brief Groups metrics by their Prometheus name, since every sample of a
+ * name must be listed together.
+ *
+ * @tparam M Metric type
+ * @tparam F Function giving the name and labels of a metric
+ * @param metrics
+ * @param family_of
+ * @return std::map<std::string, std::vector<std::pair<std::string, const M*>>>
+ * Labels and metric of each sample, by name
+ */
+template <typename M, typename F>
+std::map<std::string, std::vector<std::pair<std::string, const M*>>>
+group_prometheus_families(
+    const std::map<std::string, std::unique_ptr<M>>& metrics, F family_of) {
+    std::map<std::string, std::vector<std::pair<std::string, const M*>>>
+        families;
+    for (const auto& entry : metrics) {
+        auto family = family_of(entry.first);
+        families[family.first].emplace_back(std::move(family.second),
+                                            entry.second.get());
+    }
+    return families;
+}
+
+/**
+ * @brief Formats a map of metrics as a JSON object, with each metric formatted
+ * by the given function.
+ *
+ * @tparam M Metric type
+ * @tparam F Formatting function type
+ * @param out
+ * @param metrics
+ * @param format
+ */
+template <typename M, typename F>
+void put_json_object(std::ostream& out,
+                     const std::map<std::string, std::unique_ptr<M>>& metrics,
+                     F format) {
+    out << '{';
+    bool first = true;
+    for (const auto& entry : metrics) {
+        if (!first) {
+            out << ',';
+        }
+        first = false;
+        put_json_string(out, entry.first);
+        out << ':';
+        format(*entry.second);
+    }
+    out << '}';
+}
+
+}  // namespace
+
+std::size_t this_thread_shard() {
+    static std::atomic<std::size_t> next_shard(0);
+    thread_local std::size_t shard =
+        next_shard.fetch_add(1, std::memory_order_relaxed) % num_shards;
+    return shard;
+}
+
+counter::counter() {
+    for (auto& shard : shards_) {
+        shard.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+void counter::increment(std::uint64_t n) {
+    shards_[this_thread_shard()].value.fetch_add(n,
+                                                 std::memory_order_relaxed);
+}
+
+std::uint64_t counter::value() const {
+    std::uint64_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+gauge::gauge() : value_(0) {}
+
+void gauge::set(std::int64_t value) {
+    value_.store(value, std::memory_order_relaxed);
+}
+
+void gauge::add(std::int64_t n) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::int64_t gauge::value() const {
+    return value_.load(std::memory_order_relaxed);
+}
+
+histogram::histogram() : max_(0) {
+    for (auto& shard : shards_) {
+        for (auto& bucket : shard.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        shard.count.store(0, std::memory_order_relaxed);
+        shard.sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+void histogram::observe(std::uint64_t value) {
+    auto& shard = shards_[this_thread_shard()];
+    shard.buckets[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+
+    std::uint64_t current = max_.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max_.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+    }
+}
+
+std::uint64_t histogram::count() const {
+    std::uint64_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard.count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::uint64_t histogram::sum() const {
+    std::uint64_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard.sum.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::uint64_t histogram::max() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+std::array<std::uint64_t, histogram::num_buckets> histogram::buckets() const {
+    std::array<std::uint64_t, num_buckets> totals{};
+    for (const auto& shard : shards_) {
+        for (std::size_t i = 0; i < num_buckets; ++i) {
+            totals[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+std::uint64_t histogram::upper_bound(std::size_t bucket) {
+    return bucket == 0 ? 0 : (std::uint64_t(1) << bucket) - 1;
+}
+
+std::uint64_t histogram::percentile(double p) const {
+    // The total is taken from the same reads as the buckets, so the rank is
+    // always within them.
+    auto counts = buckets();
+    std::uint64_t total = 0;
+    for (auto bucket_count : counts) {
+        total += bucket_count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    // Nearest rank of the value at the percentile, starting at 1.
+    std::uint64_t rank =
+        static_cast<std::uint64_t>(std::ceil(p / 100.0 * total));
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // The bucket bound may be above any recorded value.
+            std::uint64_t bound = upper_bound(i);
+            std::uint64_t max_value = max();
+            return bound < max_value ? bound : max_value;
+        }
+    }
+    return max();
+}
+
+hdr_histogram::hdr_histogram()
+    : buckets_(new std::atomic<std::uint64_t>[num_buckets]),
+      count_(0),
+      sum_(0),
+      max_(0) {
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void hdr_histogram::observe(std::uint64_t value) {
+    buckets_[hdr_bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    std::uint64_t current = max_.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max_.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+    }
+}
+
+std::uint64_t hdr_histogram::count() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t hdr_histogram::max() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+hdr_histogram::snapshot hdr_histogram::take_snapshot() const {
+    snapshot copy;
+    copy.buckets_.resize(num_buckets);
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+        copy.buckets_[i] = buckets_[i].load(std::memory_order_relaxed);
+        copy.count_ += copy.buckets_[i];
+    }
+    copy.sum_ = sum_.load(std::memory_order_relaxed);
+    copy.max_ = max();
+    return copy;
+}
+
+std::uint64_t hdr_histogram::snapshot::count() const { return count_; }
+
+std::uint64_t hdr_histogram::snapshot::sum() const { return sum_; }
+
+std::uint64_t hdr_histogram::snapshot::max() const { return max_; }
+
+std::uint64_t hdr_histogram::snapshot::percentile(double p) const {
+    if (count_ == 0) {
+        return 0;
+    }
+
+    // Nearest rank of the value at the percentile, starting at 1.
+    std::uint64_t rank =
+        static_cast<std::uint64_t>(std::ceil(p / 100.0 * count_));
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < buckets_.size(); ++i) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            std::uint64_t bound = hdr_bucket_upper_bound(i);
+            return bound < max_ ? bound : max_;
+        }
+    }
+    return max_;
+}
+
+hdr_histogram::snapshot hdr_histogram::snapshot::since(
+    const snapshot& earlier) const {
+    if (earlier.buckets_.size() != buckets_.size()) {
+        return *this;
+    }
+
+    snapshot delta;
+    delta.buckets_.resize(buckets_.size());
+    for (std::size_t i = 0; i < buckets_.size(); ++i) {
+        // Guards against snapshots passed in the wrong order.
+        delta.buckets_[i] = buckets_[i] > earlier.buckets_[i]
+                                ? buckets_[i] - earlier.buckets_[i]
+                                : 0;
+        delta.count_ += delta.buckets_[i];
+        if (delta.buckets_[i] != 0) {
+            std::uint64_t bound = hdr_bucket_upper_bound(i);
+            delta.max_ = bound < max_ ? bound : max_;
+        }
+    }
+    delta.sum_ = sum_ > earlier.sum_ ? sum_ - earlier.sum_ : 0;
+    return delta;
+}
+
+counter& registry::get_counter(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = counters_[name];
+    if (!entry) {
+        entry.reset(new counter());
+    }
+    return *entry;
+}
+
+gauge& registry::get_gauge(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = gauges_[name];
+    if (!entry) {
+        entry.reset(new gauge());
+    }
+    return *entry;
+}
+
+histogram& registry::get_histogram(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = histograms_[name];
+    if (!entry) {
+        entry.reset(new histogram());
+    }
+    return *entry;
+}
+
+hdr_histogram& registry::get_hdr_histogram(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = hdr_histograms_[name];
+    if (!entry) {
+        entry.reset(new hdr_histogram());
+    }
+    return *entry;
+}
+
+std::string registry::dump() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    for (const auto& entry : counters_) {
+        out << entry.first << ' ' << entry.second->value() << '\n';
+    }
+    for (const auto& entry : gauges_) {
+        out << entry.first << ' ' << entry.second->value() << '\n';
+    }
+    for (const auto& entry : histograms_) {
+        const auto& hist = *entry.second;
+        std::uint64_t count = hist.count();
+        out << entry.first << " count=" << count
+            << " mean=" << (count == 0 ? 0 : hist.sum() / count)
+            << " p50=" << hist.percentile(50) << " p90=" << hist.percentile(90)
+            << " p99=" << hist.percentile(99) << " max=" << hist.max()
+            << '\n';
+    }
+    for (const auto& entry : hdr_histograms_) {
+        auto hist = entry.second->take_snapshot();
+        out << entry.first << " count=" << hist.count()
+            << " p50=" << hist.percentile(50) << " p99=" << hist.percentile(99)
+            << " p999=" << hist.percentile(99.9) << " max=" << hist.max()
+            << '\n';
+    }
+    return out.str();
+}
+
+std::string registry::dump_json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    out << "{\"counters\":";
+    put_json_object(out, counters_,
+                    [&out](const counter& c) { out << c.value(); });
+    out << ",\"gauges\":";
+    put_json_object(out, gauges_, [&out](const gauge& g) { out << g.value(); });
+    out << ",\"histograms\":";
+    put_json_object(out, histograms_, [&out](const histogram& hist) {
+        std::uint64_t count = hist.count();
+        out << "{\"count\":" << count
+            << ",\"mean\":" << (count == 0 ? 0 : hist.sum() / count)
+            << ",\"p50\":" << hist.percentile(50)
+            << ",\"p90\":" << hist.percentile(90)
+            << ",\"p99\":" << hist.percentile(99) << ",\"max\":" << hist.max()
+            << '}';
+    });
+    out << ",\"hdr_histograms\":";
+    put_json_object(out, hdr_histograms_, [&out](const hdr_histogram& h) {
+        auto hist = h.take_snapshot();
+        out << "{\"count\":" << hist.count()
+            << ",\"p50\":" << hist.percentile(50)
+            << ",\"p99\":" << hist.percentile(99)
+            << ",\"p999\":" << hist.percentile(99.9)
+            << ",\"max\":" << hist.max() << '}';
+    });
+    out << '}';
+    return out.str();
+}
+
+void registry::label(const std::string& prefix,
+                     const std::string& family_prefix,
+                     const std::string& label_name,
+                     const std::string& label_value) {
+    std::ostringstream formatted;
+    formatted << prometheus_name(label_name) << '=';
+    put_prometheus_label_value(formatted, label_value);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    labels_[prefix] = std::make_pair(family_prefix, formatted.str());
+}
+
+std::pair<std::string, std::string> registry::prometheus_family(
+    const std::string& name) const {
+    // The longest matching prefix wins.
+    for (std::size_t length = name.size(); length > 0; --length) {
+        auto it = labels_.find(name.substr(0, length));
+        if (it != labels_.end()) {
+            return std::make_pair(
+                prometheus_name(it->second.first + name.substr(length)),
+                it->second.second);
+        }
+    }
+    return std::make_pair(prometheus_name(name), std::string());
+}
+
+std::string registry::dump_prometheus() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    auto family_of = [this](const std::string& name) {
+        return prometheus_family(name);
+    };
+    for (const auto& family :
+         group_prometheus_families(counters_, family_of)) {
+        put_prometheus_type(out, family.first, "counter");
+        for (const auto& sample : family.second) {
+            out << family.first;
+            put_prometheus_labels(out, sample.first, std::string());
+            out << ' ' << sample.second->value() << '\n';
+        }
+    }
+    for (const auto& family : group_prometheus_families(gauges_, family_of)) {
+        put_prometheus_type(out, family.first, "gauge");
+        for (const auto& sample : family.second) {
+            out << family.first;
+            put_prometheus_labels(out, sample.first, std::string());
+            out << ' ' << sample.second->value() << '\n';
+        }
+    }
+    for (const auto& family :
+         group_prometheus_families(histograms_, family_of)) {
+        put_prometheus_type(out, family.first, "histogram");
+        for (const auto& sample : family.second) {
+            const auto& hist = *sample.second;
+            auto counts = hist.buckets();
+            std::size_t last = 0;
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                if (counts[i] != 0) {
+                    last = i;
+                }
+            }
+
+            // Buckets are cumulative, and the count is the last of them.
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i <= last; ++i) {
+                seen += counts[i];
+                out << family.first << "_bucket";
+                put_prometheus_labels(
+                    out, sample.first,
+                    "le=\"" + std::to_string(histogram::upper_bound(i)) +
+                        '"');
+                out << ' ' << seen << '\n';
+            }
+            out << family.first << "_bucket";
+            put_prometheus_labels(out, sample.first, "le=\"+Inf\"");
+            out << ' ' << seen << '\n';
+            out << family.first << "_sum";
+            put_prometheus_labels(out, sample.first, std::string());
+            out << ' ' << hist.sum() << '\n';
+            out << family.first << "_count";
+            put_prometheus_labels(out, sample.first, std::string());
+            out << ' ' << seen << '\n';
+        }
+    }
+    for (const auto& family :
+         group_prometheus_families(hdr_histograms_, family_of)) {
+        put_prometheus_type(out, family.first, "summary");
+        for (const auto& sample : family.second) {
+            auto hist = sample.second->take_snapshot();
+            const std::pair<const char*, double> quantiles[] = {
+                {"0.5", 50}, {"0.9", 90}, {"0.99", 99}, {"0.999", 99.9}};
+            for (const auto& quantile : quantiles) {
+                out << family.first;
+                put_prometheus_labels(
+                    out, sample.first,
+                    std::string("quantile=\"") + quantile.first + '"');
+                out << ' ' << hist.percentile(quantile.second) << '\n';
+            }
+            out << family.first << "_sum";
+            put_prometheus_labels(out, sample.first, std::string());
+            out << ' ' << hist.sum() << '\n';
+            out << family.first << "_count";
+            put_prometheus_labels(out, sample.first, std::string());
+            out << ' ' << hist.count() << '\n';
+        }
+    }
+    return out.str();
+}
+
+}  // namespace metrics
+}  // namespace util
\ No newline at end of file
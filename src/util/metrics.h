@@ -0,0 +1,308 @@
+#ifndef UTIL_METRICS_
+#define UTIL_METRICS_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace util {
+namespace metrics {
+
+/**
+ * @brief Number of shards that counters and histograms are split into.
+ *
+ */
+constexpr std::size_t num_shards = 16;
+
+/**
+ * @brief Size shards are padded to, so each is on its own cache lines.
+ *
+ * Heap allocations are not aligned to it before C++17, so shards are padded
+ * rather than aligned.
+ *
+ */
+constexpr std::size_t cache_line_size = 64;
+
+/**
+ * @brief Gets the shard the calling thread records into.
+ *
+ * Threads are given shards in turn the first time they record, so threads
+ * recording at the same time rarely write to the same cache line.
+ *
+ * @return std::size_t
+ */
+std::size_t this_thread_shard();
+
+/**
+ * @brief A value that only goes up.
+ *
+ * Every thread increments its own shard, and reading sums them.
+ *
+ */
+class counter {
+   public:
+    counter();
+
+    void increment(std::uint64_t n = 1);
+    std::uint64_t value() const;
+
+   private:
+    struct shard {
+        std::atomic<std::uint64_t> value;
+        char padding[cache_line_size - sizeof(std::atomic<std::uint64_t>)];
+    };
+
+    std::array<shard, num_shards> shards_;
+};
+
+/**
+ * @brief A value that can go up and down.
+ *
+ * Setting a gauge replaces its value, so it is not sharded.
+ *
+ */
+class gauge {
+   public:
+    gauge();
+
+    void set(std::int64_t value);
+    void add(std::int64_t n);
+    std::int64_t value() const;
+
+   private:
+    std::atomic<std::int64_t> value_;
+};
+
+/**
+ * @brief A distribution of values, recorded in power-of-two buckets.
+ *
+ * Bucket `i` holds values in `[2^(i-1), 2^i)`, and bucket 0 holds 0. Recording
+ * is lock-free, and percentiles are accurate to within a factor of two. Every
+ * thread records into its own shard, and reading sums them.
+ *
+ */
+class histogram {
+   public:
+    static constexpr std::size_t num_buckets = 64;
+
+    histogram();
+
+    void observe(std::uint64_t value);
+
+    std::uint64_t count() const;
+    std::uint64_t sum() const;
+    std::uint64_t max() const;
+
+    /**
+     * @brief Gets the number of values recorded in each bucket.
+     *
+     * @return std::array<std::uint64_t, num_buckets>
+     */
+    std::array<std::uint64_t, num_buckets> buckets() const;
+
+    /**
+     * @brief Gets the largest value a bucket holds.
+     *
+     * @param bucket
+     * @return std::uint64_t
+     */
+    static std::uint64_t upper_bound(std::size_t bucket);
+
+    /**
+     * @brief Gets an upper bound on the given percentile of recorded values.
+     *
+     * @param p Percentile, from 0 to 100
+     * @return std::uint64_t
+     */
+    std::uint64_t percentile(double p) const;
+
+   private:
+    struct shard {
+        std::array<std::atomic<std::uint64_t>, num_buckets> buckets;
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> sum;
+        char padding[cache_line_size -
+                     (num_buckets + 2) * sizeof(std::uint64_t) %
+                         cache_line_size];
+    };
+
+    std::array<shard, num_shards> shards_;
+    // Only written when a value is larger, which is rare once warmed up.
+    std::atomic<std::uint64_t> max_;
+};
+
+/**
+ * @brief A distribution of values over a high dynamic range, recorded in
+ * log-linear buckets.
+ *
+ * Values below `sub_buckets` are recorded exactly, and every power of two
+ * above is split into `sub_buckets / 2` equal buckets, so percentiles are
+ * accurate to within 1% at any magnitude. Recording is lock-free, and each
+ * histogram takes about 60 KB, so it is not sharded.
+ *
+ */
+class hdr_histogram {
+   public:
+    static constexpr std::size_t precision_bits = 8;
+    static constexpr std::size_t sub_buckets = std::size_t(1)
+                                               << precision_bits;
+    static constexpr std::size_t num_buckets =
+        sub_buckets + (64 - precision_bits) * (sub_buckets / 2);
+
+    /**
+     * @brief The values recorded in a histogram up to some point in time.
+     *
+     */
+    class snapshot {
+       public:
+        std::uint64_t count() const;
+        std::uint64_t sum() const;
+        std::uint64_t max() const;
+
+        /**
+         * @brief Gets the highest value equivalent to the given percentile of
+         * recorded values.
+         *
+         * @param p Percentile, from 0 to 100
+         * @return std::uint64_t
+         */
+        std::uint64_t percentile(double p) const;
+
+        /**
+         * @brief Gets the values recorded after an earlier snapshot of the
+         * same histogram was taken.
+         *
+         * The maximum is only known to the precision of a bucket.
+         *
+         * @param earlier
+         * @return snapshot
+         */
+        snapshot since(const snapshot& earlier) const;
+
+       private:
+        std::vector<std::uint64_t> buckets_;
+        std::uint64_t count_ = 0;
+        std::uint64_t sum_ = 0;
+        std::uint64_t max_ = 0;
+
+        friend class hdr_histogram;
+    };
+
+    hdr_histogram();
+
+    void observe(std::uint64_t value);
+
+    std::uint64_t count() const;
+    std::uint64_t max() const;
+
+    /**
+     * @brief Copies the values recorded so far.
+     *
+     * Values recorded while copying may or may not be included.
+     *
+     * @return snapshot
+     */
+    snapshot take_snapshot() const;
+
+   private:
+    std::unique_ptr<std::atomic<std::uint64_t>[]> buckets_;
+    std::atomic<std::uint64_t> count_;
+    std::atomic<std::uint64_t> sum_;
+    std::atomic<std::uint64_t> max_;
+};
+
+/**
+ * @brief In-process registry of named metrics.
+ *
+ * Metrics are created on first use and live as long as the registry, so
+ * references can be kept and updated without going through the registry
+ * again.
+ *
+ */
+class registry {
+   public:
+    counter& get_counter(const std::string& name);
+    gauge& get_gauge(const std::string& name);
+    histogram& get_histogram(const std::string& name);
+    hdr_histogram& get_hdr_histogram(const std::string& name);
+
+    /**
+     * @brief Exports metrics named with the given prefix to Prometheus under
+     * a shared name, told apart by a label, instead of one name for every
+     * value of the label.
+     *
+     * For example, labelling the prefix "mutex.a." as "mutex." with file "a"
+     * exports "mutex.a.requests" as `mutex_requests{file="a"}`. Other formats
+     * keep the full name.
+     *
+     * @param prefix
+     * @param family_prefix Replaces the prefix in the exported name
+     * @param label_name
+     * @param label_value
+     */
+    void label(const std::string& prefix, const std::string& family_prefix,
+               const std::string& label_name, const std::string& label_value);
+
+    /**
+     * @brief Formats every metric, one per line, sorted by name within each
+     * kind of metric.
+     *
+     * @return std::string
+     */
+    std::string dump() const;
+
+    /**
+     * @brief Formats every metric as a single-line JSON object, with an
+     * object of metrics by name for each kind of metric.
+     *
+     * @return std::string
+     */
+    std::string dump_json() const;
+
+    /**
+     * @brief Formats every metric in the Prometheus text format.
+     *
+     * Every character of a name other than a letter, digit, or underscore
+     * becomes an underscore, and metrics sharing a name after labelling are
+     * listed together under one type. Histograms have a bucket for every
+     * power of two up to the largest recorded value, and HDR histograms are
+     * summaries of the 50th, 90th, 99th, and 99.9th percentiles.
+     *
+     * @return std::string
+     */
+    std::string dump_prometheus() const;
+
+   private:
+    /**
+     * @brief Finds the Prometheus name and labels of a metric.
+     *
+     * Must be called with the lock held.
+     *
+     * @param name
+     * @return std::pair<std::string, std::string> Name, and labels without
+     * braces
+     */
+    std::pair<std::string, std::string> prometheus_family(
+        const std::string& name) const;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<counter>> counters_;
+    std::map<std::string, std::unique_ptr<gauge>> gauges_;
+    std::map<std::string, std::unique_ptr<histogram>> histograms_;
+    std::map<std::string, std::unique_ptr<hdr_histogram>> hdr_histograms_;
+
+    // Exported prefix and formatted label, by the prefix of the names they
+    // apply to.
+    std::map<std::string, std::pair<std::string, std::string>> labels_;
+};
+
+}  // namespace metrics
+}  // namespace util
+
+#endif  // UTIL_METRICS_
\ No newline at end of file
@@ -203,10 +203,14 @@ class base_state_machine {
             }
             running_ = false;
         });
+        // The callback may destroy this machine, so nothing of it is touched
+        // once the callback runs.
+        blocker_.unblock();
         if (run_callback_.has_value()) {
-            run_callback_.value()(result_of_last_run_);
+            sm_callback_t callback = run_callback_.value();
+            result<void, error> result = result_of_last_run_;
+            callback(result);
         }
-        blocker_.unblock();
     }
 
     /**